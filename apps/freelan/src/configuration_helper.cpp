@@ -291,6 +291,14 @@ po::options_description get_fscp_options()
 	("fscp.never_contact", po::value<std::vector<asiotap::ip_network_address> >()->multitoken()->zero_tokens()->default_value(std::vector<asiotap::ip_network_address>(), ""), "A network address to avoid when dynamically contacting hosts.")
 	("fscp.cipher_suite_capability", po::value<std::vector<fscp::cipher_suite_type> >()->multitoken()->zero_tokens()->default_value(fscp::get_default_cipher_suites(), ""), "A cipher suite to allow.")
 	("fscp.elliptic_curve_capability", po::value<std::vector<fscp::elliptic_curve_type> >()->multitoken()->zero_tokens()->default_value(fscp::get_default_elliptic_curves(), ""), "A elliptic curve to allow.")
+	("fscp.cipher_strands", po::value<unsigned int>()->default_value(0), "The number of cipher strands to use for DATA messages. 0 means that DATA messages are ciphered within the session strand.")
+	("fscp.handshake_threads", po::value<unsigned int>()->default_value(0), "The number of threads dedicated to signing and checking handshake messages. 0 means that handshake messages are processed within the session strand.")
+	("fscp.handshake_queue_size", po::value<unsigned int>()->default_value(static_cast<unsigned int>(fscp::server::DEFAULT_HANDSHAKE_QUEUE_SIZE)), "The maximum number of handshake operations waiting for a handshake thread.")
+	("fscp.ecdhe_key_pool_size", po::value<unsigned int>()->default_value(static_cast<unsigned int>(fscp::ecdhe_key_pool::DEFAULT_SIZE)), "The number of ECDHE key pairs to generate in advance for every elliptic curve. 0 means that key pairs are generated when sessions are prepared.")
+	("fscp.io_batch_size", po::value<unsigned int>()->default_value(0), "The maximum number of datagrams to receive or send per system call. 0 or 1 disables batching.")
+	("fscp.listen_sockets", po::value<unsigned int>()->default_value(0), "The number of sockets to open on the listen endpoint, using SO_REUSEPORT. 0 or 1 opens a single socket.")
+	("fscp.io_uring", po::value<bool>()->default_value(false, "no"), "Whether to receive datagrams with io_uring.")
+	("fscp.path_mtu_discovery", po::value<bool>()->default_value(false, "no"), "Whether to discover the path MTU to every host.")
 	;
 
 	return result;
@@ -311,6 +319,8 @@ po::options_description get_security_options()
 	("security.authority_certificate_file", po::value<std::vector<fs::path> >()->multitoken()->zero_tokens()->default_value(std::vector<fs::path>(), ""), "An authority certificate file to use.")
 	("security.certificate_revocation_validation_method", po::value<fl::security_configuration::certificate_revocation_validation_method_type>()->default_value(fl::security_configuration::CRVM_NONE), "The certificate revocation validation method.")
 	("security.certificate_revocation_list_file", po::value<std::vector<fs::path> >()->multitoken()->zero_tokens()->default_value(std::vector<fs::path>(), ""), "A certificate revocation list file to use.")
+	("security.certificate_validation_cache_size", po::value<unsigned int>()->default_value(static_cast<unsigned int>(fl::certificate_validation_cache::DEFAULT_SIZE)), "The maximum number of certificate validation results to cache. 0 disables the cache.")
+	("security.certificate_validation_cache_ttl", po::value<millisecond_duration>()->default_value(300000), "The time after which a cached certificate validation result is computed again, in milliseconds.")
 	;
 
 	return result;
@@ -332,6 +342,8 @@ po::options_description get_tap_adapter_options()
 	("tap_adapter.mtu", po::value<fl::mtu_type>()->default_value(fl::auto_mtu_type()), "The MTU of the tap adapter.")
 	("tap_adapter.mss_override", po::value<fl::mss_type>()->default_value(fl::mss_type()), "The MSS override.")
 	("tap_adapter.metric", po::value<fl::metric_type>()->default_value(fl::auto_metric_type()), "The metric of the tap adapter.")
+	("tap_adapter.queues", po::value<unsigned int>()->default_value(0), "The number of queues to open on the tap adapter. 0 or 1 opens a single queue.")
+	("tap_adapter.offload_enabled", po::value<bool>()->default_value(false, "no"), "Whether to enable segmentation and checksum offloading on the tap adapter.")
 	("tap_adapter.ipv4_address_prefix_length", po::value<asiotap::ipv4_network_address>(), "The tap adapter IPv4 address and prefix length.")
 	("tap_adapter.ipv6_address_prefix_length", po::value<asiotap::ipv6_network_address>(), "The tap adapter IPv6 address and prefix length.")
 	("tap_adapter.remote_ipv4_address", po::value<asiotap::ipv4_network_address>(), "The tap adapter IPv4 remote address.")
@@ -354,6 +366,8 @@ po::options_description get_switch_options()
 	result.add_options()
 	("switch.routing_method", po::value<fl::switch_configuration::routing_method_type>()->default_value(fl::switch_configuration::RM_SWITCH), "The routing method for messages.")
 	("switch.relay_mode_enabled", po::value<bool>()->default_value(false, "no"), "Whether to enable the relay mode.")
+	("switch.max_entries", po::value<unsigned int>()->default_value(1024), "The maximum number of entries in the ethernet address table.")
+	("switch.ethernet_address_aging_time", po::value<millisecond_duration>()->default_value(300000), "The time after which an ethernet address that was not seen is forgotten, in milliseconds. 0 disables aging.")
 	;
 
 	return result;
@@ -378,6 +392,18 @@ po::options_description get_router_options()
 	return result;
 }
 
+po::options_description get_metrics_options()
+{
+	po::options_description result("Metrics options");
+
+	result.add_options()
+	("metrics.socket", po::value<fs::path>()->default_value(""), "The path of the UNIX socket that exposes the metrics.")
+	("metrics.format", po::value<fl::metrics_configuration::metrics_format_type>()->default_value(fl::metrics_configuration::metrics_format_type::json), "The format of the metrics.")
+	;
+
+	return result;
+}
+
 void make_paths_absolute(boost::program_options::variables_map& vm, const boost::filesystem::path& root)
 {
 	make_path_absolute("server.server_certificate_file", vm, root);
@@ -393,6 +419,7 @@ void make_paths_absolute(boost::program_options::variables_map& vm, const boost:
 	make_path_list_absolute("security.certificate_revocation_list_file", vm, root);
 	make_path_absolute("tap_adapter.up_script", vm, root);
 	make_path_absolute("tap_adapter.down_script", vm, root);
+	make_path_absolute("metrics.socket", vm, root);
 }
 
 void setup_configuration(const fscp::logger& logger, fl::configuration& configuration, const po::variables_map& vm)
@@ -462,6 +489,14 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	configuration.fscp.never_contact_list = vm["fscp.never_contact"].as<std::vector<asiotap::ip_network_address>>();
 	configuration.fscp.cipher_suite_capabilities = vm["fscp.cipher_suite_capability"].as<std::vector<fscp::cipher_suite_type>>();
 	configuration.fscp.elliptic_curve_capabilities = vm["fscp.elliptic_curve_capability"].as<std::vector<fscp::elliptic_curve_type>>();
+	configuration.fscp.cipher_strands = vm["fscp.cipher_strands"].as<unsigned int>();
+	configuration.fscp.handshake_threads = vm["fscp.handshake_threads"].as<unsigned int>();
+	configuration.fscp.handshake_queue_size = vm["fscp.handshake_queue_size"].as<unsigned int>();
+	configuration.fscp.ecdhe_key_pool_size = vm["fscp.ecdhe_key_pool_size"].as<unsigned int>();
+	configuration.fscp.io_batch_size = vm["fscp.io_batch_size"].as<unsigned int>();
+	configuration.fscp.listen_sockets = vm["fscp.listen_sockets"].as<unsigned int>();
+	configuration.fscp.io_uring = vm["fscp.io_uring"].as<bool>();
+	configuration.fscp.path_mtu_discovery = vm["fscp.path_mtu_discovery"].as<bool>();
 
 	// Security options
 	const std::string passphrase = vm["security.passphrase"].as<std::string>();
@@ -507,6 +542,8 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	}
 
 	configuration.security.certificate_revocation_validation_method = vm["security.certificate_revocation_validation_method"].as<fl::security_configuration::certificate_revocation_validation_method_type>();
+	configuration.security.certificate_validation_cache_size = vm["security.certificate_validation_cache_size"].as<unsigned int>();
+	configuration.security.certificate_validation_cache_ttl = vm["security.certificate_validation_cache_ttl"].as<millisecond_duration>().to_time_duration();
 
 	if (load_crl_list(configuration.security.certificate_revocation_list_list, "security.certificate_revocation_list_file", vm))
 	{
@@ -528,6 +565,8 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	configuration.tap_adapter.mtu = vm["tap_adapter.mtu"].as<fl::mtu_type>();
 	configuration.tap_adapter.mss_override = vm["tap_adapter.mss_override"].as<fl::mss_type>();
 	configuration.tap_adapter.metric = vm["tap_adapter.metric"].as<fl::metric_type>();
+	configuration.tap_adapter.queues = vm["tap_adapter.queues"].as<unsigned int>();
+	configuration.tap_adapter.offload_enabled = vm["tap_adapter.offload_enabled"].as<bool>();
 
 	if (vm.count("tap_adapter.ipv4_address_prefix_length"))
 	{
@@ -555,6 +594,8 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	// Switch options
 	configuration.switch_.routing_method = vm["switch.routing_method"].as<fl::switch_configuration::routing_method_type>();
 	configuration.switch_.relay_mode_enabled = vm["switch.relay_mode_enabled"].as<bool>();
+	configuration.switch_.max_entries = vm["switch.max_entries"].as<unsigned int>();
+	configuration.switch_.ethernet_address_aging_time = vm["switch.ethernet_address_aging_time"].as<millisecond_duration>().to_time_duration();
 
 	// Router
 	const auto local_ip_routes = vm["router.local_ip_route"].as<std::vector<freelan::ip_route> >();
@@ -569,4 +610,8 @@ void setup_configuration(const fscp::logger& logger, fl::configuration& configur
 	configuration.router.maximum_routes_limit = vm["router.maximum_routes_limit"].as<unsigned int>();
 	configuration.router.dns_servers_acceptance_policy = vm["router.dns_servers_acceptance_policy"].as<fl::router_configuration::dns_servers_scope_type>();
 	configuration.router.dns_script = vm["router.dns_script"].as<fs::path>();
+
+	// Metrics
+	configuration.metrics.socket = vm["metrics.socket"].as<fs::path>();
+	configuration.metrics.format = vm["metrics.format"].as<fl::metrics_configuration::metrics_format_type>();
 }
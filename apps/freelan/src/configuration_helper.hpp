@@ -96,6 +96,12 @@ boost::program_options::options_description get_switch_options();
  */
 boost::program_options::options_description get_router_options();
 
+/**
+ * \brief Get the metrics options.
+ * \return The metrics options.
+ */
+boost::program_options::options_description get_metrics_options();
+
 /**
  * \brief Set the paths options relative to the specified root.
  * \param vm The variables map.
@@ -0,0 +1,92 @@
+/**
+ * \file checksum.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Internet checksum benchmarks.
+ */
+
+#include <benchmark.hpp>
+
+#include <asiotap/osi/checksum.hpp>
+#include <asiotap/osi/checksum_helper.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	namespace ao = asiotap::osi;
+
+	void add_benchmarks(benchmark::runner& runner, size_t size)
+	{
+		// One extra byte allows to benchmark misaligned buffers as well.
+		std::vector<uint8_t> buffer(size + 1);
+
+		for (size_t i = 0; i < buffer.size(); ++i)
+		{
+			buffer[i] = static_cast<uint8_t>(i * 7);
+		}
+
+		const std::string suffix = "/" + boost::lexical_cast<std::string>(size);
+
+		runner.run("checksum_helper/aligned" + suffix, size, [&] () {
+			benchmark::do_not_optimize(ao::compute_checksum(reinterpret_cast<const uint16_t*>(buffer.data()), size));
+		});
+
+		runner.run("checksum_helper/misaligned" + suffix, size, [&] () {
+			benchmark::do_not_optimize(ao::compute_checksum(reinterpret_cast<const uint16_t*>(buffer.data() + 1), size));
+		});
+
+		// This is how the transport checksums are computed: pseudo-header, header, then payload.
+		runner.run("checksum_helper/chunked" + suffix, size, [&] () {
+			const size_t first_chunk = std::min<size_t>(12, size);
+			const size_t second_chunk = std::min<size_t>(8, size - first_chunk);
+
+			ao::checksum_helper helper;
+			helper.update(reinterpret_cast<const uint16_t*>(buffer.data()), first_chunk);
+			helper.update(reinterpret_cast<const uint16_t*>(buffer.data() + first_chunk), second_chunk);
+			helper.update(reinterpret_cast<const uint16_t*>(buffer.data() + first_chunk + second_chunk), size - first_chunk - second_chunk);
+
+			benchmark::do_not_optimize(helper.compute());
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		benchmark::runner runner(argc, argv);
+
+		for (size_t size : { 20, 64, 576, 1500, 9000, 65535 })
+		{
+			add_benchmarks(runner, size);
+		}
+
+		uint16_t checksum = 0x1234;
+		uint32_t value = 0;
+
+		runner.run("update_checksum/16", 0, [&] () {
+			checksum = ao::update_checksum(checksum, static_cast<uint16_t>(value), static_cast<uint16_t>(value + 1), false);
+			++value;
+		});
+
+		runner.run("update_checksum/32", 0, [&] () {
+			checksum = ao::update_checksum(checksum, value, value + 1);
+			++value;
+		});
+
+		benchmark::do_not_optimize(checksum);
+
+		return runner.report();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
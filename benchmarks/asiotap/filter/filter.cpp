@@ -0,0 +1,129 @@
+/**
+ * \file filter.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Frame filters and classifier benchmarks.
+ */
+
+#include <benchmark.hpp>
+#include <frames.hpp>
+
+#include <asiotap/osi/arp_filter.hpp>
+#include <asiotap/osi/bootp_filter.hpp>
+#include <asiotap/osi/complex_filter.hpp>
+#include <asiotap/osi/dhcp_filter.hpp>
+#include <asiotap/osi/ethernet_filter.hpp>
+#include <asiotap/osi/icmpv6_filter.hpp>
+#include <asiotap/osi/ipv4_filter.hpp>
+#include <asiotap/osi/ipv6_filter.hpp>
+#include <asiotap/osi/udp_filter.hpp>
+#include <asiotap/osi/frame_classifier.hpp>
+
+#include <boost/array.hpp>
+
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+	namespace ao = asiotap::osi;
+
+	/**
+	 * \brief The filter chain of an Ethernet tap adapter: ARP, DHCP and ICMPv6 frames are inspected.
+	 */
+	class filter_chain
+	{
+		public:
+
+			filter_chain() :
+				m_ethernet_filter(),
+				m_arp_filter(m_ethernet_filter),
+				m_ipv4_filter(m_ethernet_filter),
+				m_udp_filter(m_ipv4_filter),
+				m_bootp_filter(m_udp_filter),
+				m_dhcp_filter(m_bootp_filter),
+				m_ipv6_filter(m_ethernet_filter),
+				m_icmpv6_filter(m_ipv6_filter),
+				m_frames(0)
+			{
+				// Like the tap adapter frames, the frames are parsed from mutable buffers.
+				m_udp_filter.add_handler([this] (ao::mutable_helper<ao::udp_frame>) { ++m_frames; });
+				m_dhcp_filter.add_handler([this] (ao::mutable_helper<ao::dhcp_frame>) { ++m_frames; });
+				m_icmpv6_filter.add_handler([this] (ao::mutable_helper<ao::icmpv6_frame>) { ++m_frames; });
+			}
+
+			void parse(boost::asio::mutable_buffer frame)
+			{
+				m_ethernet_filter.parse(frame);
+			}
+
+			uint64_t frames() const { return m_frames; }
+
+		private:
+
+			ao::filter<ao::ethernet_frame> m_ethernet_filter;
+			ao::complex_filter<ao::arp_frame, ao::ethernet_frame>::type m_arp_filter;
+			ao::complex_filter<ao::ipv4_frame, ao::ethernet_frame>::type m_ipv4_filter;
+			ao::complex_filter<ao::udp_frame, ao::ipv4_frame, ao::ethernet_frame>::type m_udp_filter;
+			ao::complex_filter<ao::bootp_frame, ao::udp_frame, ao::ipv4_frame, ao::ethernet_frame>::type m_bootp_filter;
+			ao::complex_filter<ao::dhcp_frame, ao::bootp_frame, ao::udp_frame, ao::ipv4_frame, ao::ethernet_frame>::type m_dhcp_filter;
+			ao::complex_filter<ao::ipv6_frame, ao::ethernet_frame>::type m_ipv6_filter;
+			ao::complex_filter<ao::icmpv6_frame, ao::ipv6_frame, ao::ethernet_frame>::type m_icmpv6_filter;
+			uint64_t m_frames;
+	};
+
+	void add_benchmarks(benchmark::runner& runner, const std::string& name, boost::asio::mutable_buffer frame)
+	{
+		filter_chain chain;
+
+		runner.run("osi/filter/" + name, boost::asio::buffer_size(frame), [&] () {
+			chain.parse(frame);
+		});
+
+		benchmark::do_not_optimize(chain.frames());
+
+		ao::frame_classifier_handler handler;
+
+		runner.run("osi/classify_ethernet_frame/" + name, boost::asio::buffer_size(frame), [&] () {
+			benchmark::do_not_optimize(ao::classify_ethernet_frame(frame, handler));
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		benchmark::runner runner(argc, argv);
+
+		const benchmark::ethernet_address_type target = benchmark::make_ethernet_address(1);
+		const benchmark::ethernet_address_type sender = benchmark::make_ethernet_address(2);
+
+		boost::array<uint8_t, 1514> ipv4_buffer;
+		const boost::asio::mutable_buffer ipv4_packet = benchmark::make_ipv4_udp_packet(boost::asio::buffer(ipv4_buffer), boost::asio::ip::address_v4(0x0a000001), boost::asio::ip::address_v4(0x0a000002), 1400);
+		const boost::asio::mutable_buffer ipv4_frame = benchmark::make_ethernet_frame(boost::asio::buffer(ipv4_buffer), target, sender, ao::IP_PROTOCOL, boost::asio::buffer_size(ipv4_packet));
+
+		add_benchmarks(runner, "ipv4_udp", ipv4_frame);
+
+		boost::array<uint8_t, 1514> ipv6_buffer;
+		const boost::asio::mutable_buffer ipv6_packet = benchmark::make_ipv6_udp_packet(boost::asio::buffer(ipv6_buffer), boost::asio::ip::address_v6::from_string("fd00::1"), boost::asio::ip::address_v6::from_string("fd00::2"), 1400);
+		const boost::asio::mutable_buffer ipv6_frame = benchmark::make_ethernet_frame(boost::asio::buffer(ipv6_buffer), target, sender, ao::IPV6_PROTOCOL, boost::asio::buffer_size(ipv6_packet));
+
+		add_benchmarks(runner, "ipv6_udp", ipv6_frame);
+
+		// This is what the router does for every packet read from a TUN adapter.
+		ao::filter<ao::ipv4_frame> ipv4_filter;
+
+		runner.run("osi/filter/tun_ipv4", boost::asio::buffer_size(ipv4_packet), [&] () {
+			ipv4_filter.parse(ipv4_packet);
+			benchmark::do_not_optimize(ipv4_filter.get_last_const_helper());
+		});
+
+		return runner.report();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
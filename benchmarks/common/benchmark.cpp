@@ -0,0 +1,227 @@
+/**
+ * \file benchmark.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A minimal microbenchmark harness.
+ */
+
+#include "benchmark.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+namespace
+{
+	std::atomic<uint64_t> allocations(0);
+
+	void* allocate(std::size_t size)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+
+		return std::malloc(size ? size : 1);
+	}
+
+	// The replaced operator delete only calls this, so that GCC does not see a free() paired with a new expression.
+	void deallocate(void* ptr)
+	{
+		std::free(ptr);
+	}
+
+	bool starts_with(const std::string& str, const std::string& prefix, std::string& value)
+	{
+		if (str.compare(0, prefix.size(), prefix) == 0)
+		{
+			value = str.substr(prefix.size());
+
+			return true;
+		}
+
+		return false;
+	}
+}
+
+// Replacing the global allocation functions is the only portable way of counting the allocations.
+void* operator new(std::size_t size)
+{
+	void* const result = allocate(size);
+
+	if (!result)
+	{
+		throw std::bad_alloc();
+	}
+
+	return result;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	deallocate(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	deallocate(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	deallocate(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	deallocate(ptr);
+}
+
+namespace benchmark
+{
+	uint64_t allocation_count()
+	{
+		return allocations.load(std::memory_order_relaxed);
+	}
+
+	runner::runner(int argc, char** argv) :
+		m_filter(),
+		m_min_time(std::chrono::milliseconds(200)),
+		m_repetitions(5),
+		m_csv(false),
+		m_results()
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string argument = argv[i];
+			std::string value;
+
+			if (starts_with(argument, "--filter=", value))
+			{
+				m_filter = value;
+			}
+			else if (starts_with(argument, "--min-time=", value))
+			{
+				m_min_time = std::chrono::milliseconds(boost::lexical_cast<unsigned int>(value));
+			}
+			else if (starts_with(argument, "--repetitions=", value))
+			{
+				m_repetitions = std::max(boost::lexical_cast<unsigned int>(value), 1u);
+			}
+			else if (argument == "--csv")
+			{
+				m_csv = true;
+			}
+			else
+			{
+				throw std::invalid_argument("Unknown argument: " + argument);
+			}
+		}
+	}
+
+	int runner::report() const
+	{
+		if (m_csv)
+		{
+			std::cout << "name,iterations,ns/op,bytes/s,allocs/op,spread" << std::endl;
+
+			for (auto&& result : m_results)
+			{
+				std::cout << result.name << "," << result.iterations << "," << result.nanoseconds_per_operation << "," << result.bytes_per_second << "," << result.allocations_per_operation << "," << result.spread << std::endl;
+			}
+		}
+		else
+		{
+			size_t name_width = 9;
+
+			for (auto&& result : m_results)
+			{
+				name_width = std::max(name_width, result.name.size());
+			}
+
+			std::cout << std::left << std::setw(name_width) << "benchmark" << std::right << std::setw(12) << "iterations" << std::setw(14) << "ns/op" << std::setw(12) << "MB/s" << std::setw(12) << "allocs/op" << std::setw(10) << "spread" << std::endl;
+			std::cout << std::string(name_width + 60, '-') << std::endl;
+
+			for (auto&& result : m_results)
+			{
+				std::cout << std::left << std::setw(name_width) << result.name << std::right << std::setw(12) << result.iterations;
+				std::cout << std::fixed << std::setprecision(1) << std::setw(14) << result.nanoseconds_per_operation;
+
+				if (result.bytes_per_second > 0)
+				{
+					std::cout << std::setw(12) << result.bytes_per_second / 1e6;
+				}
+				else
+				{
+					std::cout << std::setw(12) << "-";
+				}
+
+				std::cout << std::setprecision(2) << std::setw(12) << result.allocations_per_operation;
+				std::cout << std::setprecision(1) << std::setw(9) << result.spread * 100 << "%" << std::endl;
+			}
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	bool runner::is_selected(const std::string& name) const
+	{
+		return (name.find(m_filter) != std::string::npos);
+	}
+
+	size_t runner::get_next_iterations(const sample_type& sample) const
+	{
+		// Aim a bit higher than the minimum time, but never grow too fast: the first samples are the least reliable ones.
+		if (sample.duration.count() <= 0)
+		{
+			return sample.iterations * 10;
+		}
+
+		const double ratio = 1.2 * static_cast<double>(m_min_time.count()) / static_cast<double>(sample.duration.count());
+
+		return std::max(sample.iterations + 1, static_cast<size_t>(sample.iterations * std::min(ratio, 10.0)));
+	}
+
+	void runner::add_result(const std::string& name, size_t bytes_per_operation, std::vector<sample_type> samples)
+	{
+		std::sort(samples.begin(), samples.end(), [] (const sample_type& lhs, const sample_type& rhs) {
+			return (lhs.duration < rhs.duration);
+		});
+
+		const sample_type& median = samples[samples.size() / 2];
+		const double iterations = static_cast<double>(median.iterations);
+		const double nanoseconds = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(median.duration).count());
+		const double spread = (median.duration.count() > 0) ? static_cast<double>((samples.back().duration - samples.front().duration).count()) / static_cast<double>(median.duration.count()) : 0;
+
+		const result_type result = {
+			name,
+			median.iterations,
+			nanoseconds / iterations,
+			(nanoseconds > 0) ? bytes_per_operation * iterations * 1e9 / nanoseconds : 0,
+			static_cast<double>(median.allocations) / iterations,
+			spread
+		};
+
+		m_results.push_back(result);
+
+		// Long suites are easier to follow when the results are also shown as they come.
+		std::cerr << name << ": " << result.nanoseconds_per_operation << " ns/op" << std::endl;
+	}
+}
@@ -0,0 +1,161 @@
+/**
+ * \file benchmark.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A minimal microbenchmark harness.
+ */
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <boost/noncopyable.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace benchmark
+{
+	/**
+	 * \brief Get the count of C++ allocations done by the process so far.
+	 * \return The count of calls to the global operator new.
+	 *
+	 * Allocations done directly with malloc(), like the ones OpenSSL does, are not accounted for.
+	 */
+	uint64_t allocation_count();
+
+	/**
+	 * \brief Prevent the compiler from optimizing a value away.
+	 * \param value The value that must be considered as used.
+	 */
+	template <typename Type>
+	inline void do_not_optimize(const Type& value)
+	{
+#if defined(__GNUC__)
+		__asm__ __volatile__("" : : "g"(&value) : "memory");
+#else
+		static_cast<void>(*reinterpret_cast<const volatile char*>(&value));
+#endif
+	}
+
+	/**
+	 * \brief A benchmark runner.
+	 *
+	 * Every benchmark is calibrated so that a repetition lasts at least the minimum time, then repeated several times. The median repetition is reported.
+	 *
+	 * The following command line options are recognized:
+	 * - --filter=<text>: only run the benchmarks whose name contains text.
+	 * - --min-time=<milliseconds>: the minimum duration of a repetition. Defaults to 200.
+	 * - --repetitions=<count>: the count of repetitions. Defaults to 5.
+	 * - --csv: report the results as CSV, to ease the comparison of several runs.
+	 */
+	class runner : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief Create a runner.
+			 * \param argc The count of command line arguments.
+			 * \param argv The command line arguments.
+			 *
+			 * If the command line is invalid, a std::invalid_argument is thrown.
+			 */
+			runner(int argc, char** argv);
+
+			/**
+			 * \brief Run a benchmark.
+			 * \param name The name of the benchmark.
+			 * \param bytes_per_operation The count of bytes processed by every call to function, or 0 if it is not relevant.
+			 * \param function The function to benchmark. It is called once per operation and must not take any argument.
+			 */
+			template <typename Function>
+			void run(const std::string& name, size_t bytes_per_operation, Function function);
+
+			/**
+			 * \brief Report the results of all the benchmarks that were run.
+			 * \return The exit code of the program.
+			 */
+			int report() const;
+
+		private:
+
+			typedef std::chrono::steady_clock clock_type;
+
+			struct sample_type
+			{
+				size_t iterations;
+				clock_type::duration duration;
+				uint64_t allocations;
+			};
+
+			struct result_type
+			{
+				std::string name;
+				size_t iterations;
+				double nanoseconds_per_operation;
+				double bytes_per_second;
+				double allocations_per_operation;
+				double spread;
+			};
+
+			template <typename Function>
+			static sample_type measure(Function& function, size_t iterations);
+
+			bool is_selected(const std::string& name) const;
+			size_t get_next_iterations(const sample_type& sample) const;
+			void add_result(const std::string& name, size_t bytes_per_operation, std::vector<sample_type> samples);
+
+			std::string m_filter;
+			clock_type::duration m_min_time;
+			unsigned int m_repetitions;
+			bool m_csv;
+			std::vector<result_type> m_results;
+	};
+
+	template <typename Function>
+	inline void runner::run(const std::string& name, size_t bytes_per_operation, Function function)
+	{
+		if (!is_selected(name))
+		{
+			return;
+		}
+
+		// Warm up the caches and the lazily-allocated buffers.
+		function();
+
+		sample_type sample = measure(function, 1);
+
+		while (sample.duration < m_min_time)
+		{
+			sample = measure(function, get_next_iterations(sample));
+		}
+
+		std::vector<sample_type> samples;
+
+		for (unsigned int repetition = 0; repetition < m_repetitions; ++repetition)
+		{
+			samples.push_back(measure(function, sample.iterations));
+		}
+
+		add_result(name, bytes_per_operation, samples);
+	}
+
+	template <typename Function>
+	inline runner::sample_type runner::measure(Function& function, size_t iterations)
+	{
+		const uint64_t allocations = allocation_count();
+		const clock_type::time_point start = clock_type::now();
+
+		for (size_t iteration = 0; iteration < iterations; ++iteration)
+		{
+			function();
+		}
+
+		const clock_type::time_point stop = clock_type::now();
+		const sample_type sample = { iterations, stop - start, allocation_count() - allocations };
+
+		return sample;
+	}
+}
+
+#endif /* BENCHMARK_HPP */
@@ -0,0 +1,111 @@
+/**
+ * \file frames.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Frame building helpers for the benchmarks.
+ */
+
+#ifndef BENCHMARK_FRAMES_HPP
+#define BENCHMARK_FRAMES_HPP
+
+#include <asiotap/osi/ethernet_helper.hpp>
+#include <asiotap/osi/ipv4_helper.hpp>
+#include <asiotap/osi/ipv6_helper.hpp>
+#include <asiotap/osi/udp_helper.hpp>
+#include <asiotap/osi/ethernet_builder.hpp>
+#include <asiotap/osi/ipv4_builder.hpp>
+#include <asiotap/osi/ipv6_builder.hpp>
+#include <asiotap/osi/udp_builder.hpp>
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+
+#include <cstring>
+
+namespace benchmark
+{
+	/**
+	 * \brief An Ethernet address.
+	 */
+	typedef boost::array<uint8_t, 6> ethernet_address_type;
+
+	/**
+	 * \brief Get a locally administered Ethernet address.
+	 * \param index The index of the address. Distinct indexes give distinct addresses.
+	 * \return The Ethernet address.
+	 */
+	inline ethernet_address_type make_ethernet_address(uint32_t index)
+	{
+		const ethernet_address_type result = {{ 0x02, 0x00, static_cast<uint8_t>(index >> 24), static_cast<uint8_t>(index >> 16), static_cast<uint8_t>(index >> 8), static_cast<uint8_t>(index) }};
+
+		return result;
+	}
+
+	/**
+	 * \brief Write an IPv4 UDP packet at the end of a buffer.
+	 * \param buf The buffer. It must be large enough for the headers and the payload.
+	 * \param source The source address.
+	 * \param destination The destination address.
+	 * \param payload_size The size of the UDP payload.
+	 * \return The packet.
+	 */
+	inline boost::asio::mutable_buffer make_ipv4_udp_packet(boost::asio::mutable_buffer buf, const boost::asio::ip::address_v4& source, const boost::asio::ip::address_v4& destination, size_t payload_size)
+	{
+		using namespace asiotap::osi;
+
+		std::memset(boost::asio::buffer_cast<uint8_t*>(buf), 0x42, boost::asio::buffer_size(buf));
+
+		builder<udp_frame> udp_builder(buf, payload_size);
+		size_t size = udp_builder.write(12000, 12000);
+
+		builder<ipv4_frame> ipv4_builder(buf, size);
+		size = ipv4_builder.write(0, 0, 0, 0, 64, UDP_PROTOCOL, source, destination);
+
+		udp_builder.update_checksum(ipv4_builder.get_helper());
+
+		return buf + (boost::asio::buffer_size(buf) - size);
+	}
+
+	/**
+	 * \brief Write an IPv6 UDP packet at the end of a buffer.
+	 * \param buf The buffer. It must be large enough for the headers and the payload.
+	 * \param source The source address.
+	 * \param destination The destination address.
+	 * \param payload_size The size of the UDP payload.
+	 * \return The packet.
+	 */
+	inline boost::asio::mutable_buffer make_ipv6_udp_packet(boost::asio::mutable_buffer buf, const boost::asio::ip::address_v6& source, const boost::asio::ip::address_v6& destination, size_t payload_size)
+	{
+		using namespace asiotap::osi;
+
+		std::memset(boost::asio::buffer_cast<uint8_t*>(buf), 0x42, boost::asio::buffer_size(buf));
+
+		builder<udp_frame> udp_builder(buf, payload_size);
+		size_t size = udp_builder.write(12000, 12000);
+
+		builder<ipv6_frame> ipv6_builder(buf, size);
+		size = ipv6_builder.write(0, 0, UDP_PROTOCOL, 64, source, destination);
+
+		return buf + (boost::asio::buffer_size(buf) - size);
+	}
+
+	/**
+	 * \brief Write an Ethernet frame around a packet, at the end of a buffer.
+	 * \param buf The buffer. The packet must already be written at its end.
+	 * \param target The target Ethernet address.
+	 * \param sender The sender Ethernet address.
+	 * \param protocol The protocol of the packet.
+	 * \param packet_size The size of the packet.
+	 * \return The frame.
+	 */
+	inline boost::asio::mutable_buffer make_ethernet_frame(boost::asio::mutable_buffer buf, const ethernet_address_type& target, const ethernet_address_type& sender, uint16_t protocol, size_t packet_size)
+	{
+		using namespace asiotap::osi;
+
+		builder<ethernet_frame> ethernet_builder(buf, packet_size);
+		const size_t size = ethernet_builder.write(boost::asio::buffer(target), boost::asio::buffer(sender), protocol);
+
+		return buf + (boost::asio::buffer_size(buf) - size);
+	}
+}
+
+#endif /* BENCHMARK_FRAMES_HPP */
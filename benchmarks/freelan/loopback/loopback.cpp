@@ -0,0 +1,830 @@
+/**
+ * \file loopback.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An end-to-end throughput harness, running several peers over the loopback interface.
+ *
+ * Every peer is a freelan::core whose TAP adapter is replaced by an in-memory frame source and sink, through a freelan::virtual_tap_adapter, so that neither root privileges nor TAP devices are needed.
+ */
+
+#include <benchmark.hpp>
+#include <frames.hpp>
+
+#include <fscp/fscp.hpp>
+
+#include <freelan/core.hpp>
+#include <freelan/virtual_tap_adapter.hpp>
+
+#include <cryptoplus/cryptoplus.hpp>
+#include <cryptoplus/random/random.hpp>
+#include <cryptoplus/error/error_strings.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <sys/resource.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+	typedef std::chrono::steady_clock clock_type;
+
+	// The frame headers: Ethernet, IPv4 and UDP.
+	const size_t HEADERS_SIZE = 14 + 20 + 8;
+
+	// The payload starts with the send timestamp, in nanoseconds, then the index of the sending peer and the lane of the frame.
+	const size_t TIMESTAMP_OFFSET = HEADERS_SIZE;
+	const size_t SOURCE_OFFSET = TIMESTAMP_OFFSET + sizeof(uint64_t);
+	const size_t LANE_OFFSET = SOURCE_OFFSET + sizeof(uint32_t);
+	const size_t MIN_FRAME_SIZE = LANE_OFFSET + sizeof(uint32_t);
+
+	// A lane whose frame did not arrive after that long sends a new one.
+	const boost::posix_time::time_duration LOST_FRAME_TIMEOUT = boost::posix_time::milliseconds(500);
+
+	const benchmark::ethernet_address_type BROADCAST_ADDRESS = {{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }};
+
+	uint64_t get_timestamp()
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count());
+	}
+
+	/**
+	 * \brief Get the CPU time consumed by the process, in all its threads.
+	 * \return The CPU time, in nanoseconds.
+	 */
+	uint64_t get_cpu_time()
+	{
+		struct rusage usage;
+
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+		{
+			return 0;
+		}
+
+		const uint64_t user_time = static_cast<uint64_t>(usage.ru_utime.tv_sec) * 1000000000 + static_cast<uint64_t>(usage.ru_utime.tv_usec) * 1000;
+		const uint64_t system_time = static_cast<uint64_t>(usage.ru_stime.tv_sec) * 1000000000 + static_cast<uint64_t>(usage.ru_stime.tv_usec) * 1000;
+
+		return user_time + system_time;
+	}
+
+	/**
+	 * \brief A lock-free latency histogram.
+	 *
+	 * Every power of two is split in 16 buckets, which bounds the relative error to about 6%.
+	 */
+	class latency_histogram : public boost::noncopyable
+	{
+		public:
+
+			latency_histogram()
+			{
+				for (auto&& bucket : m_buckets)
+				{
+					bucket = 0;
+				}
+			}
+
+			void record(uint64_t value)
+			{
+				m_buckets[get_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get a percentile.
+			 * \param percentile The percentile, between 0 and 1.
+			 * \return The lower bound of the bucket that contains the percentile, or 0 if nothing was recorded.
+			 */
+			uint64_t get_percentile(double percentile) const
+			{
+				uint64_t total = 0;
+
+				for (auto&& bucket : m_buckets)
+				{
+					total += bucket.load(std::memory_order_relaxed);
+				}
+
+				const uint64_t rank = static_cast<uint64_t>(percentile * static_cast<double>(total));
+				uint64_t count = 0;
+
+				for (size_t index = 0; index < m_buckets.size(); ++index)
+				{
+					count += m_buckets[index].load(std::memory_order_relaxed);
+
+					if ((count > 0) && (count > rank))
+					{
+						return get_lower_bound(index);
+					}
+				}
+
+				return 0;
+			}
+
+		private:
+
+			static const size_t SUB_BUCKETS_BITS = 4;
+			static const size_t SUB_BUCKETS = 1 << SUB_BUCKETS_BITS;
+
+			static size_t get_bucket(uint64_t value)
+			{
+				if (value < SUB_BUCKETS)
+				{
+					return static_cast<size_t>(value);
+				}
+
+				size_t exponent = 0;
+
+				while ((value >> exponent) >= 2 * SUB_BUCKETS)
+				{
+					++exponent;
+				}
+
+				return (exponent + 1) * SUB_BUCKETS + static_cast<size_t>((value >> exponent) - SUB_BUCKETS);
+			}
+
+			static uint64_t get_lower_bound(size_t bucket)
+			{
+				if (bucket < SUB_BUCKETS)
+				{
+					return bucket;
+				}
+
+				const size_t exponent = bucket / SUB_BUCKETS - 1;
+
+				return static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << exponent;
+			}
+
+			std::array<std::atomic<uint64_t>, 64 * SUB_BUCKETS> m_buckets;
+	};
+
+	/**
+	 * \brief The statistics shared by all the peers.
+	 */
+	struct statistics_type
+	{
+		statistics_type() :
+			measuring(false),
+			sent_frames(0),
+			delivered_frames(0),
+			measured_frames(0),
+			measured_bytes(0)
+		{}
+
+		std::atomic<bool> measuring;
+		std::atomic<uint64_t> sent_frames;
+		std::atomic<uint64_t> delivered_frames;
+		std::atomic<uint64_t> measured_frames;
+		std::atomic<uint64_t> measured_bytes;
+		latency_histogram latencies;
+	};
+
+	/**
+	 * \brief The harness options.
+	 */
+	struct options_type
+	{
+		options_type() :
+			peers(2),
+			threads(boost::thread::hardware_concurrency()),
+			duration(10),
+			warmup(1),
+			frame_size(1400),
+			flows(1),
+			lanes(64),
+			base_port(12000),
+			one_way(false),
+			cipher_suite(fscp::cipher_suite_type::ecdhe_rsa_aes256_gcm_sha384)
+		{}
+
+		unsigned int peers;
+		unsigned int threads;
+		unsigned int duration;
+		unsigned int warmup;
+		size_t frame_size;
+		unsigned int flows;
+		unsigned int lanes;
+		uint16_t base_port;
+		bool one_way;
+		fscp::cipher_suite_type cipher_suite;
+	};
+
+	bool starts_with(const std::string& str, const std::string& prefix, std::string& value)
+	{
+		if (str.compare(0, prefix.size(), prefix) == 0)
+		{
+			value = str.substr(prefix.size());
+
+			return true;
+		}
+
+		return false;
+	}
+
+	options_type parse_options(int argc, char** argv)
+	{
+		options_type options;
+
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string argument = argv[i];
+			std::string value;
+
+			if (starts_with(argument, "--peers=", value))
+			{
+				options.peers = boost::lexical_cast<unsigned int>(value);
+			}
+			else if (starts_with(argument, "--threads=", value))
+			{
+				options.threads = boost::lexical_cast<unsigned int>(value);
+			}
+			else if (starts_with(argument, "--duration=", value))
+			{
+				options.duration = boost::lexical_cast<unsigned int>(value);
+			}
+			else if (starts_with(argument, "--warmup=", value))
+			{
+				options.warmup = boost::lexical_cast<unsigned int>(value);
+			}
+			else if (starts_with(argument, "--frame-size=", value))
+			{
+				options.frame_size = boost::lexical_cast<size_t>(value);
+			}
+			else if (starts_with(argument, "--flows=", value))
+			{
+				options.flows = boost::lexical_cast<unsigned int>(value);
+			}
+			else if (starts_with(argument, "--lanes=", value))
+			{
+				options.lanes = boost::lexical_cast<unsigned int>(value);
+			}
+			else if (starts_with(argument, "--base-port=", value))
+			{
+				options.base_port = boost::lexical_cast<uint16_t>(value);
+			}
+			else if (starts_with(argument, "--cipher-suite=", value))
+			{
+				options.cipher_suite = fscp::cipher_suite_type::from_string(value);
+			}
+			else if (argument == "--one-way")
+			{
+				options.one_way = true;
+			}
+			else
+			{
+				throw std::invalid_argument("Unknown argument: " + argument);
+			}
+		}
+
+		if (options.peers < 2)
+		{
+			throw std::invalid_argument("At least two peers are required.");
+		}
+
+		if ((options.frame_size < MIN_FRAME_SIZE) || (options.frame_size > 65000))
+		{
+			throw std::invalid_argument("The frame size must be between " + boost::lexical_cast<std::string>(MIN_FRAME_SIZE) + " and 65000 bytes.");
+		}
+
+		options.threads = std::max(options.threads, 1u);
+		options.flows = std::max(options.flows, 1u);
+		options.lanes = std::max(options.lanes, 1u);
+
+		return options;
+	}
+
+	class memory_tap_adapter;
+
+	typedef std::vector<boost::shared_ptr<memory_tap_adapter> > memory_tap_adapter_list_type;
+
+	/**
+	 * \brief An in-memory tap adapter.
+	 *
+	 * The frames are sent through a fixed count of lanes: the core reads the next frame of a lane once the previous one was written to the tap adapter of its target, like a TAP adapter would be read by a window-limited application. A frame that does not arrive in time is considered lost and frees its lane.
+	 */
+	class memory_tap_adapter : public freelan::virtual_tap_adapter, public boost::noncopyable
+	{
+		public:
+
+			memory_tap_adapter(boost::asio::io_service& io_service, unsigned int index, const options_type& options, statistics_type& statistics, const memory_tap_adapter_list_type& tap_adapters) :
+				m_io_service(io_service),
+				m_index(index),
+				m_ethernet_address(benchmark::make_ethernet_address(index + 1)),
+				m_options(options),
+				m_statistics(statistics),
+				m_tap_adapters(tap_adapters),
+				m_lost_frame_timer(io_service),
+				m_running(false)
+			{}
+
+			const benchmark::ethernet_address_type& ethernet_address() const
+			{
+				return m_ethernet_address;
+			}
+
+			unsigned int in_flight_lanes() const
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				return static_cast<unsigned int>(m_lanes.size() - m_free_lanes.size());
+			}
+
+			void async_read(boost::asio::mutable_buffer buffer, read_handler_type handler)
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				m_read_buffer = buffer;
+				m_read_handler = handler;
+
+				complete_read();
+			}
+
+			void write(boost::asio::const_buffer data, boost::system::error_code& ec)
+			{
+				ec = boost::system::error_code();
+
+				const uint8_t* const frame = boost::asio::buffer_cast<const uint8_t*>(data);
+
+				if ((boost::asio::buffer_size(data) >= MIN_FRAME_SIZE) && (std::memcmp(frame, m_ethernet_address.data(), m_ethernet_address.size()) == 0))
+				{
+					uint64_t timestamp;
+					uint32_t source;
+					uint32_t lane;
+					std::memcpy(&timestamp, frame + TIMESTAMP_OFFSET, sizeof(timestamp));
+					std::memcpy(&source, frame + SOURCE_OFFSET, sizeof(source));
+					std::memcpy(&lane, frame + LANE_OFFSET, sizeof(lane));
+
+					m_statistics.delivered_frames.fetch_add(1, std::memory_order_relaxed);
+
+					if (m_statistics.measuring.load(std::memory_order_relaxed))
+					{
+						m_statistics.measured_frames.fetch_add(1, std::memory_order_relaxed);
+						m_statistics.measured_bytes.fetch_add(boost::asio::buffer_size(data), std::memory_order_relaxed);
+						m_statistics.latencies.record(get_timestamp() - timestamp);
+					}
+
+					if (source < m_tap_adapters.size())
+					{
+						m_tap_adapters[source]->release_lane(lane, timestamp);
+					}
+				}
+			}
+
+			void cancel()
+			{
+				read_handler_type handler;
+
+				{
+					boost::mutex::scoped_lock lock(m_mutex);
+
+					handler.swap(m_read_handler);
+				}
+
+				if (handler)
+				{
+					handler(boost::asio::error::operation_aborted, 0);
+				}
+			}
+
+			/**
+			 * \brief Send a broadcast frame, so that the switches of the other peers learn our Ethernet address.
+			 */
+			void announce()
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				m_announce_frame = make_frame(BROADCAST_ADDRESS, 0);
+
+				complete_read();
+			}
+
+			void start(const benchmark::ethernet_address_type& target)
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				m_lanes.clear();
+				m_free_lanes.clear();
+
+				for (unsigned int lane = 0; lane < m_options.lanes; ++lane)
+				{
+					m_lanes.push_back(lane_type { make_frame(target, lane), 0 });
+					m_free_lanes.push_back(lane);
+				}
+
+				m_running = true;
+
+				complete_read();
+
+				async_wait_lost_frames();
+			}
+
+			void stop()
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				m_running = false;
+			}
+
+		private:
+
+			struct lane_type
+			{
+				std::vector<uint8_t> frame;
+
+				// The send timestamp of the frame in flight, or 0 if the lane is free.
+				uint64_t timestamp;
+			};
+
+			std::vector<uint8_t> make_frame(const benchmark::ethernet_address_type& target, uint32_t lane) const
+			{
+				std::vector<uint8_t> buffer(m_options.frame_size);
+
+				const boost::asio::ip::address_v4 source(0x0a000000 + m_index + 1);
+				const boost::asio::ip::address_v4 destination(0x0a0000ff);
+
+				const boost::asio::mutable_buffer packet = benchmark::make_ipv4_udp_packet(boost::asio::buffer(buffer), source, destination, m_options.frame_size - HEADERS_SIZE);
+				benchmark::make_ethernet_frame(boost::asio::buffer(buffer), target, m_ethernet_address, asiotap::osi::IP_PROTOCOL, boost::asio::buffer_size(packet));
+
+				// Every flow has its own UDP source port.
+				const uint16_t port = htons(static_cast<uint16_t>(20000 + lane % m_options.flows));
+				std::memcpy(&buffer[14 + 20], &port, sizeof(port));
+
+				const uint32_t index = m_index;
+				std::memcpy(&buffer[SOURCE_OFFSET], &index, sizeof(index));
+				std::memcpy(&buffer[LANE_OFFSET], &lane, sizeof(lane));
+
+				return buffer;
+			}
+
+			// Must be called with the mutex locked.
+			void complete_read()
+			{
+				if (!m_read_handler)
+				{
+					return;
+				}
+
+				size_t size = 0;
+
+				if (!m_announce_frame.empty())
+				{
+					size = boost::asio::buffer_copy(m_read_buffer, boost::asio::buffer(m_announce_frame));
+					m_announce_frame.clear();
+				}
+				else if (m_running && !m_free_lanes.empty())
+				{
+					lane_type& lane = m_lanes[m_free_lanes.back()];
+					m_free_lanes.pop_back();
+
+					lane.timestamp = get_timestamp();
+					std::memcpy(&lane.frame[TIMESTAMP_OFFSET], &lane.timestamp, sizeof(lane.timestamp));
+
+					m_statistics.sent_frames.fetch_add(1, std::memory_order_relaxed);
+
+					size = boost::asio::buffer_copy(m_read_buffer, boost::asio::buffer(lane.frame));
+				}
+				else
+				{
+					return;
+				}
+
+				read_handler_type handler;
+				handler.swap(m_read_handler);
+
+				// The core does not expect its read to complete from within async_read().
+				m_io_service.post(boost::bind(handler, boost::system::error_code(), size));
+			}
+
+			void release_lane(uint32_t lane, uint64_t timestamp)
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				// A frame that arrives after it was considered lost must not free its lane again.
+				if ((lane < m_lanes.size()) && (m_lanes[lane].timestamp == timestamp))
+				{
+					m_lanes[lane].timestamp = 0;
+					m_free_lanes.push_back(lane);
+
+					complete_read();
+				}
+			}
+
+			// Must be called with the mutex locked.
+			void async_wait_lost_frames()
+			{
+				m_lost_frame_timer.expires_from_now(LOST_FRAME_TIMEOUT);
+				m_lost_frame_timer.async_wait(boost::bind(&memory_tap_adapter::handle_lost_frame_timer, this, boost::asio::placeholders::error));
+			}
+
+			void handle_lost_frame_timer(const boost::system::error_code& ec)
+			{
+				if (ec == boost::asio::error::operation_aborted)
+				{
+					return;
+				}
+
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				const uint64_t deadline = get_timestamp() - static_cast<uint64_t>(LOST_FRAME_TIMEOUT.total_nanoseconds());
+
+				for (uint32_t lane = 0; lane < m_lanes.size(); ++lane)
+				{
+					if ((m_lanes[lane].timestamp != 0) && (m_lanes[lane].timestamp < deadline))
+					{
+						m_lanes[lane].timestamp = 0;
+						m_free_lanes.push_back(lane);
+					}
+				}
+
+				complete_read();
+
+				if (m_running)
+				{
+					async_wait_lost_frames();
+				}
+			}
+
+			boost::asio::io_service& m_io_service;
+			const unsigned int m_index;
+			const benchmark::ethernet_address_type m_ethernet_address;
+			const options_type& m_options;
+			statistics_type& m_statistics;
+			const memory_tap_adapter_list_type& m_tap_adapters;
+			boost::asio::deadline_timer m_lost_frame_timer;
+			mutable boost::mutex m_mutex;
+			bool m_running;
+			std::vector<lane_type> m_lanes;
+			std::vector<uint32_t> m_free_lanes;
+			std::vector<uint8_t> m_announce_frame;
+			boost::asio::mutable_buffer m_read_buffer;
+			read_handler_type m_read_handler;
+	};
+
+	/**
+	 * \brief A peer: a core that uses an in-memory tap adapter.
+	 */
+	class peer : public boost::noncopyable
+	{
+		public:
+
+			peer(boost::asio::io_service& io_service, unsigned int index, const cryptoplus::buffer& pre_shared_key, const options_type& options, statistics_type& statistics, const memory_tap_adapter_list_type& tap_adapters) :
+				m_index(index),
+				m_tap_adapter(boost::make_shared<memory_tap_adapter>(boost::ref(io_service), index, boost::cref(options), boost::ref(statistics), boost::cref(tap_adapters))),
+				m_core(io_service, make_configuration(index, pre_shared_key, options)),
+				m_sessions(0)
+			{
+				m_core.set_log_level(fscp::log_level::error);
+				m_core.set_log_callback(boost::bind(&peer::handle_log, this, _2));
+				m_core.set_session_established_callback(boost::bind(&peer::handle_session_established, this, _2));
+				m_core.set_session_lost_callback(boost::bind(&peer::handle_session_lost, this));
+				m_core.set_virtual_tap_adapter(m_tap_adapter);
+			}
+
+			void open()
+			{
+				m_core.open();
+			}
+
+			void close()
+			{
+				m_core.close();
+			}
+
+			const boost::shared_ptr<memory_tap_adapter>& tap_adapter() const
+			{
+				return m_tap_adapter;
+			}
+
+			unsigned int sessions() const
+			{
+				return m_sessions;
+			}
+
+		private:
+
+			static asiotap::ipv4_endpoint get_endpoint(const options_type& options, unsigned int index)
+			{
+				return asiotap::ipv4_endpoint(boost::asio::ip::address_v4::loopback(), static_cast<uint16_t>(options.base_port + index));
+			}
+
+			static freelan::configuration make_configuration(unsigned int index, const cryptoplus::buffer& pre_shared_key, const options_type& options)
+			{
+				freelan::configuration configuration;
+
+				configuration.fscp.listen_on = get_endpoint(options, index);
+
+				// The peers are opened in order: every peer contacts the ones that were opened before it.
+				for (unsigned int other = 0; other < index; ++other)
+				{
+					configuration.fscp.contact_list.insert(get_endpoint(options, other));
+				}
+
+				configuration.fscp.cipher_suite_capabilities = fscp::cipher_suite_list_type(1, options.cipher_suite);
+				configuration.fscp.elliptic_curve_capabilities = fscp::get_default_elliptic_curves();
+				configuration.security.identity = fscp::identity_store(fscp::identity_store::cert_type(), fscp::identity_store::key_type(), pre_shared_key);
+
+				return configuration;
+			}
+
+			void handle_log(const std::string& message)
+			{
+				std::cerr << "Peer #" << m_index << ": " << message << std::endl;
+			}
+
+			void handle_session_established(bool is_new)
+			{
+				if (is_new)
+				{
+					++m_sessions;
+				}
+			}
+
+			void handle_session_lost()
+			{
+				--m_sessions;
+			}
+
+			const unsigned int m_index;
+			const boost::shared_ptr<memory_tap_adapter> m_tap_adapter;
+			freelan::core m_core;
+			std::atomic<unsigned int> m_sessions;
+	};
+
+	template <typename Predicate>
+	bool wait_for(Predicate predicate, clock_type::duration timeout)
+	{
+		const clock_type::time_point deadline = clock_type::now() + timeout;
+
+		while (!predicate())
+		{
+			if (clock_type::now() > deadline)
+			{
+				return false;
+			}
+
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+		}
+
+		return true;
+	}
+
+	void report(const options_type& options, const statistics_type& statistics, clock_type::duration duration, uint64_t cpu_time, uint64_t allocations)
+	{
+		const double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(duration).count();
+		const uint64_t frames = statistics.measured_frames;
+		const uint64_t bytes = statistics.measured_bytes;
+		const uint64_t sent_frames = statistics.sent_frames;
+		const uint64_t lost_frames = (sent_frames > statistics.delivered_frames) ? sent_frames - statistics.delivered_frames : 0;
+
+		std::cout << "peers: " << options.peers << (options.one_way ? " (one way)" : "") << ", threads: " << options.threads << ", cipher suite: " << options.cipher_suite << std::endl;
+		std::cout << "frame size: " << options.frame_size << " bytes, flows: " << options.flows << ", lanes per peer: " << options.lanes << ", duration: " << options.duration << " s" << std::endl;
+		std::cout << std::endl;
+		std::cout << std::fixed << std::setprecision(2);
+		std::cout << "throughput: " << (bytes * 8 / seconds / 1e9) << " Gbit/s, " << std::setprecision(0) << (frames / seconds) << " frames/s" << std::endl;
+		std::cout << std::setprecision(1);
+		std::cout << "latency: p50 " << (statistics.latencies.get_percentile(0.5) / 1e3) << " us, p99 " << (statistics.latencies.get_percentile(0.99) / 1e3) << " us" << std::endl;
+
+		if (bytes > 0)
+		{
+			std::cout << std::setprecision(2);
+			std::cout << "cpu: " << (cpu_time / 1e9 / seconds) << " cores, " << (static_cast<double>(cpu_time) / bytes) << " ns/byte, " << (static_cast<double>(allocations) / frames) << " allocs/frame" << std::endl;
+		}
+
+		std::cout << "lost: " << lost_frames << " of " << sent_frames << " frames" << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	cryptoplus::crypto_initializer crypto_initializer;
+	cryptoplus::algorithms_initializer algorithms_initializer;
+	cryptoplus::error::error_strings_initializer error_strings_initializer;
+
+	try
+	{
+		const options_type options = parse_options(argc, argv);
+
+		boost::asio::io_service io_service;
+		boost::asio::io_service::work work(io_service);
+		statistics_type statistics;
+
+		const cryptoplus::buffer pre_shared_key = cryptoplus::random::get_random_bytes(32);
+
+		memory_tap_adapter_list_type tap_adapters;
+		std::vector<std::unique_ptr<peer> > peers;
+
+		for (unsigned int index = 0; index < options.peers; ++index)
+		{
+			peers.push_back(std::unique_ptr<peer>(new peer(io_service, index, pre_shared_key, options, statistics, tap_adapters)));
+			tap_adapters.push_back(peers.back()->tap_adapter());
+		}
+
+		for (auto&& local : peers)
+		{
+			local->open();
+		}
+
+		boost::thread_group threads;
+
+		for (unsigned int i = 0; i < options.threads; ++i)
+		{
+			threads.create_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+		}
+
+		const bool connected = wait_for([&] () {
+			for (auto&& local : peers)
+			{
+				if (local->sessions() + 1 < options.peers)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}, std::chrono::seconds(10));
+
+		if (!connected)
+		{
+			throw std::runtime_error("The sessions could not be established.");
+		}
+
+		for (auto&& local : peers)
+		{
+			local->tap_adapter()->announce();
+		}
+
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+
+		std::cerr << "Sessions established: sending traffic..." << std::endl;
+
+		for (size_t i = 0; i < peers.size(); ++i)
+		{
+			if (!options.one_way || (i == 0))
+			{
+				peers[i]->tap_adapter()->start(peers[(i + 1) % peers.size()]->tap_adapter()->ethernet_address());
+			}
+		}
+
+		boost::this_thread::sleep_for(boost::chrono::seconds(options.warmup));
+
+		const uint64_t cpu_time = get_cpu_time();
+		const uint64_t allocations = benchmark::allocation_count();
+		const clock_type::time_point start = clock_type::now();
+		statistics.measuring = true;
+
+		boost::this_thread::sleep_for(boost::chrono::seconds(options.duration));
+
+		statistics.measuring = false;
+		const clock_type::time_point stop = clock_type::now();
+		const uint64_t measured_cpu_time = get_cpu_time() - cpu_time;
+		const uint64_t measured_allocations = benchmark::allocation_count() - allocations;
+
+		for (auto&& local : peers)
+		{
+			local->tap_adapter()->stop();
+		}
+
+		// Give the frames in flight a chance to arrive, so that they are not counted as lost.
+		wait_for([&] () {
+			for (auto&& local : peers)
+			{
+				if (local->tap_adapter()->in_flight_lanes() > 0)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}, std::chrono::seconds(2));
+
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+
+		for (auto&& local : peers)
+		{
+			local->close();
+		}
+
+		io_service.stop();
+		threads.join_all();
+
+		report(options, statistics, stop - start, measured_cpu_time, measured_allocations);
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+/**
+ * \file router.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Router benchmarks.
+ */
+
+#include <benchmark.hpp>
+#include <frames.hpp>
+
+#include <freelan/router.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	const freelan::router::port_group_type SOURCE_GROUP = 0;
+	const freelan::router::port_group_type HOSTS_GROUP = 1;
+
+	freelan::port_index_type make_host_port_index(uint32_t index)
+	{
+		return freelan::make_port_index(fscp::server::ep_type(boost::asio::ip::address_v4(0x0a000000 + index), 12000));
+	}
+
+	boost::asio::ip::address_v4 make_ipv4_network(uint32_t host)
+	{
+		return boost::asio::ip::address_v4(0x0a000000 + (host << 8));
+	}
+
+	boost::asio::ip::address_v6 make_ipv6_network(uint32_t host)
+	{
+		boost::asio::ip::address_v6::bytes_type bytes = {{ 0xfd, 0x00, 0x00, 0x00, 0x00, 0x00, static_cast<uint8_t>(host >> 8), static_cast<uint8_t>(host) }};
+
+		return boost::asio::ip::address_v6(bytes);
+	}
+
+	boost::asio::ip::address_v6 make_ipv6_host(uint32_t host)
+	{
+		boost::asio::ip::address_v6::bytes_type bytes = make_ipv6_network(host).to_bytes();
+		bytes[15] = 0x01;
+
+		return boost::asio::ip::address_v6(bytes);
+	}
+
+	/**
+	 * \brief A router with a source port and a given count of hosts, every host being the gateway of its own /24 and /64 networks.
+	 *
+	 * An additional host is the default gateway, so that the lookups go through realistic tries.
+	 */
+	class router_fixture
+	{
+		public:
+
+			explicit router_fixture(size_t hosts) :
+				m_router(freelan::router_configuration()),
+				m_source_port_index(make_host_port_index(0))
+			{
+				const freelan::router::port_type::write_function_type write_function = [] (boost::asio::const_buffer, freelan::router::port_type::write_handler_type handler) {
+					handler(boost::system::error_code());
+				};
+
+				m_router.register_port(m_source_port_index, freelan::router::port_type(write_function, SOURCE_GROUP));
+
+				for (uint32_t host = 1; host <= hosts + 1; ++host)
+				{
+					const freelan::port_index_type port_index = make_host_port_index(host);
+
+					m_router.register_port(port_index, freelan::router::port_type(write_function, HOSTS_GROUP));
+
+					asiotap::ip_route_set routes;
+
+					if (host <= hosts)
+					{
+						routes.insert(asiotap::to_ip_route(make_ipv4_network(host), 24));
+						routes.insert(asiotap::to_ip_route(make_ipv6_network(host), 64));
+					}
+					else
+					{
+						routes.insert(asiotap::to_ip_route(boost::asio::ip::address_v4::any(), 0));
+						routes.insert(asiotap::to_ip_route(boost::asio::ip::address_v6::any(), 0));
+					}
+
+					m_router.get_port(port_index)->set_local_routes(routes);
+				}
+			}
+
+			const freelan::router& get() const { return m_router; }
+			const freelan::port_index_type& source_port_index() const { return m_source_port_index; }
+
+		private:
+
+			freelan::router m_router;
+			freelan::port_index_type m_source_port_index;
+	};
+
+	template <typename PacketFactory>
+	void add_benchmark(benchmark::runner& runner, const std::string& name, const router_fixture& fixture, size_t hosts, PacketFactory packet_factory)
+	{
+		// The packets go to every host in turn, so that the lookups are spread over the whole trie.
+		std::vector<std::vector<uint8_t> > packets;
+
+		for (uint32_t host = 1; host <= hosts; ++host)
+		{
+			std::vector<uint8_t> buffer(128);
+
+			const boost::asio::const_buffer packet = packet_factory(boost::asio::buffer(buffer), host);
+
+			packets.push_back(std::vector<uint8_t>(boost::asio::buffer_cast<const uint8_t*>(packet), boost::asio::buffer_cast<const uint8_t*>(packet) + boost::asio::buffer_size(packet)));
+		}
+
+		const freelan::router::port_type::write_handler_type handler = [] (boost::system::error_code) {};
+		size_t next = 0;
+
+		runner.run("router/async_write/" + name + "/" + boost::lexical_cast<std::string>(hosts) + "_routes", packets.front().size(), [&] () {
+			const std::vector<uint8_t>& packet = packets[next];
+
+			next = (next + 1) % packets.size();
+
+			fixture.get().async_write(fixture.source_port_index(), boost::asio::buffer(packet), handler);
+		});
+	}
+
+	void add_benchmarks(benchmark::runner& runner, size_t hosts)
+	{
+		const router_fixture fixture(hosts);
+
+		add_benchmark(runner, "ipv4", fixture, hosts, [] (boost::asio::mutable_buffer buf, uint32_t host) {
+			return benchmark::make_ipv4_udp_packet(buf, boost::asio::ip::address_v4(0x0a000001), boost::asio::ip::address_v4(make_ipv4_network(host).to_ulong() + 1), 64);
+		});
+
+		add_benchmark(runner, "ipv4_default_route", fixture, hosts, [] (boost::asio::mutable_buffer buf, uint32_t host) {
+			return benchmark::make_ipv4_udp_packet(buf, boost::asio::ip::address_v4(0x0a000001), boost::asio::ip::address_v4(0xc0a80000 + host), 64);
+		});
+
+		add_benchmark(runner, "ipv6", fixture, hosts, [] (boost::asio::mutable_buffer buf, uint32_t host) {
+			return benchmark::make_ipv6_udp_packet(buf, make_ipv6_host(0), make_ipv6_host(host), 64);
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		benchmark::runner runner(argc, argv);
+
+		for (size_t hosts : { 16, 256, 1024 })
+		{
+			add_benchmarks(runner, hosts);
+		}
+
+		return runner.report();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
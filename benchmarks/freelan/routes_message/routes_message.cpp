@@ -0,0 +1,112 @@
+/**
+ * \file routes_message.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Routes message benchmarks.
+ */
+
+#include <benchmark.hpp>
+
+#include <freelan/routes_message.hpp>
+
+#include <boost/array.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+	/**
+	 * \brief Get a set of routes, like the ones a peer would announce.
+	 * \param count The count of routes. Half of them are IPv6 routes and one quarter have a gateway.
+	 * \return The routes.
+	 */
+	asiotap::ip_route_set make_routes(size_t count)
+	{
+		asiotap::ip_route_set result;
+
+		for (uint32_t index = 0; index < count; ++index)
+		{
+			const bool has_gateway = (index % 4 == 3);
+
+			if (index % 2 == 0)
+			{
+				const boost::asio::ip::address_v4 network(0x0a000000 + (index << 8));
+
+				if (has_gateway)
+				{
+					result.insert(asiotap::to_ip_route(network, 24, boost::asio::ip::address_v4(network.to_ulong() + 1)));
+				}
+				else
+				{
+					result.insert(asiotap::to_ip_route(network, 24));
+				}
+			}
+			else
+			{
+				boost::asio::ip::address_v6::bytes_type bytes = {{ 0xfd, 0x00, 0x00, 0x00, 0x00, 0x00, static_cast<uint8_t>(index >> 8), static_cast<uint8_t>(index) }};
+				const boost::asio::ip::address_v6 network(bytes);
+
+				if (has_gateway)
+				{
+					bytes[15] = 0x01;
+
+					result.insert(asiotap::to_ip_route(network, 64, boost::asio::ip::address_v6(bytes)));
+				}
+				else
+				{
+					result.insert(asiotap::to_ip_route(network, 64));
+				}
+			}
+		}
+
+		return result;
+	}
+
+	void add_benchmarks(benchmark::runner& runner, size_t count)
+	{
+		const asiotap::ip_route_set routes = make_routes(count);
+
+		asiotap::ip_address_set dns_servers;
+		dns_servers.insert(boost::asio::ip::address_v4(0x0a000001));
+		dns_servers.insert(boost::asio::ip::address_v6::loopback());
+
+		// This is the buffer size the core uses.
+		boost::array<uint8_t, 8192> buffer;
+
+		const size_t size = freelan::routes_message::write(buffer.data(), buffer.size(), 1, routes, dns_servers);
+		const std::string suffix = "/" + boost::lexical_cast<std::string>(count) + "_routes";
+
+		runner.run("routes_message/write" + suffix, size, [&] () {
+			benchmark::do_not_optimize(freelan::routes_message::write(buffer.data(), buffer.size(), 1, routes, dns_servers));
+		});
+
+		runner.run("routes_message/read" + suffix, size, [&] () {
+			// The routes are cached by the message instance: a new one must be created every time.
+			const freelan::routes_message message(buffer.data(), size);
+
+			benchmark::do_not_optimize(message.routes().size() + message.dns_servers().size());
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		benchmark::runner runner(argc, argv);
+
+		for (size_t count : { 1, 16, 128 })
+		{
+			add_benchmarks(runner, count);
+		}
+
+		return runner.report();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,160 @@
+/**
+ * \file switch.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Switch benchmarks.
+ */
+
+#include <benchmark.hpp>
+#include <frames.hpp>
+
+#include <freelan/switch.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	const freelan::switch_::port_group_type SOURCE_GROUP = 0;
+	const freelan::switch_::port_group_type HOSTS_GROUP = 1;
+
+	const benchmark::ethernet_address_type BROADCAST_ADDRESS = {{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }};
+
+	freelan::port_index_type make_host_port_index(uint32_t index)
+	{
+		return freelan::make_port_index(fscp::server::ep_type(boost::asio::ip::address_v4(0x0a000000 + index), 12000));
+	}
+
+	/**
+	 * \brief A switch with a source port and a given count of hosts, whose addresses were all learnt already.
+	 */
+	class switch_fixture
+	{
+		public:
+
+			switch_fixture(size_t hosts, freelan::switch_configuration::routing_method_type routing_method) :
+				m_configuration(make_configuration(hosts, routing_method)),
+				m_switch(m_configuration),
+				m_source_port_index(make_host_port_index(0))
+			{
+				const freelan::switch_::port_type::write_function_type write_function = [] (boost::asio::const_buffer, freelan::switch_::port_type::write_handler_type handler) {
+					handler(boost::system::error_code());
+				};
+
+				m_switch.register_port(m_source_port_index, freelan::switch_::port_type(write_function, SOURCE_GROUP));
+
+				boost::array<uint8_t, 128> buffer;
+				const freelan::switch_::multi_write_handler_type handler = [] (const boost::system::error_code&) {};
+
+				for (uint32_t host = 1; host <= hosts; ++host)
+				{
+					const freelan::port_index_type port_index = make_host_port_index(host);
+
+					m_switch.register_port(port_index, freelan::switch_::port_type(write_function, HOSTS_GROUP));
+
+					// Every host says hello once, so that the switch learns its address.
+					const boost::asio::mutable_buffer packet = benchmark::make_ipv4_udp_packet(boost::asio::buffer(buffer), boost::asio::ip::address_v4(0x0a000000 + host), boost::asio::ip::address_v4(0x0a000000), 0);
+					const boost::asio::const_buffer frame = benchmark::make_ethernet_frame(boost::asio::buffer(buffer), benchmark::make_ethernet_address(0), benchmark::make_ethernet_address(host), asiotap::osi::IP_PROTOCOL, boost::asio::buffer_size(packet));
+
+					m_switch.async_write(port_index, frame, handler);
+				}
+			}
+
+			freelan::switch_& get() { return m_switch; }
+			const freelan::port_index_type& source_port_index() const { return m_source_port_index; }
+
+		private:
+
+			static freelan::switch_configuration make_configuration(size_t hosts, freelan::switch_configuration::routing_method_type routing_method)
+			{
+				freelan::switch_configuration configuration;
+
+				configuration.routing_method = routing_method;
+				configuration.max_entries = 2 * (hosts + 1);
+
+				return configuration;
+			}
+
+			freelan::switch_configuration m_configuration;
+			freelan::switch_ m_switch;
+			freelan::port_index_type m_source_port_index;
+	};
+
+	void add_unicast_benchmark(benchmark::runner& runner, size_t hosts, size_t payload_size)
+	{
+		switch_fixture fixture(hosts, freelan::switch_configuration::RM_SWITCH);
+
+		// The frames go to every host in turn, so that the accesses to the address table are spread.
+		std::vector<std::vector<uint8_t> > frames;
+
+		for (uint32_t host = 1; host <= hosts; ++host)
+		{
+			std::vector<uint8_t> buffer(payload_size + 64);
+
+			const boost::asio::mutable_buffer packet = benchmark::make_ipv4_udp_packet(boost::asio::buffer(buffer), boost::asio::ip::address_v4(0x0a000000), boost::asio::ip::address_v4(0x0a000000 + host), payload_size);
+			const boost::asio::const_buffer frame = benchmark::make_ethernet_frame(boost::asio::buffer(buffer), benchmark::make_ethernet_address(host), benchmark::make_ethernet_address(0), asiotap::osi::IP_PROTOCOL, boost::asio::buffer_size(packet));
+
+			frames.push_back(std::vector<uint8_t>(boost::asio::buffer_cast<const uint8_t*>(frame), boost::asio::buffer_cast<const uint8_t*>(frame) + boost::asio::buffer_size(frame)));
+		}
+
+		const freelan::switch_::multi_write_handler_type handler = [] (const boost::system::error_code&) {};
+		size_t next = 0;
+
+		runner.run("switch/async_write/unicast/" + boost::lexical_cast<std::string>(hosts) + "_hosts/" + boost::lexical_cast<std::string>(payload_size), frames.front().size(), [&] () {
+			const std::vector<uint8_t>& frame = frames[next];
+
+			next = (next + 1) % frames.size();
+
+			fixture.get().async_write(fixture.source_port_index(), boost::asio::buffer(frame), handler);
+		});
+	}
+
+	void add_flood_benchmark(benchmark::runner& runner, size_t hosts, freelan::switch_configuration::routing_method_type routing_method)
+	{
+		switch_fixture fixture(hosts, routing_method);
+
+		boost::array<uint8_t, 1500> buffer;
+
+		const boost::asio::mutable_buffer packet = benchmark::make_ipv4_udp_packet(boost::asio::buffer(buffer), boost::asio::ip::address_v4(0x0a000000), boost::asio::ip::address_v4::broadcast(), 1400);
+		const boost::asio::const_buffer frame = benchmark::make_ethernet_frame(boost::asio::buffer(buffer), BROADCAST_ADDRESS, benchmark::make_ethernet_address(0), asiotap::osi::IP_PROTOCOL, boost::asio::buffer_size(packet));
+
+		const freelan::switch_::multi_write_handler_type handler = [] (const boost::system::error_code&) {};
+		const std::string name = (routing_method == freelan::switch_configuration::RM_HUB) ? "hub" : "broadcast";
+
+		runner.run("switch/async_write/" + name + "/" + boost::lexical_cast<std::string>(hosts) + "_hosts", boost::asio::buffer_size(frame), [&] () {
+			fixture.get().async_write(fixture.source_port_index(), frame, handler);
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		benchmark::runner runner(argc, argv);
+
+		for (size_t hosts : { 16, 256, 1024 })
+		{
+			for (size_t payload_size : { 64, 1400 })
+			{
+				add_unicast_benchmark(runner, hosts, payload_size);
+			}
+		}
+
+		for (size_t hosts : { 4, 16, 64 })
+		{
+			add_flood_benchmark(runner, hosts, freelan::switch_configuration::RM_SWITCH);
+			add_flood_benchmark(runner, hosts, freelan::switch_configuration::RM_HUB);
+		}
+
+		return runner.report();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
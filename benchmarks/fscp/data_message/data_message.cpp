@@ -0,0 +1,91 @@
+/**
+ * \file data_message.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Data message benchmarks.
+ */
+
+#include <benchmark.hpp>
+
+#include <fscp/data_message.hpp>
+
+#include <cryptoplus/cryptoplus.hpp>
+#include <cryptoplus/random/random.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	void add_benchmarks(benchmark::runner& runner, fscp::cipher_suite_type cipher_suite, size_t payload_size)
+	{
+		using cryptoplus::buffer_cast;
+		using cryptoplus::buffer_size;
+
+		const fscp::data_message::calg_t cipher_algorithm = cipher_suite.to_cipher_algorithm();
+		const cryptoplus::buffer key = cryptoplus::random::get_random_bytes(cipher_algorithm.key_length());
+		const cryptoplus::buffer nonce_prefix = cryptoplus::random::get_random_bytes(fscp::DEFAULT_NONCE_PREFIX_SIZE);
+
+		// This is how the peer sessions initialize their cipher contexts.
+		fscp::data_message::cctx_t encrypt_context;
+		fscp::data_message::cctx_t decrypt_context;
+		fscp::data_message::initialize_cipher_context(encrypt_context, cipher_algorithm, fscp::data_message::cctx_t::encrypt, buffer_cast<const void*>(key), buffer_size(key), buffer_size(nonce_prefix));
+		fscp::data_message::initialize_cipher_context(decrypt_context, cipher_algorithm, fscp::data_message::cctx_t::decrypt, buffer_cast<const void*>(key), buffer_size(key), buffer_size(nonce_prefix));
+
+		const std::vector<uint8_t> cleartext(payload_size, 0x42);
+		std::vector<uint8_t> message_buffer(fscp::data_message::get_write_buffer_size(payload_size));
+		std::vector<uint8_t> cleartext_buffer(payload_size);
+		fscp::sequence_number_type sequence_number = 0;
+
+		const std::string suffix = "/" + cipher_suite.to_string() + "/" + boost::lexical_cast<std::string>(payload_size);
+
+		runner.run("data_message/write" + suffix, payload_size, [&] () {
+			benchmark::do_not_optimize(fscp::data_message::write(message_buffer.data(), message_buffer.size(), fscp::CHANNEL_NUMBER_0, ++sequence_number, encrypt_context, cleartext.data(), cleartext.size(), buffer_cast<const void*>(nonce_prefix), buffer_size(nonce_prefix)));
+		});
+
+		// The key schedule is computed for every message: this is what the cipher contexts save.
+		runner.run("data_message/write_with_key" + suffix, payload_size, [&] () {
+			benchmark::do_not_optimize(fscp::data_message::write(message_buffer.data(), message_buffer.size(), fscp::CHANNEL_NUMBER_0, ++sequence_number, cipher_algorithm, cleartext.data(), cleartext.size(), buffer_cast<const void*>(key), buffer_size(key), buffer_cast<const void*>(nonce_prefix), buffer_size(nonce_prefix)));
+		});
+
+		const size_t message_size = fscp::data_message::write(message_buffer.data(), message_buffer.size(), fscp::CHANNEL_NUMBER_0, ++sequence_number, encrypt_context, cleartext.data(), cleartext.size(), buffer_cast<const void*>(nonce_prefix), buffer_size(nonce_prefix));
+		const fscp::data_message message(message_buffer.data(), message_size);
+
+		runner.run("data_message/get_cleartext" + suffix, payload_size, [&] () {
+			benchmark::do_not_optimize(message.get_cleartext(cleartext_buffer.data(), cleartext_buffer.size(), decrypt_context, buffer_cast<const void*>(nonce_prefix), buffer_size(nonce_prefix)));
+		});
+
+		runner.run("data_message/get_cleartext_with_key" + suffix, payload_size, [&] () {
+			benchmark::do_not_optimize(message.get_cleartext(cleartext_buffer.data(), cleartext_buffer.size(), cipher_algorithm, buffer_cast<const void*>(key), buffer_size(key), buffer_cast<const void*>(nonce_prefix), buffer_size(nonce_prefix)));
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	cryptoplus::crypto_initializer crypto_initializer;
+	cryptoplus::algorithms_initializer algorithms_initializer;
+
+	try
+	{
+		benchmark::runner runner(argc, argv);
+
+		for (fscp::cipher_suite_type cipher_suite : { fscp::cipher_suite_type::ecdhe_rsa_aes128_gcm_sha256, fscp::cipher_suite_type::ecdhe_rsa_aes256_gcm_sha384 })
+		{
+			for (size_t payload_size : { 64, 512, 1400, 8192 })
+			{
+				add_benchmarks(runner, cipher_suite, payload_size);
+			}
+		}
+
+		return runner.report();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,89 @@
+/**
+ * \file endpoint_map.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Peer table lookup benchmarks.
+ */
+
+#include <benchmark.hpp>
+
+#include <fscp/endpoint_map.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace
+{
+	typedef boost::asio::ip::udp::endpoint ep_type;
+
+	std::vector<ep_type> generate_endpoints(size_t count)
+	{
+		std::mt19937 rng(42);
+		std::vector<ep_type> result;
+		result.reserve(count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			// Most peers share the default port, as in a real network.
+			result.push_back(ep_type(boost::asio::ip::address_v4(static_cast<unsigned long>(0x0a000000 + (rng() & 0x00ffffff))), 12000));
+		}
+
+		return result;
+	}
+
+	template <typename MapType>
+	void add_lookup_benchmark(benchmark::runner& runner, const std::string& name, const std::vector<ep_type>& endpoints)
+	{
+		MapType map;
+
+		for (const ep_type& endpoint : endpoints)
+		{
+			map[endpoint] = 1;
+		}
+
+		// The lookups follow the arrival order of the packets, which is unrelated to the insertion order.
+		std::vector<ep_type> lookups(endpoints);
+		std::shuffle(lookups.begin(), lookups.end(), std::mt19937(7));
+
+		size_t index = 0;
+
+		runner.run("endpoint_map/find/" + name + "/" + boost::lexical_cast<std::string>(endpoints.size()) + "_peers", 0, [&] () {
+			benchmark::do_not_optimize(map.find(lookups[index])->second);
+
+			if (++index == lookups.size())
+			{
+				index = 0;
+			}
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		benchmark::runner runner(argc, argv);
+
+		for (size_t peers : { 16, 1024, 10000, 100000 })
+		{
+			const std::vector<ep_type> endpoints = generate_endpoints(peers);
+
+			add_lookup_benchmark<std::map<ep_type, int> >(runner, "std_map", endpoints);
+			add_lookup_benchmark<fscp::endpoint_map<int> >(runner, "endpoint_map", endpoints);
+		}
+
+		return runner.report();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
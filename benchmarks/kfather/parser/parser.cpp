@@ -0,0 +1,112 @@
+/**
+ * \file parser.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief JSON parser benchmarks.
+ */
+
+#include <benchmark.hpp>
+
+#include <kfather/kfather.hpp>
+#include <kfather/parser.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+	/**
+	 * \brief Get a document that looks like a server response: a small object with a few nested values.
+	 * \return The document.
+	 */
+	std::string make_small_object()
+	{
+		return "{\"name\": \"alice\", \"public_endpoint\": \"192.168.0.1:12000\", \"registered\": true, \"expiration\": 1420070400, \"networks\": {\"ipv4\": \"9.0.0.0/24\", \"ipv6\": \"2aa1::/8\"}, \"users\": null}";
+	}
+
+	/**
+	 * \brief Get an array of numbers.
+	 * \param count The count of numbers.
+	 * \return The document.
+	 */
+	std::string make_number_array(size_t count)
+	{
+		std::ostringstream oss;
+
+		oss << "[";
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			oss << (i ? ", " : "") << (i * 1.25 - 100);
+		}
+
+		oss << "]";
+
+		return oss.str();
+	}
+
+	/**
+	 * \brief Get an object of strings, some of which contain escape sequences.
+	 * \param count The count of members.
+	 * \return The document.
+	 */
+	std::string make_string_object(size_t count)
+	{
+		std::ostringstream oss;
+
+		oss << "{";
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			oss << (i ? ", " : "") << "\"key" << i << "\": \"" << ((i % 4 == 0) ? "line\\nwith \\\"escapes\\\" and \\u00e9" : "a plain string value") << "\"";
+		}
+
+		oss << "}";
+
+		return oss.str();
+	}
+
+	void add_benchmark(benchmark::runner& runner, const std::string& name, const std::string& document)
+	{
+		json::parser parser;
+		json::value_type value;
+
+		if (!parser.parse(value, document.data(), document.size()))
+		{
+			throw std::runtime_error("Invalid document: " + name);
+		}
+
+		runner.run("parser/" + name, document.size(), [&] () {
+			json::value_type result;
+
+			benchmark::do_not_optimize(parser.parse(result, document.data(), document.size()));
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		benchmark::runner runner(argc, argv);
+
+		add_benchmark(runner, "small_object", make_small_object());
+
+		for (size_t count : { 16, 1024 })
+		{
+			add_benchmark(runner, "number_array/" + boost::lexical_cast<std::string>(count), make_number_array(count));
+			add_benchmark(runner, "string_object/" + boost::lexical_cast<std::string>(count), make_string_object(count));
+		}
+
+		return runner.report();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
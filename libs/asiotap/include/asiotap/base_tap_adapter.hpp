@@ -47,8 +47,12 @@
 
 #include <boost/asio.hpp>
 #include <boost/system/system_error.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/ref.hpp>
 
 #include <iostream>
+#include <vector>
 
 #include "osi/ethernet_address.hpp"
 #include "tap_adapter_layer.hpp"
@@ -103,6 +107,54 @@ namespace asiotap
 				m_descriptor.async_write_some(buffers, handler);
 			}
 
+			/**
+			 * \brief Read some data from a queue of the tap adapter.
+			 * \param queue The index of the queue. Must be lower than queues_count().
+			 * \param buffers The buffers into which the data will be read.
+			 * \param handler The handler to be called when the read operation completes.
+			 */
+			template <typename MutableBufferSequence, typename ReadHandler>
+			void async_read(size_t queue, const MutableBufferSequence& buffers, ReadHandler handler)
+			{
+				queue_descriptor(queue).async_read_some(buffers, handler);
+			}
+
+			/**
+			 * \brief Write some data to a queue of the tap adapter.
+			 * \param queue The index of the queue. Must be lower than queues_count().
+			 * \param buffers One or more buffers to be written to the tap adapter.
+			 * \param handler The handler to be called when the write operation completes.
+			 */
+			template <typename ConstBufferSequence, typename WriteHandler>
+			void async_write(size_t queue, const ConstBufferSequence& buffers, WriteHandler handler)
+			{
+				queue_descriptor(queue).async_write_some(buffers, handler);
+			}
+
+			/**
+			 * \brief Write a frame to a queue of the tap adapter.
+			 * \param queue The index of the queue. Must be lower than queues_count().
+			 * \param buffers One or more buffers that form the frame.
+			 * \param ec The error code. If the descriptors are in non-blocking mode and the frame cannot be written right away, it is set to boost::asio::error::would_block.
+			 * \return The number of bytes written.
+			 */
+			template <typename ConstBufferSequence>
+			size_t write(size_t queue, const ConstBufferSequence& buffers, boost::system::error_code& ec)
+			{
+				return queue_descriptor(queue).write_some(buffers, ec);
+			}
+
+			/**
+			 * \brief Wait until a queue of the tap adapter can be written to.
+			 * \param queue The index of the queue. Must be lower than queues_count().
+			 * \param handler The handler to be called when the queue is writable.
+			 */
+			template <typename WaitHandler>
+			void async_wait_write(size_t queue, WaitHandler handler)
+			{
+				queue_descriptor(queue).async_write_some(boost::asio::null_buffers(), handler);
+			}
+
 			/**
 			 * \brief Read some data from the tap adapter.
 			 * \param buffers The buffers into which the data will be read.
@@ -155,6 +207,11 @@ namespace asiotap
 			void cancel()
 			{
 				m_descriptor.cancel();
+
+				for (auto&& queue : m_queue_descriptors)
+				{
+					queue->cancel();
+				}
 			}
 
 			/**
@@ -164,6 +221,16 @@ namespace asiotap
 			void cancel(boost::system::error_code& ec)
 			{
 				m_descriptor.cancel(ec);
+
+				for (auto&& queue : m_queue_descriptors)
+				{
+					if (ec)
+					{
+						break;
+					}
+
+					queue->cancel(ec);
+				}
 			}
 
 			/**
@@ -211,6 +278,46 @@ namespace asiotap
 				return m_ethernet_address;
 			}
 
+			/**
+			 * \brief Set the number of queues to open.
+			 * \param count The number of queues. Values lower than 1 are treated as 1.
+			 *
+			 * This must be called before the tap adapter is opened. Only the platforms that support multi-queue adapters take it into account: the other ones always open a single queue.
+			 */
+			void set_queues_count(size_t count)
+			{
+				m_requested_queues_count = (count > 0) ? count : 1;
+			}
+
+			/**
+			 * \brief Get the number of opened queues.
+			 * \return The number of opened queues. Each queue can be read from and written to independently.
+			 */
+			size_t queues_count() const
+			{
+				return 1 + m_queue_descriptors.size();
+			}
+
+			/**
+			 * \brief Request segmentation and checksum offloading.
+			 * \param enabled Whether to request offloading.
+			 *
+			 * This must be called before the tap adapter is opened. Only the platforms that support virtio headers take it into account.
+			 */
+			void set_offload_requested(bool enabled)
+			{
+				m_offload_requested = enabled;
+			}
+
+			/**
+			 * \brief Check whether offloading is enabled.
+			 * \return true if offloading is enabled. In that case, every frame read from or written to the tap adapter is preceded by an osi::virtio_net_header and the frames read can be GSO frames or lack their transport checksum.
+			 */
+			bool is_offload_enabled() const
+			{
+				return m_offload_enabled;
+			}
+
 			/**
 			 * \brief Get the tap adapter current state.
 			 * \return true if the tap adapter is open.
@@ -225,6 +332,8 @@ namespace asiotap
 			 */
 			void close()
 			{
+				m_queue_descriptors.clear();
+				m_offload_enabled = false;
 				m_descriptor.close();
 			}
 
@@ -234,6 +343,9 @@ namespace asiotap
 			 */
 			boost::system::error_code close(boost::system::error_code& ec)
 			{
+				m_queue_descriptors.clear();
+				m_offload_enabled = false;
+
 				return m_descriptor.close(ec);
 			}
 
@@ -241,6 +353,10 @@ namespace asiotap
 
 			base_tap_adapter(boost::asio::io_service& _io_service, tap_adapter_layer _layer) :
 				m_descriptor(_io_service),
+				m_queue_descriptors(),
+				m_requested_queues_count(1),
+				m_offload_requested(false),
+				m_offload_enabled(false),
 				m_layer(_layer),
 				m_name(),
 				m_mtu(),
@@ -252,6 +368,38 @@ namespace asiotap
 				return m_descriptor;
 			}
 
+			descriptor_type& queue_descriptor(size_t queue)
+			{
+				return (queue == 0) ? m_descriptor : *m_queue_descriptors[queue - 1];
+			}
+
+			size_t requested_queues_count() const
+			{
+				return m_requested_queues_count;
+			}
+
+			bool is_offload_requested() const
+			{
+				return m_offload_requested;
+			}
+
+			void set_offload_enabled(bool enabled)
+			{
+				m_offload_enabled = enabled;
+			}
+
+			boost::system::error_code add_queue_descriptor(typename descriptor_type::native_handle_type handle, boost::system::error_code& ec)
+			{
+				const boost::shared_ptr<descriptor_type> queue = boost::make_shared<descriptor_type>(boost::ref(m_descriptor.get_io_service()));
+
+				if (!queue->assign(handle, ec))
+				{
+					m_queue_descriptors.push_back(queue);
+				}
+
+				return ec;
+			}
+
 			void set_name(const std::string& _name)
 			{
 				m_name = _name;
@@ -270,6 +418,10 @@ namespace asiotap
 		private:
 
 			descriptor_type m_descriptor;
+			std::vector<boost::shared_ptr<descriptor_type> > m_queue_descriptors;
+			size_t m_requested_queues_count;
+			bool m_offload_requested;
+			bool m_offload_enabled;
 			tap_adapter_layer m_layer;
 			std::string m_name;
 			size_t m_mtu;
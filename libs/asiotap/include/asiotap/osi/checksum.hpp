@@ -47,7 +47,7 @@
 
 #include <boost/asio.hpp>
 
-#include "osi/checksum_helper.hpp"
+#include "checksum_helper.hpp"
 
 namespace asiotap
 {
@@ -61,6 +61,29 @@ namespace asiotap
 		 */
 		uint16_t compute_checksum(const uint16_t* buf, size_t buf_len);
 
+		/**
+		 * \brief Update a checksum after a 16-bit word of the checksummed data changed, as described in RFC 1624.
+		 * \param checksum The checksum, as stored in the frame.
+		 * \param old_value The previous value of the word, as stored in the frame.
+		 * \param new_value The new value of the word, as stored in the frame.
+		 * \param odd_offset Whether the word starts at an odd offset from the beginning of the checksummed data.
+		 * \return The updated checksum.
+		 *
+		 * This is much cheaper than computing the checksum again when only a few fields of a frame are rewritten.
+		 */
+		uint16_t update_checksum(uint16_t checksum, uint16_t old_value, uint16_t new_value, bool odd_offset = false);
+
+		/**
+		 * \brief Update a checksum after a 32-bit field of the checksummed data changed, as described in RFC 1624.
+		 * \param checksum The checksum, as stored in the frame.
+		 * \param old_value The previous value of the field, as stored in the frame.
+		 * \param new_value The new value of the field, as stored in the frame.
+		 * \return The updated checksum.
+		 *
+		 * The field must start at an even offset from the beginning of the checksummed data.
+		 */
+		uint16_t update_checksum(uint16_t checksum, uint32_t old_value, uint32_t new_value);
+
 		inline uint16_t compute_checksum(const uint16_t* buf, size_t buf_len)
 		{
 			checksum_helper helper;
@@ -69,6 +92,32 @@ namespace asiotap
 
 			return helper.compute();
 		}
+
+		inline uint16_t update_checksum(uint16_t checksum, uint16_t old_value, uint16_t new_value, bool odd_offset)
+		{
+			if (odd_offset)
+			{
+				// A word that straddles two aligned words contributes with its bytes swapped.
+				old_value = static_cast<uint16_t>((old_value << 8) | (old_value >> 8));
+				new_value = static_cast<uint16_t>((new_value << 8) | (new_value >> 8));
+			}
+
+			// HC' = ~(~HC + ~m + m')
+			uint32_t sum = static_cast<uint16_t>(~checksum);
+			sum += static_cast<uint16_t>(~old_value);
+			sum += new_value;
+			sum = (sum & 0xFFFF) + (sum >> 16);
+			sum = (sum & 0xFFFF) + (sum >> 16);
+
+			return static_cast<uint16_t>(~sum);
+		}
+
+		inline uint16_t update_checksum(uint16_t checksum, uint32_t old_value, uint32_t new_value)
+		{
+			checksum = update_checksum(checksum, static_cast<uint16_t>(old_value), static_cast<uint16_t>(new_value));
+
+			return update_checksum(checksum, static_cast<uint16_t>(old_value >> 16), static_cast<uint16_t>(new_value >> 16));
+		}
 	}
 }
 
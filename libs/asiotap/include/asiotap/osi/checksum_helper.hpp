@@ -53,6 +53,10 @@ namespace asiotap
 	{
 		/**
 		 * \brief A checksum helper class.
+		 *
+		 * Computes the Internet checksum (RFC 1071) of data that may be provided in several chunks, of any size and alignment.
+		 *
+		 * The data is summed as native 16-bit words in a 64-bit accumulator, using SSE2 or AVX2 when the processor supports it. The result must therefore be stored as is, without any byte order conversion.
 		 */
 		class checksum_helper
 		{
@@ -78,13 +82,15 @@ namespace asiotap
 
 			private:
 
-				uint32_t m_checksum;
+				uint64_t m_checksum;
 				uint8_t m_left;
+				bool m_has_left;
 		};
 
 		inline checksum_helper::checksum_helper() :
 			m_checksum(0),
-			m_left(0)
+			m_left(0),
+			m_has_left(false)
 		{
 		}
 	}
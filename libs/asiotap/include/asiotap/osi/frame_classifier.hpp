@@ -0,0 +1,390 @@
+/*
+ * libasiotap - A portable TAP adapter extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libasiotap.
+ *
+ * libasiotap is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libasiotap is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libasiotap in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file frame_classifier.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A static frame classifier.
+ */
+
+#pragma once
+
+#include "ethernet_filter.hpp"
+#include "arp_filter.hpp"
+#include "ipv4_filter.hpp"
+#include "ipv6_filter.hpp"
+#include "udp_filter.hpp"
+#include "tcp_filter.hpp"
+#include "bootp_filter.hpp"
+#include "dhcp_filter.hpp"
+#include "icmpv6_filter.hpp"
+
+namespace asiotap
+{
+	namespace osi
+	{
+		/**
+		 * \brief The result of a frame classification.
+		 */
+		enum class classification_status
+		{
+			consumed, /**< \brief A handler consumed the frame: it must not be forwarded. */
+			passed, /**< \brief The frame must be forwarded. */
+			truncated, /**< \brief The frame is shorter than one of its headers. */
+			malformed /**< \brief One of the frame headers is invalid. */
+		};
+
+		/**
+		 * \brief The default frame classifier handler.
+		 *
+		 * Handlers given to classify_ethernet_frame() and classify_ip_frame() are bound statically: they only need to redefine the methods they are interested in, which hides the corresponding ones of this class.
+		 */
+		struct frame_classifier_handler
+		{
+			/**
+			 * \brief Handle an ARP frame.
+			 * \param ethernet_helper The Ethernet helper.
+			 * \param arp_helper The ARP helper.
+			 * \return true if the frame was consumed.
+			 */
+			bool handle_arp(const_helper<ethernet_frame> ethernet_helper, const_helper<arp_frame> arp_helper)
+			{
+				static_cast<void>(ethernet_helper);
+				static_cast<void>(arp_helper);
+
+				return false;
+			}
+
+			/**
+			 * \brief Handle a DHCP frame.
+			 * \param ethernet_helper The Ethernet helper.
+			 * \param ipv4_helper The IPv4 helper.
+			 * \param udp_helper The UDP helper.
+			 * \param bootp_helper The BOOTP helper.
+			 * \param dhcp_helper The DHCP helper.
+			 * \return true if the frame was consumed.
+			 */
+			bool handle_dhcp(const_helper<ethernet_frame> ethernet_helper, const_helper<ipv4_frame> ipv4_helper, const_helper<udp_frame> udp_helper, const_helper<bootp_frame> bootp_helper, const_helper<dhcp_frame> dhcp_helper)
+			{
+				static_cast<void>(ethernet_helper);
+				static_cast<void>(ipv4_helper);
+				static_cast<void>(udp_helper);
+				static_cast<void>(bootp_helper);
+				static_cast<void>(dhcp_helper);
+
+				return false;
+			}
+
+			/**
+			 * \brief Handle an ICMPv6 frame.
+			 * \param ipv6_helper The IPv6 helper.
+			 * \param icmpv6_helper The ICMPv6 helper.
+			 * \return true if the frame was consumed.
+			 */
+			bool handle_icmpv6(const_helper<ipv6_frame> ipv6_helper, const_helper<icmpv6_frame> icmpv6_helper)
+			{
+				static_cast<void>(ipv6_helper);
+				static_cast<void>(icmpv6_helper);
+
+				return false;
+			}
+
+			/**
+			 * \brief Handle a TCP SYN frame.
+			 * \param ipv4_helper The IPv4 helper.
+			 * \param tcp_helper The TCP helper. It may be modified in place.
+			 */
+			void handle_tcp_syn(const_helper<ipv4_frame> ipv4_helper, mutable_helper<tcp_frame> tcp_helper)
+			{
+				static_cast<void>(ipv4_helper);
+				static_cast<void>(tcp_helper);
+			}
+
+			/**
+			 * \brief Handle a TCP SYN frame.
+			 * \param ipv6_helper The IPv6 helper.
+			 * \param tcp_helper The TCP helper. It may be modified in place.
+			 */
+			void handle_tcp_syn(const_helper<ipv6_frame> ipv6_helper, mutable_helper<tcp_frame> tcp_helper)
+			{
+				static_cast<void>(ipv6_helper);
+				static_cast<void>(tcp_helper);
+			}
+		};
+
+		/**
+		 * \brief Classify an Ethernet frame.
+		 * \param buf The frame.
+		 * \param handler The handler. See frame_classifier_handler.
+		 * \return The classification status.
+		 *
+		 * The frame goes through the Ethernet, ARP, IPv4, IPv6, UDP, TCP, BOOTP, DHCP and ICMPv6 layers. Every header is bounds-checked before it is accessed and nothing is ever thrown or allocated: a frame that cannot be parsed is reported through the returned status.
+		 *
+		 * The function keeps no state, so it can be called concurrently.
+		 */
+		template <typename Handler>
+		classification_status classify_ethernet_frame(boost::asio::mutable_buffer buf, Handler& handler);
+
+		/**
+		 * \brief Classify an IP frame, as read from a TUN adapter.
+		 * \param buf The frame.
+		 * \param handler The handler. See frame_classifier_handler.
+		 * \return The classification status.
+		 *
+		 * The IP version is read from the first byte of the frame. See classify_ethernet_frame() for details.
+		 */
+		template <typename Handler>
+		classification_status classify_ip_frame(boost::asio::mutable_buffer buf, Handler& handler);
+
+		/**
+		 * \brief Check that a buffer is large enough to hold a frame header.
+		 * \param buf The buffer.
+		 * \return true if buf can be given to a helper for OSIFrameType.
+		 */
+		template <typename OSIFrameType>
+		inline bool _fits(boost::asio::const_buffer buf)
+		{
+			return (boost::asio::buffer_size(buf) >= sizeof(OSIFrameType));
+		}
+
+		template <typename Handler>
+		inline classification_status _classify_tcp(boost::asio::mutable_buffer buf, Handler& handler, const_helper<ipv4_frame> parent)
+		{
+			if (!_fits<tcp_frame>(buf))
+			{
+				return classification_status::truncated;
+			}
+
+			const mutable_helper<tcp_frame> tcp_helper(buf);
+
+			if (tcp_helper.syn_flag())
+			{
+				handler.handle_tcp_syn(parent, tcp_helper);
+			}
+
+			return classification_status::passed;
+		}
+
+		template <typename Handler>
+		inline classification_status _classify_tcp(boost::asio::mutable_buffer buf, Handler& handler, const_helper<ipv6_frame> parent)
+		{
+			if (!_fits<tcp_frame>(buf))
+			{
+				return classification_status::truncated;
+			}
+
+			const mutable_helper<tcp_frame> tcp_helper(buf);
+
+			if (tcp_helper.syn_flag())
+			{
+				handler.handle_tcp_syn(parent, tcp_helper);
+			}
+
+			return classification_status::passed;
+		}
+
+		template <typename Handler>
+		inline classification_status _classify_dhcp(Handler& handler, const_helper<ethernet_frame> ethernet_helper, const_helper<ipv4_frame> ipv4_helper)
+		{
+			const boost::asio::const_buffer udp_buf = ipv4_helper.payload();
+
+			if (!_fits<udp_frame>(udp_buf))
+			{
+				return classification_status::truncated;
+			}
+
+			const const_helper<udp_frame> udp_helper(udp_buf);
+
+			if (!frame_parent_match<bootp_frame>(udp_helper))
+			{
+				return classification_status::passed;
+			}
+
+			if (!_fits<bootp_frame>(udp_helper.payload()))
+			{
+				return classification_status::truncated;
+			}
+
+			const const_helper<bootp_frame> bootp_helper(udp_helper.payload());
+
+			if (!frame_parent_match<dhcp_frame>(bootp_helper))
+			{
+				return classification_status::passed;
+			}
+
+			if (!_fits<dhcp_frame>(bootp_helper.payload()))
+			{
+				return classification_status::truncated;
+			}
+
+			const const_helper<dhcp_frame> dhcp_helper(bootp_helper.payload());
+
+			if (!check_frame(dhcp_helper))
+			{
+				return classification_status::malformed;
+			}
+
+			return handler.handle_dhcp(ethernet_helper, ipv4_helper, udp_helper, bootp_helper, dhcp_helper) ? classification_status::consumed : classification_status::passed;
+		}
+
+		template <typename Handler>
+		inline classification_status _classify_ipv4(boost::asio::mutable_buffer buf, Handler& handler, const const_helper<ethernet_frame>* ethernet_helper)
+		{
+			if (!_fits<ipv4_frame>(buf))
+			{
+				return classification_status::truncated;
+			}
+
+			const mutable_helper<ipv4_frame> ipv4_helper(buf);
+
+			if (!check_frame(ipv4_helper) || (ipv4_helper.header_length() > boost::asio::buffer_size(buf)))
+			{
+				return classification_status::malformed;
+			}
+
+			if (frame_parent_match<tcp_frame>(ipv4_helper))
+			{
+				return _classify_tcp(ipv4_helper.payload(), handler, const_helper<ipv4_frame>(ipv4_helper));
+			}
+
+			// DHCP only makes sense on Ethernet.
+			if (ethernet_helper && frame_parent_match<udp_frame>(ipv4_helper))
+			{
+				return _classify_dhcp(handler, *ethernet_helper, const_helper<ipv4_frame>(ipv4_helper));
+			}
+
+			return classification_status::passed;
+		}
+
+		template <typename Handler>
+		inline classification_status _classify_ipv6(boost::asio::mutable_buffer buf, Handler& handler)
+		{
+			if (!_fits<ipv6_frame>(buf))
+			{
+				return classification_status::truncated;
+			}
+
+			const mutable_helper<ipv6_frame> ipv6_helper(buf);
+
+			if (!check_frame(ipv6_helper))
+			{
+				return classification_status::malformed;
+			}
+
+			if (frame_parent_match<tcp_frame>(ipv6_helper))
+			{
+				return _classify_tcp(ipv6_helper.payload(), handler, const_helper<ipv6_frame>(ipv6_helper));
+			}
+
+			if (frame_parent_match<icmpv6_frame>(ipv6_helper))
+			{
+				const boost::asio::const_buffer icmpv6_buf = ipv6_helper.payload();
+
+				if (!_fits<icmpv6_frame>(icmpv6_buf))
+				{
+					return classification_status::truncated;
+				}
+
+				return handler.handle_icmpv6(const_helper<ipv6_frame>(ipv6_helper), const_helper<icmpv6_frame>(icmpv6_buf)) ? classification_status::consumed : classification_status::passed;
+			}
+
+			return classification_status::passed;
+		}
+
+		template <typename Handler>
+		inline classification_status classify_ethernet_frame(boost::asio::mutable_buffer buf, Handler& handler)
+		{
+			if (!_fits<ethernet_frame>(buf))
+			{
+				return classification_status::truncated;
+			}
+
+			const const_helper<ethernet_frame> ethernet_helper(buf);
+
+			if (frame_parent_match<ipv4_frame>(ethernet_helper))
+			{
+				return _classify_ipv4(buf + sizeof(ethernet_frame), handler, &ethernet_helper);
+			}
+
+			if (frame_parent_match<ipv6_frame>(ethernet_helper))
+			{
+				return _classify_ipv6(buf + sizeof(ethernet_frame), handler);
+			}
+
+			if (frame_parent_match<arp_frame>(ethernet_helper))
+			{
+				const boost::asio::const_buffer arp_buf = ethernet_helper.payload();
+
+				if (!_fits<arp_frame>(arp_buf))
+				{
+					return classification_status::truncated;
+				}
+
+				const const_helper<arp_frame> arp_helper(arp_buf);
+
+				if (!check_frame(arp_helper))
+				{
+					return classification_status::malformed;
+				}
+
+				return handler.handle_arp(ethernet_helper, arp_helper) ? classification_status::consumed : classification_status::passed;
+			}
+
+			return classification_status::passed;
+		}
+
+		template <typename Handler>
+		inline classification_status classify_ip_frame(boost::asio::mutable_buffer buf, Handler& handler)
+		{
+			if (boost::asio::buffer_size(buf) == 0)
+			{
+				return classification_status::truncated;
+			}
+
+			switch (boost::asio::buffer_cast<const uint8_t*>(buf)[0] >> 4)
+			{
+				case IP_PROTOCOL_VERSION_4:
+					return _classify_ipv4(buf, handler, static_cast<const const_helper<ethernet_frame>*>(NULL));
+				case IP_PROTOCOL_VERSION_6:
+					return _classify_ipv6(buf, handler);
+				default:
+					return classification_status::malformed;
+			}
+		}
+	}
+}
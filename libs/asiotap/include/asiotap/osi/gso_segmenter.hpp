@@ -0,0 +1,194 @@
+/*
+ * libasiotap - A portable TAP adapter extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libasiotap.
+ *
+ * libasiotap is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libasiotap is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libasiotap in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file gso_segmenter.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief Generic segmentation offload helpers.
+ */
+
+#pragma once
+
+#include "frame.hpp"
+
+#include <boost/asio.hpp>
+
+namespace asiotap
+{
+	namespace osi
+	{
+#ifdef MSV
+#pragma pack(push, 1)
+#endif
+
+		/**
+		 * \brief The frame checksum must be completed: see virtio_net_header::csum_start and virtio_net_header::csum_offset.
+		 */
+		const uint8_t VIRTIO_NET_HDR_F_NEEDS_CSUM = 0x01;
+
+		/**
+		 * \brief The frame checksum was already verified.
+		 */
+		const uint8_t VIRTIO_NET_HDR_F_DATA_VALID = 0x02;
+
+		/**
+		 * \brief The frame is not a GSO frame.
+		 */
+		const uint8_t VIRTIO_NET_HDR_GSO_NONE = 0x00;
+
+		/**
+		 * \brief The frame is a TCP over IPv4 GSO frame.
+		 */
+		const uint8_t VIRTIO_NET_HDR_GSO_TCPV4 = 0x01;
+
+		/**
+		 * \brief The frame is a UDP GSO frame.
+		 */
+		const uint8_t VIRTIO_NET_HDR_GSO_UDP = 0x03;
+
+		/**
+		 * \brief The frame is a TCP over IPv6 GSO frame.
+		 */
+		const uint8_t VIRTIO_NET_HDR_GSO_TCPV6 = 0x04;
+
+		/**
+		 * \brief The frame has the ECN bit set.
+		 */
+		const uint8_t VIRTIO_NET_HDR_GSO_ECN = 0x80;
+
+		/**
+		 * \brief The header that precedes every frame on a tap adapter opened with IFF_VNET_HDR.
+		 *
+		 * The multi-byte fields are in host byte order.
+		 */
+		struct virtio_net_header
+		{
+			uint8_t flags; /**< The flags */
+			uint8_t gso_type; /**< The GSO type */
+			uint16_t hdr_len; /**< The length of the headers to copy in every segment */
+			uint16_t gso_size; /**< The maximum payload size of a segment */
+			uint16_t csum_start; /**< The offset at which checksumming starts */
+			uint16_t csum_offset; /**< The offset of the checksum field, from csum_start */
+		} PACKED;
+
+#ifdef MSV
+#pragma pack(pop)
+#endif
+
+		/**
+		 * \brief Complete the checksum of a frame that has the VIRTIO_NET_HDR_F_NEEDS_CSUM flag.
+		 * \param header The virtio header of the frame.
+		 * \param frame The frame, without its virtio header.
+		 * \return false if the checksum offsets lie outside of frame. If the frame does not need a checksum, nothing is done and true is returned.
+		 */
+		bool complete_checksum(const virtio_net_header& header, boost::asio::mutable_buffer frame);
+
+		/**
+		 * \brief Splits TCP GSO frames into segments that fit the tunnel MTU.
+		 *
+		 * Every segment gets a copy of the headers with its own lengths, sequence number and checksums.
+		 */
+		class gso_segmenter
+		{
+			public:
+
+				/**
+				 * \brief Create a segmenter.
+				 * \param header The virtio header of the frame.
+				 * \param frame The GSO frame, without its virtio header. Must remain valid as long as the segmenter is used.
+				 * \param network_offset The offset of the IP header in frame: 14 on an ethernet tap adapter, 0 on a tun adapter.
+				 */
+				gso_segmenter(const virtio_net_header& header, boost::asio::const_buffer frame, size_t network_offset);
+
+				/**
+				 * \brief Check if the frame can be segmented.
+				 * \return true if the frame is a TCP GSO frame that was successfully parsed.
+				 */
+				bool valid() const
+				{
+					return (m_segments_count > 0);
+				}
+
+				/**
+				 * \brief Get the number of segments.
+				 * \return The number of segments. 0 if the segmenter is not valid.
+				 */
+				size_t segments_count() const
+				{
+					return m_segments_count;
+				}
+
+				/**
+				 * \brief Get the size of a segment.
+				 * \param index The index of the segment. Must be lower than segments_count().
+				 * \return The size of the segment, headers included.
+				 */
+				size_t segment_size(size_t index) const
+				{
+					return m_headers_length + segment_payload_size(index);
+				}
+
+				/**
+				 * \brief Write a segment.
+				 * \param index The index of the segment. Must be lower than segments_count().
+				 * \param output The buffer to write the segment to. Must be at least segment_size(index) bytes long.
+				 * \return The written segment.
+				 */
+				boost::asio::mutable_buffer write_segment(size_t index, boost::asio::mutable_buffer output) const;
+
+			private:
+
+				size_t segment_payload_size(size_t index) const
+				{
+					const size_t offset = index * m_segment_payload_size;
+					const size_t left = m_payload_size - offset;
+
+					return (left < m_segment_payload_size) ? left : m_segment_payload_size;
+				}
+
+				boost::asio::const_buffer m_frame;
+				size_t m_network_offset;
+				size_t m_ip_header_length;
+				size_t m_headers_length;
+				size_t m_payload_size;
+				size_t m_segment_payload_size;
+				size_t m_segments_count;
+				bool m_ipv6;
+		};
+	}
+}
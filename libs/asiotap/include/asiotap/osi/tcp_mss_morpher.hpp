@@ -84,7 +84,28 @@ namespace asiotap
 				*/
 				void handle(const_helper<ipv6_frame> ipv6_helper, mutable_helper<tcp_frame> tcp_helper);
 
+				/**
+				 * \brief Handle a TCP frame.
+				 * \param ipv4_helper The IPv4 helper.
+				 * \param tcp_helper The TCP helper.
+				 * \param max_mss The max MSS value towards the destination of the frame. It only applies if it is lower than the max MSS value of the morpher. 0 means that it is not known.
+				 */
+				void handle(const_helper<ipv4_frame> ipv4_helper, mutable_helper<tcp_frame> tcp_helper, size_t max_mss);
+
+				/**
+				 * \brief Handle a TCP frame.
+				 * \param ipv6_helper The IPv6 helper.
+				 * \param tcp_helper The TCP helper.
+				 * \param max_mss The max MSS value towards the destination of the frame. It only applies if it is lower than the max MSS value of the morpher. 0 means that it is not known.
+				 */
+				void handle(const_helper<ipv6_frame> ipv6_helper, mutable_helper<tcp_frame> tcp_helper, size_t max_mss);
+
 			private:
+				size_t get_max_mss(size_t max_mss) const
+				{
+					return ((max_mss > 0) && (max_mss < m_max_mss)) ? max_mss : m_max_mss;
+				}
+
 				size_t m_max_mss;
 		};
 	}
@@ -116,6 +116,8 @@ namespace asiotap
 			 * \brief Open the tap adapter.
 			 * \param name The name of the tap adapter to open.
 			 * \param ec The error code.
+			 *
+			 * The descriptors are put in non-blocking mode: synchronous writes fail with boost::asio::error::would_block instead of blocking.
 			 */
 			void open(const std::string& name, boost::system::error_code& ec);
 
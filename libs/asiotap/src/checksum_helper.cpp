@@ -44,40 +44,206 @@
 
 #include "osi/checksum_helper.hpp"
 
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define ASIOTAP_CHECKSUM_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ASIOTAP_CHECKSUM_AVX2
+#include <immintrin.h>
+#endif
+
 namespace asiotap
 {
 	namespace osi
 	{
-		void checksum_helper::update(const uint16_t* buf, size_t buf_len)
+		namespace
 		{
-			if (buf_len > 0)
+			// All the kernels return the sum of the native 16-bit words of buf, which must have an even size. The sum is not folded.
+			typedef uint64_t (*sum_function_type)(const uint8_t* buf, size_t buf_len);
+
+			uint64_t sum_tail(const uint8_t* buf, size_t buf_len, uint64_t sum)
 			{
-				if (m_left != 0)
+				while (buf_len >= sizeof(uint32_t))
 				{
-					m_checksum += (static_cast<uint16_t>(m_left) << 8 | *reinterpret_cast<const uint8_t*>(buf));
-					buf_len -= sizeof(uint8_t);
-					m_left = 0;
+					uint32_t value;
+					std::memcpy(&value, buf, sizeof(value));
+					sum += value;
+					buf += sizeof(value);
+					buf_len -= sizeof(value);
 				}
 
-				while (buf_len > 1)
+				if (buf_len >= sizeof(uint16_t))
 				{
-					m_checksum += *buf++;
-					buf_len -= sizeof(uint16_t);
+					uint16_t value;
+					std::memcpy(&value, buf, sizeof(value));
+					sum += value;
 				}
 
-				if (buf_len > 0)
+				return sum;
+			}
+
+			uint64_t sum_scalar(const uint8_t* buf, size_t buf_len)
+			{
+				// Summing 32-bit words in a 64-bit accumulator cannot overflow for any realistic buffer size.
+				uint64_t sum0 = 0;
+				uint64_t sum1 = 0;
+
+				while (buf_len >= 4 * sizeof(uint32_t))
 				{
-					m_left = *reinterpret_cast<const uint8_t*>(buf);
+					uint32_t values[4];
+					std::memcpy(values, buf, sizeof(values));
+					sum0 += values[0];
+					sum1 += values[1];
+					sum0 += values[2];
+					sum1 += values[3];
+					buf += sizeof(values);
+					buf_len -= sizeof(values);
+				}
+
+				return sum_tail(buf, buf_len, sum0 + sum1);
+			}
+
+			// Every 32-bit lane receives at most two 16-bit words per iteration: flushing them every 16384 iterations avoids any overflow.
+			const size_t SIMD_FLUSH_ITERATIONS = 16384;
+
+#ifdef ASIOTAP_CHECKSUM_SSE2
+			uint64_t sum_sse2(const uint8_t* buf, size_t buf_len)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				uint64_t sum = 0;
+
+				while (buf_len >= sizeof(__m128i))
+				{
+					__m128i accumulator = zero;
+
+					for (size_t i = 0; (i < SIMD_FLUSH_ITERATIONS) && (buf_len >= sizeof(__m128i)); ++i)
+					{
+						const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+						accumulator = _mm_add_epi32(accumulator, _mm_unpacklo_epi16(value, zero));
+						accumulator = _mm_add_epi32(accumulator, _mm_unpackhi_epi16(value, zero));
+						buf += sizeof(__m128i);
+						buf_len -= sizeof(__m128i);
+					}
+
+					uint32_t lanes[4];
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), accumulator);
+					sum += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+				}
+
+				return sum_tail(buf, buf_len, sum);
+			}
+#endif
+
+#ifdef ASIOTAP_CHECKSUM_AVX2
+			__attribute__((target("avx2")))
+			uint64_t sum_avx2(const uint8_t* buf, size_t buf_len)
+			{
+				const __m256i zero = _mm256_setzero_si256();
+				uint64_t sum = 0;
+
+				while (buf_len >= sizeof(__m256i))
+				{
+					__m256i accumulator = zero;
+
+					for (size_t i = 0; (i < SIMD_FLUSH_ITERATIONS) && (buf_len >= sizeof(__m256i)); ++i)
+					{
+						const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf));
+						accumulator = _mm256_add_epi32(accumulator, _mm256_unpacklo_epi16(value, zero));
+						accumulator = _mm256_add_epi32(accumulator, _mm256_unpackhi_epi16(value, zero));
+						buf += sizeof(__m256i);
+						buf_len -= sizeof(__m256i);
+					}
+
+					uint32_t lanes[8];
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), accumulator);
+
+					for (size_t i = 0; i < 8; ++i)
+					{
+						sum += lanes[i];
+					}
+				}
+
+				return sum_tail(buf, buf_len, sum);
+			}
+#endif
+
+			sum_function_type select_sum_function()
+			{
+#ifdef ASIOTAP_CHECKSUM_AVX2
+				__builtin_cpu_init();
+
+				if (__builtin_cpu_supports("avx2"))
+				{
+					return &sum_avx2;
+				}
+#endif
+
+#ifdef ASIOTAP_CHECKSUM_SSE2
+				return &sum_sse2;
+#else
+				return &sum_scalar;
+#endif
+			}
+
+			uint64_t sum_words(const uint8_t* buf, size_t buf_len)
+			{
+				// Small buffers, like pseudo-headers, are not worth the vector setup.
+				if (buf_len < 64)
+				{
+					return sum_scalar(buf, buf_len);
+				}
+
+				static const sum_function_type sum_function = select_sum_function();
+
+				return sum_function(buf, buf_len);
+			}
+		}
+
+		void checksum_helper::update(const uint16_t* buf, size_t buf_len)
+		{
+			const uint8_t* data = reinterpret_cast<const uint8_t*>(buf);
+
+			if (buf_len > 0)
+			{
+				if (m_has_left)
+				{
+					// The byte left from the previous update and the first one of this buffer form a word.
+					const uint8_t bytes[2] = { m_left, *data };
+					uint16_t value;
+					std::memcpy(&value, bytes, sizeof(value));
+
+					m_checksum += value;
+					++data;
+					--buf_len;
+					m_has_left = false;
+				}
+
+				m_checksum += sum_words(data, buf_len & ~static_cast<size_t>(1));
+
+				if (buf_len & 1)
+				{
+					m_left = data[buf_len - 1];
+					m_has_left = true;
 				}
 			}
 		}
 
 		uint32_t checksum_helper::compute()
 		{
-			if (m_left != 0)
+			if (m_has_left)
 			{
-				m_checksum += m_left;
+				// The last byte is padded with a null byte.
+				const uint8_t bytes[2] = { m_left, 0 };
+				uint16_t value;
+				std::memcpy(&value, bytes, sizeof(value));
+
+				m_checksum += value;
 				m_left = 0;
+				m_has_left = false;
 			}
 
 			while (m_checksum >> 16)
@@ -0,0 +1,263 @@
+/*
+ * libasiotap - A portable TAP adapter extension for Boost::ASIO.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libasiotap.
+ *
+ * libasiotap is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libasiotap is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libasiotap in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file gso_segmenter.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief Generic segmentation offload helpers.
+ */
+
+#include "osi/gso_segmenter.hpp"
+
+#include "osi/checksum.hpp"
+#include "osi/ipv4_helper.hpp"
+#include "osi/ipv6_helper.hpp"
+#include "osi/tcp_helper.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+namespace asiotap
+{
+	namespace osi
+	{
+		namespace
+		{
+			// The TCP congestion window reduced flag, which must only be kept on the first segment.
+			const uint16_t TCP_CWR_FLAG = 0x0080;
+
+			// The offset of the checksum field in an UDP header.
+			const uint16_t UDP_CHECKSUM_OFFSET = 6;
+		}
+
+		bool complete_checksum(const virtio_net_header& header, boost::asio::mutable_buffer frame)
+		{
+			if ((header.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) == 0)
+			{
+				return true;
+			}
+
+			const size_t frame_size = boost::asio::buffer_size(frame);
+			const size_t checksum_field = static_cast<size_t>(header.csum_start) + header.csum_offset;
+
+			if ((header.csum_start >= frame_size) || (checksum_field + sizeof(uint16_t) > frame_size))
+			{
+				return false;
+			}
+
+			uint8_t* const buf = boost::asio::buffer_cast<uint8_t*>(frame);
+
+			// The checksum field already holds the pseudo-header sum.
+			checksum_helper chk;
+			chk.update(reinterpret_cast<const uint16_t*>(buf + header.csum_start), frame_size - header.csum_start);
+
+			uint16_t checksum = static_cast<uint16_t>(chk.compute());
+
+			if ((checksum == 0x0000) && (header.csum_offset == UDP_CHECKSUM_OFFSET))
+			{
+				// A null UDP checksum means there is no checksum.
+				checksum = 0xFFFF;
+			}
+
+			std::memcpy(buf + checksum_field, &checksum, sizeof(checksum));
+
+			return true;
+		}
+
+		gso_segmenter::gso_segmenter(const virtio_net_header& header, boost::asio::const_buffer frame, size_t network_offset) :
+			m_frame(frame),
+			m_network_offset(network_offset),
+			m_ip_header_length(0),
+			m_headers_length(0),
+			m_payload_size(0),
+			m_segment_payload_size(header.gso_size),
+			m_segments_count(0),
+			m_ipv6(false)
+		{
+			switch (header.gso_type & ~VIRTIO_NET_HDR_GSO_ECN)
+			{
+				case VIRTIO_NET_HDR_GSO_TCPV4:
+				{
+					m_ipv6 = false;
+
+					break;
+				}
+				case VIRTIO_NET_HDR_GSO_TCPV6:
+				{
+					m_ipv6 = true;
+
+					break;
+				}
+				default:
+				{
+					// UDP fragmentation offload is deprecated and never enabled.
+					return;
+				}
+			}
+
+			const size_t frame_size = boost::asio::buffer_size(frame);
+
+			if ((m_segment_payload_size == 0) || (frame_size < m_network_offset))
+			{
+				return;
+			}
+
+			try
+			{
+				const boost::asio::const_buffer ip_buffer = m_frame + m_network_offset;
+
+				if (m_ipv6)
+				{
+					const const_helper<ipv6_frame> ipv6_helper(ip_buffer);
+
+					// Extension headers are not supported.
+					if ((ipv6_helper.version() != 6) || (ipv6_helper.next_header() != TCP_PROTOCOL))
+					{
+						return;
+					}
+
+					m_ip_header_length = ipv6_helper.header_length();
+				}
+				else
+				{
+					const const_helper<ipv4_frame> ipv4_helper(ip_buffer);
+
+					if ((ipv4_helper.version() != 4) || (ipv4_helper.protocol() != TCP_PROTOCOL) || (ipv4_helper.header_length() < sizeof(ipv4_frame)))
+					{
+						return;
+					}
+
+					m_ip_header_length = ipv4_helper.header_length();
+				}
+
+				if (frame_size < m_network_offset + m_ip_header_length)
+				{
+					return;
+				}
+
+				const const_helper<tcp_frame> tcp_helper(ip_buffer + m_ip_header_length);
+
+				// offset() is the length of the whole TCP header, options included.
+				if (tcp_helper.offset() < sizeof(tcp_frame))
+				{
+					return;
+				}
+
+				m_headers_length = m_network_offset + m_ip_header_length + tcp_helper.offset();
+			}
+			catch (const std::length_error&)
+			{
+				return;
+			}
+
+			if (frame_size < m_headers_length)
+			{
+				return;
+			}
+
+			m_payload_size = frame_size - m_headers_length;
+			m_segments_count = (m_payload_size == 0) ? 1 : (m_payload_size + m_segment_payload_size - 1) / m_segment_payload_size;
+		}
+
+		boost::asio::mutable_buffer gso_segmenter::write_segment(size_t index, boost::asio::mutable_buffer output) const
+		{
+			assert(index < m_segments_count);
+
+			const size_t payload_size = segment_payload_size(index);
+			const size_t size = m_headers_length + payload_size;
+
+			assert(boost::asio::buffer_size(output) >= size);
+
+			uint8_t* const out = boost::asio::buffer_cast<uint8_t*>(output);
+			const uint8_t* const in = boost::asio::buffer_cast<const uint8_t*>(m_frame);
+
+			std::memcpy(out, in, m_headers_length);
+			std::memcpy(out + m_headers_length, in + m_headers_length + index * m_segment_payload_size, payload_size);
+
+			const boost::asio::mutable_buffer segment = boost::asio::buffer(output, size);
+			const boost::asio::mutable_buffer ip_buffer = segment + m_network_offset;
+			const boost::asio::mutable_buffer tcp_buffer = ip_buffer + m_ip_header_length;
+
+			const mutable_helper<tcp_frame> tcp_helper(tcp_buffer);
+
+			tcp_helper.set_sequence(tcp_helper.sequence() + static_cast<uint32_t>(index * m_segment_payload_size));
+
+			if (index + 1 < m_segments_count)
+			{
+				// Only the last segment finishes or pushes the data.
+				tcp_helper.set_fin_flag(false);
+				tcp_helper.set_psh_flag(false);
+			}
+
+			if (index > 0)
+			{
+				tcp_helper.frame().offset_flags &= ~htons(TCP_CWR_FLAG);
+			}
+
+			tcp_helper.set_checksum(0x0000);
+
+			if (m_ipv6)
+			{
+				const mutable_helper<ipv6_frame> ipv6_helper(ip_buffer);
+
+				ipv6_helper.set_payload_length(boost::asio::buffer_size(tcp_buffer));
+				tcp_helper.set_checksum(tcp_helper.compute_checksum(ipv6_helper));
+			}
+			else
+			{
+				const mutable_helper<ipv4_frame> ipv4_helper(ip_buffer);
+
+				const uint16_t raw_total_length = ipv4_helper.frame().total_length;
+				const uint16_t raw_identification = ipv4_helper.frame().identification;
+
+				ipv4_helper.set_total_length(boost::asio::buffer_size(ip_buffer));
+				ipv4_helper.set_identification(static_cast<uint16_t>(ipv4_helper.identification() + index));
+
+				// Only two words of the copied IPv4 header changed.
+				uint16_t ipv4_checksum = ipv4_helper.checksum();
+				ipv4_checksum = update_checksum(ipv4_checksum, raw_total_length, ipv4_helper.frame().total_length);
+				ipv4_checksum = update_checksum(ipv4_checksum, raw_identification, ipv4_helper.frame().identification);
+				ipv4_helper.set_checksum(ipv4_checksum);
+				tcp_helper.set_checksum(tcp_helper.compute_checksum(ipv4_helper));
+			}
+
+			return segment;
+		}
+	}
+}
@@ -43,9 +43,12 @@
  */
 
 #include "posix/posix_tap_adapter.hpp"
+#include "osi/gso_segmenter.hpp"
 
 #include <boost/lexical_cast.hpp>
 
+#include <vector>
+
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <ifaddrs.h>
@@ -267,6 +270,30 @@ namespace asiotap
 		ifr.ifr_flags |= IFF_ONE_QUEUE;
 #endif
 
+#if defined(IFF_MULTI_QUEUE)
+		const size_t queues = requested_queues_count();
+
+		if (queues > 1)
+		{
+			// The kernel spreads the flows over the queues: each one gets its own file descriptor.
+			ifr.ifr_flags |= IFF_MULTI_QUEUE;
+		}
+#else
+		const size_t queues = 1;
+#endif
+
+#if defined(IFF_VNET_HDR) && defined(TUNSETOFFLOAD)
+		const bool offload = is_offload_requested();
+
+		if (offload)
+		{
+			// Every frame is then preceded by a virtio header, which describes its offloads.
+			ifr.ifr_flags |= IFF_VNET_HDR;
+		}
+#else
+		const bool offload = false;
+#endif
+
 		if (layer() == tap_adapter_layer::ethernet)
 		{
 			ifr.ifr_flags |= IFF_TAP;
@@ -289,6 +316,52 @@ namespace asiotap
 			return;
 		}
 
+#if defined(IFF_VNET_HDR) && defined(TUNSETOFFLOAD)
+		if (offload)
+		{
+			int header_size = sizeof(osi::virtio_net_header);
+
+			if (::ioctl(device.native_handle(), TUNSETVNETHDRSZ, (void *)&header_size) < 0)
+			{
+				ec = boost::system::error_code(errno, boost::system::system_category());
+
+				return;
+			}
+
+			// Those are the offloads we can handle: the kernel may then hand us GSO frames of up to 64 KiB, without their transport checksum.
+			const unsigned int offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+
+			if (::ioctl(device.native_handle(), TUNSETOFFLOAD, offloads) < 0)
+			{
+				ec = boost::system::error_code(errno, boost::system::system_category());
+
+				return;
+			}
+		}
+#endif
+
+		// The additional queues attach to the interface that was just created, which ifr now names.
+		std::vector<descriptor_handler> queue_devices;
+
+		for (size_t queue = 1; queue < queues; ++queue)
+		{
+			descriptor_handler queue_device = open_device(dev_name, ec);
+
+			if (!queue_device.valid())
+			{
+				return;
+			}
+
+			if (::ioctl(queue_device.native_handle(), TUNSETIFF, (void *)&ifr) < 0)
+			{
+				ec = boost::system::error_code(errno, boost::system::system_category());
+
+				return;
+			}
+
+			queue_devices.push_back(std::move(queue_device));
+		}
+
 		descriptor_handler socket = open_socket(AF_INET, ec);
 
 		if (!socket.valid())
@@ -442,6 +515,33 @@ namespace asiotap
 		{
 			return;
 		}
+
+#if defined(LINUX)
+		set_offload_enabled(offload);
+
+		for (auto&& queue_device : queue_devices)
+		{
+			if (add_queue_descriptor(queue_device.native_handle(), ec))
+			{
+				base_tap_adapter::close();
+
+				return;
+			}
+
+			queue_device.release();
+		}
+#endif
+
+		// Writes are drained in batches and must never block: when a queue is full, the caller waits with async_wait_write().
+		for (size_t queue = 0; queue < queues_count(); ++queue)
+		{
+			if (queue_descriptor(queue).non_blocking(true, ec))
+			{
+				base_tap_adapter::close();
+
+				return;
+			}
+		}
 	}
 
 	void posix_tap_adapter::open(const std::string& _name)
@@ -44,13 +44,16 @@
 
 #include "osi/tcp_mss_morpher.hpp"
 
+#include "osi/checksum.hpp"
+
+#include <cstring>
+
 namespace asiotap
 {
 	namespace osi
 	{
 		namespace {
-			template <typename OSIHelperType>
-			void generic_handle(uint16_t max_mss, OSIHelperType ip_helper, mutable_helper<tcp_frame> tcp_helper) {
+			void generic_handle(uint16_t max_mss, mutable_helper<tcp_frame> tcp_helper) {
 				if (tcp_helper.syn_flag()) {
 					for (auto option = tcp_helper.first_option(); option.valid(); option = option.next_option()) {
 						if (option.kind() == TCP_OPTION_END) {
@@ -60,12 +63,18 @@ namespace asiotap
 						if (option.kind() == TCP_OPTION_MSS) {
 							if (option.size() == 4) {
 								auto value = option.value();
-								uint16_t mss = ntohs(*boost::asio::buffer_cast<uint16_t*>(value));
+								uint8_t* const value_buf = boost::asio::buffer_cast<uint8_t*>(value);
+								uint16_t raw_mss;
+								std::memcpy(&raw_mss, value_buf, sizeof(raw_mss));
+
+								if (ntohs(raw_mss) > max_mss) {
+									const uint16_t raw_max_mss = htons(max_mss);
+									const size_t offset = value_buf - boost::asio::buffer_cast<const uint8_t*>(tcp_helper.buffer());
+
+									std::memcpy(value_buf, &raw_max_mss, sizeof(raw_max_mss));
 
-								if (mss > max_mss) {
-									*boost::asio::buffer_cast<uint16_t*>(value) = htons(max_mss);
-									tcp_helper.set_checksum(0x0000);
-									tcp_helper.set_checksum(tcp_helper.compute_checksum(ip_helper));
+									// Options may be padded so that the MSS is not word-aligned.
+									tcp_helper.set_checksum(update_checksum(tcp_helper.checksum(), raw_mss, raw_max_mss, (offset % 2) != 0));
 								}
 							}
 
@@ -76,12 +85,20 @@ namespace asiotap
 			}
 		}
 
-		void tcp_mss_morpher::handle(const_helper<ipv4_frame> ipv4_helper, mutable_helper<tcp_frame> tcp_helper) {
-			generic_handle(static_cast<uint16_t>(m_max_mss), ipv4_helper, tcp_helper);
+		void tcp_mss_morpher::handle(const_helper<ipv4_frame>, mutable_helper<tcp_frame> tcp_helper) {
+			generic_handle(static_cast<uint16_t>(m_max_mss), tcp_helper);
+		}
+
+		void tcp_mss_morpher::handle(const_helper<ipv6_frame>, mutable_helper<tcp_frame> tcp_helper) {
+			generic_handle(static_cast<uint16_t>(m_max_mss), tcp_helper);
+		}
+
+		void tcp_mss_morpher::handle(const_helper<ipv4_frame>, mutable_helper<tcp_frame> tcp_helper, size_t max_mss) {
+			generic_handle(static_cast<uint16_t>(get_max_mss(max_mss)), tcp_helper);
 		}
 
-		void tcp_mss_morpher::handle(const_helper<ipv6_frame> ipv6_helper, mutable_helper<tcp_frame> tcp_helper) {
-			generic_handle(static_cast<uint16_t>(m_max_mss), ipv6_helper, tcp_helper);
+		void tcp_mss_morpher::handle(const_helper<ipv6_frame>, mutable_helper<tcp_frame> tcp_helper, size_t max_mss) {
+			generic_handle(static_cast<uint16_t>(get_max_mss(max_mss)), tcp_helper);
 		}
 	}
 }
@@ -0,0 +1,172 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file certificate_validation_cache.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A cache of certificate validation results.
+ */
+
+#ifndef FREELAN_CERTIFICATE_VALIDATION_CACHE_HPP
+#define FREELAN_CERTIFICATE_VALIDATION_CACHE_HPP
+
+#include <list>
+#include <map>
+#include <utility>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <fscp/constants.hpp>
+
+#include <stdint.h>
+
+namespace freelan
+{
+	/**
+	 * \brief A bounded cache of certificate validation results.
+	 *
+	 * Results are keyed by the hash of the certificate and the generation of the CA store that validated it, so that rebuilding the CA store implicitly invalidates all the previous results. When the cache is full, the least recently used result is evicted.
+	 *
+	 * All the methods are thread-safe.
+	 */
+	class certificate_validation_cache
+	{
+		public:
+
+			/**
+			 * \brief The certificate hash type.
+			 */
+			typedef fscp::hash_type hash_type;
+
+			/**
+			 * \brief The CA store generation type.
+			 */
+			typedef uint64_t generation_type;
+
+			/**
+			 * \brief The default maximum number of results.
+			 */
+			static const size_t DEFAULT_SIZE = 4096;
+
+			/**
+			 * \brief The statistics type.
+			 */
+			struct statistics_type
+			{
+				statistics_type() :
+					hits(0),
+					misses(0),
+					evicted(0),
+					expired(0)
+				{}
+
+				uint64_t hits; /**< \brief The number of lookups that found a result. */
+				uint64_t misses; /**< \brief The number of lookups that found no result. */
+				uint64_t evicted; /**< \brief The number of results evicted because the cache was full. */
+				uint64_t expired; /**< \brief The number of results dropped because they expired. */
+			};
+
+			/**
+			 * \brief Create a cache.
+			 * \param max_entries The maximum number of results. If max_entries is 0, nothing is ever cached.
+			 */
+			explicit certificate_validation_cache(size_t max_entries = DEFAULT_SIZE);
+
+			/**
+			 * \brief Find a result.
+			 * \param hash The certificate hash.
+			 * \param generation The generation of the CA store.
+			 * \param now The current time.
+			 * \return The result, if a result that did not expire yet exists.
+			 */
+			boost::optional<bool> find(const hash_type& hash, generation_type generation, const boost::posix_time::ptime& now);
+
+			/**
+			 * \brief Add a result.
+			 * \param hash The certificate hash.
+			 * \param generation The generation of the CA store.
+			 * \param valid Whether the certificate is valid.
+			 * \param expires_at The time after which the result must be computed again.
+			 */
+			void insert(const hash_type& hash, generation_type generation, bool valid, const boost::posix_time::ptime& expires_at);
+
+			/**
+			 * \brief Remove all the results.
+			 */
+			void clear();
+
+			/**
+			 * \brief Get the number of results.
+			 * \return The number of results, including the expired results that were not looked up since.
+			 */
+			size_t size() const;
+
+			/**
+			 * \brief Get the statistics.
+			 * \return The statistics.
+			 */
+			statistics_type statistics() const;
+
+		private:
+
+			typedef std::pair<hash_type, generation_type> key_type;
+
+			// The front is the most recently used key.
+			typedef std::list<key_type> lru_list_type;
+
+			struct entry_type
+			{
+				bool valid;
+				boost::posix_time::ptime expires_at;
+				lru_list_type::iterator lru_position;
+			};
+
+			typedef std::map<key_type, entry_type> entry_map_type;
+
+			const size_t m_max_entries;
+			mutable boost::mutex m_mutex;
+			lru_list_type m_lru_list;
+			entry_map_type m_entries;
+			statistics_type m_statistics;
+	};
+}
+
+#endif /* FREELAN_CERTIFICATE_VALIDATION_CACHE_HPP */
@@ -72,6 +72,7 @@
 #include "mss.hpp"
 #include "metric.hpp"
 #include "ip_route.hpp"
+#include "certificate_validation_cache.hpp"
 
 namespace freelan
 {
@@ -316,6 +317,60 @@ namespace freelan
 		 * \brief The list of allowed elliptic curves.
 		 */
 		fscp::elliptic_curve_list_type elliptic_curve_capabilities;
+
+		/**
+		 * \brief The number of cipher strands to use for DATA messages.
+		 *
+		 * 0 means that DATA messages are ciphered and deciphered in the session strand.
+		 */
+		unsigned int cipher_strands;
+
+		/**
+		 * \brief The number of threads dedicated to the handshake cryptography.
+		 *
+		 * 0 means that SESSION_REQUEST and SESSION messages are signed and checked in the presentation and session strands.
+		 */
+		unsigned int handshake_threads;
+
+		/**
+		 * \brief The maximum number of handshake operations waiting for a handshake thread.
+		 */
+		unsigned int handshake_queue_size;
+
+		/**
+		 * \brief The number of ECDHE key pairs to keep ready per elliptic curve.
+		 *
+		 * 0 means that the key pairs are generated when sessions are prepared.
+		 */
+		unsigned int ecdhe_key_pool_size;
+
+		/**
+		 * \brief The maximum number of datagrams to receive or send per system call.
+		 *
+		 * 0 or 1 disables batching. Only supported on Linux.
+		 */
+		unsigned int io_batch_size;
+
+		/**
+		 * \brief The number of sockets to open on the listen endpoint.
+		 *
+		 * 0 or 1 opens a single socket. Greater values open that many sockets with SO_REUSEPORT, each with its own receive loop. Only supported on Linux.
+		 */
+		unsigned int listen_sockets;
+
+		/**
+		 * \brief Whether to receive datagrams with io_uring.
+		 *
+		 * Only supported on Linux 6.0 or later. Falls back to regular receives when unavailable.
+		 */
+		bool io_uring;
+
+		/**
+		 * \brief Whether to discover the path MTU to every host.
+		 *
+		 * Only supported on Linux. Only the probes are sent with the Don't Fragment flag, from a socket of their own.
+		 */
+		bool path_mtu_discovery;
 	};
 
 	/**
@@ -396,6 +451,18 @@ namespace freelan
 		 * \brief The certificate revocation lists.
 		 */
 		crl_list_type certificate_revocation_list_list;
+
+		/**
+		 * \brief The maximum number of certificate validation results to cache.
+		 *
+		 * 0 disables the cache.
+		 */
+		unsigned int certificate_validation_cache_size;
+
+		/**
+		 * \brief The time after which a cached certificate validation result is computed again.
+		 */
+		boost::posix_time::time_duration certificate_validation_cache_ttl;
 	};
 
 	/**
@@ -452,6 +519,18 @@ namespace freelan
 		 */
 		metric_type metric;
 
+		/**
+		 * \brief The number of queues to open on the tap adapter.
+		 *
+		 * 0 or 1 opens a single queue.
+		 */
+		unsigned int queues;
+
+		/**
+		 * \brief Whether to enable segmentation and checksum offloading on the tap adapter.
+		 */
+		bool offload_enabled;
+
 		/**
 		 * \brief The IPv4 tap adapter address.
 		 */
@@ -531,6 +610,18 @@ namespace freelan
 		 * \brief Whether to enable the relay mode.
 		 */
 		bool relay_mode_enabled;
+
+		/**
+		 * \brief The maximum number of entries in the ethernet address table.
+		 */
+		unsigned int max_entries;
+
+		/**
+		 * \brief The time after which an ethernet address that was not seen is forgotten.
+		 *
+		 * A null duration disables aging.
+		 */
+		boost::posix_time::time_duration ethernet_address_aging_time;
 	};
 
 	/**
@@ -627,6 +718,38 @@ namespace freelan
 		boost::filesystem::path dns_script;
 	};
 
+	/**
+	 * \brief The metrics related options type.
+	 */
+	struct metrics_configuration
+	{
+		/**
+		 * \brief The metrics format type.
+		 */
+		enum class metrics_format_type
+		{
+			json, /**< \brief JSON. */
+			prometheus /**< \brief The Prometheus text exposition format. */
+		};
+
+		/**
+		 * \brief Constructor.
+		 */
+		metrics_configuration();
+
+		/**
+		 * \brief The path of the UNIX socket that exposes the metrics.
+		 *
+		 * An empty path disables the metrics socket.
+		 */
+		boost::filesystem::path socket;
+
+		/**
+		 * \brief The format of the metrics.
+		 */
+		metrics_format_type format;
+	};
+
 	/**
 	 * \brief The configuration structure.
 	 */
@@ -667,6 +790,11 @@ namespace freelan
 		 */
 		freelan::router_configuration router;
 
+		/**
+		 * \brief The metrics related options.
+		 */
+		freelan::metrics_configuration metrics;
+
 		/**
 		 * \brief The constructor.
 		 */
@@ -823,6 +951,22 @@ namespace freelan
 	 * \return os.
 	 */
 	std::ostream& operator<<(std::ostream& os, const router_configuration::dns_servers_scope_type& value);
+
+	/**
+	 * \brief Input a metrics format.
+	 * \param is The input stream.
+	 * \param value The value to read.
+	 * \return is.
+	 */
+	std::istream& operator>>(std::istream& is, metrics_configuration::metrics_format_type& value);
+
+	/**
+	 * \brief Output a metrics format to a stream.
+	 * \param os The output stream.
+	 * \param value The value.
+	 * \return os.
+	 */
+	std::ostream& operator<<(std::ostream& os, const metrics_configuration::metrics_format_type& value);
 }
 
 #endif /* FREELAN_CONFIGURATION_HPP */
@@ -51,6 +51,9 @@
 #include "router.hpp"
 #include "message.hpp"
 #include "routes_message.hpp"
+#include "metrics.hpp"
+#include "certificate_validation_cache.hpp"
+#include "virtual_tap_adapter.hpp"
 
 #include <fscp/fscp.hpp>
 #include <fscp/logger.hpp>
@@ -61,7 +64,7 @@
 #include <asiotap/osi/tcp_mss_morpher.hpp>
 #include <asiotap/osi/dhcp_proxy.hpp>
 #include <asiotap/osi/icmpv6_proxy.hpp>
-#include <asiotap/osi/complex_filter.hpp>
+#include <asiotap/osi/frame_classifier.hpp>
 #include <asiotap/route_manager.hpp>
 #include <asiotap/dns_servers_manager.hpp>
 #include <asiotap/types/ip_route.hpp>
@@ -76,8 +79,9 @@
 #include <boost/weak_ptr.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
+#include <boost/circular_buffer.hpp>
 
-#include <queue>
+#include <atomic>
 #include <set>
 
 namespace freelan
@@ -248,6 +252,11 @@ namespace freelan
 			 * \brief The up callback type.
 			 */
 			typedef boost::function<bool (const std::string&, DnsAction, const boost::asio::ip::address&)> dns_handler_type;
+
+			/**
+			 * \brief The metrics handler type.
+			 */
+			typedef boost::function<void (const metrics_snapshot&)> metrics_handler_type;
 			
 			// Public constants
 
@@ -286,6 +295,11 @@ namespace freelan
 			 */
 			static const std::string DEFAULT_SERVICE;
 
+			/**
+			 * \brief The maximum number of frames waiting to be written on each tap adapter queue.
+			 */
+			static const size_t TAP_ADAPTER_WRITE_QUEUE_DEPTH;
+
 			// Public methods
 
 			/**
@@ -428,6 +442,19 @@ namespace freelan
 				m_dns_callback = callback;
 			}
 
+			/**
+			 * \brief Set a virtual tap adapter to use instead of a system tap adapter.
+			 * \param tap_adapter The virtual tap adapter. If null, a system tap adapter is used.
+			 *
+			 * The tap adapter must still be enabled in the configuration. The tap adapter up and down callbacks are not called for a virtual tap adapter.
+			 *
+			 * \warning This method can only be called when the core is NOT running.
+			 */
+			void set_virtual_tap_adapter(boost::shared_ptr<virtual_tap_adapter> tap_adapter)
+			{
+				m_virtual_tap_adapter = tap_adapter;
+			}
+
 			/**
 			 * \brief Open the core.
 			 * \see close
@@ -439,6 +466,14 @@ namespace freelan
 			 */
 			void close();
 
+			/**
+			 * \brief Get a snapshot of the runtime metrics.
+			 * \param handler The handler to call with the metrics.
+			 *
+			 * This method is thread-safe.
+			 */
+			void async_get_metrics(metrics_handler_type handler);
+
 		private:
 
 			boost::asio::io_service& m_io_service;
@@ -513,6 +548,7 @@ namespace freelan
 			void do_handle_session_error(const ep_type&, bool, const std::exception&);
 			void do_handle_session_established(const ep_type&, bool, const fscp::cipher_suite_type&, const fscp::elliptic_curve_type&);
 			void do_handle_session_lost(const ep_type&, fscp::server::session_loss_reason);
+			void do_handle_path_mtu_changed(const ep_type&, size_t);
 			void do_handle_data_received(const ep_type&, fscp::channel_number_type, fscp::SharedBuffer, boost::asio::const_buffer);
 			void do_handle_message(const ep_type&, fscp::SharedBuffer, const message&);
 			void do_handle_routes_request(const ep_type&);
@@ -534,32 +570,38 @@ namespace freelan
 				always
 			};
 
+			/**
+			 * \brief A CA store.
+			 *
+			 * A CA store is never modified once built: rebuilding it creates a new instance with a greater generation.
+			 */
+			struct ca_store_type
+			{
+				cryptoplus::x509::store store;
+				certificate_validation_cache::generation_type generation;
+			};
+
 			void build_ca_store(build_ca_store_when);
 			bool certificate_validation_method(bool, cryptoplus::x509::store_context);
 			bool certificate_is_valid(cert_type);
+			bool certificate_chain_is_valid(const ca_store_type&, cert_type);
 
-			cryptoplus::x509::store m_ca_store;
+			// Readers take a reference to the current CA store with boost::atomic_load(): the mutex only serializes the rebuilds.
+			boost::shared_ptr<const ca_store_type> m_ca_store;
 			boost::mutex m_ca_store_mutex;
+			certificate_validation_cache m_certificate_validation_cache;
 
 		private: /* TAP adapter */
 
-			typedef asiotap::osi::filter<asiotap::osi::ethernet_frame> ethernet_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::arp_frame, asiotap::osi::ethernet_frame>::type arp_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::ipv4_frame, asiotap::osi::ethernet_frame>::type ipv4_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::ipv6_frame, asiotap::osi::ethernet_frame>::type ipv6_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::udp_frame, asiotap::osi::ipv4_frame, asiotap::osi::ethernet_frame>::type udp_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::tcp_frame, asiotap::osi::ipv4_frame, asiotap::osi::ethernet_frame>::type tcpv4_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::tcp_frame, asiotap::osi::ipv6_frame, asiotap::osi::ethernet_frame>::type tcpv6_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::bootp_frame, asiotap::osi::udp_frame, asiotap::osi::ipv4_frame, asiotap::osi::ethernet_frame>::type bootp_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::dhcp_frame, asiotap::osi::bootp_frame, asiotap::osi::udp_frame, asiotap::osi::ipv4_frame, asiotap::osi::ethernet_frame>::type dhcp_filter_type;
-			typedef asiotap::osi::filter<asiotap::osi::ipv4_frame> tun_ipv4_filter_type;
-			typedef asiotap::osi::filter<asiotap::osi::ipv6_frame> tun_ipv6_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::tcp_frame, asiotap::osi::ipv4_frame>::type tun_tcpv4_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::tcp_frame, asiotap::osi::ipv6_frame>::type tun_tcpv6_filter_type;
-			typedef asiotap::osi::complex_filter<asiotap::osi::icmpv6_frame, asiotap::osi::ipv6_frame>::type tun_icmpv6_filter_type;
+			typedef asiotap::osi::const_helper<asiotap::osi::ethernet_frame> ethernet_helper_type;
 			typedef asiotap::osi::const_helper<asiotap::osi::arp_frame> arp_helper_type;
+			typedef asiotap::osi::const_helper<asiotap::osi::ipv4_frame> ipv4_helper_type;
+			typedef asiotap::osi::const_helper<asiotap::osi::ipv6_frame> ipv6_helper_type;
+			typedef asiotap::osi::const_helper<asiotap::osi::udp_frame> udp_helper_type;
+			typedef asiotap::osi::const_helper<asiotap::osi::bootp_frame> bootp_helper_type;
 			typedef asiotap::osi::const_helper<asiotap::osi::dhcp_frame> dhcp_helper_type;
 			typedef asiotap::osi::const_helper<asiotap::osi::icmpv6_frame> icmpv6_helper_type;
+			typedef asiotap::osi::mutable_helper<asiotap::osi::tcp_frame> tcp_helper_type;
 			typedef asiotap::osi::proxy<asiotap::osi::arp_frame> arp_proxy_type;
 			typedef asiotap::osi::proxy<asiotap::osi::dhcp_frame> dhcp_proxy_type;
 			typedef asiotap::osi::proxy<asiotap::osi::icmpv6_frame> icmpv6_proxy_type;
@@ -567,56 +609,137 @@ namespace freelan
 			void open_tap_adapter();
 			void close_tap_adapter();
 
+			/**
+			 * \brief A frame waiting to be written on the tap adapter.
+			 */
+			struct tap_write_type
+			{
+				boost::asio::const_buffer data;
+				simple_handler_type handler;
+			};
+
+			/**
+			 * \brief A tap adapter queue.
+			 *
+			 * All the operations on a queue are serialized by its strand, but different queues are handled in parallel.
+			 */
+			struct tap_queue_type
+			{
+				tap_queue_type(boost::asio::io_service& io_service, size_t write_queue_depth) :
+					strand(io_service),
+					mutex(),
+					pending_writes(write_queue_depth),
+					drain_scheduled(false)
+				{}
+
+				boost::asio::strand strand;
+
+				// Protects pending_writes and drain_scheduled, which are filled from any thread.
+				boost::mutex mutex;
+				boost::circular_buffer<tap_write_type> pending_writes;
+				bool drain_scheduled;
+			};
+
+			typedef boost::shared_ptr<tap_queue_type> tap_queue_ptr_type;
+
 			void async_get_tap_addresses(ip_network_address_list_handler_type);
 			void async_read_tap();
+			void async_write_tap(boost::asio::const_buffer, simple_handler_type);
+			size_t get_tap_queue_for(boost::asio::const_buffer) const;
+			void drain_tap_writes(size_t);
+			void do_handle_tap_adapter_writable(size_t, const boost::system::error_code&);
+			void cancel_tap_writes(size_t, const boost::system::error_code&);
+
+			void do_read_tap(size_t);
 
-			template <typename ConstBufferSequence>
-			void async_write_tap(const ConstBufferSequence& data, simple_handler_type handler)
+			void do_handle_tap_adapter_read(size_t, fscp::SharedBuffer, const boost::system::error_code&, size_t);
+			void do_handle_tap_adapter_frame(fscp::SharedBuffer, boost::asio::mutable_buffer);
+			void do_handle_tap_adapter_write(const boost::system::error_code&);
+			bool do_handle_arp_frame(const ethernet_helper_type&, const arp_helper_type&);
+			bool do_handle_dhcp_frame(const ethernet_helper_type&, const ipv4_helper_type&, const udp_helper_type&, const bootp_helper_type&, const dhcp_helper_type&);
+			bool do_handle_icmpv6_frame(const ipv6_helper_type&, const icmpv6_helper_type&);
+			size_t get_max_mss_for(boost::asio::const_buffer, const boost::asio::ip::address&);
+
+			/**
+			 * \brief Dispatches the frames read from the tap adapter to the proxies and the MSS morpher.
+			 *
+			 * The classification is stateless so that the tap adapter queues can run it concurrently.
+			 */
+			struct tap_frame_handler : asiotap::osi::frame_classifier_handler
 			{
-				m_tap_adapter_io_service.post([this, data, handler] () {
-					push_tap_write(data, handler);
-				});
-			}
+				tap_frame_handler(core& _core, boost::asio::const_buffer _frame) :
+					m_core(_core),
+					m_frame(_frame)
+				{}
 
-			template <typename ConstBufferSequence>
-			void push_tap_write(const ConstBufferSequence&, simple_handler_type);
-			void pop_tap_write();
+				bool handle_arp(ethernet_helper_type ethernet_helper, arp_helper_type arp_helper)
+				{
+					return m_core.do_handle_arp_frame(ethernet_helper, arp_helper);
+				}
 
-			void do_read_tap();
+				bool handle_dhcp(ethernet_helper_type ethernet_helper, ipv4_helper_type ipv4_helper, udp_helper_type udp_helper, bootp_helper_type bootp_helper, dhcp_helper_type dhcp_helper)
+				{
+					return m_core.do_handle_dhcp_frame(ethernet_helper, ipv4_helper, udp_helper, bootp_helper, dhcp_helper);
+				}
+
+				bool handle_icmpv6(ipv6_helper_type ipv6_helper, icmpv6_helper_type icmpv6_helper)
+				{
+					return m_core.do_handle_icmpv6_frame(ipv6_helper, icmpv6_helper);
+				}
+
+				void handle_tcp_syn(ipv4_helper_type ipv4_helper, tcp_helper_type tcp_helper)
+				{
+					if (m_core.m_tcp_mss_morpher)
+					{
+						m_core.m_tcp_mss_morpher->handle(ipv4_helper, tcp_helper, m_core.get_max_mss_for(m_frame, ipv4_helper.destination()));
+					}
+				}
+
+				void handle_tcp_syn(ipv6_helper_type ipv6_helper, tcp_helper_type tcp_helper)
+				{
+					if (m_core.m_tcp_mss_morpher)
+					{
+						m_core.m_tcp_mss_morpher->handle(ipv6_helper, tcp_helper, m_core.get_max_mss_for(m_frame, ipv6_helper.destination()));
+					}
+				}
+
+				core& m_core;
+				boost::asio::const_buffer m_frame;
+			};
 
-			void do_handle_tap_adapter_read(fscp::SharedBuffer, const boost::system::error_code&, size_t);
-			void do_handle_tap_adapter_write(const boost::system::error_code&);
-			void do_handle_arp_frame(const arp_helper_type&);
-			void do_handle_dhcp_frame(const dhcp_helper_type&);
-			void do_handle_icmpv6_frame(const icmpv6_helper_type&);
 			bool do_handle_arp_request(const boost::asio::ip::address_v4&, ethernet_address_type&);
 			bool do_handle_icmpv6_neighbor_solicitation(const boost::asio::ip::address_v6&, ethernet_address_type&);
 
 			boost::asio::io_service m_tap_adapter_io_service;
-			boost::thread m_tap_adapter_thread;
+			boost::thread_group m_tap_adapter_threads;
 			boost::shared_ptr<asiotap::tap_adapter> m_tap_adapter;
-			std::queue<void_handler_type> m_tap_write_queue;
-			std::list<fscp::SharedBuffer> m_tap_adapter_buffers;
-
-			ethernet_filter_type m_ethernet_filter;
-			arp_filter_type m_arp_filter;
-			ipv4_filter_type m_ipv4_filter;
-			ipv6_filter_type m_ipv6_filter;
-			udp_filter_type m_udp_filter;
-			tcpv4_filter_type m_tcpv4_filter;
-			tcpv6_filter_type m_tcpv6_filter;
-			bootp_filter_type m_bootp_filter;
-			dhcp_filter_type m_dhcp_filter;
-			tun_ipv4_filter_type m_tun_ipv4_filter;
-			tun_ipv6_filter_type m_tun_ipv6_filter;
-			tun_tcpv4_filter_type m_tun_tcpv4_filter;
-			tun_tcpv6_filter_type m_tun_tcpv6_filter;
-			tun_icmpv6_filter_type m_tun_icmpv6_filter;
+			std::vector<tap_queue_ptr_type> m_tap_queues;
+
+			// When set, m_tap_adapter is never opened: it only identifies the tap adapter port.
+			boost::shared_ptr<virtual_tap_adapter> m_virtual_tap_adapter;
+			boost::scoped_ptr<boost::asio::io_service::work> m_virtual_tap_adapter_work;
+
+			std::atomic<uint64_t> m_tap_dropped_frames;
+
+			enum class tap_counter
+			{
+				frames_read,
+				bytes_read,
+				read_errors,
+				frames_written,
+				bytes_written,
+				write_errors,
+				gso_drops,
+				count
+			};
+
+			fscp::sharded_counters<tap_counter> m_tap_counters;
 
 			boost::scoped_ptr<arp_proxy_type> m_arp_proxy;
 			boost::scoped_ptr<dhcp_proxy_type> m_dhcp_proxy;
 			boost::scoped_ptr<icmpv6_proxy_type> m_icmpv6_proxy;
 
+			unsigned int m_tap_mtu;
 			boost::scoped_ptr<asiotap::osi::tcp_mss_morpher> m_tcp_mss_morpher;
 
 		private: /* Switch & router */
@@ -677,13 +800,15 @@ namespace freelan
 			template <typename WriteHandler>
 			void async_write_switch(const port_index_type& index, boost::asio::const_buffer data, WriteHandler handler)
 			{
-				m_router_strand.post(boost::bind(&core::do_write_switch, this, index, data, handler));
+				// The switch forwarding plane is thread-safe: frames do not need to go through the router strand.
+				m_switch.async_write(index, data, handler);
 			}
 
 			template <typename WriteHandler>
 			void async_write_router(const port_index_type& index, boost::asio::const_buffer data, WriteHandler handler)
 			{
-				m_router_strand.post(boost::bind(&core::do_write_router, this, index, data, handler));
+				// The router forwarding plane is thread-safe: frames do not need to go through the router strand.
+				m_router.async_write(index, data, handler);
 			}
 
 			void do_register_switch_port(const ep_type&, void_handler_type);
@@ -692,8 +817,7 @@ namespace freelan
 			void do_unregister_router_port(const ep_type&, void_handler_type);
 			void do_save_system_route(const ep_type&, const route_type&, void_handler_type);
 			void do_clear_client_router_info(const ep_type&, void_handler_type);
-			void do_write_switch(const port_index_type&, boost::asio::const_buffer, switch_::multi_write_handler_type);
-			void do_write_router(const port_index_type&, boost::asio::const_buffer, router::port_type::write_handler_type);
+			void do_set_port_mtu(const ep_type&, size_t);
 
 			boost::asio::strand m_router_strand;
 
@@ -704,6 +828,9 @@ namespace freelan
 			boost::optional<routes_message::version_type> m_local_routes_version;
 			client_router_info_map_type m_client_router_info_map;
 
+			// The MTU of the endpoint ports, as derived from their path MTU.
+			std::map<ep_type, size_t> m_port_mtus;
+
 		private:
 
 			void open_web_server();
@@ -712,6 +839,23 @@ namespace freelan
 			boost::shared_ptr<web_server> m_web_server;
 			boost::thread m_web_server_thread;
 
+		private: /* Metrics */
+
+			metrics_snapshot get_metrics(const fscp::server::statistics_type*, const boost::posix_time::time_duration&) const;
+
+			void open_metrics_socket();
+			void close_metrics_socket();
+
+#ifndef WINDOWS
+			typedef boost::asio::local::stream_protocol::acceptor metrics_acceptor_type;
+			typedef boost::asio::local::stream_protocol::socket metrics_socket_type;
+
+			void async_accept_metrics_connection(boost::shared_ptr<metrics_acceptor_type>);
+			void do_handle_metrics_connection(boost::shared_ptr<metrics_acceptor_type>, boost::shared_ptr<metrics_socket_type>, const boost::system::error_code&);
+
+			boost::shared_ptr<metrics_acceptor_type> m_metrics_acceptor;
+#endif
+
 		private:
 
 			void open_web_client();
@@ -0,0 +1,438 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file mac_address_table.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A MAC address learning table.
+ */
+
+#ifndef MAC_ADDRESS_TABLE_HPP
+#define MAC_ADDRESS_TABLE_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <stdint.h>
+
+namespace freelan
+{
+	/**
+	 * \brief A fixed-capacity open-addressing hash table that maps MAC addresses to values, with aging.
+	 * \tparam ValueType The value type.
+	 *
+	 * When the table is full, learning a new address evicts the least recently seen entry among a few entries close to the new one.
+	 *
+	 * The slots are allocated as entries are learned, so that a table sized for many entries costs little until it gets used.
+	 */
+	template <typename ValueType>
+	class mac_address_table
+	{
+		public:
+
+			/**
+			 * \brief The value type.
+			 */
+			typedef ValueType value_type;
+
+			/**
+			 * \brief The MAC address type.
+			 */
+			typedef boost::array<uint8_t, 6> mac_address_type;
+
+			/**
+			 * \brief The key type: a MAC address stored in the 48 lower bits of an integer.
+			 */
+			typedef uint64_t key_type;
+
+			/**
+			 * \brief The statistics type.
+			 */
+			struct statistics_type
+			{
+				statistics_type() :
+					learned(0),
+					moved(0),
+					evicted(0),
+					expired(0),
+					hits(0),
+					misses(0)
+				{}
+
+				uint64_t learned; /**< \brief The number of addresses that were learned. */
+				uint64_t moved; /**< \brief The number of addresses that changed value. */
+				uint64_t evicted; /**< \brief The number of entries evicted because the table was full. */
+				uint64_t expired; /**< \brief The number of entries that aged out. */
+				uint64_t hits; /**< \brief The number of successful lookups. */
+				uint64_t misses; /**< \brief The number of failed lookups. */
+			};
+
+			/**
+			 * \brief Convert a MAC address to a key.
+			 * \param address The MAC address.
+			 * \return The key.
+			 */
+			static key_type to_key(const mac_address_type& address)
+			{
+				key_type result = 0;
+
+				for (auto&& byte : address)
+				{
+					result = (result << 8) | byte;
+				}
+
+				return result;
+			}
+
+			/**
+			 * \brief Create a table.
+			 * \param max_entries The maximum number of entries. Must be at least 1.
+			 * \param aging_time The time after which an entry that was not seen expires. A non-positive value disables aging.
+			 */
+			mac_address_table(size_t max_entries, const boost::posix_time::time_duration& aging_time) :
+				m_max_entries(std::max<size_t>(max_entries, 1)),
+				m_aging_time(aging_time),
+				m_max_capacity(get_capacity(m_max_entries)),
+				m_slots(MIN_CAPACITY),
+				m_size(0),
+				m_statistics()
+			{}
+
+			/**
+			 * \brief Get the number of entries.
+			 * \return The number of entries, including the expired entries that were not purged yet.
+			 */
+			size_t size() const
+			{
+				return m_size;
+			}
+
+			/**
+			 * \brief Get the statistics.
+			 * \return The statistics.
+			 */
+			const statistics_type& statistics() const
+			{
+				return m_statistics;
+			}
+
+			/**
+			 * \brief Learn an address.
+			 * \param key The key of the address.
+			 * \param value The value to associate to the address.
+			 * \param now The current time.
+			 * \param full Whether an entry must be evicted to learn a new address even though the table is not full. This lets several tables share a capacity.
+			 */
+			void learn(key_type key, const value_type& value, const boost::posix_time::ptime& now, bool full = false)
+			{
+				size_t index = get_home_index(key);
+
+				for (; m_slots[index].used; index = next_index(index))
+				{
+					if (m_slots[index].key == key)
+					{
+						if (!(m_slots[index].value == value))
+						{
+							m_slots[index].value = value;
+							++m_statistics.moved;
+						}
+
+						m_slots[index].last_seen = now;
+
+						return;
+					}
+				}
+
+				if ((m_size >= m_max_entries) || (full && (m_size > 0)))
+				{
+					evict(key, now);
+				}
+				else if (((m_size + 1) * 2 > m_slots.size()) && (m_slots.size() < m_max_capacity))
+				{
+					grow();
+				}
+
+				// The eviction or the growth may have moved entries around: we look for a free slot again.
+				for (index = get_home_index(key); m_slots[index].used; index = next_index(index)) {}
+
+				slot_type& slot = m_slots[index];
+				slot.used = true;
+				slot.key = key;
+				slot.value = value;
+				slot.last_seen = now;
+
+				++m_size;
+				++m_statistics.learned;
+			}
+
+			/**
+			 * \brief Find the value associated to an address.
+			 * \param key The key of the address.
+			 * \param now The current time.
+			 * \return A pointer to the value, or a null pointer if the address is unknown or expired. The pointer is invalidated by any non-const call.
+			 */
+			const value_type* find(key_type key, const boost::posix_time::ptime& now)
+			{
+				for (size_t index = get_home_index(key); m_slots[index].used; index = next_index(index))
+				{
+					if (m_slots[index].key == key)
+					{
+						if (has_expired(m_slots[index], now))
+						{
+							erase_at(index);
+							++m_statistics.expired;
+
+							break;
+						}
+
+						++m_statistics.hits;
+
+						return &m_slots[index].value;
+					}
+				}
+
+				++m_statistics.misses;
+
+				return nullptr;
+			}
+
+			/**
+			 * \brief Find the value associated to an address, without updating the table.
+			 * \param key The key of the address.
+			 * \param now The current time.
+			 * \param last_seen If not null, receives the last time the address was seen when it is found.
+			 * \return A pointer to the value, or a null pointer if the address is unknown or expired. The pointer is invalidated by any non-const call.
+			 *
+			 * Unlike find(), expired entries are left in place and the statistics are not updated: this can be called concurrently on a table that is not modified.
+			 */
+			const value_type* peek(key_type key, const boost::posix_time::ptime& now, boost::posix_time::ptime* last_seen = nullptr) const
+			{
+				for (size_t index = get_home_index(key); m_slots[index].used; index = next_index(index))
+				{
+					if (m_slots[index].key == key)
+					{
+						if (has_expired(m_slots[index], now))
+						{
+							return nullptr;
+						}
+
+						if (last_seen)
+						{
+							*last_seen = m_slots[index].last_seen;
+						}
+
+						return &m_slots[index].value;
+					}
+				}
+
+				return nullptr;
+			}
+
+			/**
+			 * \brief Remove an address.
+			 * \param key The key of the address.
+			 * \return true if the address was removed.
+			 */
+			bool erase(key_type key)
+			{
+				for (size_t index = get_home_index(key); m_slots[index].used; index = next_index(index))
+				{
+					if (m_slots[index].key == key)
+					{
+						erase_at(index);
+
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+		private:
+
+			// The number of slots inspected when an entry must be evicted.
+			static const size_t EVICTION_SAMPLE_SIZE = 8;
+
+			// The number of slots of an empty table.
+			static const size_t MIN_CAPACITY = 16;
+
+			struct slot_type
+			{
+				slot_type() :
+					used(false),
+					key(),
+					value(),
+					last_seen()
+				{}
+
+				bool used;
+				key_type key;
+				value_type value;
+				boost::posix_time::ptime last_seen;
+			};
+
+			static size_t get_capacity(size_t max_entries)
+			{
+				// We keep the load factor under 50% so that probe sequences remain short.
+				size_t capacity = MIN_CAPACITY;
+
+				while (capacity < max_entries * 2)
+				{
+					capacity *= 2;
+				}
+
+				return capacity;
+			}
+
+			size_t get_home_index(key_type key) const
+			{
+				// Fibonacci hashing: the vendor bytes of MAC addresses are shared, so the high bits of the product are the ones we want.
+				return static_cast<size_t>((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & (m_slots.size() - 1);
+			}
+
+			size_t next_index(size_t index) const
+			{
+				return (index + 1) & (m_slots.size() - 1);
+			}
+
+			bool has_expired(const slot_type& slot, const boost::posix_time::ptime& now) const
+			{
+				return (m_aging_time > boost::posix_time::time_duration()) && (now > slot.last_seen + m_aging_time);
+			}
+
+			void evict(key_type key, const boost::posix_time::ptime& now)
+			{
+				// We start looking from the home index of the new key, and wrap around the whole table if needed to find enough entries.
+				size_t candidate = m_slots.size();
+				size_t sampled = 0;
+
+				for (size_t index = get_home_index(key), count = 0; (count < m_slots.size()) && (sampled < EVICTION_SAMPLE_SIZE); index = next_index(index), ++count)
+				{
+					if (m_slots[index].used)
+					{
+						if (has_expired(m_slots[index], now))
+						{
+							candidate = index;
+
+							break;
+						}
+
+						if ((candidate == m_slots.size()) || (m_slots[index].last_seen < m_slots[candidate].last_seen))
+						{
+							candidate = index;
+						}
+
+						++sampled;
+					}
+				}
+
+				if (candidate != m_slots.size())
+				{
+					const bool expired = has_expired(m_slots[candidate], now);
+
+					erase_at(candidate);
+
+					if (expired)
+					{
+						++m_statistics.expired;
+					}
+					else
+					{
+						++m_statistics.evicted;
+					}
+				}
+			}
+
+			void grow()
+			{
+				std::vector<slot_type> slots(m_slots.size() * 2);
+				slots.swap(m_slots);
+
+				for (auto&& slot : slots)
+				{
+					if (slot.used)
+					{
+						size_t index = get_home_index(slot.key);
+
+						for (; m_slots[index].used; index = next_index(index)) {}
+
+						m_slots[index] = slot;
+					}
+				}
+			}
+
+			void erase_at(size_t index)
+			{
+				// Backward shift deletion: no tombstones are needed.
+				m_slots[index] = slot_type();
+				--m_size;
+
+				for (size_t next = next_index(index); m_slots[next].used; next = next_index(next))
+				{
+					const size_t home = get_home_index(m_slots[next].key);
+
+					// The entry at next can only move to index if index lies cyclically between its home slot and next.
+					if (((next - home) & (m_slots.size() - 1)) >= ((next - index) & (m_slots.size() - 1)))
+					{
+						m_slots[index] = m_slots[next];
+						m_slots[next] = slot_type();
+						index = next;
+					}
+				}
+			}
+
+			size_t m_max_entries;
+			boost::posix_time::time_duration m_aging_time;
+			size_t m_max_capacity;
+			std::vector<slot_type> m_slots;
+			size_t m_size;
+			statistics_type m_statistics;
+	};
+
+	template <typename ValueType>
+	const size_t mac_address_table<ValueType>::EVICTION_SAMPLE_SIZE;
+
+	template <typename ValueType>
+	const size_t mac_address_table<ValueType>::MIN_CAPACITY;
+}
+
+#endif /* MAC_ADDRESS_TABLE_HPP */
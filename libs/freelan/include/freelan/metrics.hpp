@@ -0,0 +1,161 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file metrics.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A snapshot of runtime metrics.
+ */
+
+#ifndef FREELAN_METRICS_HPP
+#define FREELAN_METRICS_HPP
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+#include <kfather/value.hpp>
+
+namespace freelan
+{
+	/**
+	 * \brief A snapshot of runtime metrics.
+	 *
+	 * Metrics are grouped in families that share a name, a type and a description. The samples of a family are told apart by their labels.
+	 */
+	class metrics_snapshot
+	{
+		public:
+
+			/**
+			 * \brief The labels type.
+			 */
+			typedef std::map<std::string, std::string> labels_type;
+
+			/**
+			 * \brief The buckets type.
+			 *
+			 * Every bucket is made of its upper bound and of the number of observations lower than or equal to it: the counts are cumulative.
+			 */
+			typedef std::vector<std::pair<double, uint64_t> > buckets_type;
+
+			/**
+			 * \brief The metric types.
+			 */
+			enum class metric_type
+			{
+				counter, /**< \brief A value that only ever increases. */
+				gauge, /**< \brief A value that can go up and down. */
+				histogram /**< \brief A distribution of observations, counted in buckets. */
+			};
+
+			/**
+			 * \brief Add a sample.
+			 * \param name The name of the metric family. Must only contain letters, digits and underscores.
+			 * \param type The type of the metric family.
+			 * \param help The description of the metric family.
+			 * \param value The value of the sample.
+			 * \param labels The labels of the sample.
+			 *
+			 * The type and the description of a family are set by its first sample.
+			 */
+			void add(const std::string& name, metric_type type, const std::string& help, double value, const labels_type& labels = labels_type());
+
+			/**
+			 * \brief Add a histogram sample.
+			 * \param name The name of the metric family. Must only contain letters, digits and underscores.
+			 * \param help The description of the metric family.
+			 * \param buckets The buckets, by increasing upper bound. The implicit last bucket, with no upper bound, holds count observations.
+			 * \param sum The sum of all the observations.
+			 * \param count The number of observations.
+			 * \param labels The labels of the sample.
+			 */
+			void add_histogram(const std::string& name, const std::string& help, const buckets_type& buckets, double sum, uint64_t count, const labels_type& labels = labels_type());
+
+			/**
+			 * \brief Convert the snapshot to JSON.
+			 * \return An object with one member per family, each holding its type, description and samples.
+			 */
+			kfather::object_type to_json() const;
+
+			/**
+			 * \brief Write the snapshot as compact JSON.
+			 * \param os The output stream.
+			 * \return os.
+			 * \see to_json
+			 */
+			std::ostream& write_json(std::ostream& os) const;
+
+			/**
+			 * \brief Write the snapshot in the Prometheus text exposition format.
+			 * \param os The output stream.
+			 * \return os.
+			 */
+			std::ostream& write_prometheus(std::ostream& os) const;
+
+		private:
+
+			struct sample_type
+			{
+				labels_type labels;
+				double value;
+
+				// Only set for histograms, whose value is the number of observations.
+				buckets_type buckets;
+				double sum;
+			};
+
+			void add_sample(const std::string& name, metric_type type, const std::string& help, const sample_type& sample);
+
+			struct family_type
+			{
+				metric_type type;
+				std::string help;
+				std::vector<sample_type> samples;
+			};
+
+			std::map<std::string, family_type> m_families;
+	};
+}
+
+#endif /* FREELAN_METRICS_HPP */
@@ -0,0 +1,269 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file route_trie.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A longest-prefix-match route table.
+ */
+
+#ifndef ROUTE_TRIE_HPP
+#define ROUTE_TRIE_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <asiotap/types/ip_network_address.hpp>
+
+namespace freelan
+{
+	/**
+	 * \brief A binary trie that maps network addresses to values.
+	 * \tparam AddressType The address type.
+	 * \tparam ValueType The value type. It must be less-than and equality comparable.
+	 *
+	 * Lookups walk at most one node per bit of the address and do not allocate.
+	 *
+	 * The nodes are immutable and shared between the copies of a trie: a modification only copies the nodes on the path to the modified network address, so that a copy can be changed cheaply while the original is still being read.
+	 */
+	template <typename AddressType, typename ValueType>
+	class route_trie
+	{
+		public:
+
+			/**
+			 * \brief The address type.
+			 */
+			typedef AddressType address_type;
+
+			/**
+			 * \brief The network address type.
+			 */
+			typedef asiotap::base_ip_network_address<address_type> network_address_type;
+
+			/**
+			 * \brief The value type.
+			 */
+			typedef ValueType value_type;
+
+			/**
+			 * \brief The maximum prefix length.
+			 */
+			static const size_t max_prefix_length = network_address_type::single_address_prefix_length;
+
+			/**
+			 * \brief Create an empty trie.
+			 */
+			route_trie() :
+				m_root()
+			{}
+
+			/**
+			 * \brief Remove all the values.
+			 */
+			void clear()
+			{
+				m_root.reset();
+			}
+
+			/**
+			 * \brief Add a value for a network address.
+			 * \param network_address The network address. The bits of its address beyond its prefix length are ignored.
+			 * \param value The value.
+			 *
+			 * Values added for the same network address are kept sorted, whatever the order they were added in.
+			 */
+			void insert(const network_address_type& network_address, const value_type& value)
+			{
+				const typename address_type::bytes_type bytes = network_address.address().to_bytes();
+				const size_t prefix_length = std::min<size_t>(network_address.prefix_length(), max_prefix_length);
+
+				m_root = insert(m_root, bytes, prefix_length, 0, value);
+			}
+
+			/**
+			 * \brief Remove a value for a network address.
+			 * \param network_address The network address. The bits of its address beyond its prefix length are ignored.
+			 * \param value The value.
+			 *
+			 * If the value was added several times for the network address, only one of them is removed. If it was not added, nothing is done.
+			 */
+			void erase(const network_address_type& network_address, const value_type& value)
+			{
+				const typename address_type::bytes_type bytes = network_address.address().to_bytes();
+				const size_t prefix_length = std::min<size_t>(network_address.prefix_length(), max_prefix_length);
+
+				m_root = erase(m_root, bytes, prefix_length, 0, value);
+			}
+
+			/**
+			 * \brief Visit the values whose network address contains the specified address, from the most specific to the least specific.
+			 * \param address The address.
+			 * \param visitor A callable that takes a const value_type& and returns true to stop the visit.
+			 * \return true if the visitor stopped the visit.
+			 */
+			template <typename Visitor>
+			bool find(const address_type& address, Visitor visitor) const
+			{
+				const typename address_type::bytes_type bytes = address.to_bytes();
+
+				boost::array<const node_type*, max_prefix_length + 1> path;
+				size_t path_length = 0;
+				const node_type* node = m_root.get();
+
+				for (size_t bit = 0; node; ++bit)
+				{
+					if (!node->values.empty())
+					{
+						path[path_length++] = node;
+					}
+
+					if (bit == max_prefix_length)
+					{
+						break;
+					}
+
+					node = node->children[get_bit(bytes, bit)].get();
+				}
+
+				while (path_length > 0)
+				{
+					for (auto&& value : path[--path_length]->values)
+					{
+						if (visitor(value))
+						{
+							return true;
+						}
+					}
+				}
+
+				return false;
+			}
+
+		private:
+
+			struct node_type;
+
+			typedef boost::shared_ptr<const node_type> node_ptr_type;
+
+			struct node_type
+			{
+				boost::array<node_ptr_type, 2> children;
+				std::vector<value_type> values;
+			};
+
+			static size_t get_bit(const typename address_type::bytes_type& bytes, size_t bit)
+			{
+				return (bytes[bit / 8] >> (7 - (bit % 8))) & 0x01;
+			}
+
+			static node_ptr_type insert(const node_ptr_type& node, const typename address_type::bytes_type& bytes, size_t prefix_length, size_t bit, const value_type& value)
+			{
+				const boost::shared_ptr<node_type> result = node ? boost::make_shared<node_type>(*node) : boost::make_shared<node_type>();
+
+				if (bit == prefix_length)
+				{
+					result->values.insert(std::upper_bound(result->values.begin(), result->values.end(), value), value);
+				}
+				else
+				{
+					const size_t branch = get_bit(bytes, bit);
+
+					result->children[branch] = insert(result->children[branch], bytes, prefix_length, bit + 1, value);
+				}
+
+				return result;
+			}
+
+			static node_ptr_type erase(const node_ptr_type& node, const typename address_type::bytes_type& bytes, size_t prefix_length, size_t bit, const value_type& value)
+			{
+				if (!node)
+				{
+					return node;
+				}
+
+				boost::shared_ptr<node_type> result;
+
+				if (bit == prefix_length)
+				{
+					const typename std::vector<value_type>::const_iterator value_entry = std::find(node->values.begin(), node->values.end(), value);
+
+					if (value_entry == node->values.end())
+					{
+						return node;
+					}
+
+					result = boost::make_shared<node_type>(*node);
+					result->values.erase(result->values.begin() + (value_entry - node->values.begin()));
+				}
+				else
+				{
+					const size_t branch = get_bit(bytes, bit);
+					const node_ptr_type child = erase(node->children[branch], bytes, prefix_length, bit + 1, value);
+
+					if (child == node->children[branch])
+					{
+						return node;
+					}
+
+					result = boost::make_shared<node_type>(*node);
+					result->children[branch] = child;
+				}
+
+				// The nodes that lead to no value are pruned.
+				if (result->values.empty() && !result->children[0] && !result->children[1])
+				{
+					return node_ptr_type();
+				}
+
+				return result;
+			}
+
+			node_ptr_type m_root;
+	};
+
+	template <typename AddressType, typename ValueType>
+	const size_t route_trie<AddressType, ValueType>::max_prefix_length;
+}
+
+#endif /* ROUTE_TRIE_HPP */
@@ -61,14 +61,19 @@
 #include <asiotap/osi/ipv6_frame.hpp>
 #include <asiotap/types/ip_network_address.hpp>
 
+#include <fscp/counters.hpp>
+
 #include "configuration.hpp"
 #include "port_index.hpp"
 #include "routes_message.hpp"
+#include "route_trie.hpp"
 
 namespace freelan
 {
 	/**
 	 * \brief A class that represents a router.
+	 *
+	 * The ports and their routes must only be modified from one strand. Every modification publishes an immutable snapshot of the forwarding state, which async_write() reads without locking: frames can be routed from any thread.
 	 */
 	class router
 	{
@@ -103,7 +108,9 @@ namespace freelan
 						m_write_function(),
 						m_local_routes(),
 						m_group(),
-						m_router(NULL)
+						m_mtu(),
+						m_router(NULL),
+						m_index()
 					{}
 
 					/**
@@ -115,7 +122,9 @@ namespace freelan
 						m_write_function(write_function),
 						m_local_routes(),
 						m_group(_group),
-						m_router(NULL)
+						m_mtu(),
+						m_router(NULL),
+						m_index()
 					{}
 
 					/**
@@ -126,29 +135,31 @@ namespace freelan
 						m_write_function(other.m_write_function),
 						m_local_routes(other.m_local_routes),
 						m_group(other.m_group),
-						m_router(NULL)
+						m_mtu(other.m_mtu),
+						m_router(NULL),
+						m_index()
 					{}
 
-					/**
-					 * \brief Destructor.
-					 */
-					~port_type()
-					{
-						dissociate_from_router();
-					}
-
 					/**
 					 * \brief Assignment operator.
 					 * \param other The other instance.
 					 * \return *this.
+					 *
+					 * If the port is registered, it remains so and is published again.
 					 */
 					port_type& operator=(const port_type& other)
 					{
-						dissociate_from_router();
+						asiotap::ip_route_set previous_local_routes = other.m_local_routes;
 
 						m_write_function = other.m_write_function;
-						m_local_routes = other.m_local_routes;
+						m_local_routes.swap(previous_local_routes);
 						m_group = other.m_group;
+						m_mtu = other.m_mtu;
+
+						if (m_router)
+						{
+							m_router->publish_port(m_index, previous_local_routes);
+						}
 
 						return *this;
 					}
@@ -175,11 +186,13 @@ namespace freelan
 
 					void set_local_routes(const asiotap::ip_route_set& _local_routes)
 					{
-						m_local_routes = _local_routes;
+						asiotap::ip_route_set previous_local_routes = _local_routes;
+
+						m_local_routes.swap(previous_local_routes);
 
 						if (m_router)
 						{
-							m_router->invalidate_routes();
+							m_router->publish_port(m_index, previous_local_routes);
 						}
 					}
 
@@ -193,35 +206,49 @@ namespace freelan
 						return m_group;
 					}
 
-				private:
-
-					void associate_to_router(router* _router)
+					/**
+					 * \brief Get the MTU of the port.
+					 * \return The greatest packet size that the port delivers without fragmentation, or 0 if it is not known.
+					 */
+					size_t mtu() const
 					{
-						m_router = _router;
-
-						if (m_router)
-						{
-							m_router->invalidate_routes();
-						}
+						return m_mtu;
 					}
 
-					void dissociate_from_router()
+					/**
+					 * \brief Set the MTU of the port.
+					 * \param _mtu The greatest packet size that the port delivers without fragmentation, or 0 if it is not known.
+					 */
+					void set_mtu(size_t _mtu)
 					{
-						if (m_router)
+						if (m_mtu != _mtu)
 						{
-							m_router->invalidate_routes();
+							m_mtu = _mtu;
 
-							m_router = NULL;
+							if (m_router)
+							{
+								m_router->publish_port(m_index, m_local_routes);
+							}
 						}
 					}
 
+				private:
+
+					void associate_to_router(router* _router, const port_index_type& index)
+					{
+						m_router = _router;
+						m_index = index;
+					}
+
 					friend class router;
 
 					write_function_type m_write_function;
 					asiotap::ip_route_set m_local_routes;
 					asiotap::ip_address_set m_local_dns_servers;
 					port_group_type m_group;
+					size_t m_mtu;
 					router* m_router;
+					port_index_type m_index;
 			};
 
 			/**
@@ -229,20 +256,47 @@ namespace freelan
 			 */
 			typedef std::map<port_index_type, port_type> port_list_type;
 
+			/**
+			 * \brief The statistics type.
+			 */
+			struct statistics_type
+			{
+				uint64_t routed_packets; /**< \brief The number of unicast packets sent to the port of their best route. */
+				uint64_t multicast_packets; /**< \brief The number of multicast packets sent to all the ports. */
+				uint64_t no_route_drops; /**< \brief The number of unicast packets dropped because they matched no route. */
+				uint64_t unsupported_drops; /**< \brief The number of frames dropped because they were neither IPv4 nor IPv6 packets. */
+			};
+
 			/**
 			 * \brief Create a new router.
 			 * \param configuration The router configuration.
 			 */
 			router(const router_configuration& configuration) :
-				m_configuration(configuration)
+				m_configuration(configuration),
+				m_forwarding_table(boost::make_shared<forwarding_table_type>()),
+				m_counters()
 			{}
 
+			/**
+			 * \brief Destroy the router.
+			 */
+			~router()
+			{
+				// The ports must not publish anything while the router is being destroyed.
+				for (auto&& port_entry : m_ports)
+				{
+					port_entry.second.m_router = NULL;
+				}
+			}
+
 			/**
 			 * \brief Invalidate the routes cache.
+			 *
+			 * The forwarding state is compiled and published again from all the ports. Changing a port already publishes the changes it makes, so this is seldom needed.
 			 */
 			void invalidate_routes()
 			{
-				m_routes = boost::none;
+				publish_forwarding_table();
 			}
 
 			/**
@@ -252,10 +306,11 @@ namespace freelan
 			 */
 			void register_port(port_index_type index, port_type port)
 			{
-				port_type& local_port = (m_ports[index] = port);
+				port_type& local_port = m_ports[index];
 
-				// This takes care of automatically clearing the route cache whenever needed.
-				local_port.associate_to_router(this);
+				// The port publishes its changes from now on, starting with the assignment.
+				local_port.associate_to_router(this, index);
+				local_port = port;
 			}
 
 			/**
@@ -266,7 +321,18 @@ namespace freelan
 			 */
 			void unregister_port(port_index_type index)
 			{
-				m_ports.erase(index);
+				const port_list_type::iterator port_entry = m_ports.find(index);
+
+				if (port_entry != m_ports.end())
+				{
+					asiotap::ip_route_set previous_local_routes;
+
+					previous_local_routes.swap(port_entry->second.m_local_routes);
+					port_entry->second.m_router = NULL;
+					m_ports.erase(port_entry);
+
+					publish_port(index, previous_local_routes);
+				}
 			}
 
 			/**
@@ -282,7 +348,7 @@ namespace freelan
 			/**
 			 * \brief Get the port associated to a given index, if it exists.
 			 * \param index The index of the port to get.
-			 * \return A pointer to the port.
+			 * \return A pointer to the port. Changing the routes of the port publishes a new forwarding state.
 			 */
 			port_type* get_port(port_index_type index)
 			{
@@ -300,28 +366,101 @@ namespace freelan
 			 * \brief Receive data trough the specified port.
 			 * \param index The port from which the data comes.
 			 * \param data The data to write.
-			 * \param handler The handler to call when the write is complete.
+			 * \param handler The handler to call when the write is complete. It is called once for every target port.
+			 *
+			 * This method is thread-safe.
+			 */
+			void async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler) const;
+
+			/**
+			 * \brief Get the MTU of the port a packet would be routed to.
+			 * \param index The port from which the packet comes.
+			 * \param destination The destination of the packet.
+			 * \return The MTU of the port the packet would be routed to. If the packet is a multicast one, if it has no route or if the MTU of its target is not known, 0 is returned.
+			 *
+			 * This method is thread-safe.
+			 */
+			size_t get_target_mtu(port_index_type index, const boost::asio::ip::address_v4& destination) const;
+
+			/**
+			 * \brief Get the MTU of the port a packet would be routed to.
+			 * \param index The port from which the packet comes.
+			 * \param destination The destination of the packet.
+			 * \return The MTU of the port the packet would be routed to. If the packet is a multicast one, if it has no route or if the MTU of its target is not known, 0 is returned.
+			 *
+			 * This method is thread-safe.
+			 */
+			size_t get_target_mtu(port_index_type index, const boost::asio::ip::address_v6& destination) const;
+
+			/**
+			 * \brief Get the router statistics.
+			 * \return The statistics.
+			 *
+			 * This method is thread-safe.
 			 */
-			void async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler);
+			statistics_type statistics() const;
 
 		private:
 
-			std::vector<const port_type*> get_targets_for(port_index_type, boost::asio::const_buffer);
+			/**
+			 * \brief The compiled routes, indexed by network address.
+			 */
+			struct routes_port_type
+			{
+				route_trie<boost::asio::ip::address_v4, port_index_type> ipv4;
+				route_trie<boost::asio::ip::address_v6, port_index_type> ipv6;
+
+				const route_trie<boost::asio::ip::address_v4, port_index_type>& get(const boost::asio::ip::address_v4&) const { return ipv4; }
+				const route_trie<boost::asio::ip::address_v6, port_index_type>& get(const boost::asio::ip::address_v6&) const { return ipv6; }
+			};
+
+			class route_inserter;
+			class route_eraser;
+
+			// The ports are copies: they are not associated to the router.
+			typedef std::map<port_index_type, boost::shared_ptr<const port_type> > port_snapshot_list_type;
+
+			/**
+			 * \brief An immutable snapshot of the forwarding state.
+			 *
+			 * A snapshot shares the ports and the route nodes that did not change with the snapshot it was derived from.
+			 */
+			struct forwarding_table_type
+			{
+				port_snapshot_list_type ports;
+				routes_port_type routes;
+			};
+
+			typedef boost::shared_ptr<const forwarding_table_type> forwarding_table_ptr_type;
+
+			void publish_forwarding_table();
+			void publish_port(port_index_type, const asiotap::ip_route_set&);
+
+			template <typename AddressType>
+			void async_write(const forwarding_table_type&, port_snapshot_list_type::const_iterator, const AddressType&, boost::asio::const_buffer, port_type::write_handler_type) const;
 
 			template <typename AddressType>
-			std::vector<const port_type*> get_targets_for(port_index_type, const AddressType&);
+			size_t get_target_mtu(port_index_type, const AddressType&) const;
 
 			router_configuration m_configuration;
 
+			// Only accessed by the control plane.
 			port_list_type m_ports;
 
-			asiotap::osi::filter<asiotap::osi::ipv4_frame> m_ipv4_filter;
-			asiotap::osi::filter<asiotap::osi::ipv6_frame> m_ipv6_filter;
+			// Always accessed atomically.
+			forwarding_table_ptr_type m_forwarding_table;
 
-			typedef std::multimap<asiotap::ip_route, port_index_type> routes_port_type;
+			enum class counter
+			{
+				routed_packets,
+				multicast_packets,
+				no_route_drops,
+				unsupported_drops,
+				count
+			};
 
-			const routes_port_type& routes() const;
-			mutable boost::optional<routes_port_type> m_routes;
+			// Updated by async_write(), which is otherwise read-only.
+			mutable fscp::sharded_counters<counter> m_counters;
 	};
 }
 
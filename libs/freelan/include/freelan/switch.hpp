@@ -47,43 +47,44 @@
 #define SWITCH_HPP
 
 #include <algorithm>
+#include <atomic>
 #include <map>
-#include <set>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <fscp/counters.hpp>
 
 #include "configuration.hpp"
 #include "port_index.hpp"
+#include "mac_address_table.hpp"
 
 namespace freelan
 {
 	/**
 	 * \brief A class that represents a switch.
+	 *
+	 * The ports must only be registered and unregistered from one strand. Every change publishes an immutable snapshot of the ports, which async_write() reads without locking. The ethernet address table is sharded, and every shard publishes an immutable snapshot of its entries as well: switching a frame from a known sender to a known target takes no lock.
 	 */
 	class switch_
 	{
 		public:
 
-			/**
-			 * \brief The default maximum entry count.
-			 */
-			static const unsigned int MAX_ENTRIES_DEFAULT;
-
 			/**
 			 * \brief The port group type.
 			 */
 			typedef unsigned int port_group_type;
 
-			/**
-			 * \brief The multi write result type.
-			 */
-			typedef std::map<port_index_type, boost::system::error_code> multi_write_result_type;
-
 			/**
 			 * \brief The write handler type.
+			 *
+			 * The handler is called once, when the frame was written to all its target ports. It receives the first error that occurred, if any.
 			 */
-			typedef boost::function<void (const multi_write_result_type&)> multi_write_handler_type;
+			typedef boost::function<void (const boost::system::error_code&)> multi_write_handler_type;
 
 			/**
 			 * \brief A switch port type.
@@ -95,7 +96,7 @@ namespace freelan
 					/**
 					 * \brief The write handler type.
 					 */
-					typedef boost::function<void (boost::system::error_code)> write_handler_type;
+					typedef boost::function<void (const boost::system::error_code&)> write_handler_type;
 
 					/**
 					 * \brief A write function type.
@@ -107,7 +108,8 @@ namespace freelan
 					 */
 					port_type() :
 						m_write_function(),
-						m_group()
+						m_group(),
+						m_mtu()
 					{}
 
 					/**
@@ -117,7 +119,8 @@ namespace freelan
 					 */
 					port_type(write_function_type write_function, port_group_type _group) :
 						m_write_function(write_function),
-						m_group(_group)
+						m_group(_group),
+						m_mtu()
 					{}
 
 					/**
@@ -125,7 +128,7 @@ namespace freelan
 					 * \param data The data to write.
 					 * \param handler The handler to call when the write is complete.
 					 */
-					void async_write(boost::asio::const_buffer data, write_handler_type handler)
+					void async_write(boost::asio::const_buffer data, write_handler_type handler) const
 					{
 						m_write_function(data, handler);
 					}
@@ -135,10 +138,29 @@ namespace freelan
 						return m_group;
 					}
 
+					/**
+					 * \brief Get the MTU of the port.
+					 * \return The greatest frame payload size that the port delivers without fragmentation, or 0 if it is not known.
+					 */
+					size_t mtu() const
+					{
+						return m_mtu;
+					}
+
+					/**
+					 * \brief Set the MTU of the port.
+					 * \param _mtu The greatest frame payload size that the port delivers without fragmentation, or 0 if it is not known.
+					 */
+					void set_mtu(size_t _mtu)
+					{
+						m_mtu = _mtu;
+					}
+
 				private:
 
 					write_function_type m_write_function;
 					port_group_type m_group;
+					size_t m_mtu;
 			};
 
 			/**
@@ -146,15 +168,27 @@ namespace freelan
 			 */
 			typedef std::map<port_index_type, port_type> port_list_type;
 
+			/**
+			 * \brief The ethernet address table type.
+			 */
+			typedef mac_address_table<port_index_type> ethernet_address_table_type;
+
+			/**
+			 * \brief The statistics type.
+			 */
+			struct statistics_type
+			{
+				ethernet_address_table_type::statistics_type ethernet_address_table; /**< \brief The ethernet address table statistics. */
+				size_t ethernet_address_table_size; /**< \brief The number of entries in the ethernet address table. */
+				uint64_t switched_frames; /**< \brief The number of frames sent to a single known port. */
+				uint64_t flooded_frames; /**< \brief The number of frames sent to all the ports, because their target is a multicast or an unknown address. */
+			};
+
 			/**
 			 * \brief Create a new switch.
 			 * \param configuration The switch configuration.
-			 * \param max_entries maximum entries allowed.
 			 */
-			switch_(const switch_configuration& configuration, const unsigned int max_entries = MAX_ENTRIES_DEFAULT) :
-				m_configuration(configuration),
-				m_max_entries(max_entries)
-			{}
+			switch_(const switch_configuration& configuration);
 
 			/**
 			 * \brief Register a switch port.
@@ -164,6 +198,8 @@ namespace freelan
 			void register_port(port_index_type index, port_type port)
 			{
 				m_ports[index] = port;
+
+				publish_ports();
 			}
 
 			/**
@@ -174,7 +210,10 @@ namespace freelan
 			 */
 			void unregister_port(port_index_type index)
 			{
-				m_ports.erase(index);
+				if (m_ports.erase(index) > 0)
+				{
+					publish_ports();
+				}
 			}
 
 			/**
@@ -184,34 +223,120 @@ namespace freelan
 			 */
 			bool is_registered(port_index_type index) const
 			{
+				// This is only meant for the control plane.
 				return (m_ports.find(index) != m_ports.end());
 			}
 
+			/**
+			 * \brief Set the MTU of a port.
+			 * \param index The port. If it is not registered, nothing is done.
+			 * \param mtu The greatest frame payload size that the port delivers without fragmentation, or 0 if it is not known.
+			 */
+			void set_port_mtu(port_index_type index, size_t mtu)
+			{
+				const port_list_type::iterator port_entry = m_ports.find(index);
+
+				if ((port_entry != m_ports.end()) && (port_entry->second.mtu() != mtu))
+				{
+					port_entry->second.set_mtu(mtu);
+
+					publish_ports();
+				}
+			}
+
+			/**
+			 * \brief Get the MTU of the port a frame would be switched to.
+			 * \param data The frame.
+			 * \return The MTU of the single port data would be switched to. If data would be flooded, or if the MTU of its target is not known, 0 is returned.
+			 *
+			 * No ethernet address is learnt. This method is thread-safe.
+			 */
+			size_t get_target_mtu(boost::asio::const_buffer data);
+
 			/**
 			 * \brief Receive data trough the specified port.
 			 * \param index The port from which the data comes.
 			 * \param data The data to write.
 			 * \param handler The handler to call when the write is complete.
+			 *
+			 * This method is thread-safe.
 			 */
 			void async_write(port_index_type index, boost::asio::const_buffer data, multi_write_handler_type handler);
 
+			/**
+			 * \brief Get the switch statistics.
+			 * \return The statistics.
+			 *
+			 * This method is thread-safe.
+			 */
+			statistics_type statistics() const;
+
 		private:
 
-			std::set<port_index_type> get_targets_for(port_index_type, boost::asio::const_buffer);
-			std::set<port_index_type> get_targets_for(port_list_type::const_iterator);
+			typedef boost::shared_ptr<const port_list_type> port_list_ptr_type;
+
+			typedef boost::shared_ptr<const ethernet_address_table_type> ethernet_address_table_ptr_type;
+
+			/**
+			 * \brief A shard of the ethernet address table.
+			 */
+			struct ethernet_address_table_shard_type
+			{
+				ethernet_address_table_shard_type(size_t max_entries, const boost::posix_time::time_duration& aging_time) :
+					mutex(),
+					table(max_entries, aging_time),
+					snapshot(boost::make_shared<ethernet_address_table_type>(table))
+				{}
+
+				boost::mutex mutex;
+
+				// Only accessed with the mutex locked.
+				ethernet_address_table_type table;
+
+				// A copy of the table, republished after every change of its entries. Always accessed atomically.
+				ethernet_address_table_ptr_type snapshot;
+			};
+
+			/**
+			 * \brief The number of ethernet address table shards.
+			 */
+			static const size_t ETHERNET_ADDRESS_TABLE_SHARDS = 16;
+
+			void publish_ports();
+			ethernet_address_table_shard_type& get_shard(ethernet_address_table_type::key_type);
+			void update_ethernet_address_table_size(size_t, size_t);
+			void publish_shard(ethernet_address_table_shard_type&);
+			void learn_ethernet_address(ethernet_address_table_type::key_type, port_index_type, const boost::posix_time::ptime&);
+			const port_index_type* find_ethernet_address(ethernet_address_table_type::key_type, const boost::posix_time::ptime&, ethernet_address_table_ptr_type&);
+			const port_type* get_target_for(const port_list_type&, port_list_type::const_iterator, boost::asio::const_buffer);
+			bool is_flood_target(port_list_type::const_iterator, port_list_type::const_iterator) const;
 
 			switch_configuration m_configuration;
-			unsigned int m_max_entries;
 
+			// Only accessed by the control plane.
 			port_list_type m_ports;
 
-			typedef boost::array<uint8_t, 6> ethernet_address_type;
-			typedef std::map<ethernet_address_type, port_index_type> ethernet_address_map_type;
+			// Always accessed atomically.
+			port_list_ptr_type m_ports_snapshot;
+
+			typedef ethernet_address_table_type::mac_address_type ethernet_address_type;
 
 			static ethernet_address_type to_ethernet_address(boost::asio::const_buffer);
 			static bool is_multicast_address(const ethernet_address_type&);
 
-			ethernet_address_map_type m_ethernet_address_map;
+			enum class counter
+			{
+				switched_frames,
+				flooded_frames,
+				snapshot_hits,
+				count
+			};
+
+			std::vector<boost::shared_ptr<ethernet_address_table_shard_type> > m_ethernet_address_table_shards;
+
+			// The number of entries in all the shards. A shard that learns a new address while the maximum is reached evicts one of its own entries instead of growing, unless it is empty: the table can thus exceed the maximum by less than one entry per shard.
+			std::atomic<size_t> m_ethernet_address_table_size;
+			fscp::sharded_counters<counter> m_counters;
 	};
 }
 
@@ -0,0 +1,100 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file virtual_tap_adapter.hpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A virtual tap adapter interface.
+ */
+
+#ifndef VIRTUAL_TAP_ADAPTER_HPP
+#define VIRTUAL_TAP_ADAPTER_HPP
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+
+namespace freelan
+{
+	/**
+	 * \brief A virtual tap adapter.
+	 *
+	 * A core that is given a virtual tap adapter uses it instead of opening a system tap adapter: it reads the frames to send to its peers from it and writes the frames it receives from them to it. Nothing gets configured on the host, so that a core can run without privileges nor devices.
+	 *
+	 * A virtual tap adapter has a single queue, no offloading and no IP addresses. Its layer is the one of the core configuration.
+	 */
+	class virtual_tap_adapter
+	{
+		public:
+
+			/**
+			 * \brief The read handler type.
+			 */
+			typedef boost::function<void (const boost::system::error_code&, size_t)> read_handler_type;
+
+			/**
+			 * \brief Destroy the virtual tap adapter.
+			 */
+			virtual ~virtual_tap_adapter() {}
+
+			/**
+			 * \brief Read a frame.
+			 * \param buffer The buffer to read the frame into. It remains valid until the handler is called.
+			 * \param handler The handler to call with the size of the frame. It must not be called from within async_read().
+			 *
+			 * The core only has one read pending at a time.
+			 */
+			virtual void async_read(boost::asio::mutable_buffer buffer, read_handler_type handler) = 0;
+
+			/**
+			 * \brief Write a frame.
+			 * \param data The frame. It is only valid during the call.
+			 * \param ec The error code, if any. boost::asio::error::would_block is not supported.
+			 */
+			virtual void write(boost::asio::const_buffer data, boost::system::error_code& ec) = 0;
+
+			/**
+			 * \brief Cancel the pending read, if any.
+			 *
+			 * The handler of the pending read must be called with boost::asio::error::operation_aborted before cancel() returns.
+			 */
+			virtual void cancel() = 0;
+	};
+}
+
+#endif /* VIRTUAL_TAP_ADAPTER_HPP */
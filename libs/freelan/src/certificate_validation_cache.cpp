@@ -0,0 +1,148 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file certificate_validation_cache.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A cache of certificate validation results.
+ */
+
+#include "certificate_validation_cache.hpp"
+
+namespace freelan
+{
+	certificate_validation_cache::certificate_validation_cache(size_t max_entries) :
+		m_max_entries(max_entries),
+		m_mutex(),
+		m_lru_list(),
+		m_entries(),
+		m_statistics()
+	{
+	}
+
+	boost::optional<bool> certificate_validation_cache::find(const hash_type& hash, generation_type generation, const boost::posix_time::ptime& now)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		const entry_map_type::iterator entry = m_entries.find(key_type(hash, generation));
+
+		if (entry == m_entries.end())
+		{
+			++m_statistics.misses;
+
+			return boost::none;
+		}
+
+		if (now >= entry->second.expires_at)
+		{
+			m_lru_list.erase(entry->second.lru_position);
+			m_entries.erase(entry);
+
+			++m_statistics.expired;
+			++m_statistics.misses;
+
+			return boost::none;
+		}
+
+		m_lru_list.splice(m_lru_list.begin(), m_lru_list, entry->second.lru_position);
+
+		++m_statistics.hits;
+
+		return entry->second.valid;
+	}
+
+	void certificate_validation_cache::insert(const hash_type& hash, generation_type generation, bool valid, const boost::posix_time::ptime& expires_at)
+	{
+		if (m_max_entries == 0)
+		{
+			return;
+		}
+
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		const key_type key(hash, generation);
+		const entry_map_type::iterator entry = m_entries.find(key);
+
+		if (entry != m_entries.end())
+		{
+			// Another thread validated the same certificate in the meantime.
+			entry->second.valid = valid;
+			entry->second.expires_at = expires_at;
+			m_lru_list.splice(m_lru_list.begin(), m_lru_list, entry->second.lru_position);
+
+			return;
+		}
+
+		if (m_entries.size() >= m_max_entries)
+		{
+			m_entries.erase(m_lru_list.back());
+			m_lru_list.pop_back();
+
+			++m_statistics.evicted;
+		}
+
+		m_lru_list.push_front(key);
+
+		const entry_type new_entry = { valid, expires_at, m_lru_list.begin() };
+
+		m_entries.insert(std::make_pair(key, new_entry));
+	}
+
+	void certificate_validation_cache::clear()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		m_entries.clear();
+		m_lru_list.clear();
+	}
+
+	size_t certificate_validation_cache::size() const
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		return m_entries.size();
+	}
+
+	certificate_validation_cache::statistics_type certificate_validation_cache::statistics() const
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		return m_statistics;
+	}
+}
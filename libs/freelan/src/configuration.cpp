@@ -79,7 +79,15 @@ namespace freelan
 		accept_contact_requests(true),
 		accept_contacts(true),
 		hostname_resolution_protocol(HRP_IPV4),
-		hello_timeout(boost::posix_time::seconds(3))
+		hello_timeout(boost::posix_time::seconds(3)),
+		cipher_strands(0),
+		handshake_threads(0),
+		handshake_queue_size(fscp::server::DEFAULT_HANDSHAKE_QUEUE_SIZE),
+		ecdhe_key_pool_size(fscp::ecdhe_key_pool::DEFAULT_SIZE),
+		io_batch_size(0),
+		listen_sockets(0),
+		io_uring(false),
+		path_mtu_discovery(false)
 	{
 	}
 
@@ -89,13 +97,17 @@ namespace freelan
 		certificate_validation_script(),
 		certificate_authority_list(),
 		certificate_revocation_validation_method(CRVM_NONE),
-		certificate_revocation_list_list()
+		certificate_revocation_list_list(),
+		certificate_validation_cache_size(certificate_validation_cache::DEFAULT_SIZE),
+		certificate_validation_cache_ttl(boost::posix_time::minutes(5))
 	{
 	}
 
 	tap_adapter_configuration::tap_adapter_configuration() :
 		enabled(true),
 		type(tap_adapter_type::tap),
+		queues(0),
+		offload_enabled(false),
 		ipv4_address_prefix_length(),
 		ipv6_address_prefix_length(),
 		arp_proxy_enabled(false),
@@ -110,7 +122,9 @@ namespace freelan
 
 	switch_configuration::switch_configuration() :
 		routing_method(RM_SWITCH),
-		relay_mode_enabled(false)
+		relay_mode_enabled(false),
+		max_entries(1024),
+		ethernet_address_aging_time(boost::posix_time::minutes(5))
 	{
 	}
 
@@ -127,13 +141,20 @@ namespace freelan
 	{
 	}
 
+	metrics_configuration::metrics_configuration() :
+		socket(),
+		format(metrics_format_type::json)
+	{
+	}
+
 	configuration::configuration() :
 		server(),
 		fscp(),
 		security(),
 		tap_adapter(),
 		switch_(),
-		router()
+		router(),
+		metrics()
 	{
 	}
 
@@ -452,4 +473,34 @@ namespace freelan
 		assert(false);
 		throw std::logic_error("Unexpected value");
 	}
+
+	std::istream& operator>>(std::istream& is, metrics_configuration::metrics_format_type& v)
+	{
+		std::string value;
+
+		is >> value;
+
+		if (value == "json")
+			v = metrics_configuration::metrics_format_type::json;
+		else if (value == "prometheus")
+			v = metrics_configuration::metrics_format_type::prometheus;
+		else
+			throw boost::bad_lexical_cast();
+
+		return is;
+	}
+
+	std::ostream& operator<<(std::ostream& os, const metrics_configuration::metrics_format_type& value)
+	{
+		switch (value)
+		{
+			case metrics_configuration::metrics_format_type::json:
+				return os << "json";
+			case metrics_configuration::metrics_format_type::prometheus:
+				return os << "prometheus";
+		}
+
+		assert(false);
+		throw std::logic_error("Unexpected value");
+	}
 }
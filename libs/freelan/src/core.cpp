@@ -54,8 +54,10 @@
 #include "client.hpp"
 
 #include <fscp/server_error.hpp>
+#include <fscp/data_message.hpp>
 
 #include <asiotap/types/ip_network_address.hpp>
+#include <asiotap/osi/gso_segmenter.hpp>
 
 #ifdef WINDOWS
 #include <executeplus/windows_system.hpp>
@@ -64,12 +66,16 @@
 #endif
 
 #include <boost/make_shared.hpp>
+#include <boost/array.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/iterator/transform_iterator.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/date_time/c_local_time_adjustor.hpp>
 
 #include <cassert>
+#include <cstring>
+#include <sstream>
 
 namespace freelan
 {
@@ -83,11 +89,26 @@ namespace freelan
 
 	namespace
 	{
+		void add_latency_histogram(metrics_snapshot& metrics, const std::string& name, const std::string& help, const fscp::sharded_histogram::snapshot_type& latencies)
+		{
+			// The latencies are observed in microseconds.
+			metrics_snapshot::buckets_type buckets;
+			uint64_t count = 0;
+
+			for (size_t bucket = 0; bucket + 1 < fscp::sharded_histogram::BUCKETS_COUNT; ++bucket)
+			{
+				count += latencies.counts[bucket];
+				buckets.push_back(std::make_pair(fscp::sharded_histogram::upper_bound(bucket) / 1e6, count));
+			}
+
+			metrics.add_histogram(name, help, buckets, latencies.sum / 1e6, latencies.count);
+		}
+
 		void null_simple_write_handler(const boost::system::error_code&)
 		{
 		}
 
-		void null_switch_write_handler(const switch_::multi_write_result_type&)
+		void null_switch_write_handler(const boost::system::error_code&)
 		{
 		}
 
@@ -95,6 +116,12 @@ namespace freelan
 		{
 		}
 
+		// Written in front of every frame when the tap adapter has offloading enabled: the frames we write are never GSO frames.
+		const asiotap::osi::virtio_net_header NULL_VIRTIO_NET_HEADER = {};
+
+		// Room for a 64 KiB GSO frame, with its ethernet and virtio headers.
+		const size_t TAP_ADAPTER_OFFLOAD_RECEIVE_BUFFER_SIZE = 65536 + 1024;
+
 		asiotap::endpoint to_endpoint(const core::ep_type& host)
 		{
 			if (host.address().is_v4())
@@ -175,19 +202,35 @@ namespace freelan
 			return causal_handler<Handler, CausalHandler>(_handler, _causal_handler);
 		}
 
-		unsigned int get_auto_mtu_value()
+		size_t get_ip_header_size(bool is_v6)
+		{
+			return is_v6 ? 40 : 20;
+		}
+
+		size_t get_mtu_for(size_t datagram_size, asiotap::tap_adapter_layer layer)
+		{
+			// The frames are sent as they are in FSCP DATA messages.
+			const size_t ethernet_header_size = 14;
+			const size_t overhead = fscp::data_message::get_message_size(0) + ((layer == asiotap::tap_adapter_layer::ethernet) ? ethernet_header_size : 0);
+
+			return (datagram_size > overhead) ? datagram_size - overhead : 0;
+		}
+
+		unsigned int get_auto_mtu_value(bool is_v6, asiotap::tap_adapter_layer layer)
 		{
-			const unsigned int default_mtu_value = 1500;
-			const size_t static_payload_size = 20 + 8 + 4 + 22; // IP + UDP + FSCP HEADER + FSCP DATA HEADER
+			// We assume the most common link MTU when the path MTU is not known yet.
+			const size_t default_mtu_value = 1500;
+			const size_t udp_header_size = 8;
 
-			return default_mtu_value - static_payload_size;
+			return static_cast<unsigned int>(get_mtu_for(default_mtu_value - get_ip_header_size(is_v6) - udp_header_size, layer));
 		}
 
-		size_t get_auto_mss_value(size_t mtu)
+		size_t get_auto_mss_value(size_t mtu, bool is_v6)
 		{
-			// This somehow is the magic number.
-			const size_t static_payload_size = 20 + 8 + 4 + 22; // IP + UDP + FSCP HEADER + FSCP DATA HEADER
-			return mtu - static_payload_size;
+			const size_t tcp_header_size = 20;
+			const size_t headers_size = get_ip_header_size(is_v6) + tcp_header_size;
+
+			return (mtu > headers_size) ? mtu - headers_size : 0;
 		}
 
 		static const unsigned int TAP_ADAPTERS_GROUP = 0;
@@ -417,6 +460,7 @@ namespace freelan
 	const boost::posix_time::time_duration core::GET_CONTACT_INFORMATION_UPDATE_PERIOD = boost::posix_time::minutes(5);
 
 	const std::string core::DEFAULT_SERVICE = "12000";
+	const size_t core::TAP_ADAPTER_WRITE_QUEUE_DEPTH = 1024;
 
 	core::core(boost::asio::io_service& io_service, const freelan::configuration& _configuration) :
 		m_io_service(io_service),
@@ -439,21 +483,17 @@ namespace freelan
 		m_contact_timer(m_io_service, CONTACT_PERIOD),
 		m_dynamic_contact_timer(m_io_service, DYNAMIC_CONTACT_PERIOD),
 		m_routes_request_timer(m_io_service, ROUTES_REQUEST_PERIOD),
+		m_ca_store(),
+		m_ca_store_mutex(),
+		m_certificate_validation_cache(m_configuration.security.certificate_validation_cache_size),
 		m_tap_adapter_io_service(),
-		m_tap_adapter_thread(),
-		m_arp_filter(m_ethernet_filter),
-		m_ipv4_filter(m_ethernet_filter),
-		m_ipv6_filter(m_ethernet_filter),
-		m_udp_filter(m_ipv4_filter),
-		m_tcpv4_filter(m_ipv4_filter),
-		m_tcpv6_filter(m_ipv6_filter),
-		m_bootp_filter(m_udp_filter),
-		m_dhcp_filter(m_bootp_filter),
-		m_tun_ipv4_filter(),
-		m_tun_ipv6_filter(),
-		m_tun_tcpv4_filter(m_tun_ipv4_filter),
-		m_tun_tcpv6_filter(m_tun_ipv6_filter),
-		m_tun_icmpv6_filter(m_tun_ipv6_filter),
+		m_tap_adapter_threads(),
+		m_tap_queues(),
+		m_virtual_tap_adapter(),
+		m_virtual_tap_adapter_work(),
+		m_tap_dropped_frames(0),
+		m_tap_counters(),
+		m_tap_mtu(0),
 		m_router_strand(m_io_service),
 		m_switch(m_configuration.switch_),
 		m_router(m_configuration.router),
@@ -466,30 +506,6 @@ namespace freelan
 		m_set_contact_information_retry(m_io_service, boost::posix_time::seconds(5), boost::posix_time::seconds(35)),
 		m_get_contact_information_retry(m_io_service, boost::posix_time::seconds(5), boost::posix_time::seconds(35))
 	{
-		m_arp_filter.add_handler(boost::bind(&core::do_handle_arp_frame, this, _1));
-		m_dhcp_filter.add_handler(boost::bind(&core::do_handle_dhcp_frame, this, _1));
-		m_tun_icmpv6_filter.add_handler(boost::bind(&core::do_handle_icmpv6_frame, this, _1));
-		m_tcpv4_filter.add_handler([this](asiotap::osi::mutable_helper<asiotap::osi::tcp_frame> tcp_helper){
-			if (m_tcp_mss_morpher) {
-				m_tcp_mss_morpher->handle(*m_tcpv4_filter.parent().get_last_helper(), tcp_helper);
-			}
-		});
-		m_tcpv6_filter.add_handler([this](asiotap::osi::mutable_helper<asiotap::osi::tcp_frame> tcp_helper){
-			if (m_tcp_mss_morpher) {
-				m_tcp_mss_morpher->handle(*m_tcpv6_filter.parent().get_last_helper(), tcp_helper);
-			}
-		});
-		m_tun_tcpv4_filter.add_handler([this](asiotap::osi::mutable_helper<asiotap::osi::tcp_frame> tcp_helper){
-			if (m_tcp_mss_morpher) {
-				m_tcp_mss_morpher->handle(*m_tun_tcpv4_filter.parent().get_last_helper(), tcp_helper);
-			}
-		});
-		m_tun_tcpv6_filter.add_handler([this](asiotap::osi::mutable_helper<asiotap::osi::tcp_frame> tcp_helper){
-			if (m_tcp_mss_morpher) {
-				m_tcp_mss_morpher->handle(*m_tun_tcpv6_filter.parent().get_last_helper(), tcp_helper);
-			}
-		});
-
 		// Setup the route manager.
 		m_route_manager.set_route_registration_success_handler([this](const asiotap::route_manager::route_type& route){
 			m_logger(fscp::log_level::information) << "Added system route: " << route;
@@ -564,6 +580,7 @@ namespace freelan
 
 		open_tap_adapter();
 		open_web_server();
+		open_metrics_socket();
 
 		m_logger(fscp::log_level::debug) << "Core opened.";
 	}
@@ -572,6 +589,7 @@ namespace freelan
 	{
 		m_logger(fscp::log_level::debug) << "Closing core...";
 
+		close_metrics_socket();
 		close_web_server();
 		close_tap_adapter();
 		close_fscp_server();
@@ -580,6 +598,26 @@ namespace freelan
 		m_logger(fscp::log_level::debug) << "Core closed.";
 	}
 
+	void core::async_get_metrics(metrics_handler_type handler)
+	{
+		const boost::posix_time::ptime request_time = boost::posix_time::microsec_clock::universal_time();
+
+		m_router_strand.post([this, request_time, handler] () {
+			const boost::posix_time::time_duration router_strand_latency = boost::posix_time::microsec_clock::universal_time() - request_time;
+
+			if (m_fscp_server)
+			{
+				m_fscp_server->async_get_statistics([this, router_strand_latency, handler] (const fscp::server::statistics_type& server_statistics) {
+					handler(get_metrics(&server_statistics, router_strand_latency));
+				});
+			}
+			else
+			{
+				handler(get_metrics(nullptr, router_strand_latency));
+			}
+		});
+	}
+
 	// Private methods
 
 	void core::do_handle_log(fscp::log_level level, const std::string& msg, const boost::posix_time::ptime& timestamp)
@@ -630,6 +668,71 @@ namespace freelan
 		{
 			m_fscp_server->set_cipher_suites(m_configuration.fscp.cipher_suite_capabilities);
 			m_fscp_server->set_elliptic_curves(m_configuration.fscp.elliptic_curve_capabilities);
+			m_fscp_server->set_cipher_strands_count(m_configuration.fscp.cipher_strands);
+
+			if (m_configuration.fscp.cipher_strands > 0)
+			{
+				m_logger(fscp::log_level::information) << "Ciphering DATA messages on " << m_configuration.fscp.cipher_strands << " cipher strand(s).";
+			}
+
+			m_fscp_server->set_handshake_threads_count(m_configuration.fscp.handshake_threads, m_configuration.fscp.handshake_queue_size);
+			m_fscp_server->set_ecdhe_key_pool_size(m_configuration.fscp.ecdhe_key_pool_size);
+
+			if (m_configuration.fscp.handshake_threads > 0)
+			{
+				m_logger(fscp::log_level::information) << "Processing handshakes on " << m_configuration.fscp.handshake_threads << " dedicated thread(s), with up to " << m_configuration.fscp.handshake_queue_size << " pending operation(s).";
+			}
+
+			m_fscp_server->set_io_batch_size(m_configuration.fscp.io_batch_size);
+
+#ifdef LINUX
+			if (m_fscp_server->io_batch_size() > 1)
+			{
+				m_logger(fscp::log_level::information) << "Receiving and sending up to " << m_fscp_server->io_batch_size() << " datagram(s) per system call.";
+			}
+#else
+			if (m_configuration.fscp.io_batch_size > 1)
+			{
+				m_logger(fscp::log_level::warning) << "Batched I/O is not supported on this platform. Ignoring fscp.io_batch_size.";
+			}
+#endif
+
+			m_fscp_server->set_listen_sockets_count(m_configuration.fscp.listen_sockets);
+
+#ifndef LINUX
+			if (m_configuration.fscp.listen_sockets > 1)
+			{
+				m_logger(fscp::log_level::warning) << "SO_REUSEPORT is not supported on this platform. Ignoring fscp.listen_sockets.";
+			}
+#endif
+
+			m_fscp_server->set_io_uring_enabled(m_configuration.fscp.io_uring);
+
+#ifdef LINUX
+			if (m_configuration.fscp.io_uring)
+			{
+				m_logger(fscp::log_level::information) << "Receiving datagrams with io_uring when the system supports it.";
+			}
+#else
+			if (m_configuration.fscp.io_uring)
+			{
+				m_logger(fscp::log_level::warning) << "io_uring is not supported on this platform. Ignoring fscp.io_uring.";
+			}
+#endif
+
+			m_fscp_server->set_path_mtu_discovery_enabled(m_configuration.fscp.path_mtu_discovery);
+
+#ifdef LINUX
+			if (m_configuration.fscp.path_mtu_discovery)
+			{
+				m_logger(fscp::log_level::information) << "Path MTU discovery enabled: the probes are sent without fragmentation.";
+			}
+#else
+			if (m_configuration.fscp.path_mtu_discovery)
+			{
+				m_logger(fscp::log_level::warning) << "Path MTU discovery is not supported on this platform. Ignoring fscp.path_mtu_discovery.";
+			}
+#endif
 
 			m_fscp_server->set_hello_message_received_callback(boost::bind(&core::do_handle_hello_received, this, _1, _2));
 			m_fscp_server->set_contact_request_received_callback(boost::bind(&core::do_handle_contact_request_received, this, _1, _2, _3, _4));
@@ -641,6 +744,7 @@ namespace freelan
 			m_fscp_server->set_session_error_callback(boost::bind(&core::do_handle_session_error, this, _1, _2, _3));
 			m_fscp_server->set_session_established_callback(boost::bind(&core::do_handle_session_established, this, _1, _2, _3, _4));
 			m_fscp_server->set_session_lost_callback(boost::bind(&core::do_handle_session_lost, this, _1, _2));
+			m_fscp_server->set_path_mtu_changed_callback(boost::bind(&core::do_handle_path_mtu_changed, this, _1, _2));
 			m_fscp_server->set_data_received_callback(boost::bind(&core::do_handle_data_received, this, _1, _2, _3, _4));
 
 			resolver_type resolver(m_io_service);
@@ -670,18 +774,32 @@ namespace freelan
 			m_fscp_server->open(listen_endpoint);
 
 #ifdef LINUX
+			if (m_fscp_server->listen_sockets_count() > 1)
+			{
+				m_logger(fscp::log_level::information) << "Listening on " << m_fscp_server->listen_sockets_count() << " socket(s) with SO_REUSEPORT.";
+			}
+
 			if (!m_configuration.fscp.listen_on_device.empty())
 			{
-				const auto socket_fd = m_fscp_server->get_socket().native();
 				const std::string device_name = m_configuration.fscp.listen_on_device;
+				bool restricted = true;
 
-				if (::setsockopt(socket_fd, SOL_SOCKET, SO_BINDTODEVICE, device_name.c_str(), device_name.size()) == 0)
+				for (size_t i = 0; i < m_fscp_server->listen_sockets_count(); ++i)
 				{
-					m_logger(fscp::log_level::important) << "Restricting VPN traffic on: " << device_name;
+					const auto socket_fd = m_fscp_server->get_socket(i).native();
+
+					if (::setsockopt(socket_fd, SOL_SOCKET, SO_BINDTODEVICE, device_name.c_str(), device_name.size()) != 0)
+					{
+						m_logger(fscp::log_level::warning) << "Unable to restrict traffic on: " << device_name << ". Error was: " << boost::system::error_code(errno, boost::system::system_category()).message();
+						restricted = false;
+
+						break;
+					}
 				}
-				else
+
+				if (restricted)
 				{
-					m_logger(fscp::log_level::warning) << "Unable to restrict traffic on: " << device_name << ". Error was: " << boost::system::error_code(errno, boost::system::system_category()).message();
+					m_logger(fscp::log_level::important) << "Restricting VPN traffic on: " << device_name;
 				}
 			}
 #endif
@@ -1289,6 +1407,20 @@ namespace freelan
 		async_clear_client_router_info(host, void_handler_type());
 	}
 
+	void core::do_handle_path_mtu_changed(const ep_type& host, size_t path_mtu)
+	{
+		if (path_mtu > 0)
+		{
+			m_logger(fscp::log_level::debug) << "Path MTU to " << host << " is now " << path_mtu << " byte(s).";
+		}
+		else
+		{
+			m_logger(fscp::log_level::debug) << "Path MTU to " << host << " is not known anymore.";
+		}
+
+		m_router_strand.post(boost::bind(&core::do_set_port_mtu, this, host, path_mtu));
+	}
+
 	void core::do_handle_data_received(const ep_type& sender, fscp::channel_number_type channel_number, fscp::SharedBuffer buffer, boost::asio::const_buffer data)
 	{
 		switch (channel_number)
@@ -1618,10 +1750,12 @@ namespace freelan
 
 	void core::build_ca_store(build_ca_store_when condition)
 	{
-		// We can't easily ensure m_ca_store is used only in one strand, so we protect it with a mutex instead.
 		boost::mutex::scoped_lock lock(m_ca_store_mutex);
 
-		if (!!m_ca_store)
+		// Only rebuilds modify m_ca_store and they are serialized by the mutex: no atomic load is needed here.
+		const boost::shared_ptr<const ca_store_type> current_ca_store = m_ca_store;
+
+		if (current_ca_store)
 		{
 			if (condition == build_ca_store_when::it_doesnt_exist)
 			{
@@ -1635,33 +1769,36 @@ namespace freelan
 			m_logger(fscp::log_level::information) << "Building CA store...";
 		}
 
-		m_ca_store = cryptoplus::x509::store::create();
+		const boost::shared_ptr<ca_store_type> ca_store = boost::make_shared<ca_store_type>();
+
+		ca_store->store = cryptoplus::x509::store::create();
+		ca_store->generation = current_ca_store ? current_ca_store->generation + 1 : 0;
 
 		for (const cert_type& cert : m_configuration.security.certificate_authority_list)
 		{
-			m_ca_store.add_certificate(cert);
+			ca_store->store.add_certificate(cert);
 		}
 
 		for (const cert_type& cert : m_client_certificate_authority_list)
 		{
-			m_ca_store.add_certificate(cert);
+			ca_store->store.add_certificate(cert);
 		}
 
 		for (const crl_type& crl : m_configuration.security.certificate_revocation_list_list)
 		{
-			m_ca_store.add_certificate_revocation_list(crl);
+			ca_store->store.add_certificate_revocation_list(crl);
 		}
 
 		switch (m_configuration.security.certificate_revocation_validation_method)
 		{
 			case security_configuration::CRVM_LAST:
 				{
-					m_ca_store.set_verification_flags(X509_V_FLAG_CRL_CHECK);
+					ca_store->store.set_verification_flags(X509_V_FLAG_CRL_CHECK);
 					break;
 				}
 			case security_configuration::CRVM_ALL:
 				{
-					m_ca_store.set_verification_flags(X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
+					ca_store->store.set_verification_flags(X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
 					break;
 				}
 			case security_configuration::CRVM_NONE:
@@ -1669,7 +1806,13 @@ namespace freelan
 					break;
 				}
 		}
+
+		boost::atomic_store(&m_ca_store, boost::shared_ptr<const ca_store_type>(ca_store));
+
+		// The results of the previous CA store can't be looked up anymore: we free them right away.
+		m_certificate_validation_cache.clear();
 	}
+
 	bool core::certificate_validation_method(bool ok, cryptoplus::x509::store_context store_context)
 	{
 		cert_type cert = store_context.get_current_certificate();
@@ -1692,23 +1835,41 @@ namespace freelan
 		{
 			case security_configuration::CVM_DEFAULT:
 				{
-					using namespace cryptoplus;
+					const boost::shared_ptr<const ca_store_type> ca_store = boost::atomic_load(&m_ca_store);
+
+					if (!ca_store)
+					{
+						m_logger(fscp::log_level::warning) << "Unable to validate " << cert.subject() << ": no CA store was built.";
+
+						return false;
+					}
 
-					// We can't easily ensure m_ca_store is used only in one strand, so we protect it with a mutex instead.
-					boost::mutex::scoped_lock lock(m_ca_store_mutex);
+					const fscp::hash_type hash = fscp::get_certificate_hash(cert);
+					const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+					const boost::optional<bool> cached_result = m_certificate_validation_cache.find(hash, ca_store->generation, now);
 
-					// Create a store context to proceed to verification
-					x509::store_context store_context = x509::store_context::create();
+					bool valid = false;
+
+					if (cached_result)
+					{
+						valid = *cached_result;
+					}
+					else
+					{
+						valid = certificate_chain_is_valid(*ca_store, cert);
 
-					store_context.initialize(m_ca_store, cert, NULL);
+						boost::posix_time::ptime expires_at = now + m_configuration.security.certificate_validation_cache_ttl;
 
-					// Ensure to set the verification callback *AFTER* you called initialize or it will be ignored.
-					store_context.set_verification_callback(&core::certificate_validation_callback);
+						if (valid)
+						{
+							// A valid result must not outlive the certificate.
+							expires_at = std::min(expires_at, cert.not_after().to_ptime());
+						}
 
-					// Add a reference to the current instance into the store context.
-					store_context.set_external_data(core::ex_data_index, this);
+						m_certificate_validation_cache.insert(hash, ca_store->generation, valid, expires_at);
+					}
 
-					if (!store_context.verify())
+					if (!valid)
 					{
 						return false;
 					}
@@ -1729,6 +1890,24 @@ namespace freelan
 		return true;
 	}
 
+	bool core::certificate_chain_is_valid(const ca_store_type& ca_store, cert_type cert)
+	{
+		using namespace cryptoplus;
+
+		// Create a store context to proceed to verification
+		x509::store_context store_context = x509::store_context::create();
+
+		store_context.initialize(ca_store.store, cert, NULL);
+
+		// Ensure to set the verification callback *AFTER* you called initialize or it will be ignored.
+		store_context.set_verification_callback(&core::certificate_validation_callback);
+
+		// Add a reference to the current instance into the store context.
+		store_context.set_external_data(core::ex_data_index, this);
+
+		return store_context.verify();
+	}
+
 	void core::open_tap_adapter()
 	{
 		if (m_configuration.tap_adapter.enabled)
@@ -1738,20 +1917,57 @@ namespace freelan
 			m_tap_adapter = boost::make_shared<asiotap::tap_adapter>(boost::ref(m_tap_adapter_io_service), tap_adapter_type);
 
 			const auto write_func = [this] (boost::asio::const_buffer data, simple_handler_type handler) {
-				async_write_tap(buffer(data), m_io_service.wrap(handler));
+				// The handlers only release buffers and can run on any thread.
+				async_write_tap(data, handler);
 			};
 
-			m_tap_adapter->open(m_configuration.tap_adapter.name);
+			if (m_virtual_tap_adapter)
+			{
+				// The reads of a virtual tap adapter are not operations of our io_service: they must not let its threads stop.
+				m_virtual_tap_adapter_work.reset(new boost::asio::io_service::work(m_tap_adapter_io_service));
+			}
+			else
+			{
+				m_tap_adapter->set_queues_count(m_configuration.tap_adapter.queues);
+				m_tap_adapter->open(m_configuration.tap_adapter.name);
+
+				if ((m_configuration.tap_adapter.queues > 1) && (m_tap_adapter->queues_count() == 1))
+				{
+					m_logger(fscp::log_level::warning) << "Multi-queue tap adapters are not supported on this platform. Ignoring tap_adapter.queues.";
+				}
+			}
+
+			m_tap_queues.clear();
+
+			for (size_t queue = 0; queue < m_tap_adapter->queues_count(); ++queue)
+			{
+				m_tap_queues.push_back(boost::make_shared<tap_queue_type>(boost::ref(m_tap_adapter_io_service), TAP_ADAPTER_WRITE_QUEUE_DEPTH));
+			}
 
 			asiotap::tap_adapter_configuration tap_config;
 
-			// The device MTU.
-			tap_config.mtu = compute_mtu(m_configuration.tap_adapter.mtu, get_auto_mtu_value());
+			// The device MTU. With an IPv6 socket, the datagrams may have to carry IPv6 headers.
+			const bool ipv6_underlay = (m_fscp_server && m_fscp_server->get_socket().is_open() && m_fscp_server->get_socket().local_endpoint().address().is_v6());
 
-			m_logger(fscp::log_level::important) << "Tap adapter \"" << *m_tap_adapter << "\" opened in mode " << m_configuration.tap_adapter.type << " with a MTU set to: " << tap_config.mtu;
+			tap_config.mtu = compute_mtu(m_configuration.tap_adapter.mtu, get_auto_mtu_value(ipv6_underlay, tap_adapter_type));
+			m_tap_mtu = tap_config.mtu;
+
+			if (m_virtual_tap_adapter)
+			{
+				m_logger(fscp::log_level::important) << "Virtual tap adapter opened in mode " << m_configuration.tap_adapter.type << " with a MTU set to: " << tap_config.mtu;
+			}
+			else
+			{
+				m_logger(fscp::log_level::important) << "Tap adapter \"" << *m_tap_adapter << "\" opened in mode " << m_configuration.tap_adapter.type << " with a MTU set to: " << tap_config.mtu;
+			}
+
+			if (m_tap_queues.size() > 1)
+			{
+				m_logger(fscp::log_level::information) << "Tap adapter has " << m_tap_queues.size() << " queue(s).";
+			}
 
 			// The MSS override.
-			const size_t max_mss = compute_mss(m_configuration.tap_adapter.mss_override, get_auto_mss_value(tap_config.mtu));
+			const size_t max_mss = compute_mss(m_configuration.tap_adapter.mss_override, get_auto_mss_value(tap_config.mtu, false));
 
 			if (max_mss > 0) {
 				m_tcp_mss_morpher.reset(new asiotap::osi::tcp_mss_morpher(max_mss));
@@ -1809,21 +2025,24 @@ namespace freelan
 				}
 			}
 
-			m_tap_adapter->configure(tap_config);
+			if (!m_virtual_tap_adapter)
+			{
+				m_tap_adapter->configure(tap_config);
 
 #ifdef WINDOWS
-			const auto metric_value = get_metric_value(m_configuration.tap_adapter.metric);
+				const auto metric_value = get_metric_value(m_configuration.tap_adapter.metric);
 
-			if (metric_value)
-			{
-				m_logger(fscp::log_level::information) << "Setting interface metric to: " << *metric_value;
+				if (metric_value)
+				{
+					m_logger(fscp::log_level::information) << "Setting interface metric to: " << *metric_value;
 
-				m_tap_adapter->set_metric(*metric_value);
-			}
+					m_tap_adapter->set_metric(*metric_value);
+				}
 #endif
 
-			m_logger(fscp::log_level::information) << "Putting interface into the connected state.";
-			m_tap_adapter->set_connected_state(true);
+				m_logger(fscp::log_level::information) << "Putting interface into the connected state.";
+				m_tap_adapter->set_connected_state(true);
+			}
 
 			auto local_routes = translate_ip_routes(m_configuration.router.local_ip_routes);
 			auto local_dns_servers = m_configuration.router.local_dns_servers;
@@ -1882,7 +2101,7 @@ namespace freelan
 				m_router.register_port(make_port_index(m_tap_adapter), router::port_type(write_func, TAP_ADAPTERS_GROUP));
 
 				// Add the routes from the TAP adapter.
-				const auto tap_ip_addresses = m_tap_adapter->get_ip_addresses();
+				const auto tap_ip_addresses = m_virtual_tap_adapter ? asiotap::ip_network_address_list() : m_tap_adapter->get_ip_addresses();
 
 				for (auto&& ip_address : tap_ip_addresses)
 				{
@@ -1920,18 +2139,22 @@ namespace freelan
 				m_logger(fscp::log_level::information) << "Advertising the following DNS servers: " << local_dns_servers;
 			}
 
-			if (m_tap_adapter_up_callback)
+			if (m_tap_adapter_up_callback && !m_virtual_tap_adapter)
 			{
 				m_tap_adapter_up_callback(*m_tap_adapter);
 			}
 
 			async_read_tap();
 
-			m_tap_adapter_thread = boost::thread([this](){
-				m_logger(fscp::log_level::information) << "Starting tap adapter's thread...";
-				m_tap_adapter_io_service.run();
-				m_logger(fscp::log_level::information) << "Tap adapter's thread is now stopped.";
-			});
+			// One thread per queue: the queues strands let them run in parallel.
+			for (size_t queue = 0; queue < m_tap_queues.size(); ++queue)
+			{
+				m_tap_adapter_threads.create_thread([this](){
+					m_logger(fscp::log_level::information) << "Starting tap adapter's thread...";
+					m_tap_adapter_io_service.run();
+					m_logger(fscp::log_level::information) << "Tap adapter's thread is now stopped.";
+				});
+			}
 		}
 		else
 		{
@@ -1951,10 +2174,11 @@ namespace freelan
 		m_icmpv6_proxy.reset();
 
 		m_tcp_mss_morpher.reset();
+		m_tap_mtu = 0;
 
 		if (m_tap_adapter)
 		{
-			if (m_tap_adapter_down_callback)
+			if (m_tap_adapter_down_callback && !m_virtual_tap_adapter)
 			{
 				m_tap_adapter_down_callback(*m_tap_adapter);
 			}
@@ -1964,18 +2188,33 @@ namespace freelan
 				m_router.unregister_port(make_port_index(m_tap_adapter));
 			});
 
-			m_tap_adapter->cancel();
-			m_tap_adapter->set_connected_state(false);
+			if (m_virtual_tap_adapter)
+			{
+				m_virtual_tap_adapter->cancel();
+				m_virtual_tap_adapter_work.reset();
+			}
+			else
+			{
+				m_tap_adapter->cancel();
+				m_tap_adapter->set_connected_state(false);
+
+				m_tap_adapter->close();
+			}
+
+			m_tap_adapter_threads.join_all();
 
-			m_tap_adapter->close();
+			const uint64_t dropped_frames = m_tap_dropped_frames.exchange(0);
 
-			m_tap_adapter_thread.join();
+			if (dropped_frames > 0)
+			{
+				m_logger(fscp::log_level::warning) << dropped_frames << " frame(s) were dropped because the tap adapter write queue was full.";
+			}
 		}
 	}
 
 	void core::async_get_tap_addresses(ip_network_address_list_handler_type handler)
 	{
-		if (m_tap_adapter)
+		if (m_tap_adapter && !m_virtual_tap_adapter)
 		{
 			m_tap_adapter_io_service.post([this, handler](){
 			handler(m_tap_adapter->get_ip_addresses());
@@ -1989,255 +2228,523 @@ namespace freelan
 
 	void core::async_read_tap()
 	{
-		m_tap_adapter_io_service.post(boost::bind(&core::do_read_tap, this));
+		for (size_t queue = 0; queue < m_tap_queues.size(); ++queue)
+		{
+			m_tap_queues[queue]->strand.post(boost::bind(&core::do_read_tap, this, queue));
+		}
 	}
 
-	template <typename ConstBufferSequence>
-	void core::push_tap_write(const ConstBufferSequence& data, simple_handler_type handler)
+	void core::async_write_tap(boost::asio::const_buffer data, simple_handler_type handler)
 	{
-		// All push_tap_write() calls are done in the m_tap_adapter_io_service so the following is thread-safe.
-		const auto write_call = [this, data, handler] () {
-			m_tap_adapter->async_write(data, [this, handler] (const boost::system::error_code& ec, size_t) {
-				pop_tap_write();
+		const size_t queue = get_tap_queue_for(data);
+		tap_queue_type& tap_queue = *m_tap_queues[queue];
 
-				handler(ec);
-			});
-		};
+		bool schedule_drain = false;
 
-		if (m_tap_write_queue.empty())
 		{
-			// Nothing is being written, lets start the write immediately.
-			write_call();
-		}
+			boost::mutex::scoped_lock lock(tap_queue.mutex);
 
-		// We need to push it always, even if it was called immediately as it
-		// will be popped-out when the write ends and also serves as a marker
-		// that a write is in progress.
-		m_tap_write_queue.push(write_call);
-	}
+			if (tap_queue.pending_writes.full())
+			{
+				lock.unlock();
 
-	void core::pop_tap_write()
-	{
-		// All pop_tap_write() calls are done in the m_tap_adapter_io_service so the following is thread-safe.
-		m_tap_write_queue.pop();
+				// The tap adapter cannot keep up: we drop the frame rather than queuing it forever.
+				m_tap_dropped_frames.fetch_add(1, std::memory_order_relaxed);
+
+				if (handler)
+				{
+					handler(boost::asio::error::no_buffer_space);
+				}
+
+				return;
+			}
 
-		if (!m_tap_write_queue.empty())
+			tap_queue.pending_writes.push_back(tap_write_type { data, handler });
+
+			// A single drain takes care of all the frames that get queued until it completes.
+			schedule_drain = !tap_queue.drain_scheduled;
+			tap_queue.drain_scheduled = true;
+		}
+
+		if (schedule_drain)
 		{
-			m_tap_write_queue.front()();
+			tap_queue.strand.post(boost::bind(&core::drain_tap_writes, this, queue));
 		}
 	}
 
-	void core::do_read_tap()
+	size_t core::get_tap_queue_for(boost::asio::const_buffer data) const
 	{
-		// All calls to do_read_tap() are done within the m_tap_adapter_io_service, so the following is safe.
-		assert(m_tap_adapter);
+		if (m_tap_queues.size() <= 1)
+		{
+			return 0;
+		}
 
-		// Get either a new buffer or an old, recycled one if possible.
-		const SharedBuffer receive_buffer = m_tap_adapter_buffers.empty() ? SharedBuffer(65536) : [this] () {
-			const auto result = m_tap_adapter_buffers.front();
-			m_tap_adapter_buffers.pop_front();
+		// The frames of a given flow must always be written to the same queue, or they could get reordered.
+		const uint8_t* const frame = boost::asio::buffer_cast<const uint8_t*>(data);
+		const size_t frame_size = boost::asio::buffer_size(data);
 
-			return result;
-		}();
+		size_t offset = 0;
+		size_t length = 0;
 
-		m_tap_adapter->async_read(
-			buffer(receive_buffer),
-			boost::bind(
-				&core::do_handle_tap_adapter_read,
-				this,
-				SharedBuffer(receive_buffer, [this](const SharedBuffer& buffer) {
-					m_tap_adapter_io_service.post([this, buffer] () {
-						m_tap_adapter_buffers.push_back(buffer);
-					});
-				}),
-				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred
-			)
-		);
-	}
+		if (m_tap_adapter->layer() == asiotap::tap_adapter_layer::ethernet)
+		{
+			// The target and source ethernet addresses.
+			length = 12;
+		}
+		else if ((frame_size > 0) && ((frame[0] >> 4) == 4))
+		{
+			// The source and destination IPv4 addresses.
+			offset = 12;
+			length = 8;
+		}
+		else if ((frame_size > 0) && ((frame[0] >> 4) == 6))
+		{
+			// The source and destination IPv6 addresses.
+			offset = 8;
+			length = 32;
+		}
 
-	void core::do_handle_tap_adapter_read(SharedBuffer receive_buffer, const boost::system::error_code& ec, size_t count)
-	{
-		// All calls to do_handle_tap_adapter_read() are done within the m_tap_adapter_io_service, so the following is safe.
-		if (ec != boost::asio::error::operation_aborted)
+		if (frame_size < offset + length)
 		{
-			// We try to read again, as soon as possible.
-			do_read_tap();
+			return 0;
 		}
 
-		if (!ec)
+		// FNV-1a
+		uint32_t hash = 2166136261u;
+
+		for (size_t i = offset; i < offset + length; ++i)
 		{
-			const boost::asio::mutable_buffer data = buffer(receive_buffer, count);
+			hash = (hash ^ frame[i]) * 16777619u;
+		}
 
-#ifdef FREELAN_DEBUG
-			std::cerr << "Read " << buffer_size(data) << " byte(s) on " << *m_tap_adapter << std::endl;
-#endif
+		return hash % m_tap_queues.size();
+	}
+
+	void core::drain_tap_writes(size_t queue)
+	{
+		// All calls to drain_tap_writes() for a given queue are done within its strand so the following is thread-safe.
+		tap_queue_type& tap_queue = *m_tap_queues[queue];
 
-			bool handled = false;
+		for (;;)
+		{
+			boost::asio::const_buffer data;
 
-			if (m_tap_adapter->layer() == asiotap::tap_adapter_layer::ethernet)
 			{
-				// This line will eventually call the filters callbacks and the mss morpher.
-				m_ethernet_filter.parse(data);
+				boost::mutex::scoped_lock lock(tap_queue.mutex);
 
-				if (m_arp_proxy || m_dhcp_proxy)
+				if (tap_queue.pending_writes.empty())
 				{
-					if (m_arp_proxy && m_arp_filter.get_last_helper())
-					{
-						handled = true;
-						m_arp_filter.clear_last_helper();
-					}
+					tap_queue.drain_scheduled = false;
 
-					if (m_dhcp_proxy && m_dhcp_filter.get_last_helper())
-					{
-						handled = true;
-						m_dhcp_filter.clear_last_helper();
-					}
+					return;
 				}
 
-				if (!handled)
-				{
-					async_write_switch(
-						make_port_index(m_tap_adapter),
-						data,
-						make_shared_buffer_handler(
-							receive_buffer,
-							&null_switch_write_handler
-						)
-					);
-				}
+				// Producers only ever push at the back, so the front frame stays in place until we pop it.
+				data = tap_queue.pending_writes.front().data;
 			}
-			else
-			{
-				// This line will eventually call the filters callbacks and the mss override.
-				m_tun_ipv6_filter.parse(data);
 
-				if (m_icmpv6_proxy)
-				{
-					if (m_tun_icmpv6_filter.get_last_helper())
-					{
-						// We don't want to catch ICMP echo requests or other stuff yet.
-						handled = m_tun_icmpv6_filter.get_last_helper()->type() == asiotap::osi::ICMPV6_NEIGHBOR_SOLICITATION;
-						m_tun_icmpv6_filter.clear_last_helper();
-					}
-				}
+			boost::system::error_code ec;
 
-				if (!handled)
-				{
-					// This is a TUN interface. We receive either IPv4 or IPv6 frames.
-					async_write_router(
-						make_port_index(m_tap_adapter),
-						data,
-						make_shared_buffer_handler(
-							receive_buffer,
-							&null_router_write_handler
-						)
-					);
-				}
+			// Every frame needs its own write: the tap adapter does not accept several frames per call.
+			if (m_virtual_tap_adapter)
+			{
+				m_virtual_tap_adapter->write(data, ec);
 			}
-		}
-		else if (ec != boost::asio::error::operation_aborted)
-		{
-			m_logger(fscp::log_level::error) << "Read failed on " << m_tap_adapter->name() << ". Error: " << ec.message();
-		}
-	}
+			else if (m_tap_adapter->is_offload_enabled())
+			{
+				const boost::array<boost::asio::const_buffer, 2> buffers = {{ buffer(&NULL_VIRTIO_NET_HEADER, sizeof(NULL_VIRTIO_NET_HEADER)), data }};
 
-	void core::do_handle_tap_adapter_write(const boost::system::error_code& ec)
-	{
-		if (ec)
-		{
-			if (ec != boost::asio::error::operation_aborted)
+				m_tap_adapter->write(queue, buffers, ec);
+			}
+			else
 			{
-				m_logger(fscp::log_level::warning) << "Write failed on " << m_tap_adapter->name() << ". Error: " << ec.message();
+				m_tap_adapter->write(queue, boost::asio::const_buffers_1(data), ec);
+			}
+
+			if ((ec == boost::asio::error::would_block) || (ec == boost::asio::error::try_again))
+			{
+				// The drain remains scheduled: it resumes once the tap adapter can take more frames.
+				m_tap_adapter->async_wait_write(
+					queue,
+					tap_queue.strand.wrap(
+						boost::bind(
+							&core::do_handle_tap_adapter_writable,
+							this,
+							queue,
+							boost::asio::placeholders::error
+						)
+					)
+				);
+
+				return;
+			}
+
+			if (ec)
+			{
+				m_tap_counters.increment(tap_counter::write_errors);
+			}
+			else
+			{
+				m_tap_counters.increment(tap_counter::frames_written);
+				m_tap_counters.increment(tap_counter::bytes_written, buffer_size(data));
+			}
+
+			simple_handler_type handler;
+
+			{
+				boost::mutex::scoped_lock lock(tap_queue.mutex);
+
+				handler.swap(tap_queue.pending_writes.front().handler);
+				tap_queue.pending_writes.pop_front();
+			}
+
+			// This releases the frame buffer.
+			if (handler)
+			{
+				handler(ec);
 			}
 		}
 	}
 
-	void core::do_handle_arp_frame(const arp_helper_type& helper)
+	void core::do_handle_tap_adapter_writable(size_t queue, const boost::system::error_code& ec)
 	{
-		if (m_arp_proxy)
+		// All calls to do_handle_tap_adapter_writable() for a given queue are done within its strand so the following is thread-safe.
+		if (ec)
 		{
-			const auto response_buffer = SharedBuffer(2048);
-			const boost::optional<boost::asio::const_buffer> data = m_arp_proxy->process_frame(
-				*m_arp_filter.parent().get_last_helper(),
-				helper,
-				buffer(response_buffer)
-			);
+			// The tap adapter is being closed: the pending frames will never be written.
+			cancel_tap_writes(queue, ec);
+		}
+		else
+		{
+			drain_tap_writes(queue);
+		}
+	}
+
+	void core::cancel_tap_writes(size_t queue, const boost::system::error_code& ec)
+	{
+		tap_queue_type& tap_queue = *m_tap_queues[queue];
+
+		boost::circular_buffer<tap_write_type> pending_writes(tap_queue.pending_writes.capacity());
+
+		{
+			boost::mutex::scoped_lock lock(tap_queue.mutex);
+
+			pending_writes.swap(tap_queue.pending_writes);
+			tap_queue.drain_scheduled = false;
+		}
+
+		for (auto&& pending_write : pending_writes)
+		{
+			if (pending_write.handler)
+			{
+				pending_write.handler(ec);
+			}
+		}
+	}
+
+	void core::do_read_tap(size_t queue)
+	{
+		// All calls to do_read_tap() for a given queue are done within its strand, so the following is safe.
+		assert(m_tap_adapter);
+
+		// The buffer comes from the pool and goes back to it once the frame was handled.
+		const SharedBuffer receive_buffer(m_tap_adapter->is_offload_enabled() ? TAP_ADAPTER_OFFLOAD_RECEIVE_BUFFER_SIZE : 65536);
+
+		const auto read_handler = m_tap_queues[queue]->strand.wrap(
+			boost::bind(
+				&core::do_handle_tap_adapter_read,
+				this,
+				queue,
+				receive_buffer,
+				boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred
+			)
+		);
+
+		if (m_virtual_tap_adapter)
+		{
+			m_virtual_tap_adapter->async_read(buffer(receive_buffer), read_handler);
+		}
+		else
+		{
+			m_tap_adapter->async_read(queue, buffer(receive_buffer), read_handler);
+		}
+	}
+
+	void core::do_handle_tap_adapter_read(size_t queue, SharedBuffer receive_buffer, const boost::system::error_code& ec, size_t count)
+	{
+		// All calls to do_handle_tap_adapter_read() for a given queue are done within its strand, so the following is safe.
+		if (ec != boost::asio::error::operation_aborted)
+		{
+			// We try to read again, as soon as possible.
+			do_read_tap(queue);
+		}
+
+		if (!ec)
+		{
+			m_tap_counters.increment(tap_counter::frames_read);
+			m_tap_counters.increment(tap_counter::bytes_read, count);
+
+			if (m_tap_adapter->is_offload_enabled())
+			{
+				asiotap::osi::virtio_net_header header;
+
+				if (count < sizeof(header))
+				{
+					return;
+				}
+
+				std::memcpy(&header, buffer_cast<const void*>(receive_buffer), sizeof(header));
+
+				const boost::asio::mutable_buffer frame = buffer(receive_buffer, count) + sizeof(header);
+
+				if (header.gso_type == asiotap::osi::VIRTIO_NET_HDR_GSO_NONE)
+				{
+					if (asiotap::osi::complete_checksum(header, frame))
+					{
+						do_handle_tap_adapter_frame(receive_buffer, frame);
+					}
+
+					return;
+				}
+
+				// This is a GSO frame: the segments are made as small as the tunnel needs them to be.
+				const size_t network_offset = (m_tap_adapter->layer() == asiotap::tap_adapter_layer::ethernet) ? sizeof(asiotap::osi::ethernet_frame) : 0;
+				const asiotap::osi::gso_segmenter segmenter(header, frame, network_offset);
+
+				if (!segmenter.valid())
+				{
+					// A sender that produces such frames produces a lot of them: we only log the first one.
+					if (m_tap_counters.get(tap_counter::gso_drops) == 0)
+					{
+						m_logger(fscp::log_level::warning) << "Dropping an unsupported GSO frame read on " << m_tap_adapter->name() << ". The next ones are only counted.";
+					}
+
+					m_tap_counters.increment(tap_counter::gso_drops);
+
+					return;
+				}
+
+				for (size_t index = 0; index < segmenter.segments_count(); ++index)
+				{
+					const SharedBuffer segment_buffer(segmenter.segment_size(index));
+
+					do_handle_tap_adapter_frame(segment_buffer, segmenter.write_segment(index, buffer(segment_buffer)));
+				}
+			}
+			else
+			{
+				do_handle_tap_adapter_frame(receive_buffer, buffer(receive_buffer, count));
+			}
+		}
+		else if (ec != boost::asio::error::operation_aborted)
+		{
+			m_tap_counters.increment(tap_counter::read_errors);
+			m_logger(fscp::log_level::error) << "Read failed on " << m_tap_adapter->name() << ". Error: " << ec.message();
+		}
+	}
+
+	void core::do_handle_tap_adapter_frame(SharedBuffer receive_buffer, boost::asio::mutable_buffer data)
+	{
+		// All calls to do_handle_tap_adapter_frame() are done within the strand of a tap adapter queue.
+#ifdef FREELAN_DEBUG
+		std::cerr << "Read " << buffer_size(data) << " byte(s) on " << *m_tap_adapter << std::endl;
+#endif
+
+		tap_frame_handler handler(*this, data);
 
-			if (data)
+		if (m_tap_adapter->layer() == asiotap::tap_adapter_layer::ethernet)
+		{
+			// This line will eventually call the proxies and the mss morpher.
+			if (asiotap::osi::classify_ethernet_frame(data, handler) != asiotap::osi::classification_status::consumed)
 			{
-				async_write_tap(
-					buffer(*data),
+				async_write_switch(
+					make_port_index(m_tap_adapter),
+					data,
 					make_shared_buffer_handler(
-						response_buffer,
-						boost::bind(
-							&core::do_handle_tap_adapter_write,
-							this,
-							boost::asio::placeholders::error
-						)
+						receive_buffer,
+						&null_switch_write_handler
 					)
 				);
 			}
 		}
+		else
+		{
+			// This is a TUN interface. We receive either IPv4 or IPv6 frames.
+			if (asiotap::osi::classify_ip_frame(data, handler) != asiotap::osi::classification_status::consumed)
+			{
+				async_write_router(
+					make_port_index(m_tap_adapter),
+					data,
+					make_shared_buffer_handler(
+						receive_buffer,
+						&null_router_write_handler
+					)
+				);
+			}
+		}
+	}
+
+	void core::do_handle_tap_adapter_write(const boost::system::error_code& ec)
+	{
+		if (ec)
+		{
+			if (ec != boost::asio::error::operation_aborted)
+			{
+				m_logger(fscp::log_level::warning) << "Write failed on " << m_tap_adapter->name() << ". Error: " << ec.message();
+			}
+		}
+	}
+
+	size_t core::get_max_mss_for(boost::asio::const_buffer frame, const boost::asio::ip::address& destination)
+	{
+		// This is called from the tap adapter queues: the switch and the router lookups are thread-safe.
+		const port_index_type index = make_port_index(m_tap_adapter);
+		size_t target_mtu = 0;
+
+		if (m_tap_adapter->layer() == asiotap::tap_adapter_layer::ethernet)
+		{
+			target_mtu = m_switch.get_target_mtu(frame);
+		}
+		else if (destination.is_v4())
+		{
+			target_mtu = m_router.get_target_mtu(index, destination.to_v4());
+		}
+		else
+		{
+			target_mtu = m_router.get_target_mtu(index, destination.to_v6());
+		}
+
+		const size_t mtu = ((target_mtu > 0) && ((m_tap_mtu == 0) || (target_mtu < m_tap_mtu))) ? target_mtu : m_tap_mtu;
+
+		return get_auto_mss_value(mtu, destination.is_v6());
 	}
 
-	void core::do_handle_dhcp_frame(const dhcp_helper_type& helper)
+	bool core::do_handle_arp_frame(const ethernet_helper_type& ethernet_helper, const arp_helper_type& helper)
 	{
-		if (m_dhcp_proxy)
+		if (!m_arp_proxy)
+		{
+			return false;
+		}
+
+		const auto response_buffer = SharedBuffer(2048);
+		boost::optional<boost::asio::const_buffer> data;
+
+		try
 		{
-			const auto response_buffer = SharedBuffer(2048);
-			const boost::optional<boost::asio::const_buffer> data = m_dhcp_proxy->process_frame(
-				*m_dhcp_filter.parent().parent().parent().parent().get_last_helper(),
-				*m_dhcp_filter.parent().parent().parent().get_last_helper(),
-				*m_dhcp_filter.parent().parent().get_last_helper(),
-				*m_dhcp_filter.parent().get_last_helper(),
+			data = m_arp_proxy->process_frame(
+				ethernet_helper,
 				helper,
 				buffer(response_buffer)
 			);
+		}
+		catch (const std::logic_error&)
+		{
+			// Malformed frames are simply ignored.
+		}
 
-			if (data)
-			{
-				async_write_tap(
-					buffer(*data),
-					make_shared_buffer_handler(
-						response_buffer,
-						boost::bind(
-							&core::do_handle_tap_adapter_write,
-							this,
-							boost::asio::placeholders::error
-						)
+		if (data)
+		{
+			async_write_tap(
+				buffer(*data),
+				make_shared_buffer_handler(
+					response_buffer,
+					boost::bind(
+						&core::do_handle_tap_adapter_write,
+						this,
+						boost::asio::placeholders::error
 					)
-				);
-			}
+				)
+			);
 		}
+
+		return true;
 	}
 
-	void core::do_handle_icmpv6_frame(const icmpv6_helper_type& helper)
+	bool core::do_handle_dhcp_frame(const ethernet_helper_type& ethernet_helper, const ipv4_helper_type& ipv4_helper, const udp_helper_type& udp_helper, const bootp_helper_type& bootp_helper, const dhcp_helper_type& helper)
 	{
-		if (m_icmpv6_proxy)
+		if (!m_dhcp_proxy)
 		{
-			const auto response_buffer = SharedBuffer(2048);
-			const boost::optional<boost::asio::const_buffer> data = m_icmpv6_proxy->process_frame(
-				*m_tun_icmpv6_filter.parent().get_last_helper(),
+			return false;
+		}
+
+		const auto response_buffer = SharedBuffer(2048);
+		boost::optional<boost::asio::const_buffer> data;
+
+		try
+		{
+			data = m_dhcp_proxy->process_frame(
+				ethernet_helper,
+				ipv4_helper,
+				udp_helper,
+				bootp_helper,
 				helper,
 				buffer(response_buffer)
 			);
+		}
+		catch (const std::logic_error&)
+		{
+			// Malformed frames are simply ignored.
+		}
 
-			if (data)
-			{
-				async_write_tap(
-					buffer(*data),
-					make_shared_buffer_handler(
+		if (data)
+		{
+			async_write_tap(
+				buffer(*data),
+				make_shared_buffer_handler(
 					response_buffer,
 					boost::bind(
 						&core::do_handle_tap_adapter_write,
 						this,
 						boost::asio::placeholders::error
 					)
+				)
+			);
+		}
+
+		return true;
+	}
+
+	bool core::do_handle_icmpv6_frame(const ipv6_helper_type& ipv6_helper, const icmpv6_helper_type& helper)
+	{
+		if (!m_icmpv6_proxy)
+		{
+			return false;
+		}
+
+		const auto response_buffer = SharedBuffer(2048);
+		boost::optional<boost::asio::const_buffer> data;
+
+		try
+		{
+			data = m_icmpv6_proxy->process_frame(
+				ipv6_helper,
+				helper,
+				buffer(response_buffer)
+			);
+		}
+		catch (const std::logic_error&)
+		{
+			// Malformed frames are simply ignored.
+		}
+
+		if (data)
+		{
+			async_write_tap(
+				buffer(*data),
+				make_shared_buffer_handler(
+					response_buffer,
+					boost::bind(
+						&core::do_handle_tap_adapter_write,
+						this,
+						boost::asio::placeholders::error
 					)
-				);
-			}
+				)
+			);
 		}
+
+		// We don't want to catch ICMP echo requests or other stuff yet.
+		return (helper.type() == asiotap::osi::ICMPV6_NEIGHBOR_SOLICITATION);
 	}
 
 	bool core::do_handle_arp_request(const boost::asio::ip::address_v4& logical_address, ethernet_address_type& ethernet_address)
@@ -2273,7 +2780,16 @@ namespace freelan
 	void core::do_register_switch_port(const ep_type& host, void_handler_type handler)
 	{
 		// All calls to do_register_switch_port() are done within the m_router_strand, so the following is safe.
-		m_switch.register_port(make_port_index(host), switch_::port_type(boost::bind(&fscp::server::async_send_data, m_fscp_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), ENDPOINTS_GROUP));
+		switch_::port_type port(boost::bind(&fscp::server::async_send_data, m_fscp_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), ENDPOINTS_GROUP);
+
+		const std::map<ep_type, size_t>::const_iterator port_mtu = m_port_mtus.find(host);
+
+		if (port_mtu != m_port_mtus.end())
+		{
+			port.set_mtu(port_mtu->second);
+		}
+
+		m_switch.register_port(make_port_index(host), port);
 
 		if (handler)
 		{
@@ -2285,6 +2801,7 @@ namespace freelan
 	{
 		// All calls to do_unregister_switch_port() are done within the m_router_strand, so the following is safe.
 		m_switch.unregister_port(make_port_index(host));
+		m_port_mtus.erase(host);
 
 		if (handler)
 		{
@@ -2295,7 +2812,16 @@ namespace freelan
 	void core::do_register_router_port(const ep_type& host, void_handler_type handler)
 	{
 		// All calls to do_register_router_port() are done within the m_router_strand, so the following is safe.
-		m_router.register_port(make_port_index(host), router::port_type(boost::bind(&fscp::server::async_send_data, m_fscp_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), ENDPOINTS_GROUP));
+		router::port_type port(boost::bind(&fscp::server::async_send_data, m_fscp_server, host, fscp::CHANNEL_NUMBER_0, _1, _2), ENDPOINTS_GROUP);
+
+		const std::map<ep_type, size_t>::const_iterator port_mtu = m_port_mtus.find(host);
+
+		if (port_mtu != m_port_mtus.end())
+		{
+			port.set_mtu(port_mtu->second);
+		}
+
+		m_router.register_port(make_port_index(host), port);
 
 		if (handler)
 		{
@@ -2307,6 +2833,7 @@ namespace freelan
 	{
 		// All calls to do_unregister_router_port() are done within the m_router_strand, so the following is safe.
 		m_router.unregister_port(make_port_index(host));
+		m_port_mtus.erase(host);
 
 		if (handler)
 		{
@@ -2314,6 +2841,38 @@ namespace freelan
 		}
 	}
 
+	void core::do_set_port_mtu(const ep_type& host, size_t path_mtu)
+	{
+		// All calls to do_set_port_mtu() are done within the m_router_strand, so the following is safe.
+		const asiotap::tap_adapter_layer layer = (m_configuration.tap_adapter.type == tap_adapter_configuration::tap_adapter_type::tap) ? asiotap::tap_adapter_layer::ethernet : asiotap::tap_adapter_layer::ip;
+		const size_t mtu = get_mtu_for(path_mtu, layer);
+
+		if (mtu > 0)
+		{
+			m_port_mtus[host] = mtu;
+		}
+		else
+		{
+			m_port_mtus.erase(host);
+		}
+
+		const port_index_type index = make_port_index(host);
+
+		if (layer == asiotap::tap_adapter_layer::ethernet)
+		{
+			m_switch.set_port_mtu(index, mtu);
+		}
+		else
+		{
+			router::port_type* const port = m_router.get_port(index);
+
+			if (port)
+			{
+				port->set_mtu(mtu);
+			}
+		}
+	}
+
 	void core::do_save_system_route(const ep_type& host, const route_type& route, void_handler_type handler)
 	{
 		// All calls to do_save_system_route() are done within the m_router_strand, so the following is safe.
@@ -2339,18 +2898,6 @@ namespace freelan
 		}
 	}
 
-	void core::do_write_switch(const port_index_type& index, boost::asio::const_buffer data, switch_::multi_write_handler_type handler)
-	{
-		// All calls to do_write_switch() are done within the m_router_strand, so the following is safe.
-		m_switch.async_write(index, data, handler);
-	}
-
-	void core::do_write_router(const port_index_type& index, boost::asio::const_buffer data, router::port_type::write_handler_type handler)
-	{
-		// All calls to do_write_router() are done within the m_router_strand, so the following is safe.
-		m_router.async_write(index, data, handler);
-	}
-
 	void core::open_web_server()
 	{
 		if (m_configuration.server.enabled)
@@ -2438,6 +2985,198 @@ namespace freelan
 #endif
 	}
 
+	metrics_snapshot core::get_metrics(const fscp::server::statistics_type* server_statistics, const boost::posix_time::time_duration& router_strand_latency) const
+	{
+		typedef metrics_snapshot::labels_type labels_type;
+
+		metrics_snapshot result;
+
+		if (server_statistics)
+		{
+			for (auto&& peer_entry : server_statistics->peers)
+			{
+				const labels_type labels { { "peer", boost::lexical_cast<std::string>(peer_entry.first) } };
+				const fscp::server::peer_statistics_type& statistics = peer_entry.second;
+
+				result.add("freelan_peer_session", metrics_snapshot::metric_type::gauge, "Whether a session currently exists with the peer.", statistics.has_session ? 1 : 0, labels);
+				result.add("freelan_peer_received_bytes_total", metrics_snapshot::metric_type::counter, "The number of cleartext bytes received from the peer.", statistics.bytes_received, labels);
+				result.add("freelan_peer_received_messages_total", metrics_snapshot::metric_type::counter, "The number of data messages received from the peer.", statistics.messages_received, labels);
+				result.add("freelan_peer_sent_bytes_total", metrics_snapshot::metric_type::counter, "The number of cleartext bytes sent to the peer.", statistics.bytes_sent, labels);
+				result.add("freelan_peer_sent_messages_total", metrics_snapshot::metric_type::counter, "The number of data messages sent to the peer.", statistics.messages_sent, labels);
+				result.add("freelan_peer_decipher_failures_total", metrics_snapshot::metric_type::counter, "The number of data messages from the peer that could not be deciphered.", statistics.decipher_failures, labels);
+				result.add("freelan_peer_replays_total", metrics_snapshot::metric_type::counter, "The number of data messages from the peer rejected by the replay window.", statistics.replays, labels);
+				result.add("freelan_peer_drops_total", metrics_snapshot::metric_type::counter, "The number of data messages from the peer that did not belong to the current session.", statistics.drops, labels);
+			}
+
+			result.add("freelan_handshake_queue_depth", metrics_snapshot::metric_type::gauge, "The number of handshake operations queued or running on the handshake threads.", server_statistics->handshake_queue_depth);
+			result.add("freelan_handshake_rejections_total", metrics_snapshot::metric_type::counter, "The number of handshake operations dropped because the handshake queue was full.", server_statistics->handshake_rejections);
+			result.add("freelan_ecdhe_key_pool_hits_total", metrics_snapshot::metric_type::counter, "The number of sessions prepared with a pre-generated ECDHE key pair.", server_statistics->ecdhe_key_pool_hits);
+			result.add("freelan_ecdhe_key_pool_misses_total", metrics_snapshot::metric_type::counter, "The number of sessions whose ECDHE key pair had to be generated on the spot.", server_statistics->ecdhe_key_pool_misses);
+			result.add("freelan_session_strand_latency_seconds", metrics_snapshot::metric_type::gauge, "The time the last metrics request waited in the FSCP session strand.", server_statistics->session_strand_latency.total_microseconds() / 1e6);
+			add_latency_histogram(result, "freelan_session_strand_wait_seconds", "The times the periodic tasks and the metrics requests waited in the FSCP session strand.", server_statistics->session_strand_latencies);
+			add_latency_histogram(result, "freelan_handshake_duration_seconds", "The times between the queuing and the completion of the handshake operations.", server_statistics->handshake_latencies);
+		}
+
+		result.add("freelan_router_strand_latency_seconds", metrics_snapshot::metric_type::gauge, "The time the last metrics request waited in the router strand.", router_strand_latency.total_microseconds() / 1e6);
+
+		const switch_::statistics_type switch_statistics = m_switch.statistics();
+
+		result.add("freelan_switch_switched_frames_total", metrics_snapshot::metric_type::counter, "The number of frames sent to a single known port.", switch_statistics.switched_frames);
+		result.add("freelan_switch_flooded_frames_total", metrics_snapshot::metric_type::counter, "The number of frames sent to all the ports.", switch_statistics.flooded_frames);
+		result.add("freelan_switch_learned_addresses_total", metrics_snapshot::metric_type::counter, "The number of ethernet addresses learned.", switch_statistics.ethernet_address_table.learned);
+		result.add("freelan_switch_moved_addresses_total", metrics_snapshot::metric_type::counter, "The number of ethernet addresses that moved to another port.", switch_statistics.ethernet_address_table.moved);
+		result.add("freelan_switch_evicted_addresses_total", metrics_snapshot::metric_type::counter, "The number of ethernet addresses evicted because the table was full.", switch_statistics.ethernet_address_table.evicted);
+		result.add("freelan_switch_expired_addresses_total", metrics_snapshot::metric_type::counter, "The number of ethernet addresses forgotten because they were not seen for too long.", switch_statistics.ethernet_address_table.expired);
+		result.add("freelan_switch_addresses", metrics_snapshot::metric_type::gauge, "The number of entries in the ethernet address table.", switch_statistics.ethernet_address_table_size);
+
+		const router::statistics_type router_statistics = m_router.statistics();
+
+		result.add("freelan_router_routed_packets_total", metrics_snapshot::metric_type::counter, "The number of unicast packets sent to the port of their best route.", router_statistics.routed_packets);
+		result.add("freelan_router_multicast_packets_total", metrics_snapshot::metric_type::counter, "The number of multicast packets sent to all the ports.", router_statistics.multicast_packets);
+		result.add("freelan_router_no_route_drops_total", metrics_snapshot::metric_type::counter, "The number of unicast packets dropped because they matched no route.", router_statistics.no_route_drops);
+		result.add("freelan_router_unsupported_drops_total", metrics_snapshot::metric_type::counter, "The number of frames dropped because they were neither IPv4 nor IPv6 packets.", router_statistics.unsupported_drops);
+
+		const certificate_validation_cache::statistics_type certificate_validation_cache_statistics = m_certificate_validation_cache.statistics();
+
+		result.add("freelan_certificate_validation_cache_hits_total", metrics_snapshot::metric_type::counter, "The number of certificate validations answered by the cache.", certificate_validation_cache_statistics.hits);
+		result.add("freelan_certificate_validation_cache_misses_total", metrics_snapshot::metric_type::counter, "The number of certificate validations that required a chain verification.", certificate_validation_cache_statistics.misses);
+		result.add("freelan_certificate_validation_cache_evicted_total", metrics_snapshot::metric_type::counter, "The number of certificate validation results evicted because the cache was full.", certificate_validation_cache_statistics.evicted);
+		result.add("freelan_certificate_validation_cache_expired_total", metrics_snapshot::metric_type::counter, "The number of certificate validation results dropped because they expired.", certificate_validation_cache_statistics.expired);
+		result.add("freelan_certificate_validation_cache_entries", metrics_snapshot::metric_type::gauge, "The number of certificate validation results in the cache.", m_certificate_validation_cache.size());
+
+		result.add("freelan_tap_read_frames_total", metrics_snapshot::metric_type::counter, "The number of frames read from the tap adapter.", m_tap_counters.get(tap_counter::frames_read));
+		result.add("freelan_tap_read_bytes_total", metrics_snapshot::metric_type::counter, "The number of bytes read from the tap adapter.", m_tap_counters.get(tap_counter::bytes_read));
+		result.add("freelan_tap_read_errors_total", metrics_snapshot::metric_type::counter, "The number of failed reads on the tap adapter.", m_tap_counters.get(tap_counter::read_errors));
+		result.add("freelan_tap_written_frames_total", metrics_snapshot::metric_type::counter, "The number of frames written to the tap adapter.", m_tap_counters.get(tap_counter::frames_written));
+		result.add("freelan_tap_written_bytes_total", metrics_snapshot::metric_type::counter, "The number of bytes written to the tap adapter.", m_tap_counters.get(tap_counter::bytes_written));
+		result.add("freelan_tap_write_errors_total", metrics_snapshot::metric_type::counter, "The number of failed writes on the tap adapter.", m_tap_counters.get(tap_counter::write_errors));
+		result.add("freelan_tap_gso_drops_total", metrics_snapshot::metric_type::counter, "The number of GSO frames read from the tap adapter that could not be segmented.", m_tap_counters.get(tap_counter::gso_drops));
+		result.add("freelan_tap_write_queue_drops_total", metrics_snapshot::metric_type::counter, "The number of frames dropped because a tap adapter write queue was full.", m_tap_dropped_frames.load(std::memory_order_relaxed));
+
+		for (size_t queue = 0; queue < m_tap_queues.size(); ++queue)
+		{
+			size_t depth = 0;
+
+			{
+				boost::mutex::scoped_lock lock(m_tap_queues[queue]->mutex);
+
+				depth = m_tap_queues[queue]->pending_writes.size();
+			}
+
+			result.add("freelan_tap_write_queue_depth", metrics_snapshot::metric_type::gauge, "The number of frames waiting to be written on a tap adapter queue.", depth, labels_type { { "queue", boost::lexical_cast<std::string>(queue) } });
+		}
+
+		for (auto&& statistics : fscp::buffer_pool::get_statistics())
+		{
+			const labels_type labels { { "block_size", boost::lexical_cast<std::string>(statistics.block_size) } };
+
+			result.add("freelan_buffer_pool_blocks", metrics_snapshot::metric_type::gauge, "The number of blocks allocated by the buffer pool.", statistics.blocks, labels);
+			result.add("freelan_buffer_pool_blocks_in_use", metrics_snapshot::metric_type::gauge, "The number of buffer pool blocks currently in use.", statistics.blocks_in_use, labels);
+			result.add("freelan_buffer_pool_cache_hits_total", metrics_snapshot::metric_type::counter, "The number of buffer requests served by a thread cache.", statistics.cache_hits, labels);
+			result.add("freelan_buffer_pool_global_hits_total", metrics_snapshot::metric_type::counter, "The number of buffer requests served by the global free list.", statistics.global_hits, labels);
+			result.add("freelan_buffer_pool_misses_total", metrics_snapshot::metric_type::counter, "The number of buffer requests that required a new allocation.", statistics.misses, labels);
+		}
+
+		return result;
+	}
+
+	void core::open_metrics_socket()
+	{
+		if (!m_configuration.metrics.socket.empty())
+		{
+#ifdef WINDOWS
+			m_logger(fscp::log_level::warning) << "The metrics socket is not supported on this platform.";
+#else
+			const boost::filesystem::path& path = m_configuration.metrics.socket;
+
+			m_logger(fscp::log_level::information) << "Exposing metrics on " << path << "...";
+
+			try
+			{
+				boost::system::error_code ec;
+
+				// A socket left behind by a previous instance would prevent the bind.
+				if (boost::filesystem::status(path, ec).type() == boost::filesystem::socket_file)
+				{
+					boost::filesystem::remove(path, ec);
+				}
+
+				m_metrics_acceptor = boost::make_shared<metrics_acceptor_type>(boost::ref(m_io_service), boost::asio::local::stream_protocol::endpoint(path.string()));
+
+				// The metrics name the peer endpoints: only the owner may connect.
+				boost::filesystem::permissions(path, boost::filesystem::owner_read | boost::filesystem::owner_write);
+
+				async_accept_metrics_connection(m_metrics_acceptor);
+			}
+			catch (const boost::system::system_error& ex)
+			{
+				m_logger(fscp::log_level::error) << "Unable to expose metrics on " << path << ": " << ex.what();
+			}
+#endif
+		}
+	}
+
+	void core::close_metrics_socket()
+	{
+#ifndef WINDOWS
+		if (m_metrics_acceptor)
+		{
+			boost::system::error_code ec;
+
+			m_metrics_acceptor->close(ec);
+			m_metrics_acceptor.reset();
+
+			boost::filesystem::remove(m_configuration.metrics.socket, ec);
+		}
+#endif
+	}
+
+#ifndef WINDOWS
+	void core::async_accept_metrics_connection(boost::shared_ptr<metrics_acceptor_type> acceptor)
+	{
+		const boost::shared_ptr<metrics_socket_type> socket = boost::make_shared<metrics_socket_type>(boost::ref(m_io_service));
+
+		acceptor->async_accept(*socket, boost::bind(&core::do_handle_metrics_connection, this, acceptor, socket, boost::asio::placeholders::error));
+	}
+
+	void core::do_handle_metrics_connection(boost::shared_ptr<metrics_acceptor_type> acceptor, boost::shared_ptr<metrics_socket_type> socket, const boost::system::error_code& ec)
+	{
+		if (ec == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
+
+		async_accept_metrics_connection(acceptor);
+
+		if (ec)
+		{
+			m_logger(fscp::log_level::warning) << "Unable to accept a metrics connection: " << ec.message();
+
+			return;
+		}
+
+		const metrics_configuration::metrics_format_type format = m_configuration.metrics.format;
+
+		async_get_metrics([socket, format] (const metrics_snapshot& metrics) {
+			std::ostringstream oss;
+
+			if (format == metrics_configuration::metrics_format_type::prometheus)
+			{
+				metrics.write_prometheus(oss);
+			}
+			else
+			{
+				metrics.write_json(oss) << "\n";
+			}
+
+			const boost::shared_ptr<std::string> data = boost::make_shared<std::string>(oss.str());
+
+			// Every connection gets a single snapshot: the socket is closed once the last reference to it is gone.
+			boost::asio::async_write(*socket, boost::asio::buffer(*data), [socket, data] (const boost::system::error_code&, size_t) {});
+		});
+	}
+#endif
+
 	void core::open_web_client()
 	{
 		if (m_configuration.client.enabled)
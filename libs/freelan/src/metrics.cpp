@@ -0,0 +1,284 @@
+/*
+ * libfreelan - A C++ library to establish peer-to-peer virtual private
+ * networks.
+ * Copyright (C) 2010-2011 Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfreelan.
+ *
+ * libfreelan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfreelan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfreelan in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file metrics.cpp
+ * \author Julien KAUFFMANN <julien.kauffmann@freelan.org>
+ * \brief A snapshot of runtime metrics.
+ */
+
+#include "metrics.hpp"
+
+#include <kfather/formatter.hpp>
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+namespace freelan
+{
+	namespace
+	{
+		const char* to_string(metrics_snapshot::metric_type type)
+		{
+			switch (type)
+			{
+				case metrics_snapshot::metric_type::counter:
+					return "counter";
+				case metrics_snapshot::metric_type::gauge:
+					return "gauge";
+				case metrics_snapshot::metric_type::histogram:
+					return "histogram";
+			}
+
+			return "untyped";
+		}
+
+		std::ostream& write_escaped(std::ostream& os, const std::string& str, bool escape_quotes)
+		{
+			for (auto&& c : str)
+			{
+				if (c == '\\')
+				{
+					os << "\\\\";
+				}
+				else if (c == '\n')
+				{
+					os << "\\n";
+				}
+				else if ((c == '"') && escape_quotes)
+				{
+					os << "\\\"";
+				}
+				else
+				{
+					os << c;
+				}
+			}
+
+			return os;
+		}
+
+		std::ostream& write_value(std::ostream& os, double value)
+		{
+			// Counters are integers: we don't want them to be printed in scientific notation.
+			if ((std::floor(value) == value) && (std::fabs(value) < 9007199254740992.0))
+			{
+				return os << static_cast<int64_t>(value);
+			}
+
+			const std::streamsize precision = os.precision(std::numeric_limits<double>::digits10);
+			os << value;
+			os.precision(precision);
+
+			return os;
+		}
+
+		std::ostream& write_sample(std::ostream& os, const std::string& name, const metrics_snapshot::labels_type& labels, const char* bucket_bound, double value)
+		{
+			os << name;
+
+			if (!labels.empty() || bucket_bound)
+			{
+				os << "{";
+
+				for (auto label = labels.begin(); label != labels.end(); ++label)
+				{
+					if (label != labels.begin())
+					{
+						os << ",";
+					}
+
+					os << label->first << "=\"";
+					write_escaped(os, label->second, true) << "\"";
+				}
+
+				if (bucket_bound)
+				{
+					os << (labels.empty() ? "" : ",") << "le=\"" << bucket_bound << "\"";
+				}
+
+				os << "}";
+			}
+
+			os << " ";
+
+			return write_value(os, value) << "\n";
+		}
+	}
+
+	void metrics_snapshot::add(const std::string& name, metric_type type, const std::string& help, double value, const labels_type& labels)
+	{
+		sample_type sample;
+		sample.labels = labels;
+		sample.value = value;
+		sample.sum = 0;
+
+		add_sample(name, type, help, sample);
+	}
+
+	void metrics_snapshot::add_histogram(const std::string& name, const std::string& help, const buckets_type& buckets, double sum, uint64_t count, const labels_type& labels)
+	{
+		sample_type sample;
+		sample.labels = labels;
+		sample.value = static_cast<double>(count);
+		sample.buckets = buckets;
+		sample.sum = sum;
+
+		add_sample(name, metric_type::histogram, help, sample);
+	}
+
+	void metrics_snapshot::add_sample(const std::string& name, metric_type type, const std::string& help, const sample_type& sample)
+	{
+		const auto family_entry = m_families.find(name);
+
+		if (family_entry == m_families.end())
+		{
+			family_type family;
+			family.type = type;
+			family.help = help;
+			family.samples.push_back(sample);
+
+			m_families[name] = family;
+		}
+		else
+		{
+			family_entry->second.samples.push_back(sample);
+		}
+	}
+
+	kfather::object_type metrics_snapshot::to_json() const
+	{
+		kfather::object_type result;
+
+		for (auto&& family_entry : m_families)
+		{
+			const family_type& family = family_entry.second;
+			kfather::array_type samples;
+
+			for (auto&& sample : family.samples)
+			{
+				kfather::object_type labels;
+
+				for (auto&& label : sample.labels)
+				{
+					labels.items[label.first] = label.second;
+				}
+
+				kfather::object_type json_sample;
+				json_sample.items["labels"] = labels;
+				json_sample.items["value"] = sample.value;
+
+				if (family.type == metric_type::histogram)
+				{
+					kfather::array_type buckets;
+
+					for (auto&& bucket : sample.buckets)
+					{
+						kfather::object_type json_bucket;
+						json_bucket.items["le"] = bucket.first;
+						json_bucket.items["count"] = static_cast<double>(bucket.second);
+
+						buckets.items.push_back(json_bucket);
+					}
+
+					json_sample.items["buckets"] = buckets;
+					json_sample.items["sum"] = sample.sum;
+				}
+
+				samples.items.push_back(json_sample);
+			}
+
+			kfather::object_type json_family;
+			json_family.items["type"] = std::string(to_string(family.type));
+			json_family.items["help"] = family.help;
+			json_family.items["samples"] = samples;
+
+			result.items[family_entry.first] = json_family;
+		}
+
+		return result;
+	}
+
+	std::ostream& metrics_snapshot::write_json(std::ostream& os) const
+	{
+		// The default precision would print big counters in scientific notation.
+		const std::streamsize precision = os.precision(std::numeric_limits<double>::digits10);
+		kfather::compact_formatter().format(os, to_json());
+		os.precision(precision);
+
+		return os;
+	}
+
+	std::ostream& metrics_snapshot::write_prometheus(std::ostream& os) const
+	{
+		for (auto&& family_entry : m_families)
+		{
+			const family_type& family = family_entry.second;
+
+			os << "# HELP " << family_entry.first << " ";
+			write_escaped(os, family.help, false) << "\n";
+			os << "# TYPE " << family_entry.first << " " << to_string(family.type) << "\n";
+
+			for (auto&& sample : family.samples)
+			{
+				if (family.type != metric_type::histogram)
+				{
+					write_sample(os, family_entry.first, sample.labels, nullptr, sample.value);
+
+					continue;
+				}
+
+				for (auto&& bucket : sample.buckets)
+				{
+					std::ostringstream bound;
+					write_value(bound, bucket.first);
+
+					write_sample(os, family_entry.first + "_bucket", sample.labels, bound.str().c_str(), static_cast<double>(bucket.second));
+				}
+
+				write_sample(os, family_entry.first + "_bucket", sample.labels, "+Inf", sample.value);
+				write_sample(os, family_entry.first + "_sum", sample.labels, nullptr, sample.sum);
+				write_sample(os, family_entry.first + "_count", sample.labels, nullptr, sample.value);
+			}
+		}
+
+		return os;
+	}
+}
@@ -67,110 +67,242 @@ namespace freelan
 		}
 	}
 
-	void router::async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler)
+	class router::route_inserter : public boost::static_visitor<void>
 	{
-		const auto port_entries = get_targets_for(index, data);
+		public:
 
-		for (auto&& port_entry : port_entries) {
-			port_entry->async_write(data, handler);
-		}
-	}
+			route_inserter(routes_port_type& routes, port_index_type port_index) :
+				m_routes(routes),
+				m_port_index(port_index)
+			{}
+
+			void operator()(const asiotap::ipv4_route& route) const
+			{
+				m_routes.ipv4.insert(route.network_address(), m_port_index);
+			}
 
-	std::vector<const router::port_type*> router::get_targets_for(port_index_type index, boost::asio::const_buffer data)
+			void operator()(const asiotap::ipv6_route& route) const
+			{
+				m_routes.ipv6.insert(route.network_address(), m_port_index);
+			}
+
+		private:
+
+			routes_port_type& m_routes;
+			port_index_type m_port_index;
+	};
+
+	class router::route_eraser : public boost::static_visitor<void>
 	{
-		// Try IPv4 first because it is more likely.
+		public:
+
+			route_eraser(routes_port_type& routes, port_index_type port_index) :
+				m_routes(routes),
+				m_port_index(port_index)
+			{}
+
+			void operator()(const asiotap::ipv4_route& route) const
+			{
+				m_routes.ipv4.erase(route.network_address(), m_port_index);
+			}
+
+			void operator()(const asiotap::ipv6_route& route) const
+			{
+				m_routes.ipv6.erase(route.network_address(), m_port_index);
+			}
+
+		private:
+
+			routes_port_type& m_routes;
+			port_index_type m_port_index;
+	};
+
+	void router::async_write(port_index_type index, boost::asio::const_buffer data, port_type::write_handler_type handler) const
+	{
+		// The snapshot remains valid for the whole call, even if a new one gets published in the meantime.
+		const forwarding_table_ptr_type forwarding_table = boost::atomic_load(&m_forwarding_table);
 
-		m_ipv4_filter.parse(data);
+		const port_snapshot_list_type::const_iterator source_port_entry = forwarding_table->ports.find(index);
 
-		if (m_ipv4_filter.get_last_const_helper())
+		if (source_port_entry == forwarding_table->ports.end())
 		{
-			const boost::asio::ip::address_v4 destination = m_ipv4_filter.get_last_const_helper()->destination();
+			return;
+		}
+
+		// Try IPv4 first because it is more likely.
+		asiotap::osi::filter<asiotap::osi::ipv4_frame> ipv4_filter;
 
-			m_ipv4_filter.clear_last_helper();
+		ipv4_filter.parse(data);
 
-			return get_targets_for(index, destination);
+		if (ipv4_filter.get_last_const_helper())
+		{
+			const boost::asio::ip::address_v4 destination = ipv4_filter.get_last_const_helper()->destination();
+
+			async_write(*forwarding_table, source_port_entry, destination, data, handler);
 		}
 		else
 		{
-			m_ipv6_filter.parse(data);
+			asiotap::osi::filter<asiotap::osi::ipv6_frame> ipv6_filter;
+
+			ipv6_filter.parse(data);
 
-			if (m_ipv6_filter.get_last_const_helper())
+			if (ipv6_filter.get_last_const_helper())
 			{
-				const boost::asio::ip::address_v6 destination = m_ipv6_filter.get_last_const_helper()->destination();
+				const boost::asio::ip::address_v6 destination = ipv6_filter.get_last_const_helper()->destination();
 
-				m_ipv6_filter.clear_last_helper();
+				async_write(*forwarding_table, source_port_entry, destination, data, handler);
+			}
+			else
+			{
+				// Frame of other types than IPv4 or IPv6 are silently dropped.
+				m_counters.increment(counter::unsupported_drops);
+			}
+		}
+	}
 
-				return get_targets_for(index, destination);
+	template <typename AddressType>
+	void router::async_write(const forwarding_table_type& forwarding_table, port_snapshot_list_type::const_iterator source_port_entry, const AddressType& dest_addr, boost::asio::const_buffer data, port_type::write_handler_type handler) const
+	{
+		const port_snapshot_list_type& ports = forwarding_table.ports;
+
+		if (is_multicast(dest_addr)) {
+			m_counters.increment(counter::multicast_packets);
+
+			for (auto port_entry = ports.begin(); port_entry != ports.end(); ++port_entry) {
+				// Make sure we don't route multicast back packets to the source.
+				if (source_port_entry != port_entry) {
+					if (m_configuration.client_routing_enabled || (source_port_entry->second->group() != port_entry->second->group())) {
+						port_entry->second->async_write(data, handler);
+					}
+				}
 			}
+		} else {
+			// The routes are visited from the most specific to the least specific one.
+			const bool routed = forwarding_table.routes.get(dest_addr).find(dest_addr, [&] (const port_index_type& route_port) {
+				const port_snapshot_list_type::const_iterator port_entry = ports.find(route_port);
+
+				if (m_configuration.client_routing_enabled || (source_port_entry->second->group() != port_entry->second->group())) {
+					port_entry->second->async_write(data, handler);
+
+					return true;
+				}
+
+				return false;
+			});
+
+			m_counters.increment(routed ? counter::routed_packets : counter::no_route_drops);
 		}
+	}
+
+	router::statistics_type router::statistics() const
+	{
+		statistics_type result;
+
+		result.routed_packets = m_counters.get(counter::routed_packets);
+		result.multicast_packets = m_counters.get(counter::multicast_packets);
+		result.no_route_drops = m_counters.get(counter::no_route_drops);
+		result.unsupported_drops = m_counters.get(counter::unsupported_drops);
 
-		// Frame of other types than IPv4 or IPv6 are silently dropped.
-		return {};
+		return result;
+	}
+
+	size_t router::get_target_mtu(port_index_type index, const boost::asio::ip::address_v4& destination) const
+	{
+		return get_target_mtu<boost::asio::ip::address_v4>(index, destination);
+	}
+
+	size_t router::get_target_mtu(port_index_type index, const boost::asio::ip::address_v6& destination) const
+	{
+		return get_target_mtu<boost::asio::ip::address_v6>(index, destination);
 	}
 
 	template <typename AddressType>
-	std::vector<const router::port_type*> router::get_targets_for(port_index_type index, const AddressType& dest_addr)
+	size_t router::get_target_mtu(port_index_type index, const AddressType& destination) const
 	{
-		const router::port_list_type::const_iterator source_port_entry = m_ports.find(index);
+		if (is_multicast(destination))
+		{
+			return 0;
+		}
+
+		const forwarding_table_ptr_type forwarding_table = boost::atomic_load(&m_forwarding_table);
+		const port_snapshot_list_type& ports = forwarding_table->ports;
 
-		if (source_port_entry != m_ports.end())
+		const port_snapshot_list_type::const_iterator source_port_entry = ports.find(index);
+
+		if (source_port_entry == ports.end())
 		{
-			std::vector<const router::port_type*> result;
+			return 0;
+		}
 
-			if (is_multicast(dest_addr)) {
-				result.reserve(m_ports.size());
+		size_t result = 0;
 
-				for (auto port_entry = m_ports.begin(); port_entry != m_ports.end(); ++port_entry) {
-					// Make sure we don't route multicast back packets to the source.
-					if (source_port_entry != port_entry) {
-						if (m_configuration.client_routing_enabled || (source_port_entry->second.group() != port_entry->second.group())) {
-							result.push_back(&port_entry->second);
-						}
-					}
-				}
-			} else {
-				const auto& routes_ports = routes();
+		// The port is selected the same way async_write() does.
+		forwarding_table->routes.get(destination).find(destination, [&] (const port_index_type& route_port) {
+			const port_snapshot_list_type::const_iterator port_entry = ports.find(route_port);
 
-				for (auto&& route_port : routes_ports) {
-					if (has_address(route_port.first, dest_addr)) {
-						const port_list_type::const_iterator port_entry = m_ports.find(route_port.second);
+			if (m_configuration.client_routing_enabled || (source_port_entry->second->group() != port_entry->second->group())) {
+				result = port_entry->second->mtu();
 
-						if (m_configuration.client_routing_enabled || (source_port_entry->second.group() != port_entry->second.group())) {
-							result.push_back(&port_entry->second);
-							break;
-						}
-					}
-				}
+				return true;
 			}
 
-			return result;
-		}
+			return false;
+		});
 
-		// No route for the current frame so we return an empty list.
-		return {};
+		return result;
 	}
 
-	const router::routes_port_type& router::routes() const
+	void router::publish_forwarding_table()
 	{
-		if (!m_routes)
+		const boost::shared_ptr<forwarding_table_type> forwarding_table = boost::make_shared<forwarding_table_type>();
+
+		for (port_list_type::const_iterator port = m_ports.begin(); port != m_ports.end(); ++port)
 		{
-			// The routes were invalidated, we recompile them.
+			forwarding_table->ports[port->first] = boost::make_shared<const port_type>(port->second);
+
+			for (auto&& route : port->second.local_routes())
+			{
+				boost::apply_visitor(route_inserter(forwarding_table->routes, port->first), route);
+			}
+		}
 
-			m_routes = routes_port_type();
+		boost::atomic_store(&m_forwarding_table, forwarding_table_ptr_type(forwarding_table));
+	}
 
-			// We add all the port routes to the routes list.
-			// These are sorted automatically by the container.
-			for (port_list_type::const_iterator port = m_ports.begin(); port != m_ports.end(); ++port)
+	void router::publish_port(port_index_type index, const asiotap::ip_route_set& previous_local_routes)
+	{
+		// The new snapshot starts as a shallow copy of the current one: only the changes of the port are applied to it.
+		const boost::shared_ptr<forwarding_table_type> forwarding_table = boost::make_shared<forwarding_table_type>(*boost::atomic_load(&m_forwarding_table));
+
+		const port_list_type::const_iterator port = m_ports.find(index);
+		const asiotap::ip_route_set no_local_routes;
+		const asiotap::ip_route_set& local_routes = (port != m_ports.end()) ? port->second.local_routes() : no_local_routes;
+
+		if (port != m_ports.end())
+		{
+			forwarding_table->ports[index] = boost::make_shared<const port_type>(port->second);
+		}
+		else
+		{
+			forwarding_table->ports.erase(index);
+		}
+
+		for (auto&& route : previous_local_routes)
+		{
+			if (local_routes.find(route) == local_routes.end())
 			{
-				const auto& local_routes = port->second.local_routes();
+				boost::apply_visitor(route_eraser(forwarding_table->routes, index), route);
+			}
+		}
 
-				for (auto&& route : local_routes)
-				{
-					m_routes->insert(std::make_pair(route, port->first));
-				}
+		for (auto&& route : local_routes)
+		{
+			if (previous_local_routes.find(route) == previous_local_routes.end())
+			{
+				boost::apply_visitor(route_inserter(forwarding_table->routes, index), route);
 			}
 		}
 
-		return *m_routes;
+		boost::atomic_store(&m_forwarding_table, forwarding_table_ptr_type(forwarding_table));
 	}
 }
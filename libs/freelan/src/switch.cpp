@@ -45,21 +45,11 @@
 
 #include "switch.hpp"
 
+#include <atomic>
 #include <cassert>
 
 #include <boost/foreach.hpp>
-#include <boost/random/mersenne_twister.hpp>
-
-#include <boost/version.hpp>
-
-#if BOOST_VERSION >= 104700
-#include <boost/random/uniform_int_distribution.hpp>
-#else
-#include <boost/random/uniform_int.hpp>
-#include <boost/random/variate_generator.hpp>
-#endif
-
-#include <boost/thread/mutex.hpp>
+#include <boost/lockfree/stack.hpp>
 #include <boost/make_shared.hpp>
 
 #include <asiotap/osi/ethernet_helper.hpp>
@@ -68,175 +58,479 @@ namespace freelan
 {
 	namespace
 	{
-		template <typename KeyType, typename ValueType, typename Handler>
-		class results_gatherer
+		class flood_context;
+
+		// The maximum number of free flood contexts retained.
+		const size_t FLOOD_CONTEXT_POOL_CAPACITY = 256;
+
+		typedef boost::lockfree::stack<flood_context*, boost::lockfree::capacity<FLOOD_CONTEXT_POOL_CAPACITY> > flood_context_free_list_type;
+
+		flood_context_free_list_type& get_flood_context_free_list()
+		{
+			// The free list is never destroyed, so that contexts released during the static destruction remain valid.
+			static flood_context_free_list_type* const free_list = new flood_context_free_list_type();
+
+			return *free_list;
+		}
+
+		/**
+		 * \brief The targets and the completion state of a frame written to several ports.
+		 *
+		 * Contexts are pooled: a context goes back to the pool, with the capacity of its target list, when the last handler referencing it goes away, whether it was called or not.
+		 */
+		class flood_context
 		{
 			public:
 
-				typedef std::set<KeyType> set_type;
-				typedef std::map<KeyType, ValueType> map_type;
+				typedef std::vector<const switch_::port_type*> target_list_type;
 
-				results_gatherer(Handler handler, const set_type& keys) :
-					m_handler(handler),
-					m_keys(keys)
+				static flood_context* acquire()
 				{
-					if (m_keys.empty())
+					flood_context* context = nullptr;
+
+					if (!get_flood_context_free_list().pop(context))
 					{
-						m_handler(m_results);
+						context = new flood_context();
 					}
+
+					return context;
+				}
+
+				void add_reference()
+				{
+					m_references.fetch_add(1, std::memory_order_relaxed);
 				}
 
-				void gather(const KeyType& key, const ValueType& value)
+				void release()
 				{
-					boost::mutex::scoped_lock lock(m_mutex);
+					if (m_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					{
+						// We are the last reference: nobody else uses the context anymore.
+						m_targets.clear();
+						m_handler.clear();
 
-					const size_t erased_count = m_keys.erase(key);
+						if (!get_flood_context_free_list().bounded_push(this))
+						{
+							delete this;
+						}
+					}
+				}
+
+				target_list_type& targets()
+				{
+					return m_targets;
+				}
 
-					// Ensure that gather was called only once for a given key.
-					assert(erased_count == 1);
+				void start(const switch_::multi_write_handler_type& handler)
+				{
+					m_pending.store(m_targets.size(), std::memory_order_relaxed);
+					m_failed.store(false, std::memory_order_relaxed);
+					m_error = boost::system::error_code();
+					m_handler = handler;
+				}
 
-					m_results[key] = value;
+				void complete(const boost::system::error_code& ec)
+				{
+					if (ec && !m_failed.exchange(true))
+					{
+						m_error = ec;
+					}
 
-					if (m_keys.empty())
+					if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
 					{
-						m_handler(m_results);
+						// We are the last write: the other handlers are done with the error code and the handler.
+						switch_::multi_write_handler_type handler;
+						handler.swap(m_handler);
+
+						if (handler)
+						{
+							handler(m_error);
+						}
 					}
 				}
 
 			private:
 
-				boost::mutex m_mutex;
-				Handler m_handler;
-				set_type m_keys;
-				map_type m_results;
+				flood_context() :
+					m_references(0),
+					m_targets(),
+					m_pending(0),
+					m_failed(false),
+					m_error(),
+					m_handler()
+				{}
+
+				std::atomic<size_t> m_references;
+				target_list_type m_targets;
+				std::atomic<size_t> m_pending;
+				std::atomic<bool> m_failed;
+				boost::system::error_code m_error;
+				switch_::multi_write_handler_type m_handler;
+		};
+
+		/**
+		 * \brief The handler of a single write of a flooded frame.
+		 *
+		 * Every handler copy holds a reference to the context.
+		 */
+		class flood_write_handler
+		{
+			public:
+
+				explicit flood_write_handler(flood_context* context) :
+					m_context(context)
+				{
+					m_context->add_reference();
+				}
+
+				// Copies never throw: this allows boost::function to store the handler without allocating.
+				flood_write_handler(const flood_write_handler& other) BOOST_NOEXCEPT :
+					m_context(other.m_context)
+				{
+					m_context->add_reference();
+				}
+
+				flood_write_handler& operator=(const flood_write_handler&) = delete;
+
+				~flood_write_handler()
+				{
+					m_context->release();
+				}
+
+				flood_context& context() const
+				{
+					return *m_context;
+				}
+
+				void operator()(const boost::system::error_code& ec) const
+				{
+					m_context->complete(ec);
+				}
+
+			private:
+
+				flood_context* m_context;
 		};
 	}
 
-	const unsigned int switch_::MAX_ENTRIES_DEFAULT = 1024;
+	switch_::switch_(const switch_configuration& configuration) :
+		m_configuration(configuration),
+		m_ports(),
+		m_ports_snapshot(boost::make_shared<port_list_type>()),
+		m_ethernet_address_table_shards(),
+		m_ethernet_address_table_size(0),
+		m_counters()
+	{
+		// Addresses do not hash evenly: any shard can hold the whole capacity, which is enforced by the shared size.
+		m_ethernet_address_table_shards.reserve(ETHERNET_ADDRESS_TABLE_SHARDS);
+
+		for (size_t i = 0; i < ETHERNET_ADDRESS_TABLE_SHARDS; ++i)
+		{
+			m_ethernet_address_table_shards.push_back(boost::make_shared<ethernet_address_table_shard_type>(m_configuration.max_entries, m_configuration.ethernet_address_aging_time));
+		}
+	}
 
 	void switch_::async_write(port_index_type index, boost::asio::const_buffer data, multi_write_handler_type handler)
 	{
-		typedef results_gatherer<port_index_type, boost::system::error_code, multi_write_handler_type> results_gatherer_type;
+		// The snapshot keeps the ports alive until the writes are issued, even if they get unregistered in the meantime.
+		const port_list_ptr_type ports = boost::atomic_load(&m_ports_snapshot);
 
-		const auto targets = get_targets_for(index, data);
+		const port_list_type::const_iterator source_port_entry = ports->find(index);
 
-#if FREELAN_DEBUG
-		if (!targets.empty())
+		if (source_port_entry == ports->end())
 		{
-			std::cerr << "Switching " << buffer_size(data) << " byte(s) of data from " << index << " to " << targets.size() << " host(s)." << std::endl;
-		}
-		else
-		{
-			std::cerr << "Switching " << buffer_size(data) << " byte(s) of data from " << index << ": no targets." << std::endl;
+			// Frames from unknown ports are dropped.
+			if (handler)
+			{
+				handler(boost::system::error_code());
+			}
+
+			return;
 		}
-#endif
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+		const port_type* const target = get_target_for(*ports, source_port_entry, data);
 
-		for (auto&& target : targets)
+		if (target)
 		{
 #if FREELAN_DEBUG
-			std::cerr << index << "-> " << target << std::endl;
+			std::cerr << "Switching " << buffer_size(data) << " byte(s) of data from " << index << " to a single host." << std::endl;
 #endif
 
-			m_ports[target].async_write(data, boost::bind(&results_gatherer_type::gather, rg, target, _1));
+			// This is the most common case: no need to gather the results.
+			target->async_write(data, handler);
+
+			return;
 		}
-	}
 
-	std::set<port_index_type> switch_::get_targets_for(port_index_type index, boost::asio::const_buffer data)
-	{
-		const port_list_type::iterator source_port_entry = m_ports.find(index);
+		// This handler keeps the context alive until every write was issued, even if some complete synchronously.
+		const flood_write_handler write_handler(flood_context::acquire());
+		flood_context::target_list_type& targets = write_handler.context().targets();
+
+		for (port_list_type::const_iterator port_entry = ports->begin(); port_entry != ports->end(); ++port_entry)
+		{
+			if (is_flood_target(source_port_entry, port_entry))
+			{
+				targets.push_back(&port_entry->second);
+			}
+		}
 
-		if (source_port_entry != m_ports.end())
+#if FREELAN_DEBUG
+		std::cerr << "Switching " << buffer_size(data) << " byte(s) of data from " << index << " to " << targets.size() << " host(s)." << std::endl;
+#endif
+
+		switch (targets.size())
 		{
-			switch (m_configuration.routing_method)
+			case 0:
 			{
-				case switch_configuration::RM_HUB:
+				if (handler)
 				{
-					return get_targets_for(source_port_entry);
+					handler(boost::system::error_code());
 				}
-				case switch_configuration::RM_SWITCH:
+
+				break;
+			}
+			case 1:
+			{
+				targets.front()->async_write(data, handler);
+
+				break;
+			}
+			default:
+			{
+				write_handler.context().start(handler);
+
+				for (auto&& target_port : targets)
 				{
-					asiotap::osi::const_helper<asiotap::osi::ethernet_frame> ethernet_helper(data);
+					target_port->async_write(data, write_handler);
+				}
 
-					const ethernet_address_type target_address = to_ethernet_address(ethernet_helper.target());
+				break;
+			}
+		}
+	}
 
-					if (is_multicast_address(target_address))
-					{
-						return get_targets_for(source_port_entry);
-					}
-					else
-					{
-						m_ethernet_address_map[to_ethernet_address(ethernet_helper.sender())] = index;
+	size_t switch_::get_target_mtu(boost::asio::const_buffer data)
+	{
+		if (m_configuration.routing_method != switch_configuration::RM_SWITCH)
+		{
+			return 0;
+		}
 
-						// We exceeded the maximum count for entries: we delete random entries to fix it.
-						while (m_ethernet_address_map.size() > m_max_entries)
-						{
-							ethernet_address_map_type::iterator entry = m_ethernet_address_map.begin();
+		asiotap::osi::const_helper<asiotap::osi::ethernet_frame> ethernet_helper(data);
 
-#if BOOST_VERSION >= 104700
-							boost::random::mt19937 gen;
+		const ethernet_address_type target_address = to_ethernet_address(ethernet_helper.target());
 
-							std::advance(entry, boost::random::uniform_int_distribution<>(0, static_cast<int>(m_ethernet_address_map.size()) - 1)(gen));
-#else
-							boost::mt19937 gen;
+		if (is_multicast_address(target_address))
+		{
+			return 0;
+		}
 
-							boost::variate_generator<boost::mt19937&, boost::uniform_int<> > vgen(gen, boost::uniform_int<>(0, m_ethernet_address_map.size() - 1));
-							std::advance(entry, vgen());
-#endif
+		ethernet_address_table_ptr_type snapshot;
+		const port_index_type* const target_port_index = find_ethernet_address(ethernet_address_table_type::to_key(target_address), boost::posix_time::microsec_clock::universal_time(), snapshot);
 
-							m_ethernet_address_map.erase(entry);
-						}
+		if (!target_port_index)
+		{
+			return 0;
+		}
 
-						// We look in the ethernet address map
+		const port_list_ptr_type ports = boost::atomic_load(&m_ports_snapshot);
+		const port_list_type::const_iterator target_port_entry = ports->find(*target_port_index);
 
-						const ethernet_address_map_type::iterator target_entry = m_ethernet_address_map.find(target_address);
+		return (target_port_entry != ports->end()) ? target_port_entry->second.mtu() : 0;
+	}
 
-						if (target_entry == m_ethernet_address_map.end())
-						{
-							// No target entry: we send the message to everybody.
-							return get_targets_for(source_port_entry);
-						}
+	switch_::statistics_type switch_::statistics() const
+	{
+		statistics_type result;
 
-						const port_index_type target_port_index = target_entry->second;
+		result.ethernet_address_table_size = 0;
 
-						if (!is_registered(target_port_index))
-						{
-							// The port does not exist: we delete the entry and send to everybody.
-							m_ethernet_address_map.erase(target_entry);
+		for (auto&& shard : m_ethernet_address_table_shards)
+		{
+			boost::mutex::scoped_lock lock(shard->mutex);
 
-							return get_targets_for(source_port_entry);
-						}
+			const ethernet_address_table_type::statistics_type shard_statistics = shard->table.statistics();
 
-						std::set<port_index_type> targets;
+			result.ethernet_address_table.learned += shard_statistics.learned;
+			result.ethernet_address_table.moved += shard_statistics.moved;
+			result.ethernet_address_table.evicted += shard_statistics.evicted;
+			result.ethernet_address_table.expired += shard_statistics.expired;
+			result.ethernet_address_table.hits += shard_statistics.hits;
+			result.ethernet_address_table.misses += shard_statistics.misses;
+			result.ethernet_address_table_size += shard->table.size();
+		}
 
-						targets.insert(target_port_index);
+		// The lookups served by the snapshots do not reach the tables.
+		result.ethernet_address_table.hits += m_counters.get(counter::snapshot_hits);
 
-						return targets;
-					}
-				}
+		result.switched_frames = m_counters.get(counter::switched_frames);
+		result.flooded_frames = m_counters.get(counter::flooded_frames);
+
+		return result;
+	}
+
+	void switch_::publish_ports()
+	{
+		boost::atomic_store(&m_ports_snapshot, port_list_ptr_type(boost::make_shared<port_list_type>(m_ports)));
+	}
+
+	switch_::ethernet_address_table_shard_type& switch_::get_shard(ethernet_address_table_type::key_type key)
+	{
+		// The table hashes with the middle bits of the product: the top bits are left to pick the shard.
+		static_assert((ETHERNET_ADDRESS_TABLE_SHARDS & (ETHERNET_ADDRESS_TABLE_SHARDS - 1)) == 0, "ETHERNET_ADDRESS_TABLE_SHARDS must be a power of two");
+
+		return *m_ethernet_address_table_shards[static_cast<size_t>((key * UINT64_C(0x9E3779B97F4A7C15)) >> 60) & (ETHERNET_ADDRESS_TABLE_SHARDS - 1)];
+	}
+
+	void switch_::update_ethernet_address_table_size(size_t previous_shard_size, size_t shard_size)
+	{
+		// Unsigned arithmetic wraps around: this also works when the shard shrank.
+		m_ethernet_address_table_size.fetch_add(shard_size - previous_shard_size, std::memory_order_relaxed);
+	}
+
+	void switch_::publish_shard(ethernet_address_table_shard_type& shard)
+	{
+		// publish_shard() is called with the shard mutex locked.
+		boost::atomic_store(&shard.snapshot, ethernet_address_table_ptr_type(boost::make_shared<ethernet_address_table_type>(shard.table)));
+	}
+
+	void switch_::learn_ethernet_address(ethernet_address_table_type::key_type key, port_index_type index, const boost::posix_time::ptime& now)
+	{
+		ethernet_address_table_shard_type& shard = get_shard(key);
+
+		{
+			const ethernet_address_table_ptr_type snapshot = boost::atomic_load(&shard.snapshot);
+			boost::posix_time::ptime last_seen;
+			const port_index_type* const port_index = snapshot->peek(key, now, &last_seen);
+
+			// The address is only seen again once in a while, so that the table and its snapshot are not copied for every frame. This delays its aging by half the aging time at most.
+			if (port_index && (*port_index == index) && ((m_configuration.ethernet_address_aging_time <= boost::posix_time::time_duration()) || (now <= last_seen + m_configuration.ethernet_address_aging_time / 2)))
+			{
+				return;
 			}
 		}
 
-		return std::set<port_index_type>();
+		boost::mutex::scoped_lock lock(shard.mutex);
+
+		// When the table is full, this evicts the least recently seen entry of the shard among a few neighbours.
+		const size_t table_size = shard.table.size();
+		shard.table.learn(key, index, now, m_ethernet_address_table_size.load(std::memory_order_relaxed) >= m_configuration.max_entries);
+		update_ethernet_address_table_size(table_size, shard.table.size());
+
+		publish_shard(shard);
 	}
 
-	std::set<port_index_type> switch_::get_targets_for(port_list_type::const_iterator source_port_entry)
+	const port_index_type* switch_::find_ethernet_address(ethernet_address_table_type::key_type key, const boost::posix_time::ptime& now, ethernet_address_table_ptr_type& snapshot)
 	{
-		std::set<port_index_type> targets;
+		ethernet_address_table_shard_type& shard = get_shard(key);
+
+		snapshot = boost::atomic_load(&shard.snapshot);
+
+		if (const port_index_type* const port_index = snapshot->peek(key, now))
+		{
+			m_counters.increment(counter::snapshot_hits);
+
+			return port_index;
+		}
 
-		for (port_list_type::const_iterator port_entry = m_ports.begin(); port_entry != m_ports.end(); ++port_entry)
 		{
-			if (source_port_entry != port_entry)
+			// The snapshot can lag behind the table: the table has the last word, and purges the expired entry if there is one.
+			boost::mutex::scoped_lock lock(shard.mutex);
+
+			const size_t table_size = shard.table.size();
+			const bool found = (shard.table.find(key, now) != nullptr);
+			update_ethernet_address_table_size(table_size, shard.table.size());
+
+			if (!found && (shard.table.size() == table_size))
 			{
-				if (m_configuration.relay_mode_enabled || (source_port_entry->second.group() != port_entry->second.group()))
+				return nullptr;
+			}
+
+			publish_shard(shard);
+			snapshot = boost::atomic_load(&shard.snapshot);
+		}
+
+		return snapshot->peek(key, now);
+	}
+
+	const switch_::port_type* switch_::get_target_for(const port_list_type& ports, port_list_type::const_iterator source_port_entry, boost::asio::const_buffer data)
+	{
+		switch (m_configuration.routing_method)
+		{
+			case switch_configuration::RM_HUB:
+			{
+				m_counters.increment(counter::flooded_frames);
+
+				return nullptr;
+			}
+			case switch_configuration::RM_SWITCH:
+			{
+				asiotap::osi::const_helper<asiotap::osi::ethernet_frame> ethernet_helper(data);
+
+				const ethernet_address_type target_address = to_ethernet_address(ethernet_helper.target());
+
+				if (is_multicast_address(target_address))
+				{
+					m_counters.increment(counter::flooded_frames);
+
+					return nullptr;
+				}
+
+				const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+				learn_ethernet_address(ethernet_address_table_type::to_key(to_ethernet_address(ethernet_helper.sender())), source_port_entry->first, now);
+
+				// We look in the ethernet address table
+				const ethernet_address_table_type::key_type target_key = ethernet_address_table_type::to_key(target_address);
+				ethernet_address_table_ptr_type snapshot;
+				const port_index_type* const target_port_index = find_ethernet_address(target_key, now, snapshot);
+
+				if (!target_port_index)
 				{
-					targets.insert(port_entry->first);
+					// No target entry (or an expired one): we send the message to everybody.
+					m_counters.increment(counter::flooded_frames);
+
+					return nullptr;
 				}
+
+				const port_list_type::const_iterator target_port_entry = ports.find(*target_port_index);
+
+				if (target_port_entry == ports.end())
+				{
+					// The port does not exist: we delete the entry and send to everybody.
+					ethernet_address_table_shard_type& shard = get_shard(target_key);
+
+					boost::mutex::scoped_lock lock(shard.mutex);
+
+					if (shard.table.erase(target_key))
+					{
+						m_ethernet_address_table_size.fetch_sub(1, std::memory_order_relaxed);
+
+						publish_shard(shard);
+					}
+
+					m_counters.increment(counter::flooded_frames);
+
+					return nullptr;
+				}
+
+				m_counters.increment(counter::switched_frames);
+
+				return &target_port_entry->second;
 			}
 		}
 
-		return targets;
+		return nullptr;
+	}
+
+	bool switch_::is_flood_target(port_list_type::const_iterator source_port_entry, port_list_type::const_iterator port_entry) const
+	{
+		if (source_port_entry == port_entry)
+		{
+			return false;
+		}
+
+		return (m_configuration.relay_mode_enabled || (source_port_entry->second.group() != port_entry->second.group()));
 	}
 
 	switch_::ethernet_address_type switch_::to_ethernet_address(boost::asio::const_buffer buf)
@@ -240,6 +240,7 @@ namespace fscp
 		MESSAGE_TYPE_DATA_13 = 0x7D,
 		MESSAGE_TYPE_DATA_14 = 0x7E,
 		MESSAGE_TYPE_DATA_15 = 0x7F,
+		MESSAGE_TYPE_PATH_MTU = 0xFC,
 		MESSAGE_TYPE_CONTACT_REQUEST = 0xFD,
 		MESSAGE_TYPE_CONTACT = 0xFE,
 		MESSAGE_TYPE_KEEP_ALIVE = 0xFF
@@ -560,11 +561,59 @@ namespace fscp
 	 */
 	const boost::posix_time::time_duration SESSION_TIMEOUT = SESSION_KEEP_ALIVE_PERIOD * 3;
 
+	/**
+	 * \brief The resolution of the timing wheels that schedule the keep-alives, the session timeouts and the HELLO timeouts.
+	 */
+	const boost::posix_time::time_duration TIMING_WHEEL_TICK_DURATION = boost::posix_time::milliseconds(100);
+
+	/**
+	 * \brief The delay before a receive loop tries again after a persistent receive error.
+	 */
+	const boost::posix_time::time_duration RECEIVE_ERROR_RETRY_DELAY = boost::posix_time::milliseconds(100);
+
 	/**
 	 * \brief The keep-alive data size.
 	 */
 	const size_t SESSION_KEEP_ALIVE_DATA_SIZE = 32;
 
+	/**
+	 * \brief The size of the anti-replay window, in messages.
+	 *
+	 * A DATA message whose sequence number is within that distance of the greatest received sequence number is accepted once, even if it arrives out of order.
+	 */
+	const size_t REPLAY_WINDOW_SIZE = 1024;
+
+	/**
+	 * \brief The period of the path MTU probes.
+	 *
+	 * A probe that was not acknowledged within that period is considered lost.
+	 */
+	const boost::posix_time::time_duration PATH_MTU_PROBE_PERIOD = boost::posix_time::seconds(1);
+
+	/**
+	 * \brief The period after which a completed path MTU search is started again, to detect path changes.
+	 */
+	const boost::posix_time::time_duration PATH_MTU_RAISE_PERIOD = boost::posix_time::minutes(10);
+
+	/**
+	 * \brief The number of times a path MTU probe is sent before its size is considered too big.
+	 */
+	const unsigned int PATH_MTU_MAX_PROBES = 3;
+
+	/**
+	 * \brief The datagram size that every path is assumed to support.
+	 *
+	 * It is probed first: peers that never acknowledge it do not take part in path MTU discovery.
+	 */
+	const size_t PATH_MTU_BASE_SIZE = 1200;
+
+	/**
+	 * \brief The greatest datagram size that is probed.
+	 *
+	 * This is a 9000 bytes jumbo frame, without its IPv4 and UDP headers.
+	 */
+	const size_t PATH_MTU_MAX_SIZE = 8972;
+
 	/**
 	 * \brief Check if a message type is a DATA type message.
 	 * \param type The message type.
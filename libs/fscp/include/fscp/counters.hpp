@@ -0,0 +1,225 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file counters.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Counters that can be incremented concurrently from many threads.
+ */
+
+#ifndef FSCP_COUNTERS_HPP
+#define FSCP_COUNTERS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+#include <boost/noncopyable.hpp>
+
+namespace fscp
+{
+	/**
+	 * \brief The assumed size of a cache line.
+	 */
+	const size_t CACHE_LINE_SIZE = 64;
+
+	/**
+	 * \brief Get the counters slot of the calling thread.
+	 * \return The slot index. It never changes for a given thread.
+	 *
+	 * Slots are assigned in a round-robin fashion, the first time a thread asks for one.
+	 */
+	size_t get_counters_slot();
+
+	/**
+	 * \brief A set of counters, with one slot per thread.
+	 *
+	 * Every thread only increments the values of its own slot, so that concurrent increments seldom touch the same cache line. Reading a counter sums all the slots: the result is exact once the writers are done, and a close approximation otherwise.
+	 *
+	 * CounterType must be an enumeration whose last value is count.
+	 *
+	 * All the methods are thread-safe.
+	 */
+	template <typename CounterType>
+	class sharded_counters : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief The number of slots.
+			 *
+			 * Threads beyond that count share their slot with another one, which is still correct, just slower.
+			 */
+			static const size_t SLOTS_COUNT = 16;
+
+			/**
+			 * \brief The number of counters.
+			 */
+			static const size_t COUNTERS_COUNT = static_cast<size_t>(CounterType::count);
+
+			/**
+			 * \brief Create a new set of counters, all set to zero.
+			 */
+			sharded_counters()
+			{
+				for (auto&& slot : m_slots)
+				{
+					for (auto&& value : slot.values)
+					{
+						value = 0;
+					}
+				}
+			}
+
+			/**
+			 * \brief Increment a counter.
+			 * \param counter The counter.
+			 * \param value The value to add.
+			 */
+			void increment(CounterType counter, uint64_t value = 1)
+			{
+				m_slots[get_counters_slot() % SLOTS_COUNT].values[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get the value of a counter.
+			 * \param counter The counter.
+			 * \return The sum of the values of all the slots.
+			 */
+			uint64_t get(CounterType counter) const
+			{
+				uint64_t result = 0;
+
+				for (auto&& slot : m_slots)
+				{
+					result += slot.values[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+				}
+
+				return result;
+			}
+
+		private:
+
+			struct slot_type
+			{
+				std::array<std::atomic<uint64_t>, COUNTERS_COUNT> values;
+
+				// The padding ensures the values of two slots never share a cache line, whatever the alignment of the storage.
+				char padding[CACHE_LINE_SIZE];
+			};
+
+			std::array<slot_type, SLOTS_COUNT> m_slots;
+	};
+
+	/**
+	 * \brief A histogram, with one slot per thread.
+	 *
+	 * The observations are counted in BUCKETS_COUNT buckets: bucket n counts the values that are lower than or equal to 2^n, and greater than the upper bound of the previous bucket. The last bucket has no upper bound.
+	 *
+	 * As with sharded_counters, every thread only updates its own slot and reading sums all the slots.
+	 *
+	 * All the methods are thread-safe.
+	 */
+	class sharded_histogram : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief The number of slots.
+			 */
+			static const size_t SLOTS_COUNT = 16;
+
+			/**
+			 * \brief The number of buckets.
+			 */
+			static const size_t BUCKETS_COUNT = 24;
+
+			/**
+			 * \brief The state of a histogram at a given time.
+			 */
+			struct snapshot_type
+			{
+				std::array<uint64_t, BUCKETS_COUNT> counts; /**< \brief The number of observations of each bucket. They are not cumulative. */
+				uint64_t count; /**< \brief The total number of observations. */
+				uint64_t sum; /**< \brief The sum of all the observed values. */
+			};
+
+			/**
+			 * \brief Get the upper bound of a bucket.
+			 * \param bucket The bucket. Must be lower than BUCKETS_COUNT - 1, as the last bucket has no upper bound.
+			 * \return The greatest value counted in bucket.
+			 */
+			static uint64_t upper_bound(size_t bucket)
+			{
+				return (static_cast<uint64_t>(1) << bucket);
+			}
+
+			/**
+			 * \brief Create a new empty histogram.
+			 */
+			sharded_histogram();
+
+			/**
+			 * \brief Record an observation.
+			 * \param value The observed value.
+			 */
+			void observe(uint64_t value);
+
+			/**
+			 * \brief Get the state of the histogram.
+			 * \return The sum of all the slots.
+			 */
+			snapshot_type snapshot() const;
+
+		private:
+
+			struct slot_type
+			{
+				std::array<std::atomic<uint64_t>, BUCKETS_COUNT> counts;
+				std::atomic<uint64_t> sum;
+
+				// The padding ensures the values of two slots never share a cache line, whatever the alignment of the storage.
+				char padding[CACHE_LINE_SIZE];
+			};
+
+			std::array<slot_type, SLOTS_COUNT> m_slots;
+	};
+}
+
+#endif /* FSCP_COUNTERS_HPP */
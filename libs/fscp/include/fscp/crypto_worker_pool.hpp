@@ -0,0 +1,150 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file crypto_worker_pool.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A bounded pool of threads dedicated to asymmetric cryptography.
+ */
+
+#ifndef FSCP_CRYPTO_WORKER_POOL_HPP
+#define FSCP_CRYPTO_WORKER_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace fscp
+{
+	/**
+	 * \brief A pool of threads that run expensive cryptographic operations.
+	 *
+	 * The pool has its own io_service and threads, so that a burst of handshakes (signatures, signature checks and key derivations) never delays the handlers of the io_service that carries the data traffic.
+	 *
+	 * The number of jobs waiting to be run is bounded: once the limit is reached, new jobs are rejected instead of queued.
+	 *
+	 * All the methods are thread-safe.
+	 */
+	class crypto_worker_pool : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief The job type.
+			 *
+			 * Jobs are run on one of the pool threads and must not throw.
+			 */
+			typedef boost::function<void ()> job_type;
+
+			/**
+			 * \brief Create a new pool and start its threads.
+			 * \param threads_count The number of threads. Must be positive.
+			 * \param max_pending The maximum number of jobs waiting to be run.
+			 */
+			crypto_worker_pool(size_t threads_count, size_t max_pending);
+
+			/**
+			 * \brief Stop the pool.
+			 *
+			 * The jobs that did not start yet are discarded. The running ones are waited for.
+			 */
+			~crypto_worker_pool();
+
+			/**
+			 * \brief Get the number of threads.
+			 * \return The number of threads.
+			 */
+			size_t threads_count() const
+			{
+				return m_threads.size();
+			}
+
+			/**
+			 * \brief Get the maximum number of jobs waiting to be run.
+			 * \return The maximum number of jobs waiting to be run.
+			 */
+			size_t max_pending() const
+			{
+				return m_max_pending;
+			}
+
+			/**
+			 * \brief Get the number of jobs that are queued or running.
+			 * \return The number of jobs that are queued or running.
+			 */
+			size_t pending() const
+			{
+				return m_pending.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get the number of jobs that were rejected because the queue was full.
+			 * \return The number of rejected jobs.
+			 */
+			uint64_t rejected() const
+			{
+				return m_rejected.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Queue a job.
+			 * \param job The job.
+			 * \return true if the job was queued, false if the queue was full. In the latter case, job is never run.
+			 */
+			bool post(job_type job);
+
+		private:
+
+			void run_job(const job_type& job);
+
+			boost::asio::io_service m_io_service;
+			boost::scoped_ptr<boost::asio::io_service::work> m_work;
+			boost::thread_group m_threads;
+			const size_t m_max_pending;
+			std::atomic<size_t> m_pending;
+			std::atomic<uint64_t> m_rejected;
+	};
+}
+
+#endif /* FSCP_CRYPTO_WORKER_POOL_HPP */
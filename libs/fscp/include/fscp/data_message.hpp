@@ -50,6 +50,7 @@
 #include "constants.hpp"
 
 #include <cryptoplus/pkey/pkey.hpp>
+#include <cryptoplus/cipher/cipher_context.hpp>
 
 namespace fscp
 {
@@ -65,6 +66,24 @@ namespace fscp
 			 */
 			typedef cryptoplus::cipher::cipher_algorithm calg_t;
 
+			/**
+			 * \brief The cipher context type.
+			 */
+			typedef cryptoplus::cipher::cipher_context cctx_t;
+
+			/**
+			 * \brief Initialize a cipher context so that it can be reused for several messages.
+			 * \param cipher_context The cipher context to initialize.
+			 * \param cipher_algorithm The cipher algorithm to use.
+			 * \param direction The cipher direction.
+			 * \param enc_key The encryption key.
+			 * \param enc_key_len The encryption key length.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 *
+			 * The key schedule is computed once and for all: only the IV is changed for every message.
+			 */
+			static void initialize_cipher_context(cctx_t& cipher_context, data_message::calg_t cipher_algorithm, cctx_t::cipher_direction direction, const void* enc_key, size_t enc_key_len, size_t nonce_prefix_len);
+
 			/**
 			 * \brief Write a data message to a buffer.
 			 * \param buf The buffer to write to.
@@ -82,6 +101,31 @@ namespace fscp
 			 */
 			static size_t write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
 
+			/**
+			 * \brief Write a data message to a buffer, using an initialized cipher context.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param channel_number The channel number.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
+			 * \param cleartext The cleartext data.
+			 * \param cleartext_len The data length.
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes written.
+			 */
+			static size_t write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type sequence_number, cctx_t& cipher_context, const void* cleartext, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Get the buffer size required to write a data message.
+			 * \param cleartext_len The data length.
+			 * \return The minimum buffer size to give to write() for cleartext_len bytes of data, with any cipher algorithm.
+			 */
+			static size_t get_write_buffer_size(size_t cleartext_len)
+			{
+				return HEADER_LENGTH + MIN_BODY_LENGTH + cleartext_len + EVP_MAX_BLOCK_LENGTH;
+			}
+
 			/**
 			 * \brief Write a contact-request message to a buffer.
 			 * \param buf The buffer to write to.
@@ -97,6 +141,19 @@ namespace fscp
 			 */
 			static size_t write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const hash_list_type& hash_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
 
+			/**
+			 * \brief Write a contact-request message to a buffer, using an initialized cipher context.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
+			 * \param hash_list The hash list.
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes written.
+			 */
+			static size_t write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, cctx_t& cipher_context, const hash_list_type& hash_list, const void* nonce_prefix, size_t nonce_prefix_len);
+
 			/**
 			 * \brief Write a contact message to a buffer.
 			 * \param buf The buffer to write to.
@@ -112,6 +169,19 @@ namespace fscp
 			 */
 			static size_t write_contact(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const contact_map_type& contact_map, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
 
+			/**
+			 * \brief Write a contact message to a buffer, using an initialized cipher context.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
+			 * \param contact_map The contact map.
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes written.
+			 */
+			static size_t write_contact(void* buf, size_t buf_len, sequence_number_type sequence_number, cctx_t& cipher_context, const contact_map_type& contact_map, const void* nonce_prefix, size_t nonce_prefix_len);
+
 			/**
 			 * \brief Write a keep-alive message to a buffer.
 			 * \param buf The buffer to write to.
@@ -127,6 +197,50 @@ namespace fscp
 			 */
 			static size_t write_keep_alive(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, size_t random_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len);
 
+			/**
+			 * \brief Write a keep-alive message to a buffer, using an initialized cipher context.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
+			 * \param random_len The length of the random content to send.
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes written.
+			 */
+			static size_t write_keep_alive(void* buf, size_t buf_len, sequence_number_type sequence_number, cctx_t& cipher_context, size_t random_len, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Write a path MTU message to a buffer, using an initialized cipher context.
+			 * \param buf The buffer to write to.
+			 * \param buf_len The length of buf.
+			 * \param sequence_number The sequence number.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
+			 * \param path_mtu The size of the received path MTU probe.
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes written.
+			 */
+			static size_t write_path_mtu(void* buf, size_t buf_len, sequence_number_type sequence_number, cctx_t& cipher_context, size_t path_mtu, const void* nonce_prefix, size_t nonce_prefix_len);
+
+			/**
+			 * \brief Get the size of a data message.
+			 * \param cleartext_len The data length.
+			 * \return The size of a data message that holds cleartext_len bytes of data. All the cipher suites use GCM, which does not pad the data.
+			 */
+			static size_t get_message_size(size_t cleartext_len)
+			{
+				return HEADER_LENGTH + MIN_BODY_LENGTH + cleartext_len;
+			}
+
+			/**
+			 * \brief Parse the path MTU.
+			 * \param buf The buffer to parse.
+			 * \param buflen The length of the buffer to parse.
+			 * \return The path MTU.
+			 */
+			static size_t parse_path_mtu(const void* buf, size_t buflen);
+
 			/**
 			 * \brief Parse the hash list.
 			 * \param buf The buffer to parse.
@@ -201,6 +315,17 @@ namespace fscp
 			 */
 			size_t get_cleartext(void* buf, size_t buf_len, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len) const;
 
+			/**
+			 * \brief Get the clear text data, using an initialized cipher context.
+			 * \param buf The buffer that must receive the data. If buf is NULL, the function returns the expected size of buf.
+			 * \param buf_len The length of buf.
+			 * \param cipher_context The decryption cipher context, as initialized by initialize_cipher_context().
+			 * \param nonce_prefix The nonce prefix.
+			 * \param nonce_prefix_len The nonce prefix length.
+			 * \return The count of bytes deciphered.
+			 */
+			size_t get_cleartext(void* buf, size_t buf_len, cctx_t& cipher_context, const void* nonce_prefix, size_t nonce_prefix_len) const;
+
 		protected:
 
 			/**
@@ -213,17 +338,15 @@ namespace fscp
 			 * \param buf The buffer to write to.
 			 * \param buf_len The length of buf.
 			 * \param sequence_number The sequence number.
-			 * \param cipher_algorithm The cipher algorithm to use.
+			 * \param cipher_context The encryption cipher context, as initialized by initialize_cipher_context().
 			 * \param cleartext The cleartext data.
 			 * \param cleartext_len The data length.
-			 * \param enc_key The encryption key.
-			 * \param enc_key_len The encryption key length.
 			 * \param nonce_prefix The nonce prefix.
 			 * \param nonce_prefix_len The nonce prefix length.
 			 * \param type The message type.
 			 * \return The count of bytes written.
 			 */
-			static size_t raw_write(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const void* cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type);
+			static size_t raw_write(void* buf, size_t buf_len, sequence_number_type sequence_number, cctx_t& cipher_context, const void* cleartext, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type);
 
 		private:
 
@@ -0,0 +1,181 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file ecdhe_key_pool.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A pool of pre-generated ephemeral ECDHE keys.
+ */
+
+#ifndef FSCP_ECDHE_KEY_POOL_HPP
+#define FSCP_ECDHE_KEY_POOL_HPP
+
+#include "constants.hpp"
+
+#include <cryptoplus/pkey/ecdhe.hpp>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <atomic>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * \brief A pool of ECDHE keys, generated in the background.
+	 *
+	 * Generating an ECDHE key pair is the most expensive part of preparing a session. The pool keeps a few ready key pairs for every elliptic curve in use, so that preparing a session only takes one of them. Every key pair is handed out once.
+	 *
+	 * Whenever a key pair is taken, the pool is refilled through its executor.
+	 *
+	 * All the methods are thread-safe, unless specified otherwise.
+	 */
+	class ecdhe_key_pool : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief The key type.
+			 */
+			typedef cryptoplus::pkey::ecdhe_context key_type;
+
+			/**
+			 * \brief The key pointer type.
+			 */
+			typedef boost::shared_ptr<key_type> key_ptr_type;
+
+			/**
+			 * \brief The executor type.
+			 *
+			 * An executor runs the specified job in the background and returns true, or returns false if it cannot do so.
+			 */
+			typedef boost::function<bool (boost::function<void ()>)> executor_type;
+
+			/**
+			 * \brief The default number of key pairs kept per elliptic curve.
+			 */
+			static const size_t DEFAULT_SIZE = 4;
+
+			/**
+			 * \brief Create a new key pool.
+			 * \param executor The executor that runs the refills.
+			 * \param size The number of key pairs to keep per elliptic curve.
+			 */
+			explicit ecdhe_key_pool(executor_type executor, size_t size = DEFAULT_SIZE);
+
+			/**
+			 * \brief Get the number of key pairs kept per elliptic curve.
+			 * \return The number of key pairs kept per elliptic curve.
+			 */
+			size_t size() const
+			{
+				return m_size;
+			}
+
+			/**
+			 * \brief Set the number of key pairs to keep per elliptic curve.
+			 * \param size The number of key pairs to keep per elliptic curve. If size is 0, every key pair is generated when it is taken.
+			 *
+			 * This method is *NOT* thread-safe.
+			 */
+			void set_size(size_t size)
+			{
+				m_size = size;
+			}
+
+			/**
+			 * \brief Get the number of key pairs that were taken from the pool.
+			 * \return The number of key pairs that were taken from the pool.
+			 */
+			uint64_t hits() const
+			{
+				return m_hits.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Get the number of key pairs that had to be generated on the spot because the pool was empty.
+			 * \return The number of key pairs generated on the spot.
+			 */
+			uint64_t misses() const
+			{
+				return m_misses.load(std::memory_order_relaxed);
+			}
+
+			/**
+			 * \brief Fill the pool for the specified elliptic curves, in the background.
+			 * \param elliptic_curves The elliptic curves.
+			 */
+			void fill(const elliptic_curve_list_type& elliptic_curves);
+
+			/**
+			 * \brief Take a key pair.
+			 * \param elliptic_curve The elliptic curve.
+			 * \return A key pair whose keys are generated. If the pool is empty, it is generated on the spot.
+			 */
+			key_ptr_type take(elliptic_curve_type elliptic_curve);
+
+		private:
+
+			struct curve_pool_type
+			{
+				curve_pool_type() : keys(), refilling(false) {}
+
+				std::vector<key_ptr_type> keys;
+				bool refilling;
+			};
+
+			static key_ptr_type generate(elliptic_curve_type elliptic_curve);
+
+			void schedule_refill(elliptic_curve_type elliptic_curve);
+			void refill(elliptic_curve_type elliptic_curve);
+
+			executor_type m_executor;
+			size_t m_size;
+			boost::mutex m_mutex;
+			std::map<elliptic_curve_type::value_type, curve_pool_type> m_curve_pools;
+			std::atomic<uint64_t> m_hits;
+			std::atomic<uint64_t> m_misses;
+	};
+}
+
+#endif /* FSCP_ECDHE_KEY_POOL_HPP */
@@ -0,0 +1,508 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file endpoint_map.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An open-addressing hash map keyed by UDP endpoints.
+ */
+
+#ifndef FSCP_ENDPOINT_MAP_HPP
+#define FSCP_ENDPOINT_MAP_HPP
+
+#include <boost/asio/ip/udp.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <iterator>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <cstring>
+#include <cassert>
+
+#include <stdint.h>
+
+namespace fscp
+{
+	/**
+	 * \brief An open-addressing hash map keyed by UDP endpoints.
+	 *
+	 * The slots are stored in a flat array and only hold a compact copy of the address, scope and port of their key, along with its hash: a lookup compares them with linear probing and only dereferences the entry that matches. The entries themselves are allocated separately so that references to them remain valid until they are erased, as with std::map.
+	 *
+	 * The iteration order is unspecified. Inserting an entry invalidates the iterators but not the references.
+	 *
+	 * Entries are created for endpoints that remote hosts choose: the slots are found with SipHash-1-3, keyed with a random per-process key, so that nobody can pick endpoints whose hashes collide.
+	 */
+	template <typename T>
+	class endpoint_map : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief The key type.
+			 */
+			typedef boost::asio::ip::udp::endpoint key_type;
+
+			/**
+			 * \brief The mapped type.
+			 */
+			typedef T mapped_type;
+
+			/**
+			 * \brief The value type.
+			 */
+			typedef std::pair<const key_type, mapped_type> value_type;
+
+		private:
+
+			struct compact_key_type
+			{
+				uint64_t high;
+				uint64_t low;
+				uint32_t port_and_family;
+				uint32_t scope_id;
+
+				bool operator==(const compact_key_type& other) const
+				{
+					return ((high == other.high) && (low == other.low) && (port_and_family == other.port_and_family) && (scope_id == other.scope_id));
+				}
+			};
+
+			struct slot_type
+			{
+				slot_type() :
+					key(),
+					hash(0),
+					entry(NULL)
+				{}
+
+				compact_key_type key;
+				uint32_t hash;
+				value_type* entry;
+			};
+
+			template <typename Value, typename Slot>
+			class basic_iterator
+			{
+				public:
+
+					typedef std::forward_iterator_tag iterator_category;
+					typedef Value value_type;
+					typedef std::ptrdiff_t difference_type;
+					typedef Value* pointer;
+					typedef Value& reference;
+
+					basic_iterator() :
+						m_slot(NULL),
+						m_end(NULL)
+					{}
+
+					basic_iterator(Slot* slot, Slot* end) :
+						m_slot(slot),
+						m_end(end)
+					{
+						skip_empty_slots();
+					}
+
+					template <typename OtherValue, typename OtherSlot>
+					basic_iterator(const basic_iterator<OtherValue, OtherSlot>& other) :
+						m_slot(other.m_slot),
+						m_end(other.m_end)
+					{}
+
+					reference operator*() const { return *m_slot->entry; }
+					pointer operator->() const { return m_slot->entry; }
+
+					basic_iterator& operator++()
+					{
+						++m_slot;
+						skip_empty_slots();
+
+						return *this;
+					}
+
+					basic_iterator operator++(int)
+					{
+						basic_iterator result = *this;
+						++*this;
+
+						return result;
+					}
+
+					template <typename OtherValue, typename OtherSlot>
+					bool operator==(const basic_iterator<OtherValue, OtherSlot>& other) const { return (m_slot == other.m_slot); }
+
+					template <typename OtherValue, typename OtherSlot>
+					bool operator!=(const basic_iterator<OtherValue, OtherSlot>& other) const { return (m_slot != other.m_slot); }
+
+				private:
+
+					void skip_empty_slots()
+					{
+						while ((m_slot != m_end) && !m_slot->entry)
+						{
+							++m_slot;
+						}
+					}
+
+					Slot* m_slot;
+					Slot* m_end;
+
+					template <typename OtherValue, typename OtherSlot>
+					friend class basic_iterator;
+			};
+
+		public:
+
+			/**
+			 * \brief The iterator type.
+			 */
+			typedef basic_iterator<value_type, slot_type> iterator;
+
+			/**
+			 * \brief The const iterator type.
+			 */
+			typedef basic_iterator<const value_type, const slot_type> const_iterator;
+
+			/**
+			 * \brief Create an empty map.
+			 */
+			endpoint_map() :
+				m_slots(),
+				m_size(0)
+			{}
+
+			/**
+			 * \brief Destroy the map and its entries.
+			 */
+			~endpoint_map()
+			{
+				clear();
+			}
+
+			/**
+			 * \brief Get the count of entries.
+			 * \return The count of entries.
+			 */
+			size_t size() const { return m_size; }
+
+			/**
+			 * \brief Check if the map is empty.
+			 * \return true if the map has no entries.
+			 */
+			bool empty() const { return (m_size == 0); }
+
+			iterator begin() { return iterator(slots_begin(), slots_end()); }
+			iterator end() { return iterator(slots_end(), slots_end()); }
+			const_iterator begin() const { return const_iterator(slots_begin(), slots_end()); }
+			const_iterator end() const { return const_iterator(slots_end(), slots_end()); }
+
+			/**
+			 * \brief Find an entry.
+			 * \param key The key.
+			 * \return An iterator to the entry, or end() if there is none.
+			 */
+			iterator find(const key_type& key)
+			{
+				const size_t index = find_slot(make_compact_key(key));
+
+				return (index != NO_SLOT) ? iterator(&m_slots[index], slots_end()) : end();
+			}
+
+			/**
+			 * \brief Find an entry.
+			 * \param key The key.
+			 * \return An iterator to the entry, or end() if there is none.
+			 */
+			const_iterator find(const key_type& key) const
+			{
+				const size_t index = find_slot(make_compact_key(key));
+
+				return (index != NO_SLOT) ? const_iterator(&m_slots[index], slots_end()) : end();
+			}
+
+			/**
+			 * \brief Count the entries with a given key.
+			 * \param key The key.
+			 * \return 1 if there is an entry for key, 0 otherwise.
+			 */
+			size_t count(const key_type& key) const
+			{
+				return (find_slot(make_compact_key(key)) != NO_SLOT) ? 1 : 0;
+			}
+
+			/**
+			 * \brief Get the value associated to a key, inserting a default-constructed value if there is none.
+			 * \param key The key.
+			 * \return The value.
+			 */
+			mapped_type& operator[](const key_type& key)
+			{
+				const compact_key_type compact_key = make_compact_key(key);
+				const size_t index = find_slot(compact_key);
+
+				if (index != NO_SLOT)
+				{
+					return m_slots[index].entry->second;
+				}
+
+				// The load factor is kept at or below one half, so that the probe sequences remain short.
+				if ((m_size + 1) * 2 > m_slots.size())
+				{
+					rehash(m_slots.empty() ? static_cast<size_t>(INITIAL_SLOTS_COUNT) : m_slots.size() * 2);
+				}
+
+				slot_type slot;
+				slot.key = compact_key;
+				slot.hash = hash(compact_key);
+				slot.entry = new value_type(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple());
+
+				place(slot);
+				++m_size;
+
+				return slot.entry->second;
+			}
+
+			/**
+			 * \brief Erase an entry.
+			 * \param key The key.
+			 * \return 1 if an entry was erased, 0 otherwise.
+			 */
+			size_t erase(const key_type& key)
+			{
+				size_t index = find_slot(make_compact_key(key));
+
+				if (index == NO_SLOT)
+				{
+					return 0;
+				}
+
+				delete m_slots[index].entry;
+				m_slots[index] = slot_type();
+				--m_size;
+
+				// Backward shift deletion: the entries that follow are moved back so that no probe sequence is broken.
+				const size_t mask = m_slots.size() - 1;
+
+				for (size_t next = (index + 1) & mask; m_slots[next].entry; next = (next + 1) & mask)
+				{
+					const size_t home = m_slots[next].hash & mask;
+
+					// The entry can move to the free slot if its home slot is not between the free slot and itself.
+					if (((next - home) & mask) >= ((next - index) & mask))
+					{
+						m_slots[index] = m_slots[next];
+						m_slots[next] = slot_type();
+						index = next;
+					}
+				}
+
+				return 1;
+			}
+
+			/**
+			 * \brief Erase all the entries.
+			 */
+			void clear()
+			{
+				for (typename std::vector<slot_type>::iterator slot = m_slots.begin(); slot != m_slots.end(); ++slot)
+				{
+					delete slot->entry;
+				}
+
+				m_slots.clear();
+				m_size = 0;
+			}
+
+		private:
+
+			static const size_t NO_SLOT = static_cast<size_t>(-1);
+			static const size_t INITIAL_SLOTS_COUNT = 16;
+
+			static compact_key_type make_compact_key(const key_type& key)
+			{
+				compact_key_type result;
+
+				// IPv4 addresses are stored as IPv4-mapped IPv6 addresses but remain distinct keys thanks to the family bit.
+				const boost::asio::ip::address_v6::bytes_type bytes = key.address().is_v4() ? boost::asio::ip::address_v6::v4_mapped(key.address().to_v4()).to_bytes() : key.address().to_v6().to_bytes();
+
+				std::memcpy(&result.high, &bytes[0], sizeof(result.high));
+				std::memcpy(&result.low, &bytes[8], sizeof(result.low));
+				result.port_and_family = (static_cast<uint32_t>(key.port()) << 1) | (key.address().is_v4() ? 1 : 0);
+
+				// Link-local addresses are only unique within their interface.
+				result.scope_id = key.address().is_v4() ? 0 : static_cast<uint32_t>(key.address().to_v6().scope_id());
+
+				return result;
+			}
+
+			typedef std::pair<uint64_t, uint64_t> hash_key_type;
+
+			static hash_key_type make_hash_key()
+			{
+				std::random_device device;
+
+				const uint64_t k0 = (static_cast<uint64_t>(device()) << 32) | device();
+				const uint64_t k1 = (static_cast<uint64_t>(device()) << 32) | device();
+
+				return hash_key_type(k0, k1);
+			}
+
+			static const hash_key_type& get_hash_key()
+			{
+				static const hash_key_type hash_key = make_hash_key();
+
+				return hash_key;
+			}
+
+			static uint64_t rotate_left(uint64_t value, int bits)
+			{
+				return (value << bits) | (value >> (64 - bits));
+			}
+
+			static void sip_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+			{
+				v0 += v1;
+				v1 = rotate_left(v1, 13) ^ v0;
+				v0 = rotate_left(v0, 32);
+				v2 += v3;
+				v3 = rotate_left(v3, 16) ^ v2;
+				v0 += v3;
+				v3 = rotate_left(v3, 21) ^ v0;
+				v2 += v1;
+				v1 = rotate_left(v1, 17) ^ v2;
+				v2 = rotate_left(v2, 32);
+			}
+
+			static uint32_t hash(const compact_key_type& key)
+			{
+				const hash_key_type& hash_key = get_hash_key();
+
+				uint64_t v0 = 0x736f6d6570736575ULL ^ hash_key.first;
+				uint64_t v1 = 0x646f72616e646f6dULL ^ hash_key.second;
+				uint64_t v2 = 0x6c7967656e657261ULL ^ hash_key.first;
+				uint64_t v3 = 0x7465646279746573ULL ^ hash_key.second;
+
+				// The compact key is hashed as three words, followed by the final block that only holds the message length.
+				const uint64_t words[4] = {
+					key.high,
+					key.low,
+					(static_cast<uint64_t>(key.scope_id) << 32) | key.port_and_family,
+					static_cast<uint64_t>(3 * sizeof(uint64_t)) << 56
+				};
+
+				for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+				{
+					v3 ^= words[i];
+					sip_round(v0, v1, v2, v3);
+					v0 ^= words[i];
+				}
+
+				v2 ^= 0xff;
+
+				sip_round(v0, v1, v2, v3);
+				sip_round(v0, v1, v2, v3);
+				sip_round(v0, v1, v2, v3);
+
+				const uint64_t result = v0 ^ v1 ^ v2 ^ v3;
+
+				return static_cast<uint32_t>(result ^ (result >> 32));
+			}
+
+			slot_type* slots_begin() { return m_slots.empty() ? NULL : &m_slots[0]; }
+			slot_type* slots_end() { return m_slots.empty() ? NULL : &m_slots[0] + m_slots.size(); }
+			const slot_type* slots_begin() const { return m_slots.empty() ? NULL : &m_slots[0]; }
+			const slot_type* slots_end() const { return m_slots.empty() ? NULL : &m_slots[0] + m_slots.size(); }
+
+			size_t find_slot(const compact_key_type& key) const
+			{
+				if (m_size == 0)
+				{
+					return NO_SLOT;
+				}
+
+				const uint32_t key_hash = hash(key);
+				const size_t mask = m_slots.size() - 1;
+
+				for (size_t index = key_hash & mask; m_slots[index].entry; index = (index + 1) & mask)
+				{
+					if ((m_slots[index].hash == key_hash) && (m_slots[index].key == key))
+					{
+						return index;
+					}
+				}
+
+				return NO_SLOT;
+			}
+
+			void place(const slot_type& slot)
+			{
+				const size_t mask = m_slots.size() - 1;
+				size_t index = slot.hash & mask;
+
+				while (m_slots[index].entry)
+				{
+					index = (index + 1) & mask;
+				}
+
+				m_slots[index] = slot;
+			}
+
+			void rehash(size_t slots_count)
+			{
+				assert((slots_count & (slots_count - 1)) == 0);
+
+				std::vector<slot_type> slots(slots_count);
+				m_slots.swap(slots);
+
+				for (typename std::vector<slot_type>::const_iterator slot = slots.begin(); slot != slots.end(); ++slot)
+				{
+					if (slot->entry)
+					{
+						place(*slot);
+					}
+				}
+			}
+
+			std::vector<slot_type> m_slots;
+			size_t m_size;
+	};
+}
+
+#endif /* FSCP_ENDPOINT_MAP_HPP */
@@ -0,0 +1,137 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file path_mtu_discovery.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A path MTU discovery class.
+ */
+
+#ifndef FSCP_PATH_MTU_DISCOVERY_HPP
+#define FSCP_PATH_MTU_DISCOVERY_HPP
+
+#include "constants.hpp"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace fscp
+{
+	/**
+	 * \brief The path MTU discovery state of a peer.
+	 *
+	 * The sizes are datagram sizes: they do not include the IP and UDP headers.
+	 *
+	 * The base size is confirmed first, then the greatest size that the path carries is searched by dichotomy, using padded probes sent without fragmentation. The search is restarted from time to time to follow the path changes.
+	 */
+	class path_mtu_discovery
+	{
+		public:
+
+			/**
+			 * \brief The discovery states.
+			 */
+			enum class state_type
+			{
+				base, /**< \brief The base size is being probed. */
+				search, /**< \brief The greatest size is being searched. */
+				complete, /**< \brief The search is complete. */
+				disabled /**< \brief The peer never acknowledged a probe. */
+			};
+
+			/**
+			 * \brief Create a new path MTU discovery.
+			 * \param max_size The greatest size to probe.
+			 */
+			explicit path_mtu_discovery(size_t max_size = PATH_MTU_MAX_SIZE);
+
+			/**
+			 * \brief Start the discovery again.
+			 */
+			void reset();
+
+			/**
+			 * \brief Get the discovery state.
+			 * \return The discovery state.
+			 */
+			state_type state() const { return m_state; }
+
+			/**
+			 * \brief Get the path MTU.
+			 * \return The greatest datagram size that was acknowledged by the peer, or 0 if none was.
+			 */
+			size_t path_mtu() const { return m_path_mtu; }
+
+			/**
+			 * \brief Get the size of the next probe to send.
+			 * \param now The current time.
+			 * \return The size of the probe to send, or 0 if no probe is to be sent yet.
+			 *
+			 * This must be called every PATH_MTU_PROBE_PERIOD: a probe that is still pending is then accounted as lost.
+			 */
+			size_t get_probe_size(const boost::posix_time::ptime& now);
+
+			/**
+			 * \brief Acknowledge a probe.
+			 * \param size The size of the probe, as reported by the peer.
+			 * \return true if the pending probe was acknowledged: the next probe can then be sent immediately.
+			 */
+			bool acknowledge_probe(size_t size);
+
+			/**
+			 * \brief Reject a probe that could not be sent at all.
+			 * \param size The size of the probe.
+			 * \param now The current time.
+			 * \return true if size was the pending probe: it is accounted as lost and the next probe can then be sent immediately.
+			 */
+			bool reject_probe(size_t size, const boost::posix_time::ptime& now);
+
+		private:
+
+			void lose_probe(const boost::posix_time::ptime&);
+
+			size_t m_max_size;
+			state_type m_state;
+			size_t m_path_mtu;
+			size_t m_max_path_mtu;
+			size_t m_probe_size;
+			unsigned int m_probe_count;
+			boost::posix_time::ptime m_raise_time;
+	};
+}
+
+#endif /* FSCP_PATH_MTU_DISCOVERY_HPP */
@@ -46,15 +46,22 @@
 #define FSCP_PEER_SESSION_HPP
 
 #include "constants.hpp"
+#include "counters.hpp"
+#include "ecdhe_key_pool.hpp"
+#include "path_mtu_discovery.hpp"
+#include "timing_wheel.hpp"
 
 #include <cryptoplus/buffer.hpp>
 #include <cryptoplus/random/random.hpp>
-#include <cryptoplus/pkey/ecdhe.hpp>
+#include <cryptoplus/cipher/cipher_context.hpp>
 
 #include <boost/optional.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/make_shared.hpp>
 
+#include <atomic>
+#include <bitset>
+
 namespace fscp
 {
 	/**
@@ -81,38 +88,137 @@ namespace fscp
 
 			struct next_session_type
 			{
-				next_session_type(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve) :
-					ecdhe_context(_elliptic_curve.to_elliptic_curve_nid()),
-					parameters(_session_number, _cipher_suite, _elliptic_curve, ecdhe_context.get_public_key())
+				next_session_type(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve, ecdhe_key_pool::key_ptr_type _ecdhe_context) :
+					ecdhe_context(_ecdhe_context),
+					parameters(_session_number, _cipher_suite, _elliptic_curve, ecdhe_context->get_public_key())
 				{}
 
-				cryptoplus::pkey::ecdhe_context ecdhe_context;
+				ecdhe_key_pool::key_ptr_type ecdhe_context;
 				session_parameters parameters;
 			};
 
+			/**
+			 * \brief The status of a received sequence number.
+			 */
+			enum class sequence_number_status
+			{
+				in_order, /**< \brief The sequence number is greater than all the previously received ones. */
+				out_of_order, /**< \brief The sequence number is within the replay window and was not received yet. */
+				duplicate, /**< \brief The sequence number was already received. */
+				too_old /**< \brief The sequence number is behind the replay window. */
+			};
+
+			typedef std::bitset<REPLAY_WINDOW_SIZE> replay_window_type;
+
+			/**
+			 * \brief The per-peer counters.
+			 */
+			enum class counter
+			{
+				bytes_received, /**< \brief The number of cleartext bytes received on the data channels. */
+				messages_received, /**< \brief The number of messages received on the data channels. */
+				bytes_sent, /**< \brief The number of cleartext bytes sent on the data channels. */
+				messages_sent, /**< \brief The number of messages sent on the data channels. */
+				decipher_failures, /**< \brief The number of data messages that could not be deciphered. */
+				replays, /**< \brief The number of data messages rejected by the replay window. */
+				drops, /**< \brief The number of data messages dropped because they did not belong to the current session. */
+				count
+			};
+
+			typedef sharded_counters<counter> counters_type;
+
 			struct current_session_type
 			{
 				explicit current_session_type(const session_parameters& _parameters) :
 					parameters(_parameters),
 					local_sequence_number(),
-					remote_sequence_number()
+					remote_sequence_number(),
+					remote_replay_window(1),
+					duplicate_count(),
+					too_old_count(),
+					out_of_order_count(),
+					remote_activity(false)
 				{}
 
 				bool is_old() const;
 
+				/**
+				 * \brief Check if the remote sequence numbers are about to run out.
+				 * \return true if the session must be renewed on behalf of the remote host.
+				 */
+				bool is_remote_old() const;
+
+				/**
+				 * \brief Get the status of a remote sequence number, without changing the replay window.
+				 * \param sequence_number The remote sequence number.
+				 * \return The status of sequence_number.
+				 */
+				sequence_number_status get_remote_sequence_number_status(sequence_number_type sequence_number) const;
+
+				/**
+				 * \brief Check a remote sequence number against the replay window, before the message is deciphered.
+				 * \param sequence_number The remote sequence number.
+				 * \return The status of sequence_number. Rejected sequence numbers are accounted for.
+				 */
+				sequence_number_status check_remote_sequence_number(sequence_number_type sequence_number);
+
+				/**
+				 * \brief Set the remote sequence number.
+				 * \param sequence_number The remote sequence number.
+				 * \return The status of sequence_number. If the status is sequence_number_status::in_order or sequence_number_status::out_of_order, sequence_number is marked as received in the replay window.
+				 */
+				sequence_number_status set_remote_sequence_number(sequence_number_type sequence_number);
+
+				/**
+				 * \brief Record that an authenticated message was received from the host.
+				 *
+				 * This is thread-safe.
+				 */
+				void mark_remote_activity() { remote_activity = true; }
+
+				/**
+				 * \brief Check if an authenticated message was received since the last call.
+				 * \return true if mark_remote_activity() was called since the last call.
+				 *
+				 * This is thread-safe.
+				 */
+				bool reset_remote_activity() { return remote_activity.exchange(false); }
+
 				session_parameters parameters;
 				sequence_number_type local_sequence_number;
 				sequence_number_type remote_sequence_number;
+
+				// Bit n is set if remote_sequence_number - n was received. The null sequence number is never valid so it is marked as received.
+				replay_window_type remote_replay_window;
+				uint64_t duplicate_count;
+				uint64_t too_old_count;
+				uint64_t out_of_order_count;
 				cryptoplus::buffer local_session_key;
 				cryptoplus::buffer remote_session_key;
 				cryptoplus::buffer local_nonce_prefix;
 				cryptoplus::buffer remote_nonce_prefix;
+
+				// Those are keyed once when the session is completed: only their IV changes for every message.
+				cryptoplus::cipher::cipher_context local_cipher_context;
+				cryptoplus::cipher::cipher_context remote_cipher_context;
+
+				// Shared with the peer session, so that deferred cipherment operations can update it.
+				boost::shared_ptr<counters_type> counters;
+
+				// Set from the cipher strands, which do not own the peer session.
+				std::atomic<bool> remote_activity;
 			};
 
 			peer_session() :
+				m_current_session(),
+				m_counters(boost::make_shared<counters_type>()),
+				m_last_sign_of_life(boost::posix_time::microsec_clock::local_time()),
+				m_data_sent(false),
 				m_local_host_identifier(),
 				m_remote_host_identifier(),
-				m_last_sign_of_life(boost::posix_time::microsec_clock::local_time())
+				m_next_session(),
+				m_path_mtu_discovery(),
+				m_keep_alive_handle()
 			{
 				// Generate a random host identifier.
 				cryptoplus::random::get_random_bytes(m_local_host_identifier.data.data(), m_local_host_identifier.data.size());
@@ -160,14 +266,34 @@ namespace fscp
 				m_last_sign_of_life = boost::posix_time::microsec_clock::local_time();
 			}
 
+			/**
+			 * \brief Record that data was sent to the host.
+			 *
+			 * The host then knows that the session is alive, which makes the next keep-alive unnecessary.
+			 */
+			void mark_data_sent() { m_data_sent = true; }
+
+			/**
+			 * \brief Check if data was sent to the host since the last call.
+			 * \return true if mark_data_sent() was called since the last call.
+			 */
+			bool reset_data_sent()
+			{
+				const bool result = m_data_sent;
+				m_data_sent = false;
+
+				return result;
+			}
+
 			/**
 			 * \brief Prepare the next session.
 			 * \param _session_number The next session number.
 			 * \param _cipher_suite The next cipher suite.
 			 * \param _elliptic_curve The next elliptic curve.
+			 * \param key_pool The pool to take the ECDHE key pair of the new session from.
 			 * \return true if a new session was created.
 			 */
-			bool prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve);
+			bool prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve, ecdhe_key_pool& key_pool);
 
 			/**
 			 * \brief Complete the next session.
@@ -177,6 +303,33 @@ namespace fscp
 			 */
 			bool complete_session(const void* remote_public_key, size_t remote_public_key_size);
 
+			/**
+			 * \brief Derive the keys of a session.
+			 * \param next_session The session in preparation.
+			 * \param local_host_identifier The local host identifier.
+			 * \param remote_host_identifier The remote host identifier.
+			 * \param remote_public_key The remote public key.
+			 * \param remote_public_key_size The remote public key size.
+			 * \return The derived session, ready to be passed to install_session().
+			 *
+			 * This function does not access any peer session and can be called from any thread, provided next_session is not modified in the meantime.
+			 */
+			static boost::shared_ptr<current_session_type> derive_session(const next_session_type& next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const void* remote_public_key, size_t remote_public_key_size);
+
+			/**
+			 * \brief Install a session derived with derive_session().
+			 * \param next_session The session in preparation the session was derived from.
+			 * \param session The derived session.
+			 * \return true if the session was installed. If next_session is no longer the session in preparation, the session is discarded and false is returned.
+			 */
+			bool install_session(const boost::shared_ptr<next_session_type>& next_session, boost::shared_ptr<current_session_type> session);
+
+			/**
+			 * \brief Get the session in preparation.
+			 * \return The session in preparation, if there is one. A null pointer otherwise.
+			 */
+			boost::shared_ptr<next_session_type> get_next_session() const { return m_next_session; }
+
 			/**
 			 * \brief Get the next session number.
 			 * \return The next session number.
@@ -207,34 +360,91 @@ namespace fscp
 			 */
 			const current_session_type& current_session() const { return *m_current_session; }
 
+			/**
+			 * \brief Get a shared reference to the current session.
+			 * \return The current session, if there is one. A null pointer otherwise.
+			 *
+			 * The returned instance remains valid even if the session gets renewed or cleared in the meantime, which makes it suitable for deferred cipherment operations.
+			 */
+			boost::shared_ptr<current_session_type> get_current_session() const { return m_current_session; }
+
 			/**
 			 * \brief Increment the local sequence number.
 			 * \return Return the current sequence number and increment it afterwards.
 			 */
 			sequence_number_type increment_local_sequence_number() { return ++m_current_session->local_sequence_number; }
 
+			/**
+			 * \brief Check a remote sequence number against the replay window, before the message is deciphered.
+			 * \param sequence_number The remote sequence number.
+			 * \return The status of sequence_number. Rejected sequence numbers are accounted for in the session counters.
+			 *
+			 * The replay window is not changed: set_remote_sequence_number() must be called once the message was authenticated.
+			 */
+			sequence_number_status check_remote_sequence_number(sequence_number_type sequence_number);
+
 			/**
 			 * \brief Set the remote sequence number.
 			 * \param sequence_number The remote sequence number.
-			 * \return true if the sequence number was incremented with the new value, false is the current sequence number is greater than sequence_number.
+			 * \return The status of sequence_number. If the status is sequence_number_status::in_order or sequence_number_status::out_of_order, sequence_number is marked as received in the replay window.
+			 */
+			sequence_number_status set_remote_sequence_number(sequence_number_type sequence_number);
+
+			/**
+			 * \brief Get the path MTU discovery state.
+			 * \return The path MTU discovery state.
+			 */
+			fscp::path_mtu_discovery& path_mtu_discovery() { return m_path_mtu_discovery; }
+
+			/**
+			 * \brief Get the path MTU discovery state.
+			 * \return The path MTU discovery state.
 			 */
-			bool set_remote_sequence_number(sequence_number_type sequence_number);
+			const fscp::path_mtu_discovery& path_mtu_discovery() const { return m_path_mtu_discovery; }
+
+			/**
+			 * \brief Get the handle of the next keep-alive in the keep-alive timing wheel.
+			 * \return The handle of the next keep-alive.
+			 */
+			timing_wheel_handle& keep_alive_handle() { return m_keep_alive_handle; }
+
+			/**
+			 * \brief Get the handle of the next keep-alive in the keep-alive timing wheel.
+			 * \return The handle of the next keep-alive.
+			 */
+			const timing_wheel_handle& keep_alive_handle() const { return m_keep_alive_handle; }
+
+			/**
+			 * \brief Get the counters.
+			 * \return The counters. They survive session renewals.
+			 */
+			counters_type& counters() const { return *m_counters; }
 
 			/**
 			 * \brief Clear the current session.
 			 * \return True if the session was cleared. False is there was no active session.
+			 *
+			 * The path MTU discovery is started over.
 			 */
 			bool clear();
 
 		private:
 
+			// Those are accessed for every DATA message: they are kept together at the start of the record.
+			boost::shared_ptr<current_session_type> m_current_session;
+			boost::shared_ptr<counters_type> m_counters;
+			boost::posix_time::ptime m_last_sign_of_life;
+			bool m_data_sent;
+
+			// Those are only accessed during the handshakes and the periodic tasks.
 			host_identifier_type m_local_host_identifier;
 			boost::optional<host_identifier_type> m_remote_host_identifier;
 
-			boost::posix_time::ptime m_last_sign_of_life;
-
 			boost::shared_ptr<next_session_type> m_next_session;
-			boost::shared_ptr<current_session_type> m_current_session;
+
+			fscp::path_mtu_discovery m_path_mtu_discovery;
+
+			timing_wheel_handle m_keep_alive_handle;
 	};
 }
 
@@ -47,18 +47,29 @@
 
 #include <boost/asio.hpp>
 
+#include <cryptoplus/os.hpp>
+
 #include "identity_store.hpp"
 #include "shared_buffer.hpp"
 #include "presentation_store.hpp"
 #include "peer_session.hpp"
+#include "crypto_worker_pool.hpp"
+#include "ecdhe_key_pool.hpp"
+#include "timing_wheel.hpp"
+#include "endpoint_map.hpp"
+#include "counters.hpp"
 #include "logger.hpp"
 
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/optional.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
+#include <exception>
 #include <set>
 #include <map>
+#include <vector>
 #include <queue>
 #include <iostream>
 
@@ -73,6 +84,7 @@ namespace fscp
 	class session_message;
 	class clear_session_message;
 	class data_message;
+	class uring_receiver;
 
 	/**
 	 * \brief A FSCP server.
@@ -103,6 +115,36 @@ namespace fscp
 			 */
 			typedef boost::asio::ip::udp::socket socket_type;
 
+			/**
+			 * \brief The statistics of a peer.
+			 */
+			struct peer_statistics_type
+			{
+				bool has_session; /**< \brief Whether a session currently exists with the peer. */
+				uint64_t bytes_received; /**< \brief The number of cleartext bytes received on the data channels. */
+				uint64_t messages_received; /**< \brief The number of messages received on the data channels. */
+				uint64_t bytes_sent; /**< \brief The number of cleartext bytes sent on the data channels. */
+				uint64_t messages_sent; /**< \brief The number of messages sent on the data channels. */
+				uint64_t decipher_failures; /**< \brief The number of data messages that could not be deciphered. */
+				uint64_t replays; /**< \brief The number of data messages rejected by the replay window. */
+				uint64_t drops; /**< \brief The number of data messages dropped because they did not belong to the current session. */
+			};
+
+			/**
+			 * \brief The server statistics.
+			 */
+			struct statistics_type
+			{
+				std::map<ep_type, peer_statistics_type> peers; /**< \brief The statistics of all the known peers. */
+				boost::posix_time::time_duration session_strand_latency; /**< \brief The time the statistics request waited in the session strand before being handled. */
+				sharded_histogram::snapshot_type session_strand_latencies; /**< \brief The times, in microseconds, that the periodic tasks and the statistics requests waited in the session strand before being handled. */
+				sharded_histogram::snapshot_type handshake_latencies; /**< \brief The times, in microseconds, between the queuing and the completion of the handshake operations. */
+				size_t handshake_queue_depth; /**< \brief The number of handshake operations queued or running on the handshake threads. */
+				uint64_t handshake_rejections; /**< \brief The number of handshake operations rejected because the handshake queue was full. */
+				uint64_t ecdhe_key_pool_hits; /**< \brief The number of sessions prepared with a pre-generated ECDHE key pair. */
+				uint64_t ecdhe_key_pool_misses; /**< \brief The number of sessions whose ECDHE key pair had to be generated on the spot. */
+			};
+
 			// Handlers
 
 			/**
@@ -145,6 +187,11 @@ namespace fscp
 			 */
 			typedef boost::function<void (const std::set<ep_type>&)> endpoints_handler_type;
 
+			/**
+			 * \brief A statistics handler.
+			 */
+			typedef boost::function<void (const statistics_type&)> statistics_handler_type;
+
 			// Callbacks
 
 			/**
@@ -233,6 +280,13 @@ namespace fscp
 			 */
 			typedef boost::function<void (const ep_type& host, session_loss_reason)> session_lost_handler_type;
 
+			/**
+			 * \brief A handler for when the path MTU to a host changed.
+			 * \param host The host.
+			 * \param path_mtu The greatest datagram size that reaches host, IP and UDP headers excluded. 0 means that the path MTU is not known anymore.
+			 */
+			typedef boost::function<void (const ep_type& host, size_t path_mtu)> path_mtu_changed_handler_type;
+
 			/**
 			 * \brief A handler for when data is available.
 			 * \param sender The endpoint that sent the data message.
@@ -272,12 +326,47 @@ namespace fscp
 
 			/**
 			 * \brief Get the underlying socket.
+			 *
+			 * When several listen sockets are open, this is the primary one.
 			 */
 			socket_type& get_socket()
 			{
 				return m_socket;
 			}
 
+			/**
+			 * \brief Get one of the listen sockets.
+			 * \param index The index of the socket. Must be lower than listen_sockets_count(). The socket at index 0 is the one returned by get_socket().
+			 * \return The socket.
+			 */
+			socket_type& get_socket(size_t index)
+			{
+				return m_listeners[index]->socket;
+			}
+
+			/**
+			 * \brief Get the number of listen sockets.
+			 * \return The number of listen sockets. This is always at least 1 and only reflects the value passed to set_listen_sockets_count() once the server was opened.
+			 */
+			size_t listen_sockets_count() const
+			{
+				return m_listeners.size();
+			}
+
+			/**
+			 * \brief Set the number of listen sockets.
+			 * \param count The number of sockets to open on the listen endpoint. A value of 0 or 1 opens a single socket.
+			 *
+			 * When count is greater than 1, all the sockets are bound to the listen endpoint with SO_REUSEPORT and each of them gets its own receive loop, strand and buffer pool. The system then spreads the incoming flows across the sockets depending on their source address so that different hosts get received in parallel.
+			 *
+			 * Each host is also sent to from one of the sockets, chosen by hashing its endpoint, with its own write queue. All the sockets share the same local port, so the hosts see no difference.
+			 *
+			 * On platforms that do not support SO_REUSEPORT, this setting is ignored.
+			 *
+			 * This method is *NOT* thread-safe and must be called before the server is opened.
+			 */
+			void set_listen_sockets_count(size_t count);
+
 			/**
 			 * \brief Get the associated io_service.
 			 * \return The associated io_service.
@@ -342,6 +431,148 @@ namespace fscp
 			 */
 			void sync_set_identity(const identity_store& identity);
 
+			/**
+			 * \brief Get the number of cipher strands.
+			 * \return The number of cipher strands.
+			 */
+			size_t cipher_strands_count() const
+			{
+				return m_cipher_strands.size();
+			}
+
+			/**
+			 * \brief Set the number of cipher strands.
+			 * \param count The number of cipher strands. If count is 0, DATA messages are ciphered and deciphered directly within the session strand.
+			 *
+			 * Cipher strands run the symmetric cipherment and decipherment of DATA messages in parallel, on any of the threads that run the io_service. A given host is always bound to the same cipher strand so that the messages sent to it keep their sequence number order on the wire.
+			 *
+			 * The received DATA messages are then handled entirely within the cipher strand of their sender, from the replay check to the data received callback, so that different hosts get handled in parallel. Only the messages that change the state of a peer session, such as path MTU reports, go through the session strand.
+			 *
+			 * Local sequence numbers and session establishment remain owned by the session strand.
+			 *
+			 * This method is *NOT* thread-safe and must be called before the server is opened.
+			 */
+			void set_cipher_strands_count(size_t count);
+
+			/**
+			 * \brief The default maximum number of handshake operations waiting for a handshake thread.
+			 */
+			static const size_t DEFAULT_HANDSHAKE_QUEUE_SIZE = 1024;
+
+			/**
+			 * \brief Get the number of handshake threads.
+			 * \return The number of handshake threads.
+			 */
+			size_t handshake_threads_count() const
+			{
+				return m_handshake_workers ? m_handshake_workers->threads_count() : 0;
+			}
+
+			/**
+			 * \brief Set the number of handshake threads.
+			 * \param count The number of handshake threads. If count is 0, the handshake cryptography runs directly within the presentation and session strands.
+			 * \param queue_size The maximum number of handshake operations waiting for a handshake thread.
+			 *
+			 * Handshake threads check the signatures of the SESSION_REQUEST and SESSION messages, sign the outgoing ones and derive the session keys. They do not run the io_service, so that a burst of handshakes does not delay the DATA messages of the established sessions. The results are posted back to the session strand.
+			 *
+			 * When the queue is full, incoming handshake messages are dropped and outgoing ones are not sent: the handshake is retried later, as if the message had been lost.
+			 *
+			 * This method is *NOT* thread-safe and must be called before the server is opened.
+			 */
+			void set_handshake_threads_count(size_t count, size_t queue_size = DEFAULT_HANDSHAKE_QUEUE_SIZE);
+
+			/**
+			 * \brief Get the size of the ECDHE key pool.
+			 * \return The number of ECDHE key pairs kept ready per elliptic curve.
+			 */
+			size_t ecdhe_key_pool_size() const
+			{
+				return m_ecdhe_key_pool.size();
+			}
+
+			/**
+			 * \brief Set the size of the ECDHE key pool.
+			 * \param size The number of ECDHE key pairs to keep ready per elliptic curve. If size is 0, key pairs are generated when sessions are prepared, within the session strand.
+			 *
+			 * The key pairs are generated in the background, on the handshake threads if there are some or on the threads that run the io_service otherwise.
+			 *
+			 * This method is *NOT* thread-safe and must be called before the server is opened.
+			 */
+			void set_ecdhe_key_pool_size(size_t size)
+			{
+				m_ecdhe_key_pool.set_size(size);
+			}
+
+			/**
+			 * \brief Get the I/O batch size.
+			 * \return The maximum number of datagrams received or sent per system call.
+			 */
+			size_t io_batch_size() const
+			{
+				return m_io_batch_size;
+			}
+
+			/**
+			 * \brief Set the I/O batch size.
+			 * \param size The maximum number of datagrams to receive or send per system call. A value of 0 or 1 disables batching. Values greater than MAX_IO_BATCH_SIZE are truncated.
+			 *
+			 * On Linux, batching relies on recvmmsg() and sendmmsg(). The datagrams received in a single call are dispatched to the session strand as a unit. On other platforms, this setting is ignored.
+			 *
+			 * This method is *NOT* thread-safe and must be called before the server is opened.
+			 */
+			void set_io_batch_size(size_t size);
+
+			/**
+			 * \brief The maximum I/O batch size.
+			 */
+			static const size_t MAX_IO_BATCH_SIZE = 64;
+
+			/**
+			 * \brief Check whether io_uring receives are enabled.
+			 * \return true if io_uring receives are enabled.
+			 */
+			bool io_uring_enabled() const
+			{
+				return m_io_uring_enabled;
+			}
+
+			/**
+			 * \brief Enable or disable io_uring receives.
+			 * \param enabled Whether to use io_uring to receive datagrams.
+			 *
+			 * On Linux 6.0 or later, every listen socket then receives its datagrams through a multishot io_uring request, directly into pooled buffers, and takes precedence over batched receives. Listen sockets for which the ring cannot be set up fall back to the regular receive loop. Sending is not affected: it keeps using batched writes when I/O batching is enabled. On other platforms, this setting is ignored.
+			 *
+			 * This method is *NOT* thread-safe and must be called before the server is opened.
+			 */
+			void set_io_uring_enabled(bool enabled)
+			{
+				m_io_uring_enabled = enabled;
+			}
+
+			/**
+			 * \brief Check whether path MTU discovery is enabled.
+			 * \return true if path MTU discovery is enabled.
+			 */
+			bool path_mtu_discovery_enabled() const
+			{
+				return m_path_mtu_discovery_enabled;
+			}
+
+			/**
+			 * \brief Enable or disable path MTU discovery.
+			 * \param enabled Whether to discover the path MTU to every host.
+			 *
+			 * On Linux, padded keep-alive messages then probe the greatest datagram size that reaches every host with a session. The probes are sent from a dedicated socket that never fragments its datagrams, bound to the listen endpoint with SO_REUSEPORT and connected to the last probed host: the listen sockets then get SO_REUSEPORT as well, and the other datagrams are still fragmented when needed. The results are reported to the path MTU changed callback. On other platforms, this setting is ignored.
+			 *
+			 * Probes from other hosts are acknowledged whatever this setting.
+			 *
+			 * This method is *NOT* thread-safe and must be called before the server is opened.
+			 */
+			void set_path_mtu_discovery_enabled(bool enabled)
+			{
+				m_path_mtu_discovery_enabled = enabled;
+			}
+
 			/**
 			 * \brief Open the server.
 			 * \param listen_endpoint The listen endpoint.
@@ -623,6 +854,23 @@ namespace fscp
 			 */
 			bool sync_has_session_with_endpoint(const ep_type& host);
 
+			/**
+			 * \brief Get the server statistics.
+			 * \param handler The handler to call with the statistics.
+			 */
+			void async_get_statistics(statistics_handler_type handler)
+			{
+				m_session_strand.post(boost::bind(&server::do_get_statistics, this, boost::posix_time::microsec_clock::universal_time(), handler));
+			}
+
+			/**
+			 * \brief Get the server statistics.
+			 * \return The statistics.
+			 * \warning If the io_service is not being run, the call will block undefinitely.
+			 * \warning This function must **NEVER** be called from inside a thread that runs one of the server's handlers.
+			 */
+			statistics_type sync_get_statistics();
+
 			/**
 			 * \brief Set the default acceptance behavior of incoming session requests.
 			 * \param value The default value.
@@ -903,6 +1151,34 @@ namespace fscp
 			 */
 			void sync_set_session_lost_callback(session_lost_handler_type callback);
 
+			/**
+			 * \brief Set the path MTU changed callback.
+			 * \param callback The callback.
+			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 */
+			void set_path_mtu_changed_callback(path_mtu_changed_handler_type callback)
+			{
+				m_path_mtu_changed_handler = callback;
+			}
+
+			/**
+			 * \brief Set the path MTU changed callback.
+			 * \param callback The callback.
+			 * \param handler The handler to call when the change was made effective.
+			 */
+			void async_set_path_mtu_changed_callback(path_mtu_changed_handler_type callback, void_handler_type handler = void_handler_type())
+			{
+				m_session_strand.post(boost::bind(&server::do_set_path_mtu_changed_callback, this, callback, handler));
+			}
+
+			/**
+			 * \brief Set the path MTU changed callback.
+			 * \param callback The callback.
+			 * \warning If the io_service is not being run, the call will block undefinitely.
+			 * \warning This function must **NEVER** be called from inside a thread that runs one of the server's handlers.
+			 */
+			void sync_set_path_mtu_changed_callback(path_mtu_changed_handler_type callback);
+
 			/**
 			 * \brief Send data to a host.
 			 * \param target The target host.
@@ -1164,6 +1440,8 @@ namespace fscp
 			 * \brief Set the data received callback.
 			 * \param callback The callback.
 			 * \warning This method is *NOT* thread-safe and should be called only before the server is started.
+			 *
+			 * If cipher strands are enabled, the callback is invoked from the cipher strands and can be called concurrently for different hosts.
 			 */
 			void set_data_received_callback(data_received_handler_type callback)
 			{
@@ -1174,6 +1452,7 @@ namespace fscp
 			 * \brief Set the data received callback.
 			 * \param callback The callback.
 			 * \param handler The handler to call when the change was made effective.
+			 * \warning If cipher strands are enabled, the callback is invoked outside of the session strand: it must then be set before the server is started.
 			 */
 			void async_set_data_received_callback(data_received_handler_type callback, void_handler_type handler = void_handler_type())
 			{
@@ -1256,35 +1535,129 @@ namespace fscp
 
 		private:
 
-			void async_receive_from()
+			struct pending_write_type
 			{
-				m_socket_strand.post(boost::bind(&server::do_async_receive_from, this));
+				pending_write_type(const SharedBuffer& _data, size_t _size, const ep_type& _target, simple_handler_type _handler) :
+					data(_data),
+					size(_size),
+					target(_target),
+					handler(_handler)
+				{}
+
+				SharedBuffer data;
+				size_t size;
+				ep_type target;
+				simple_handler_type handler;
+			};
+
+			typedef std::vector<pending_write_type> write_batch_type;
+
+			/**
+			 * \brief A listen socket, with its own receive loop and write queue.
+			 */
+			struct listener_type
+			{
+				listener_type(boost::asio::io_service& io_service, const identity_store& _identity) :
+					socket(io_service),
+					strand(io_service),
+					identity(_identity),
+					batch_buffers(),
+					uring(),
+					receive_retry_timer(io_service),
+					receive_error(),
+					write_queue_strand(io_service),
+					write_queue(),
+					pending_writes(),
+					write_batch_in_progress(false)
+				{}
+
+				socket_type socket;
+				boost::asio::strand strand;
+
+				// All the following members are only accessed from within the strand.
+
+				// A copy of the server identity, so that the receive loops do not share it.
+				identity_store identity;
+				std::vector<SharedBuffer> batch_buffers;
+				boost::shared_ptr<uring_receiver> uring;
+
+				// Delays the receive loop after a persistent error. The last error is only logged once.
+				boost::asio::deadline_timer receive_retry_timer;
+				boost::system::error_code receive_error;
+
+				boost::asio::strand write_queue_strand;
+
+				// All the following members are only accessed from within the write queue strand.
+				std::queue<void_handler_type> write_queue;
+				write_batch_type pending_writes;
+				bool write_batch_in_progress;
+			};
+
+			typedef boost::shared_ptr<listener_type> listener_ptr_type;
+
+			bool is_reuse_port_enabled() const
+			{
+#ifdef LINUX
+				return (m_listen_sockets_count > 1);
+#else
+				return false;
+#endif
 			}
 
-			void do_async_receive_from();
-			void handle_receive_from(const identity_store&, boost::shared_ptr<ep_type>, SharedBuffer, const boost::system::error_code&, size_t);
+			void async_receive_from(listener_ptr_type listener)
+			{
+				listener->strand.post(boost::bind(&server::do_async_receive_from, this, listener));
+			}
+
+			void do_async_receive_from(listener_ptr_type);
+			void handle_receive_from(listener_ptr_type, const identity_store&, boost::shared_ptr<ep_type>, SharedBuffer, const boost::system::error_code&, size_t);
+			void do_set_listener_identity(listener_ptr_type, const identity_store&);
+			void handle_message_from(const identity_store&, const ep_type&, SharedBuffer, size_t, std::vector<void_handler_type>*);
 
 			ep_type to_socket_format(const ep_type& ep);
 
-			void async_send_to(const SharedBuffer& data, const size_t size, const ep_type& target, simple_handler_type handler)
+			bool is_io_batching_enabled() const
 			{
-				const void_handler_type write_handler = [this, data, size, target, handler] () {
-					m_socket.async_send_to(buffer(data, size), target, 0, [data, handler] (const boost::system::error_code& ec, size_t) {
-						handler(ec);
-					});
-				};
-
-				m_write_queue_strand.post(boost::bind(&server::push_write, this, write_handler));
+#ifdef LINUX
+				return (m_io_batch_size > 1);
+#else
+				return false;
+#endif
 			}
 
-			void push_write(void_handler_type);
-			void pop_write();
+			// A given host is always sent to from the same listen socket, so that its datagrams keep their order.
+			void async_send_to(const SharedBuffer& data, const size_t size, const ep_type& target, simple_handler_type handler);
+
+			void push_write(listener_ptr_type, void_handler_type);
+			void pop_write(listener_ptr_type);
+
+			// Batched I/O (Linux only).
+			void do_async_receive_batch(listener_ptr_type);
+			void handle_receive_batch(listener_ptr_type, const identity_store&, const boost::system::error_code&);
+			void handle_receive_retry_timer(listener_ptr_type, const boost::system::error_code&);
+			void push_write_batch(listener_ptr_type, const pending_write_type&);
+			void flush_write_batch(listener_ptr_type);
+			void pop_write_batch(listener_ptr_type);
+			void do_send_batch(listener_ptr_type, boost::shared_ptr<write_batch_type>, size_t);
+			void handle_send_batch_ready(listener_ptr_type, boost::shared_ptr<write_batch_type>, size_t, const boost::system::error_code&);
+
+			// Sends a single datagram from the probe socket, bypassing the write queues.
+			void do_send_path_mtu_probe(const SharedBuffer&, size_t, const ep_type&, simple_handler_type);
+
+			// io_uring receives (Linux only).
+			void do_async_receive_uring(listener_ptr_type);
+			void handle_receive_uring(listener_ptr_type, const identity_store&, const boost::system::error_code&);
+			void handle_uring_datagram(const identity_store&, std::vector<void_handler_type>*, const ep_type&, SharedBuffer, size_t);
+
+			// The first listener is the primary one and always exists.
+			std::vector<listener_ptr_type> m_listeners;
+			size_t m_listen_sockets_count;
+			socket_type& m_socket;
+			boost::asio::strand& m_socket_strand;
+
+			size_t m_io_batch_size;
 
-			socket_type m_socket;
-			boost::asio::strand m_socket_strand;
-			std::queue<void_handler_type> m_write_queue;
-			boost::asio::strand m_write_queue_strand;
-			std::list<SharedBuffer> m_socket_buffers;
+			bool m_io_uring_enabled;
 
 		private: // HELLO messages
 
@@ -1313,57 +1686,48 @@ namespace fscp
 					uint32_t next_hello_unique_number();
 
 					/**
-					 * @brief Asynchronously waits for a hello reply.
-					 * @param io_service The io_service instance to use for the wait.
+					 * @brief Wait for a hello reply.
 					 * @param hello_unique_number The unique hello number.
-					 * @param timeout The time to wait for the reply.
-					 * @param handler The handler to call upon timeout or cancellation.
+					 * @param handler The handler to call upon reply, timeout or cancellation.
+					 * @return The handle of the timeout of the request, to schedule in the hello timing wheel.
 					 */
-					template <typename WaitHandler>
-					void async_wait_reply(boost::asio::io_service& io_service, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler);
+					timing_wheel_handle& add_reply_wait(uint32_t hello_unique_number, duration_handler_type handler);
 
 					/**
-					 * @brief Cancel a hello reply wait timer.
+					 * @brief Remove a hello reply wait from the pending list.
 					 * @param hello_unique_number The hello reply number.
-					 * @param success Whether the cancel is the result of a received reply.
-					 * @return true if the timer was cancelled or false if it was too late to do so.
-					 */
-					bool cancel_reply_wait(uint32_t hello_unique_number, bool success);
-
-					/**
-					 * @brief Cancel all pending hello request wait timers.
-					 *
-					 * This call is similar to calling cancel_reply_wait(<num>, false) for all hello unique numbers.
+					 * @param duration A variable whose value after the call will be the time elapsed since the creation of the request.
+					 * @param handler A variable whose value after the call will be the handler of the request.
+					 * @param timeout A variable whose value after the call will be the handle of the timeout of the request.
+					 * @return true if the request was pending, false otherwise.
 					 */
-					void cancel_all_reply_wait();
+					bool remove_reply_wait(uint32_t hello_unique_number, boost::posix_time::time_duration& duration, duration_handler_type& handler, timing_wheel_handle& timeout);
 
 					/**
-					 * @brief Remove a hello reply wait from the pending list.
-					 * @param hello_unique_number The hello reply number.
-					 * @param duration A variable whose value after the call will be the time elapsed since the creation of the request.
-					 * @return The success status of the request.
+					 * @brief Get the hello unique numbers of all the pending requests.
+					 * @return The hello unique numbers.
 					 */
-					bool remove_reply_wait(uint32_t hello_unique_number, boost::posix_time::time_duration& duration);
+					std::vector<uint32_t> pending_reply_waits() const;
 
 				private:
 
 					struct pending_request_status
 					{
 						pending_request_status() :
-							timer(),
+							handler(),
 							start_date(boost::posix_time::microsec_clock::universal_time()),
-							success(false)
+							timeout()
 						{}
 
-						pending_request_status(boost::shared_ptr<boost::asio::deadline_timer> _timer) :
-							timer(_timer),
+						explicit pending_request_status(duration_handler_type _handler) :
+							handler(_handler),
 							start_date(boost::posix_time::microsec_clock::universal_time()),
-							success(false)
+							timeout()
 						{}
 
-						boost::shared_ptr<boost::asio::deadline_timer> timer;
+						duration_handler_type handler;
 						boost::posix_time::ptime start_date;
-						bool success;
+						timing_wheel_handle timeout;
 					};
 
 					typedef std::map<uint32_t, pending_request_status> pending_requests_map;
@@ -1372,12 +1736,17 @@ namespace fscp
 					pending_requests_map m_pending_requests;
 			};
 
-			typedef std::map<ep_type, ep_hello_context_type> ep_hello_context_map;
+			typedef endpoint_map<ep_hello_context_type> ep_hello_context_map;
+
+			// Identifies a pending hello request in the hello timing wheel.
+			typedef std::pair<ep_type, uint32_t> hello_request_type;
 
 			void do_greet(const ep_type&, duration_handler_type, const boost::posix_time::time_duration&);
 			void do_greet_handler(const ep_type&, uint32_t, duration_handler_type, const boost::posix_time::time_duration&, const boost::system::error_code&);
-			void do_greet_timeout(const ep_type&, uint32_t, duration_handler_type, const boost::system::error_code&);
+			void do_complete_greeting(const hello_request_type&, const boost::system::error_code&);
 			void do_cancel_all_greetings();
+			void arm_hello_timer();
+			void do_check_hello_timeouts(const boost::system::error_code&);
 
 			void handle_hello_message_from(const hello_message&, const ep_type&);
 			void do_handle_hello_request(const ep_type&, uint32_t);
@@ -1388,12 +1757,18 @@ namespace fscp
 
 			ep_hello_context_map m_ep_hello_contexts;
 			boost::asio::strand m_greet_strand;
+
+			// Only accessed from within the greet strand. The timer is only armed while some requests are pending.
+			timing_wheel<hello_request_type> m_hello_wheel;
+			boost::asio::deadline_timer m_hello_timer;
+			bool m_hello_timer_armed;
+
 			bool m_accept_hello_messages_default;
 			hello_message_received_handler_type m_hello_message_received_handler;
 
 		private: // PRESENTATION messages
 
-			typedef std::map<ep_type, presentation_store> presentation_store_map;
+			typedef endpoint_map<presentation_store> presentation_store_map;
 
 			bool has_presentation_store_for(const ep_type&) const;
 			void do_introduce_to(const ep_type&, simple_handler_type);
@@ -1413,7 +1788,7 @@ namespace fscp
 
 		private: // SESSION_REQUEST messages
 
-			typedef std::map<ep_type, peer_session> peer_session_map_type;
+			typedef endpoint_map<peer_session> peer_session_map_type;
 
 			static cipher_suite_type get_first_common_supported_cipher_suite(const cipher_suite_list_type&, const cipher_suite_list_type&, cipher_suite_type);
 			static elliptic_curve_type get_first_common_supported_elliptic_curve(const elliptic_curve_list_type&, const elliptic_curve_list_type&, elliptic_curve_type);
@@ -1427,6 +1802,7 @@ namespace fscp
 			bool has_session_with_endpoint(const ep_type&);
 			void do_get_session_endpoints(endpoints_handler_type);
 			void do_has_session_with_endpoint(const ep_type&, boolean_handler_type);
+			void do_get_statistics(const boost::posix_time::ptime&, statistics_handler_type);
 			void do_set_accept_session_request_messages_default(bool, void_handler_type);
 			void do_set_cipher_suites(cipher_suite_list_type, void_handler_type);
 			void do_set_elliptic_curves(elliptic_curve_list_type, void_handler_type);
@@ -1436,7 +1812,6 @@ namespace fscp
 			boost::asio::strand m_session_strand;
 
 			peer_session_map_type m_peer_sessions;
-			std::list<SharedBuffer> m_session_buffers;
 
 			bool m_accept_session_request_messages_default;
 			cipher_suite_list_type m_cipher_suites;
@@ -1478,7 +1853,16 @@ namespace fscp
 			void do_send_contact_to_all(const contact_map_type&, multiple_endpoints_handler_type);
 			void do_send_contact_to_session(peer_session&, const ep_type&, const contact_map_type&, simple_handler_type);
 			void handle_data_message_from(const identity_store&, SharedBuffer, const data_message&, const ep_type&);
-			void do_handle_data(const identity_store&, const ep_type&, const data_message&);
+			void do_handle_data(SharedBuffer, const identity_store&, const ep_type&, const data_message&);
+			void do_handle_data_batch(boost::shared_ptr<std::vector<void_handler_type> >);
+			void do_decipher_data(const identity_store&, const ep_type&, boost::shared_ptr<peer_session::current_session_type>, const data_message&, SharedBuffer);
+			void do_handle_deciphered_data(const identity_store&, const ep_type&, boost::shared_ptr<peer_session::current_session_type>, sequence_number_type, message_type, SharedBuffer, size_t);
+			void do_handle_host_data(SharedBuffer, const identity_store&, const ep_type&, const data_message&);
+			void do_handle_host_deciphered_data(const identity_store&, const ep_type&, boost::shared_ptr<peer_session::current_session_type>, sequence_number_type, message_type, SharedBuffer, size_t);
+			void do_handle_host_control_data(const ep_type&, boost::shared_ptr<peer_session::current_session_type>, message_type, SharedBuffer, size_t);
+			void do_handle_control_data(const ep_type&, peer_session&, message_type, SharedBuffer, size_t);
+			void do_drop_data(const ep_type&);
+			void do_renew_session(const identity_store&, const ep_type&, boost::shared_ptr<peer_session::current_session_type>);
 			void do_handle_data_message(const ep_type&, message_type, SharedBuffer, boost::asio::const_buffer);
 			void do_handle_contact_request(const ep_type&, const std::set<hash_type>&);
 			void do_handle_contact(const ep_type&, const contact_map_type&);
@@ -1487,18 +1871,135 @@ namespace fscp
 			void do_set_contact_request_received_callback(contact_request_received_handler_type, void_handler_type);
 			void do_set_contact_received_callback(contact_received_handler_type, void_handler_type);
 
+			/**
+			 * \brief Run a cipherment operation for the specified host.
+			 * \param host The host.
+			 * \param handler The operation to run.
+			 *
+			 * If cipher strands are enabled, the operation is posted to the cipher strand bound to host. Otherwise it is run immediately.
+			 *
+			 * Must be called from within the session strand.
+			 */
+			void async_cipher(const ep_type& host, void_handler_type handler);
+
+			/**
+			 * \brief Get the index of the cipher strand bound to a host.
+			 * \param host The host.
+			 * \return The index of the cipher strand. Cipher strands must be enabled.
+			 */
+			size_t get_cipher_strand_index(const ep_type& host) const;
+
+			/**
+			 * \brief Publish the current session of a host to its cipher strand.
+			 * \param host The host.
+			 * \param session The current session of host. A null pointer if host has no current session anymore.
+			 *
+			 * Must be called from within the session strand, whenever the current session of host changes. Does nothing if cipher strands are disabled.
+			 */
+			void index_session(const ep_type& host, boost::shared_ptr<peer_session::current_session_type> session);
+
+			/**
+			 * \brief Find the current session of a host, as published by index_session().
+			 * \param host The host.
+			 * \return The current session of host, if there is one. A null pointer otherwise.
+			 *
+			 * This is thread-safe.
+			 */
+			boost::shared_ptr<peer_session::current_session_type> find_indexed_session(const ep_type& host);
+
 			boost::asio::strand m_contact_strand;
 
+			// Those strands run the symmetric cipherment of DATA messages. A given host is always bound to the same strand.
+			std::vector<boost::shared_ptr<boost::asio::strand> > m_cipher_strands;
+
+			// The current sessions, with one shard per cipher strand: the lookups of a cipher strand only contend with the session changes of its own hosts.
+			struct session_index_shard
+			{
+				boost::mutex mutex;
+				endpoint_map<boost::shared_ptr<peer_session::current_session_type> > sessions;
+			};
+
+			std::vector<boost::shared_ptr<session_index_shard> > m_session_index;
+
 			data_received_handler_type m_data_received_handler;
 			contact_request_received_handler_type m_contact_request_message_received_handler;
 			contact_received_handler_type m_contact_message_received_handler;
 
 		private: // Keep-alive
 
+			/**
+			 * \brief Schedule the next keep-alive of a host.
+			 * \param host The host.
+			 * \param p_session The peer session of host, which holds the handle of its next keep-alive.
+			 * \param delay The delay before the keep-alive.
+			 *
+			 * Must be called from within the session strand.
+			 */
+			void schedule_keep_alive(const ep_type& host, peer_session& p_session, const boost::posix_time::time_duration& delay);
+			void arm_keep_alive_timer();
 			void do_check_keep_alive(const boost::system::error_code&);
-			void do_send_keep_alive(const ep_type&, simple_handler_type);
+			void do_keep_alive(const ep_type&);
+			void do_send_keep_alive(const ep_type&, size_t, bool, simple_handler_type);
 
+			// Only accessed from within the session strand. Every host with a session is scheduled once per keep-alive period, at an offset that depends on its endpoint so that the keep-alives are spread over the period.
+			timing_wheel<ep_type> m_keep_alive_wheel;
 			boost::asio::deadline_timer m_keep_alive_timer;
+			bool m_keep_alive_timer_armed;
+
+			// Sampled whenever a keep-alive tick or a statistics request gets handled.
+			sharded_histogram m_session_strand_latencies;
+
+		private: // Path MTU discovery
+
+			void do_check_path_mtu(const boost::system::error_code&);
+			void do_probe_path_mtu(const ep_type&, peer_session&, const boost::posix_time::ptime&);
+			void handle_send_path_mtu_probe(const ep_type&, size_t, const boost::system::error_code&);
+			void do_send_path_mtu(const ep_type&, peer_session&, size_t);
+			void do_handle_path_mtu(const ep_type&, peer_session&, size_t);
+			void do_set_path_mtu_changed_callback(path_mtu_changed_handler_type, void_handler_type);
+
+			bool m_path_mtu_discovery_enabled;
+			boost::asio::deadline_timer m_path_mtu_timer;
+			path_mtu_changed_handler_type m_path_mtu_changed_handler;
+
+			// The probe socket never fragments its datagrams. Its receive loop is the one of a regular listener, but nothing else is sent from it.
+			listener_ptr_type m_probe_listener;
+
+			// The host the probe socket is connected to. Only accessed from within the probe listener strand.
+			ep_type m_probe_target;
+
+		private: // Handshake cryptography
+
+			/**
+			 * \brief Run a handshake cryptography operation.
+			 * \param job The operation to run. It must only access its arguments and post its results to a strand.
+			 * \return true if the operation was run or queued, false if the handshake queue is full.
+			 *
+			 * If handshake threads are enabled, the operation is queued on them. Otherwise it is run immediately.
+			 */
+			bool async_handshake_crypto(void_handler_type job);
+
+			/**
+			 * \brief Run an ECDHE key generation in the background.
+			 * \param job The key generation to run.
+			 * \return true if the key generation was queued.
+			 */
+			bool async_generate_keys(void_handler_type job);
+
+			void do_verify_session_request(SharedBuffer, const identity_store&, const ep_type&, const session_request_message&, const presentation_store&);
+			void do_verify_session(SharedBuffer, const identity_store&, const ep_type&, const session_message&, const presentation_store&);
+			void do_write_session_request(const identity_store&, const ep_type&, session_number_type, const host_identifier_type&, const cipher_suite_list_type&, const elliptic_curve_list_type&, simple_handler_type);
+			void do_write_session(const identity_store&, const ep_type&, const host_identifier_type&, const peer_session::session_parameters&);
+			void do_derive_session(const identity_store&, const ep_type&, bool, boost::shared_ptr<peer_session::next_session_type>, const host_identifier_type&, const host_identifier_type&, const cryptoplus::buffer&);
+			void do_complete_session(const identity_store&, const ep_type&, bool, boost::shared_ptr<peer_session::next_session_type>, boost::shared_ptr<peer_session::current_session_type>, std::exception_ptr);
+
+			ecdhe_key_pool m_ecdhe_key_pool;
+
+			// Updated from the handshake threads.
+			sharded_histogram m_handshake_latencies;
+
+			// Declared last so that the handshake threads are stopped before any other member is destroyed.
+			boost::scoped_ptr<crypto_worker_pool> m_handshake_workers;
 
 		private: // Misc
 
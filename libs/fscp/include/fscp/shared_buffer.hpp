@@ -45,14 +45,100 @@
 #pragma once
 
 #include <boost/asio.hpp>
-#include <boost/shared_array.hpp>
 #include <boost/function.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <vector>
 #include <cmath>
 #include <stdint.h>
 
 namespace fscp
 {
+	/**
+	 * \brief A pooled memory block, with an intrusive reference count.
+	 *
+	 * The data immediately follows the header in memory.
+	 */
+	struct buffer_block
+	{
+		buffer_block(size_t _size_class, size_t _capacity) :
+			references(1),
+			size_class(_size_class),
+			capacity(_capacity)
+		{}
+
+		uint8_t* data()
+		{
+			return reinterpret_cast<uint8_t*>(this + 1);
+		}
+
+		std::atomic<unsigned int> references;
+		size_t size_class;
+		size_t capacity;
+	};
+
+	/**
+	 * \brief A process-wide pool of packet buffers.
+	 *
+	 * Blocks are grouped in size classes. Every thread keeps a small cache of free blocks for each size class and only falls back to a lock-free global free list when its cache is empty or full. Requests larger than the biggest size class are not pooled.
+	 *
+	 * All the methods are thread-safe.
+	 */
+	class buffer_pool
+	{
+		public:
+
+			/**
+			 * \brief The number of size classes.
+			 */
+			static const size_t SIZE_CLASSES_COUNT = 3;
+
+			/**
+			 * \brief The size class index used for blocks that are not pooled.
+			 */
+			static const size_t UNPOOLED_SIZE_CLASS = SIZE_CLASSES_COUNT;
+
+			/**
+			 * \brief The statistics of a size class.
+			 */
+			struct statistics_type
+			{
+				size_t block_size; /**< \brief The size of the blocks in this class. */
+				uint64_t blocks; /**< \brief The number of blocks currently allocated. */
+				uint64_t blocks_in_use; /**< \brief The number of blocks currently handed over to a SharedBuffer. */
+				uint64_t cache_hits; /**< \brief The number of requests served by a thread cache. */
+				uint64_t global_hits; /**< \brief The number of requests served by the global free list. */
+				uint64_t misses; /**< \brief The number of requests that required a new allocation. */
+			};
+
+			/**
+			 * \brief Get the block size of a size class.
+			 * \param size_class The size class index.
+			 * \return The block size, in bytes.
+			 */
+			static size_t get_block_size(size_t size_class);
+
+			/**
+			 * \brief Allocate a block.
+			 * \param size The minimum capacity of the block.
+			 * \return A block with a reference count of 1.
+			 */
+			static buffer_block* allocate(size_t size);
+
+			/**
+			 * \brief Release a block whose reference count dropped to zero.
+			 * \param block The block.
+			 */
+			static void release(buffer_block* block);
+
+			/**
+			 * \brief Get the statistics of all the size classes.
+			 * \return The statistics, one entry per size class.
+			 */
+			static std::vector<statistics_type> get_statistics();
+	};
+
 	class SharedBuffer;
 
 	boost::asio::mutable_buffers_1 buffer(const SharedBuffer&);
@@ -60,76 +146,105 @@ namespace fscp
 	template <typename Type> Type buffer_cast(const SharedBuffer&);
 	size_t buffer_size(const SharedBuffer&);
 
+	/**
+	 * \brief A reference-counted buffer, allocated from the buffer pool.
+	 *
+	 * Copies share the same memory, which goes back to the pool once the last copy is destroyed.
+	 */
 	class SharedBuffer
 	{
 		public:
 			SharedBuffer(size_t size) :
 				m_size(size),
-				m_data(new uint8_t[size])
+				m_block(buffer_pool::allocate(size))
 			{}
 
-			template <typename Handler>
-			SharedBuffer(const SharedBuffer& buffer, Handler handler) :
-				m_buffer(new SharedBuffer(buffer), [handler] (SharedBuffer* buf) {
-					handler(*buf);
+			// Copies and moves never throw: this allows boost::function to store handlers that hold a SharedBuffer without allocating.
+			SharedBuffer(const SharedBuffer& other) BOOST_NOEXCEPT :
+				m_size(other.m_size),
+				m_block(other.m_block)
+			{
+				add_reference();
+			}
 
-					delete buf;
-				})
+			SharedBuffer(SharedBuffer&& other) BOOST_NOEXCEPT :
+				m_size(other.m_size),
+				m_block(other.m_block)
 			{
+				other.m_block = nullptr;
 			}
 
-		private:
-			size_t m_size;
-			boost::shared_array<uint8_t> m_data;
-			boost::shared_ptr<SharedBuffer> m_buffer;
+			~SharedBuffer()
+			{
+				remove_reference();
+			}
 
-			friend inline boost::asio::mutable_buffers_1 buffer(const SharedBuffer& buf)
+			SharedBuffer& operator=(const SharedBuffer& other)
 			{
-				if (buf.m_buffer)
+				if (m_block != other.m_block)
 				{
-					return buffer(*(buf.m_buffer));
+					remove_reference();
+					m_block = other.m_block;
+					add_reference();
 				}
-				else
+
+				m_size = other.m_size;
+
+				return *this;
+			}
+
+			SharedBuffer& operator=(SharedBuffer&& other)
+			{
+				if (this != &other)
 				{
-					return boost::asio::buffer(buf.m_data.get(), buf.m_size);
+					remove_reference();
+					m_size = other.m_size;
+					m_block = other.m_block;
+					other.m_block = nullptr;
 				}
+
+				return *this;
 			}
 
-			friend inline boost::asio::mutable_buffers_1 buffer(const SharedBuffer& buf, size_t size)
+		private:
+			void add_reference()
 			{
-				if (buf.m_buffer)
+				if (m_block)
 				{
-					return buffer(*(buf.m_buffer), size);
+					m_block->references.fetch_add(1, std::memory_order_relaxed);
 				}
-				else
+			}
+
+			void remove_reference()
+			{
+				if (m_block && (m_block->references.fetch_sub(1, std::memory_order_acq_rel) == 1))
 				{
-					return boost::asio::buffer(buf.m_data.get(), std::min(size, buf.m_size));
+					buffer_pool::release(m_block);
 				}
 			}
 
+			size_t m_size;
+			buffer_block* m_block;
+
+			friend inline boost::asio::mutable_buffers_1 buffer(const SharedBuffer& buf)
+			{
+				return boost::asio::buffer(buf.m_block->data(), buf.m_size);
+			}
+
+			friend inline boost::asio::mutable_buffers_1 buffer(const SharedBuffer& buf, size_t size)
+			{
+				return boost::asio::buffer(buf.m_block->data(), std::min(size, buf.m_size));
+			}
+
 			template <typename Type>
 			friend inline Type buffer_cast(const SharedBuffer& buf)
 			{
-				if (buf.m_buffer)
-				{
-					return buffer_cast<Type>(*(buf.m_buffer));
-				}
-				else
-				{
-					return boost::asio::buffer_cast<Type>(buffer(buf));
-				}
+				return boost::asio::buffer_cast<Type>(buffer(buf));
 			}
 
 			friend inline size_t buffer_size(const SharedBuffer& buf)
 			{
-				if (buf.m_buffer)
-				{
-					return buffer_size((*buf.m_buffer));
-				}
-				else
-				{
-					return boost::asio::buffer_size(buffer(buf));
-				}
+				return buf.m_size;
 			}
 	};
 
@@ -0,0 +1,460 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file timing_wheel.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A hierarchical timing wheel.
+ */
+
+#ifndef FSCP_TIMING_WHEEL_HPP
+#define FSCP_TIMING_WHEEL_HPP
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/array.hpp>
+
+#include <vector>
+#include <cassert>
+
+#include <stdint.h>
+
+namespace fscp
+{
+	template <typename KeyType>
+	class timing_wheel;
+
+	/**
+	 * \brief A handle to a pending expiration of a timing wheel.
+	 *
+	 * A default-constructed handle designates no expiration. A handle stops designating its expiration once it is cancelled or due, even if its storage gets reused by another expiration.
+	 */
+	class timing_wheel_handle
+	{
+		public:
+
+			/**
+			 * \brief Create a handle that designates no expiration.
+			 */
+			timing_wheel_handle() :
+				m_index(INVALID_INDEX),
+				m_generation(0)
+			{}
+
+		private:
+
+			static const uint32_t INVALID_INDEX = 0xffffffff;
+
+			timing_wheel_handle(uint32_t index, uint32_t generation) :
+				m_index(index),
+				m_generation(generation)
+			{}
+
+			uint32_t m_index;
+			uint32_t m_generation;
+
+			template <typename KeyType>
+			friend class timing_wheel;
+	};
+
+	/**
+	 * \brief A hierarchical timing wheel.
+	 *
+	 * The wheel is made of LEVELS_COUNT levels of SLOTS_COUNT slots: the first level has a slot per tick and every other level has a slot per turn of the level below it. Advancing the wheel by one tick only visits the keys that expire during that tick, plus the keys of an upper level slot that move down one level once per turn.
+	 *
+	 * The expirations are stored in a pool of nodes linked into their slots by index, and are referenced by a handle that the caller keeps along with the key. Scheduling and cancelling an expiration are constant time operations that do not allocate once the pool has grown to the largest count of pending expirations.
+	 *
+	 * This class is not thread-safe: it is meant to be used from within a single strand.
+	 */
+	template <typename KeyType>
+	class timing_wheel
+	{
+		public:
+
+			/**
+			 * \brief The key type.
+			 */
+			typedef KeyType key_type;
+
+			/**
+			 * \brief The handle type.
+			 */
+			typedef timing_wheel_handle handle_type;
+
+			/**
+			 * \brief The count of slots per level.
+			 */
+			static const size_t SLOTS_COUNT = 64;
+
+			/**
+			 * \brief The count of levels.
+			 */
+			static const size_t LEVELS_COUNT = 4;
+
+			/**
+			 * \brief Create a new timing wheel.
+			 * \param tick_duration The duration of a tick. Expirations are rounded up to the next tick.
+			 * \param origin The time of the first tick.
+			 */
+			timing_wheel(const boost::posix_time::time_duration& tick_duration, const boost::posix_time::ptime& origin = boost::posix_time::microsec_clock::universal_time()) :
+				m_tick_duration(tick_duration),
+				m_origin(origin),
+				m_current_tick(0),
+				m_nodes(),
+				m_free_node(INVALID_INDEX),
+				m_size(0)
+			{
+				assert(m_tick_duration.total_microseconds() > 0);
+
+				m_slots.fill(static_cast<uint32_t>(INVALID_INDEX));
+			}
+
+			/**
+			 * \brief Get the duration of a tick.
+			 * \return The duration of a tick.
+			 */
+			const boost::posix_time::time_duration& tick_duration() const { return m_tick_duration; }
+
+			/**
+			 * \brief Check if the wheel has no pending expiration.
+			 * \return true if the wheel has no pending expiration.
+			 */
+			bool empty() const { return (m_size == 0); }
+
+			/**
+			 * \brief Get the count of pending expirations.
+			 * \return The count of pending expirations.
+			 */
+			size_t size() const { return m_size; }
+
+			/**
+			 * \brief Check if a handle designates a pending expiration.
+			 * \param handle The handle.
+			 * \return true if the handle designates a pending expiration.
+			 */
+			bool is_scheduled(const handle_type& handle) const
+			{
+				return ((handle.m_index < m_nodes.size()) && (m_nodes[handle.m_index].generation == handle.m_generation) && (m_nodes[handle.m_index].slot != INVALID_INDEX));
+			}
+
+			/**
+			 * \brief Schedule the expiration of a key.
+			 * \param handle The handle of the expiration. If it already designates a pending expiration, that expiration is replaced. After the call, it designates the new expiration.
+			 * \param key The key, to pass to the handler of advance().
+			 * \param expires_at The expiration time. A time that already passed expires at the next tick.
+			 */
+			void schedule(handle_type& handle, const key_type& key, const boost::posix_time::ptime& expires_at)
+			{
+				cancel(handle);
+
+				tick_type expiration_tick = m_current_tick + 1;
+
+				if (expires_at > m_origin)
+				{
+					const int64_t elapsed = (expires_at - m_origin).total_microseconds();
+					const int64_t tick = m_tick_duration.total_microseconds();
+					const tick_type ticks = static_cast<tick_type>((elapsed + tick - 1) / tick);
+
+					if (ticks > expiration_tick)
+					{
+						expiration_tick = ticks;
+					}
+				}
+
+				const uint32_t index = allocate_node();
+				node_type& node = m_nodes[index];
+
+				node.key = key;
+				node.expiration_tick = expiration_tick;
+				insert(index);
+
+				handle = handle_type(index, node.generation);
+			}
+
+			/**
+			 * \brief Cancel an expiration.
+			 * \param handle The handle of the expiration. After the call, it designates no expiration.
+			 * \return true if the handle designated a pending expiration.
+			 */
+			bool cancel(handle_type& handle)
+			{
+				const bool result = is_scheduled(handle);
+
+				if (result)
+				{
+					unlink(handle.m_index);
+					release_node(handle.m_index);
+				}
+
+				handle = handle_type();
+
+				return result;
+			}
+
+			/**
+			 * \brief Cancel all the pending expirations.
+			 */
+			void clear()
+			{
+				for (size_t slot = 0; slot < m_slots.size(); ++slot)
+				{
+					uint32_t index = m_slots[slot];
+					m_slots[slot] = INVALID_INDEX;
+
+					while (index != INVALID_INDEX)
+					{
+						const uint32_t next = m_nodes[index].next;
+
+						release_node(index);
+						index = next;
+					}
+				}
+			}
+
+			/**
+			 * \brief Advance the wheel.
+			 * \param now The current time.
+			 * \param handler The handler to call with the key of every expiration that is due. The expiration is no longer pending when the handler is called, so that it may schedule the key again.
+			 */
+			template <typename Handler>
+			void advance(const boost::posix_time::ptime& now, Handler handler)
+			{
+				const tick_type target_tick = (now > m_origin) ? static_cast<tick_type>((now - m_origin).total_microseconds() / m_tick_duration.total_microseconds()) : 0;
+
+				if (m_size == 0)
+				{
+					// Nothing can expire: no need to walk the skipped ticks.
+					if (target_tick > m_current_tick)
+					{
+						m_current_tick = target_tick;
+					}
+
+					return;
+				}
+
+				std::vector<key_type> expired_keys;
+
+				while (m_current_tick < target_tick)
+				{
+					++m_current_tick;
+
+					cascade(1);
+
+					uint32_t& slot = m_slots[m_current_tick % SLOTS_COUNT];
+					uint32_t index = slot;
+					slot = INVALID_INDEX;
+
+					while (index != INVALID_INDEX)
+					{
+						const node_type& node = m_nodes[index];
+						const uint32_t next = node.next;
+
+						assert(node.expiration_tick == m_current_tick);
+
+						expired_keys.push_back(node.key);
+						release_node(index);
+						index = next;
+					}
+				}
+
+				// The handlers are only called once the wheel is consistent, as they may schedule keys again.
+				for (typename std::vector<key_type>::const_iterator key = expired_keys.begin(); key != expired_keys.end(); ++key)
+				{
+					handler(*key);
+				}
+			}
+
+		private:
+
+			typedef uint64_t tick_type;
+
+			static const uint32_t INVALID_INDEX = 0xffffffff;
+
+			struct node_type
+			{
+				node_type() :
+					key(),
+					expiration_tick(0),
+					slot(INVALID_INDEX),
+					previous(INVALID_INDEX),
+					next(INVALID_INDEX),
+					generation(0)
+				{}
+
+				key_type key;
+				tick_type expiration_tick;
+
+				// The index of the slot the node is linked into, among all the slots of all the levels. INVALID_INDEX if the node is free.
+				uint32_t slot;
+				uint32_t previous;
+				uint32_t next;
+
+				// Incremented whenever the node is released, so that the handles of its previous expirations become stale.
+				uint32_t generation;
+			};
+
+			static tick_type level_span(size_t level)
+			{
+				tick_type result = 1;
+
+				for (size_t i = 0; i < level; ++i)
+				{
+					result *= SLOTS_COUNT;
+				}
+
+				return result;
+			}
+
+			uint32_t allocate_node()
+			{
+				uint32_t index = m_free_node;
+
+				if (index != INVALID_INDEX)
+				{
+					m_free_node = m_nodes[index].next;
+				}
+				else
+				{
+					index = static_cast<uint32_t>(m_nodes.size());
+					m_nodes.push_back(node_type());
+				}
+
+				++m_size;
+
+				return index;
+			}
+
+			void release_node(uint32_t index)
+			{
+				node_type& node = m_nodes[index];
+
+				node.slot = INVALID_INDEX;
+				node.previous = INVALID_INDEX;
+				node.next = m_free_node;
+				++node.generation;
+				m_free_node = index;
+
+				--m_size;
+			}
+
+			void insert(uint32_t index)
+			{
+				node_type& node = m_nodes[index];
+
+				assert(node.expiration_tick >= m_current_tick);
+
+				size_t level = 0;
+
+				while ((level + 1 < LEVELS_COUNT) && (node.expiration_tick - m_current_tick >= level_span(level + 1)))
+				{
+					++level;
+				}
+
+				if (node.expiration_tick - m_current_tick >= level_span(LEVELS_COUNT))
+				{
+					// Too far away for the wheel: the expiration is pushed back to the last slot it can reach.
+					node.expiration_tick = m_current_tick + level_span(LEVELS_COUNT) - 1;
+				}
+
+				const uint32_t slot = static_cast<uint32_t>(level * SLOTS_COUNT + (node.expiration_tick / level_span(level)) % SLOTS_COUNT);
+
+				node.slot = slot;
+				node.previous = INVALID_INDEX;
+				node.next = m_slots[slot];
+
+				if (node.next != INVALID_INDEX)
+				{
+					m_nodes[node.next].previous = index;
+				}
+
+				m_slots[slot] = index;
+			}
+
+			void unlink(uint32_t index)
+			{
+				const node_type& node = m_nodes[index];
+
+				if (node.previous != INVALID_INDEX)
+				{
+					m_nodes[node.previous].next = node.next;
+				}
+				else
+				{
+					m_slots[node.slot] = node.next;
+				}
+
+				if (node.next != INVALID_INDEX)
+				{
+					m_nodes[node.next].previous = node.previous;
+				}
+			}
+
+			void cascade(size_t level)
+			{
+				// The slots of a level move down once the level below it has completed a turn.
+				if ((level >= LEVELS_COUNT) || (m_current_tick % level_span(level) != 0))
+				{
+					return;
+				}
+
+				cascade(level + 1);
+
+				uint32_t& slot = m_slots[level * SLOTS_COUNT + (m_current_tick / level_span(level)) % SLOTS_COUNT];
+				uint32_t index = slot;
+				slot = INVALID_INDEX;
+
+				// The nodes are linked again in place: the handles remain valid.
+				while (index != INVALID_INDEX)
+				{
+					const uint32_t next = m_nodes[index].next;
+
+					insert(index);
+					index = next;
+				}
+			}
+
+			boost::posix_time::time_duration m_tick_duration;
+			boost::posix_time::ptime m_origin;
+			tick_type m_current_tick;
+			boost::array<uint32_t, LEVELS_COUNT * SLOTS_COUNT> m_slots;
+			std::vector<node_type> m_nodes;
+			uint32_t m_free_node;
+			size_t m_size;
+	};
+}
+
+#endif /* FSCP_TIMING_WHEEL_HPP */
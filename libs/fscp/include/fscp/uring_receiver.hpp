@@ -0,0 +1,177 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file uring_receiver.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An io_uring based datagram receiver.
+ */
+
+#ifndef FSCP_URING_RECEIVER_HPP
+#define FSCP_URING_RECEIVER_HPP
+
+#ifdef LINUX
+
+#include "shared_buffer.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include <vector>
+
+namespace fscp
+{
+	/**
+	 * \brief A datagram receiver that relies on io_uring multishot receives.
+	 *
+	 * A single receive request is posted for the socket and keeps completing as datagrams arrive. The datagrams are written by the kernel directly into pooled buffers that were handed over to it through a provided buffer ring, so that no system call is required to receive them: the completions are reaped from the shared completion ring.
+	 *
+	 * The ring signals its completions through an eventfd, which is waited on with the regular asio reactor.
+	 *
+	 * Requires Linux 6.0 or later. The constructor throws if the running kernel does not support the required features so that the caller can fall back to regular receives.
+	 *
+	 * Instances are not thread-safe: async_wait(), process() and cancel() must be called from the same strand.
+	 */
+	class uring_receiver : public boost::noncopyable
+	{
+		public:
+
+			/**
+			 * \brief The endpoint type.
+			 */
+			typedef boost::asio::ip::udp::endpoint ep_type;
+
+			/**
+			 * \brief The datagram handler type.
+			 *
+			 * The datagram payload starts at the beginning of the buffer.
+			 */
+			typedef boost::function<void (const ep_type&, SharedBuffer, size_t)> datagram_handler_type;
+
+			/**
+			 * \brief The default number of buffers handed over to the kernel.
+			 */
+			static const size_t DEFAULT_BUFFERS_COUNT = 64;
+
+			/**
+			 * \brief Create a receiver.
+			 * \param io_service The io_service to use to wait for completions.
+			 * \param socket The native handle of a bound UDP socket. It must outlive the receiver.
+			 * \param buffers_count The number of buffers handed over to the kernel. Rounded up to a power of two.
+			 * \param buffer_size The size of every buffer. Datagrams bigger than that are dropped.
+			 *
+			 * The receive request is posted immediately.
+			 *
+			 * Throws a boost::system::system_error if the kernel lacks io_uring support.
+			 */
+			uring_receiver(boost::asio::io_service& io_service, int socket, size_t buffers_count, size_t buffer_size);
+
+			/**
+			 * \brief Destroy the receiver.
+			 */
+			~uring_receiver();
+
+			/**
+			 * \brief Wait for completions.
+			 * \param handler The handler to call once process() has work to do. Must have the signature void (const boost::system::error_code&, size_t). The size is always 0.
+			 */
+			template <typename WaitHandler>
+			void async_wait(WaitHandler handler)
+			{
+				m_event_descriptor.async_read_some(boost::asio::null_buffers(), handler);
+			}
+
+			/**
+			 * \brief Reap the pending completions.
+			 * \param handler The handler to call for every received datagram.
+			 * \return The number of datagrams received.
+			 *
+			 * Replenishes the buffer ring and posts the receive request again if the kernel terminated it.
+			 *
+			 * Throws a boost::system::system_error if the receive request fails for a reason other than a transient buffer shortage.
+			 */
+			size_t process(const datagram_handler_type& handler);
+
+			/**
+			 * \brief Cancel any pending wait.
+			 */
+			void cancel();
+
+		private:
+
+			void release();
+			void add_buffer(uint16_t bid);
+			void submit_receive();
+
+			boost::asio::posix::stream_descriptor m_event_descriptor;
+			int m_socket;
+			int m_ring_fd;
+			size_t m_buffer_size;
+
+			// The submission and completion rings, mapped from the kernel.
+			void* m_rings;
+			size_t m_rings_size;
+			::io_uring_sqe* m_sqes;
+			size_t m_sqes_size;
+			unsigned* m_sq_tail;
+			unsigned m_sq_mask;
+			unsigned* m_sq_array;
+			unsigned* m_cq_head;
+			unsigned* m_cq_tail;
+			unsigned m_cq_mask;
+			::io_uring_cqe* m_cqes;
+
+			// The provided buffer ring and the buffers it references, indexed by buffer id.
+			::io_uring_buf* m_buffer_ring;
+			size_t m_buffer_ring_size;
+			uint16_t m_buffer_ring_tail;
+			std::vector<SharedBuffer> m_buffers;
+
+			// Used as the multishot receive template: it only tells the kernel how much room to reserve for the sender address.
+			::msghdr m_msghdr;
+			bool m_armed;
+	};
+}
+
+#endif
+
+#endif /* FSCP_URING_RECEIVER_HPP */
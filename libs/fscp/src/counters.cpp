@@ -0,0 +1,115 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file counters.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Counters that can be incremented concurrently from many threads.
+ */
+
+#include "counters.hpp"
+
+#include <boost/thread/tss.hpp>
+
+namespace fscp
+{
+	size_t get_counters_slot()
+	{
+		static std::atomic<size_t> next_slot(0);
+		static boost::thread_specific_ptr<size_t>* const slot = new boost::thread_specific_ptr<size_t>();
+
+		if (!slot->get())
+		{
+			slot->reset(new size_t(next_slot.fetch_add(1, std::memory_order_relaxed)));
+		}
+
+		return *slot->get();
+	}
+
+	sharded_histogram::sharded_histogram()
+	{
+		for (auto&& slot : m_slots)
+		{
+			for (auto&& count : slot.counts)
+			{
+				count = 0;
+			}
+
+			slot.sum = 0;
+		}
+	}
+
+	void sharded_histogram::observe(uint64_t value)
+	{
+		size_t bucket = 0;
+
+		while ((bucket + 1 < BUCKETS_COUNT) && (value > upper_bound(bucket)))
+		{
+			++bucket;
+		}
+
+		slot_type& slot = m_slots[get_counters_slot() % SLOTS_COUNT];
+
+		slot.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+		slot.sum.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	sharded_histogram::snapshot_type sharded_histogram::snapshot() const
+	{
+		snapshot_type result;
+
+		result.counts.fill(0);
+		result.count = 0;
+		result.sum = 0;
+
+		for (auto&& slot : m_slots)
+		{
+			for (size_t bucket = 0; bucket < BUCKETS_COUNT; ++bucket)
+			{
+				const uint64_t count = slot.counts[bucket].load(std::memory_order_relaxed);
+
+				result.counts[bucket] += count;
+				result.count += count;
+			}
+
+			result.sum += slot.sum.load(std::memory_order_relaxed);
+		}
+
+		return result;
+	}
+}
@@ -0,0 +1,98 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file crypto_worker_pool.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A bounded pool of threads dedicated to asymmetric cryptography.
+ */
+
+#include "crypto_worker_pool.hpp"
+
+#include <boost/bind.hpp>
+
+#include <cassert>
+
+namespace fscp
+{
+	crypto_worker_pool::crypto_worker_pool(size_t threads_count, size_t max_pending) :
+		m_io_service(),
+		m_work(new boost::asio::io_service::work(m_io_service)),
+		m_threads(),
+		m_max_pending(max_pending),
+		m_pending(0),
+		m_rejected(0)
+	{
+		assert(threads_count > 0);
+
+		for (size_t i = 0; i < threads_count; ++i)
+		{
+			m_threads.create_thread(boost::bind(&boost::asio::io_service::run, &m_io_service));
+		}
+	}
+
+	crypto_worker_pool::~crypto_worker_pool()
+	{
+		m_work.reset();
+		m_io_service.stop();
+		m_threads.join_all();
+	}
+
+	bool crypto_worker_pool::post(job_type job)
+	{
+		// The counter is incremented first so that concurrent posts can never exceed the limit.
+		if (m_pending.fetch_add(1, std::memory_order_relaxed) >= m_max_pending)
+		{
+			m_pending.fetch_sub(1, std::memory_order_relaxed);
+			m_rejected.fetch_add(1, std::memory_order_relaxed);
+
+			return false;
+		}
+
+		m_io_service.post(boost::bind(&crypto_worker_pool::run_job, this, job));
+
+		return true;
+	}
+
+	void crypto_worker_pool::run_job(const job_type& job)
+	{
+		job();
+
+		m_pending.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
@@ -49,6 +49,7 @@
 #include <cryptoplus/random/random.hpp>
 
 #include <boost/iterator/transform_iterator.hpp>
+#include <boost/array.hpp>
 
 #include <cassert>
 #include <stdexcept>
@@ -57,16 +58,26 @@ namespace fscp
 {
 	namespace
 	{
-		typedef std::vector<uint8_t> iv_type;
+		typedef boost::array<uint8_t, EVP_MAX_IV_LENGTH> iv_type;
 
-		iv_type compute_iv(const void* nonce_prefix, size_t nonce_prefix_len, sequence_number_type sequence_number)
+		size_t get_iv_size(size_t nonce_prefix_len)
 		{
-			iv_type result(nonce_prefix_len + sizeof(sequence_number_type));
+			if (nonce_prefix_len + sizeof(sequence_number_type) > iv_type::static_size)
+			{
+				throw std::runtime_error("nonce_prefix_len");
+			}
+
+			return nonce_prefix_len + sizeof(sequence_number_type);
+		}
 
-			std::copy(static_cast<const uint8_t*>(nonce_prefix), static_cast<const uint8_t*>(nonce_prefix) + nonce_prefix_len, result.begin());
-			buffer_tools::set<sequence_number_type>(result.data(), nonce_prefix_len, htonl(sequence_number));
+		size_t compute_iv(iv_type& iv, const void* nonce_prefix, size_t nonce_prefix_len, sequence_number_type sequence_number)
+		{
+			const size_t iv_size = get_iv_size(nonce_prefix_len);
+
+			std::copy(static_cast<const uint8_t*>(nonce_prefix), static_cast<const uint8_t*>(nonce_prefix) + nonce_prefix_len, iv.begin());
+			buffer_tools::set<sequence_number_type>(iv.data(), nonce_prefix_len, htonl(sequence_number));
 
-			return result;
+			return iv_size;
 		}
 
 		const hash_type::data_type& hash_to_data(const hash_type& hash)
@@ -77,26 +88,70 @@ namespace fscp
 
 	using boost::make_transform_iterator;
 
+	void data_message::initialize_cipher_context(cctx_t& cipher_context, data_message::calg_t cipher_algorithm, cctx_t::cipher_direction direction, const void* enc_key, size_t enc_key_len, size_t nonce_prefix_len)
+	{
+		assert(enc_key);
+
+		// First initialization - required to set GCM specific attributes
+		cipher_context.initialize(cipher_algorithm, direction, NULL, 0, NULL);
+		cipher_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(get_iv_size(nonce_prefix_len)));
+
+		// The key schedule is computed here: subsequent initializations only set the IV.
+		cipher_context.initialize(cipher_algorithm, cctx_t::unchanged, enc_key, enc_key_len, NULL);
+	}
+
 	size_t data_message::write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* _cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
-		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, _cleartext, cleartext_len, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, to_data_message_type(channel_number));
+		cctx_t cipher_context;
+		initialize_cipher_context(cipher_context, cipher_algorithm, cctx_t::encrypt, enc_key, enc_key_len, nonce_prefix_len);
+
+		return write(buf, buf_len, channel_number, _sequence_number, cipher_context, _cleartext, cleartext_len, nonce_prefix, nonce_prefix_len);
+	}
+
+	size_t data_message::write(void* buf, size_t buf_len, channel_number_type channel_number, sequence_number_type _sequence_number, cctx_t& cipher_context, const void* _cleartext, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, _cleartext, cleartext_len, nonce_prefix, nonce_prefix_len, to_data_message_type(channel_number));
 	}
 
 	size_t data_message::write_keep_alive(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, size_t random_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		cctx_t cipher_context;
+		initialize_cipher_context(cipher_context, cipher_algorithm, cctx_t::encrypt, enc_key, enc_key_len, nonce_prefix_len);
+
+		return write_keep_alive(buf, buf_len, _sequence_number, cipher_context, random_len, nonce_prefix, nonce_prefix_len);
+	}
+
+	size_t data_message::write_keep_alive(void* buf, size_t buf_len, sequence_number_type _sequence_number, cctx_t& cipher_context, size_t random_len, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
 		const cryptoplus::buffer random = cryptoplus::random::get_random_bytes(random_len);
 
-		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, cryptoplus::buffer_cast<const uint8_t*>(random), cryptoplus::buffer_size(random), enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_KEEP_ALIVE);
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, cryptoplus::buffer_cast<const uint8_t*>(random), cryptoplus::buffer_size(random), nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_KEEP_ALIVE);
 	}
 
 	size_t data_message::write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, data_message::calg_t cipher_algorithm, const hash_list_type& hash_list, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		cctx_t cipher_context;
+		initialize_cipher_context(cipher_context, cipher_algorithm, cctx_t::encrypt, enc_key, enc_key_len, nonce_prefix_len);
+
+		return write_contact_request(buf, buf_len, sequence_number, cipher_context, hash_list, nonce_prefix, nonce_prefix_len);
+	}
+
+	size_t data_message::write_contact_request(void* buf, size_t buf_len, sequence_number_type sequence_number, cctx_t& cipher_context, const hash_list_type& hash_list, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
 		const std::vector<hash_type::data_type> hash_vec(make_transform_iterator(hash_list.begin(), hash_to_data), make_transform_iterator(hash_list.end(), hash_to_data));
 
-		return raw_write(buf, buf_len, sequence_number, cipher_algorithm, hash_vec.empty() ? nullptr : reinterpret_cast<const char*>(&hash_vec[0]), hash_vec.size() * hash_type::data_type::static_size, enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT_REQUEST);
+		return raw_write(buf, buf_len, sequence_number, cipher_context, hash_vec.empty() ? nullptr : reinterpret_cast<const char*>(&hash_vec[0]), hash_vec.size() * hash_type::data_type::static_size, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT_REQUEST);
 	}
 
 	size_t data_message::write_contact(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const contact_map_type& contact_map, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		cctx_t cipher_context;
+		initialize_cipher_context(cipher_context, cipher_algorithm, cctx_t::encrypt, enc_key, enc_key_len, nonce_prefix_len);
+
+		return write_contact(buf, buf_len, _sequence_number, cipher_context, contact_map, nonce_prefix, nonce_prefix_len);
+	}
+
+	size_t data_message::write_contact(void* buf, size_t buf_len, sequence_number_type _sequence_number, cctx_t& cipher_context, const contact_map_type& contact_map, const void* nonce_prefix, size_t nonce_prefix_len)
 	{
 		std::vector<uint8_t> cleartext;
 		cleartext.resize(contact_map.size() * 49);
@@ -136,7 +191,25 @@ namespace fscp
 
 		cleartext.resize(std::distance(cleartext.begin(), ptr));
 
-		return raw_write(buf, buf_len, _sequence_number, cipher_algorithm, cleartext.empty() ? nullptr : &cleartext[0], cleartext.size(), enc_key, enc_key_len, nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT);
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, cleartext.empty() ? nullptr : &cleartext[0], cleartext.size(), nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_CONTACT);
+	}
+
+	size_t data_message::write_path_mtu(void* buf, size_t buf_len, sequence_number_type _sequence_number, cctx_t& cipher_context, size_t path_mtu, const void* nonce_prefix, size_t nonce_prefix_len)
+	{
+		uint8_t cleartext[sizeof(uint16_t)];
+		buffer_tools::set<uint16_t>(cleartext, 0, htons(static_cast<uint16_t>(path_mtu)));
+
+		return raw_write(buf, buf_len, _sequence_number, cipher_context, cleartext, sizeof(cleartext), nonce_prefix, nonce_prefix_len, MESSAGE_TYPE_PATH_MTU);
+	}
+
+	size_t data_message::parse_path_mtu(const void* buf, size_t buflen)
+	{
+		if (buflen != sizeof(uint16_t))
+		{
+			throw std::runtime_error("Invalid message structure");
+		}
+
+		return ntohs(buffer_tools::get<uint16_t>(static_cast<const uint8_t*>(buf), 0));
 	}
 
 	hash_list_type data_message::parse_hash_list(const void* buf, size_t buflen)
@@ -260,21 +333,30 @@ namespace fscp
 
 	size_t data_message::get_cleartext(void* buf, size_t buf_len, data_message::calg_t cipher_algorithm, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len) const
 	{
-		assert(enc_key);
-
 		if (buf)
 		{
-			const iv_type iv = compute_iv(nonce_prefix, nonce_prefix_len, sequence_number());
+			cctx_t cipher_context;
+			initialize_cipher_context(cipher_context, cipher_algorithm, cctx_t::decrypt, enc_key, enc_key_len, nonce_prefix_len);
+
+			return get_cleartext(buf, buf_len, cipher_context, nonce_prefix, nonce_prefix_len);
+		}
+		else
+		{
+			return ciphertext_size();
+		}
+	}
 
-			cryptoplus::cipher::cipher_context cipher_context;
+	size_t data_message::get_cleartext(void* buf, size_t buf_len, cctx_t& cipher_context, const void* nonce_prefix, size_t nonce_prefix_len) const
+	{
+		if (buf)
+		{
+			iv_type iv;
+			compute_iv(iv, nonce_prefix, nonce_prefix_len, sequence_number());
 
-			// First initialization - required to set GCM specific attributes
-			cipher_context.initialize(cipher_algorithm, cryptoplus::cipher::cipher_context::decrypt, NULL, 0, NULL);
-			cipher_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(iv.size()));
+			// The key is already set: we only change the IV.
+			cipher_context.initialize(data_message::calg_t(), cctx_t::unchanged, NULL, 0, iv.data());
 			cipher_context.ctrl(EVP_CTRL_GCM_SET_TAG, static_cast<int>(tag_size()), const_cast<uint8_t*>(tag()));
 
-			cipher_context.initialize(data_message::calg_t(), cryptoplus::cipher::cipher_context::unchanged, enc_key, enc_key_len, iv.data());
-
 			size_t cnt = cipher_context.update(buf, buf_len, ciphertext(), ciphertext_size());
 
 			cnt += cipher_context.finalize(static_cast<uint8_t*>(buf) + cnt, buf_len - cnt);
@@ -287,36 +369,30 @@ namespace fscp
 		}
 	}
 
-	size_t data_message::raw_write(void* buf, size_t buf_len, sequence_number_type _sequence_number, data_message::calg_t cipher_algorithm, const void* _cleartext, size_t cleartext_len, const void* enc_key, size_t enc_key_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type)
+	size_t data_message::raw_write(void* buf, size_t buf_len, sequence_number_type _sequence_number, cctx_t& cipher_context, const void* _cleartext, size_t cleartext_len, const void* nonce_prefix, size_t nonce_prefix_len, message_type type)
 	{
-		assert(enc_key);
-
-		const iv_type iv = compute_iv(nonce_prefix, nonce_prefix_len, _sequence_number);
+		const size_t block_size = cipher_context.algorithm().block_size();
 
-		if (buf_len < HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t) + (cleartext_len + cipher_algorithm.block_size()))
+		if (buf_len < HEADER_LENGTH + sizeof(sequence_number_type) + GCM_TAG_LENGTH + sizeof(uint16_t) + (cleartext_len + block_size))
 		{
 			throw std::runtime_error("buf_len");
 		}
 
+		iv_type iv;
+		compute_iv(iv, nonce_prefix, nonce_prefix_len, _sequence_number);
+
 		uint8_t* const payload = static_cast<uint8_t*>(buf) + HEADER_LENGTH;
 		uint8_t* const tag = payload + sizeof(sequence_number_type);
 		uint8_t* const ciphertext = tag + GCM_TAG_LENGTH + sizeof(uint16_t);
 
 		buffer_tools::set<sequence_number_type>(payload, 0, htonl(_sequence_number));
 
-		cryptoplus::cipher::cipher_context cipher_context;
-
-		// First initialization - required to set GCM specific attributes
-		cipher_context.initialize(cipher_algorithm, cryptoplus::cipher::cipher_context::encrypt, NULL, 0, NULL);
-		cipher_context.ctrl_set(EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(iv.size()));
-
-		cipher_context.initialize(data_message::calg_t(), cryptoplus::cipher::cipher_context::unchanged, enc_key, enc_key_len, iv.data());
-
-		const size_t max_ciphertext_len = buf_len - HEADER_LENGTH - sizeof(sequence_number_type) - GCM_TAG_LENGTH - sizeof(uint16_t) - cipher_algorithm.block_size();
+		// The key is already set: we only change the IV.
+		cipher_context.initialize(data_message::calg_t(), cctx_t::unchanged, NULL, 0, iv.data());
 
-		const cryptoplus::buffer cleartext(_cleartext, cleartext_len);
+		const size_t max_ciphertext_len = buf_len - HEADER_LENGTH - sizeof(sequence_number_type) - GCM_TAG_LENGTH - sizeof(uint16_t) - block_size;
 
-		size_t ciphertext_len = cipher_context.update(ciphertext, max_ciphertext_len, cleartext);
+		size_t ciphertext_len = cipher_context.update(ciphertext, max_ciphertext_len, _cleartext, cleartext_len);
 		ciphertext_len += cipher_context.finalize(ciphertext + ciphertext_len, max_ciphertext_len - ciphertext_len);
 
 		cipher_context.ctrl(EVP_CTRL_GCM_GET_TAG, GCM_TAG_LENGTH, tag);
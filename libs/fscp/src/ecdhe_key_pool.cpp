@@ -0,0 +1,179 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file ecdhe_key_pool.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A pool of pre-generated ephemeral ECDHE keys.
+ */
+
+#include "ecdhe_key_pool.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+namespace fscp
+{
+	ecdhe_key_pool::ecdhe_key_pool(executor_type executor, size_t size) :
+		m_executor(executor),
+		m_size(size),
+		m_mutex(),
+		m_curve_pools(),
+		m_hits(0),
+		m_misses(0)
+	{
+	}
+
+	void ecdhe_key_pool::fill(const elliptic_curve_list_type& elliptic_curves)
+	{
+		for (auto&& elliptic_curve : elliptic_curves)
+		{
+			if (elliptic_curve.is_valid())
+			{
+				schedule_refill(elliptic_curve);
+			}
+		}
+	}
+
+	ecdhe_key_pool::key_ptr_type ecdhe_key_pool::take(elliptic_curve_type elliptic_curve)
+	{
+		key_ptr_type result;
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			std::vector<key_ptr_type>& keys = m_curve_pools[elliptic_curve.value()].keys;
+
+			if (!keys.empty())
+			{
+				result = keys.back();
+				keys.pop_back();
+			}
+		}
+
+		schedule_refill(elliptic_curve);
+
+		if (result)
+		{
+			m_hits.fetch_add(1, std::memory_order_relaxed);
+
+			return result;
+		}
+
+		m_misses.fetch_add(1, std::memory_order_relaxed);
+
+		return generate(elliptic_curve);
+	}
+
+	ecdhe_key_pool::key_ptr_type ecdhe_key_pool::generate(elliptic_curve_type elliptic_curve)
+	{
+		const key_ptr_type result = boost::make_shared<key_type>(elliptic_curve.to_elliptic_curve_nid());
+
+		result->generate_keys();
+
+		return result;
+	}
+
+	void ecdhe_key_pool::schedule_refill(elliptic_curve_type elliptic_curve)
+	{
+		if (m_size == 0)
+		{
+			return;
+		}
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			curve_pool_type& curve_pool = m_curve_pools[elliptic_curve.value()];
+
+			// A single refill per curve runs at any time: it generates all the missing key pairs.
+			if (curve_pool.refilling || (curve_pool.keys.size() >= m_size))
+			{
+				return;
+			}
+
+			curve_pool.refilling = true;
+		}
+
+		if (!m_executor(boost::bind(&ecdhe_key_pool::refill, this, elliptic_curve)))
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			m_curve_pools[elliptic_curve.value()].refilling = false;
+		}
+	}
+
+	void ecdhe_key_pool::refill(elliptic_curve_type elliptic_curve)
+	{
+		for (;;)
+		{
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				curve_pool_type& curve_pool = m_curve_pools[elliptic_curve.value()];
+
+				if (curve_pool.keys.size() >= m_size)
+				{
+					curve_pool.refilling = false;
+
+					return;
+				}
+			}
+
+			key_ptr_type key;
+
+			try
+			{
+				key = generate(elliptic_curve);
+			}
+			catch (const std::exception&)
+			{
+				// The key pair will be generated on the spot when it is taken, which reports the error properly.
+				boost::mutex::scoped_lock lock(m_mutex);
+
+				m_curve_pools[elliptic_curve.value()].refilling = false;
+
+				return;
+			}
+
+			boost::mutex::scoped_lock lock(m_mutex);
+
+			m_curve_pools[elliptic_curve.value()].keys.push_back(key);
+		}
+	}
+}
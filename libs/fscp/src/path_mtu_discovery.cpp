@@ -0,0 +1,211 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file path_mtu_discovery.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief A path MTU discovery class.
+ */
+
+#include "path_mtu_discovery.hpp"
+
+#include <algorithm>
+
+namespace fscp
+{
+	path_mtu_discovery::path_mtu_discovery(size_t max_size) :
+		m_max_size(max_size)
+	{
+		reset();
+	}
+
+	void path_mtu_discovery::reset()
+	{
+		m_state = state_type::base;
+		m_path_mtu = 0;
+		m_max_path_mtu = m_max_size;
+		m_probe_size = 0;
+		m_probe_count = 0;
+		m_raise_time = boost::posix_time::ptime();
+	}
+
+	size_t path_mtu_discovery::get_probe_size(const boost::posix_time::ptime& now)
+	{
+		if (m_probe_size != 0)
+		{
+			if (m_probe_count < PATH_MTU_MAX_PROBES)
+			{
+				++m_probe_count;
+
+				return m_probe_size;
+			}
+
+			lose_probe(now);
+		}
+
+		switch (m_state)
+		{
+			case state_type::base:
+			{
+				m_probe_size = std::min(PATH_MTU_BASE_SIZE, m_max_size);
+
+				break;
+			}
+			case state_type::search:
+			{
+				if (m_path_mtu >= m_max_path_mtu)
+				{
+					m_state = state_type::complete;
+					m_raise_time = now + PATH_MTU_RAISE_PERIOD;
+
+					return 0;
+				}
+
+				m_probe_size = m_path_mtu + (m_max_path_mtu - m_path_mtu + 1) / 2;
+
+				break;
+			}
+			case state_type::complete:
+			{
+				if (now < m_raise_time)
+				{
+					return 0;
+				}
+
+				// The current path MTU is probed again first, in case the path changed.
+				m_state = state_type::search;
+				m_max_path_mtu = m_max_size;
+				m_probe_size = m_path_mtu;
+
+				break;
+			}
+			case state_type::disabled:
+			{
+				if (now < m_raise_time)
+				{
+					return 0;
+				}
+
+				// The peer may have been upgraded in the meantime.
+				m_state = state_type::base;
+				m_probe_size = std::min(PATH_MTU_BASE_SIZE, m_max_size);
+
+				break;
+			}
+		}
+
+		m_probe_count = 1;
+
+		return m_probe_size;
+	}
+
+	bool path_mtu_discovery::acknowledge_probe(size_t size)
+	{
+		if ((size == 0) || (size > m_max_size))
+		{
+			return false;
+		}
+
+		if ((m_state == state_type::base) || (m_state == state_type::disabled))
+		{
+			m_state = state_type::search;
+			m_max_path_mtu = m_max_size;
+		}
+
+		m_path_mtu = std::max(m_path_mtu, size);
+		m_max_path_mtu = std::max(m_max_path_mtu, m_path_mtu);
+
+		if ((m_probe_size != 0) && (size >= m_probe_size))
+		{
+			m_probe_size = 0;
+			m_probe_count = 0;
+
+			return true;
+		}
+
+		return false;
+	}
+
+	bool path_mtu_discovery::reject_probe(size_t size, const boost::posix_time::ptime& now)
+	{
+		if ((m_probe_size != 0) && (size == m_probe_size))
+		{
+			lose_probe(now);
+
+			return true;
+		}
+
+		return false;
+	}
+
+	void path_mtu_discovery::lose_probe(const boost::posix_time::ptime& now)
+	{
+		switch (m_state)
+		{
+			case state_type::base:
+			{
+				m_state = state_type::disabled;
+				m_raise_time = now + PATH_MTU_RAISE_PERIOD;
+
+				break;
+			}
+			case state_type::search:
+			{
+				if (m_probe_size <= m_path_mtu)
+				{
+					// The path does not carry the sizes it used to anymore: we start over.
+					reset();
+				}
+				else
+				{
+					m_max_path_mtu = m_probe_size - 1;
+				}
+
+				break;
+			}
+			case state_type::complete:
+			case state_type::disabled:
+			{
+				break;
+			}
+		}
+
+		m_probe_size = 0;
+		m_probe_count = 0;
+	}
+}
@@ -44,6 +44,8 @@
 
 #include "peer_session.hpp"
 
+#include "data_message.hpp"
+
 #include <cryptoplus/tls/tls.hpp>
 
 namespace fscp
@@ -51,7 +53,102 @@ namespace fscp
 	bool peer_session::current_session_type::is_old() const
 	{
 		const auto max = std::numeric_limits<sequence_number_type>::max() / 2;
-		return ((local_sequence_number > max) || (remote_sequence_number > max));
+		return ((local_sequence_number > max) || is_remote_old());
+	}
+
+	bool peer_session::current_session_type::is_remote_old() const
+	{
+		return (remote_sequence_number > std::numeric_limits<sequence_number_type>::max() / 2);
+	}
+
+	peer_session::sequence_number_status peer_session::current_session_type::get_remote_sequence_number_status(sequence_number_type sequence_number) const
+	{
+		if (sequence_number > remote_sequence_number)
+		{
+			return sequence_number_status::in_order;
+		}
+
+		const sequence_number_type distance = remote_sequence_number - sequence_number;
+
+		if (distance >= remote_replay_window.size())
+		{
+			return sequence_number_status::too_old;
+		}
+
+		if (remote_replay_window.test(distance))
+		{
+			return sequence_number_status::duplicate;
+		}
+
+		return sequence_number_status::out_of_order;
+	}
+
+	peer_session::sequence_number_status peer_session::current_session_type::check_remote_sequence_number(sequence_number_type sequence_number)
+	{
+		const sequence_number_status status = get_remote_sequence_number_status(sequence_number);
+
+		switch (status)
+		{
+			case sequence_number_status::duplicate:
+				++duplicate_count;
+				break;
+			case sequence_number_status::too_old:
+				++too_old_count;
+				break;
+			case sequence_number_status::in_order:
+			case sequence_number_status::out_of_order:
+				break;
+		}
+
+		return status;
+	}
+
+	peer_session::sequence_number_status peer_session::current_session_type::set_remote_sequence_number(sequence_number_type sequence_number)
+	{
+		const sequence_number_status status = get_remote_sequence_number_status(sequence_number);
+
+		switch (status)
+		{
+			case sequence_number_status::in_order:
+			{
+				const sequence_number_type distance = sequence_number - remote_sequence_number;
+
+				if (distance >= remote_replay_window.size())
+				{
+					remote_replay_window.reset();
+				}
+				else
+				{
+					remote_replay_window <<= distance;
+				}
+
+				remote_replay_window.set(0);
+				remote_sequence_number = sequence_number;
+
+				break;
+			}
+			case sequence_number_status::out_of_order:
+			{
+				remote_replay_window.set(remote_sequence_number - sequence_number);
+				++out_of_order_count;
+
+				break;
+			}
+			case sequence_number_status::duplicate:
+			{
+				++duplicate_count;
+
+				break;
+			}
+			case sequence_number_status::too_old:
+			{
+				++too_old_count;
+
+				break;
+			}
+		}
+
+		return status;
 	}
 
 	bool peer_session::set_first_remote_host_identifier(const host_identifier_type& _host_identifier)
@@ -66,7 +163,7 @@ namespace fscp
 		return (_host_identifier == *m_remote_host_identifier);
 	}
 
-	bool peer_session::prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve)
+	bool peer_session::prepare_session(session_number_type _session_number, cipher_suite_type _cipher_suite, elliptic_curve_type _elliptic_curve, ecdhe_key_pool& key_pool)
 	{
 		if (m_next_session)
 		{
@@ -77,35 +174,42 @@ namespace fscp
 			}
 		}
 
-		m_next_session = boost::make_shared<next_session_type>(_session_number, _cipher_suite, _elliptic_curve);
+		m_next_session = boost::make_shared<next_session_type>(_session_number, _cipher_suite, _elliptic_curve, key_pool.take(_elliptic_curve));
 
 		return true;
 	}
 
 	bool peer_session::complete_session(const void* _remote_public_key, size_t remote_public_key_size)
 	{
-		using cryptoplus::buffer_cast;
-
 		if (!m_next_session || !m_remote_host_identifier)
 		{
 			return false;
 		}
 
-		boost::shared_ptr<current_session_type> _current_session = boost::make_shared<current_session_type>(m_next_session->parameters);
+		const boost::shared_ptr<next_session_type> next_session = m_next_session;
 
-		const size_t key_length = m_next_session->parameters.cipher_suite.to_cipher_algorithm().key_length();
+		return install_session(next_session, derive_session(*next_session, m_local_host_identifier, *m_remote_host_identifier, _remote_public_key, remote_public_key_size));
+	}
+
+	boost::shared_ptr<peer_session::current_session_type> peer_session::derive_session(const next_session_type& next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const void* _remote_public_key, size_t remote_public_key_size)
+	{
+		using cryptoplus::buffer_cast;
+
+		boost::shared_ptr<current_session_type> _current_session = boost::make_shared<current_session_type>(next_session.parameters);
+
+		const size_t key_length = next_session.parameters.cipher_suite.to_cipher_algorithm().key_length();
 		const auto remote_public_key = cryptoplus::buffer(_remote_public_key, remote_public_key_size);
 
-		// We get the derived secret key.
-		const auto secret_key = m_next_session->ecdhe_context.derive_secret_key(remote_public_key);
+		// We get the derived secret key. The keys of the ECDHE context were generated when the session was prepared: the derivation does not modify it.
+		const auto secret_key = next_session.ecdhe_context->derive_secret_key(remote_public_key);
 
 		_current_session->local_session_key = cryptoplus::tls::prf(
 			key_length,
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"session key",
-			m_local_host_identifier.data.data(),
-			m_local_host_identifier.data.size(),
+			local_host_identifier.data.data(),
+			local_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
@@ -114,8 +218,8 @@ namespace fscp
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"session key",
-			m_remote_host_identifier->data.data(),
-			m_remote_host_identifier->data.size(),
+			remote_host_identifier.data.data(),
+			remote_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
@@ -124,8 +228,8 @@ namespace fscp
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"nonce prefix",
-			m_local_host_identifier.data.data(),
-			m_local_host_identifier.data.size(),
+			local_host_identifier.data.data(),
+			local_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
@@ -134,13 +238,45 @@ namespace fscp
 			buffer_cast<const void*>(secret_key),
 			buffer_size(secret_key),
 			"nonce prefix",
-			m_remote_host_identifier->data.data(),
-			m_remote_host_identifier->data.size(),
+			remote_host_identifier.data.data(),
+			remote_host_identifier.data.size(),
 			get_default_digest_algorithm()
 		);
 
+		const auto cipher_algorithm = next_session.parameters.cipher_suite.to_cipher_algorithm();
+
+		data_message::initialize_cipher_context(
+			_current_session->local_cipher_context,
+			cipher_algorithm,
+			data_message::cctx_t::encrypt,
+			buffer_cast<const void*>(_current_session->local_session_key),
+			buffer_size(_current_session->local_session_key),
+			buffer_size(_current_session->local_nonce_prefix)
+		);
+
+		data_message::initialize_cipher_context(
+			_current_session->remote_cipher_context,
+			cipher_algorithm,
+			data_message::cctx_t::decrypt,
+			buffer_cast<const void*>(_current_session->remote_session_key),
+			buffer_size(_current_session->remote_session_key),
+			buffer_size(_current_session->remote_nonce_prefix)
+		);
+
+		return _current_session;
+	}
+
+	bool peer_session::install_session(const boost::shared_ptr<next_session_type>& next_session, boost::shared_ptr<current_session_type> session)
+	{
+		if (!next_session || (m_next_session != next_session))
+		{
+			return false;
+		}
+
+		session->counters = m_counters;
+
 		m_next_session.reset();
-		swap(m_current_session, _current_session);
+		swap(m_current_session, session);
 
 		keep_alive();
 
@@ -177,16 +313,18 @@ namespace fscp
 		return m_current_session->parameters;
 	}
 
-	bool peer_session::set_remote_sequence_number(sequence_number_type sequence_number)
+	peer_session::sequence_number_status peer_session::check_remote_sequence_number(sequence_number_type sequence_number)
 	{
-		if (sequence_number > m_current_session->remote_sequence_number)
-		{
-			m_current_session->remote_sequence_number = sequence_number;
+		assert(m_current_session);
 
-			return true;
-		}
+		return m_current_session->check_remote_sequence_number(sequence_number);
+	}
+
+	peer_session::sequence_number_status peer_session::set_remote_sequence_number(sequence_number_type sequence_number)
+	{
+		assert(m_current_session);
 
-		return false;
+		return m_current_session->set_remote_sequence_number(sequence_number);
 	}
 
 	bool peer_session::clear()
@@ -197,6 +335,7 @@ namespace fscp
 
 		m_current_session.reset();
 		m_next_session.reset();
+		m_path_mtu_discovery.reset();
 
 		return result;
 	}
@@ -52,14 +52,22 @@
 #include "session_request_message.hpp"
 #include "session_message.hpp"
 #include "data_message.hpp"
+#include "uring_receiver.hpp"
 
 #include <boost/random.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/ref.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/iterator/transform_iterator.hpp>
+#include <boost/functional/hash.hpp>
 
+#include <algorithm>
 #include <cassert>
+#include <exception>
+
+#ifdef LINUX
+#include <sys/socket.h>
+#endif
 
 namespace fscp
 {
@@ -90,6 +98,41 @@ namespace fscp
 			return result;
 		}
 
+#ifdef LINUX
+		void enable_reuse_port(server::socket_type& socket)
+		{
+			const int enable = 1;
+
+			if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0)
+			{
+				throw boost::system::system_error(errno, boost::system::system_category());
+			}
+		}
+
+		boost::system::error_code set_dont_fragment(server::socket_type& socket, bool is_v6)
+		{
+			// The local host must not fragment the datagrams either, whatever the path MTU it learnt: otherwise the probes would be delivered anyway.
+			const int value = IP_PMTUDISC_PROBE;
+
+			if (::setsockopt(socket.native_handle(), IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value)) != 0)
+			{
+				return boost::system::error_code(errno, boost::system::system_category());
+			}
+
+			if (is_v6)
+			{
+				const int value_v6 = IPV6_PMTUDISC_PROBE;
+
+				if (::setsockopt(socket.native_handle(), IPPROTO_IPV6, IPV6_MTU_DISCOVER, &value_v6, sizeof(value_v6)) != 0)
+				{
+					return boost::system::error_code(errno, boost::system::system_category());
+				}
+			}
+
+			return boost::system::error_code();
+		}
+#endif
+
 		template <typename Handler, typename CausalHandler>
 		class causal_handler
 		{
@@ -201,6 +244,26 @@ namespace fscp
 				map_type m_results;
 		};
 
+		size_t hash_endpoint(const server::ep_type& ep)
+		{
+			size_t seed = 0;
+
+			if (ep.address().is_v4())
+			{
+				boost::hash_combine(seed, ep.address().to_v4().to_ulong());
+			}
+			else
+			{
+				const boost::asio::ip::address_v6::bytes_type bytes = ep.address().to_v6().to_bytes();
+
+				boost::hash_range(seed, bytes.begin(), bytes.end());
+			}
+
+			boost::hash_combine(seed, ep.port());
+
+			return seed;
+		}
+
 		bool compare_certificates(const server::cert_type& lhs, const server::cert_type& rhs)
 		{
 			if (!!lhs && !!rhs)
@@ -219,10 +282,16 @@ namespace fscp
 	server::server(boost::asio::io_service& io_service, fscp::logger& _logger, const identity_store& identity) :
 		m_logger(_logger),
 		m_identity_store(identity),
-		m_socket(io_service),
-		m_socket_strand(io_service),
-		m_write_queue_strand(io_service),
+		m_listeners(1, boost::make_shared<listener_type>(boost::ref(io_service), identity)),
+		m_listen_sockets_count(0),
+		m_socket(m_listeners.front()->socket),
+		m_socket_strand(m_listeners.front()->strand),
+		m_io_batch_size(0),
+		m_io_uring_enabled(false),
 		m_greet_strand(io_service),
+		m_hello_wheel(TIMING_WHEEL_TICK_DURATION),
+		m_hello_timer(io_service),
+		m_hello_timer_armed(false),
 		m_accept_hello_messages_default(true),
 		m_hello_message_received_handler(),
 		m_presentation_strand(io_service),
@@ -239,10 +308,23 @@ namespace fscp
 		m_session_established_handler(),
 		m_session_lost_handler(),
 		m_contact_strand(io_service),
+		m_cipher_strands(),
+		m_session_index(),
 		m_data_received_handler(),
 		m_contact_request_message_received_handler(),
 		m_contact_message_received_handler(),
-		m_keep_alive_timer(io_service, SESSION_KEEP_ALIVE_PERIOD)
+		m_keep_alive_wheel(TIMING_WHEEL_TICK_DURATION),
+		m_keep_alive_timer(io_service),
+		m_keep_alive_timer_armed(false),
+		m_session_strand_latencies(),
+		m_path_mtu_discovery_enabled(false),
+		m_path_mtu_timer(io_service),
+		m_path_mtu_changed_handler(),
+		m_probe_listener(boost::make_shared<listener_type>(boost::ref(io_service), identity)),
+		m_probe_target(),
+		m_ecdhe_key_pool(boost::bind(&server::async_generate_keys, this, _1)),
+		m_handshake_latencies(),
+		m_handshake_workers()
 	{
 		// These calls are needed in C++03 to ensure that static initializations are done in a single thread.
 		server_category();
@@ -270,21 +352,167 @@ namespace fscp
 		return promise.get_future().wait();
 	}
 
+	void server::set_cipher_strands_count(size_t count)
+	{
+		m_cipher_strands.clear();
+		m_session_index.clear();
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_cipher_strands.push_back(boost::make_shared<boost::asio::strand>(boost::ref(get_io_service())));
+			m_session_index.push_back(boost::make_shared<session_index_shard>());
+		}
+	}
+
+	void server::set_handshake_threads_count(size_t count, size_t queue_size)
+	{
+		m_handshake_workers.reset();
+
+		if (count > 0)
+		{
+			m_handshake_workers.reset(new crypto_worker_pool(count, queue_size));
+		}
+	}
+
+	void server::set_io_batch_size(size_t size)
+	{
+		m_io_batch_size = std::min(size, MAX_IO_BATCH_SIZE);
+	}
+
+	void server::set_listen_sockets_count(size_t count)
+	{
+		m_listen_sockets_count = count;
+	}
+
 	void server::open(const ep_type& listen_endpoint)
 	{
-		m_socket.open(listen_endpoint.protocol());
+		// Listeners from a previous opening may still be referenced by their aborted handlers: those keep them alive.
+		m_listeners.resize(1);
+
+		if (is_reuse_port_enabled())
+		{
+			while (m_listeners.size() < m_listen_sockets_count)
+			{
+				m_listeners.push_back(boost::make_shared<listener_type>(boost::ref(get_io_service()), get_identity()));
+			}
+		}
+
+#ifdef LINUX
+		bool dont_fragment = m_path_mtu_discovery_enabled;
+#else
+		bool dont_fragment = false;
+#endif
+
+		for (auto&& listener : m_listeners)
+		{
+			listener->socket.open(listen_endpoint.protocol());
+
+			if (listen_endpoint.address().is_v6())
+			{
+				// We accept both IPv4 and IPv6 addresses
+				listener->socket.set_option(boost::asio::ip::v6_only(false));
+			}
+
+#ifdef LINUX
+			// The probe socket is bound to the listen endpoint as well.
+			if (is_reuse_port_enabled() || dont_fragment)
+			{
+				enable_reuse_port(listener->socket);
+			}
+#endif
+
+			listener->socket.bind(listen_endpoint);
+
+			listener->batch_buffers.clear();
+
+			if (is_io_batching_enabled())
+			{
+				for (size_t i = 0; i < m_io_batch_size; ++i)
+				{
+					listener->batch_buffers.push_back(SharedBuffer(65536));
+				}
+			}
+
+			listener->uring.reset();
+
+#ifdef LINUX
+			if (m_io_uring_enabled)
+			{
+				try
+				{
+					listener->uring = boost::make_shared<uring_receiver>(boost::ref(get_io_service()), listener->socket.native_handle(), uring_receiver::DEFAULT_BUFFERS_COUNT, 65536);
+				}
+				catch (const boost::system::system_error& ex)
+				{
+					m_logger(log_level::warning) << "Unable to set up io_uring receives (" << ex.what() << "). Falling back to regular receives.";
+				}
+			}
+#endif
+		}
+
+		m_probe_target = ep_type();
+
+#ifdef LINUX
+		if (dont_fragment)
+		{
+			// Only the probes are sent with the Don't Fragment flag: they get a socket of their own so that the flag never applies to the other datagrams.
+			socket_type& probe_socket = m_probe_listener->socket;
+			const ep_type local_endpoint = m_socket.local_endpoint();
+
+			try
+			{
+				probe_socket.open(local_endpoint.protocol());
+
+				if (local_endpoint.address().is_v6())
+				{
+					probe_socket.set_option(boost::asio::ip::v6_only(false));
+				}
 
-		if (listen_endpoint.address().is_v6())
+				enable_reuse_port(probe_socket);
+
+				const boost::system::error_code ec = set_dont_fragment(probe_socket, local_endpoint.address().is_v6());
+
+				if (ec)
+				{
+					throw boost::system::system_error(ec);
+				}
+
+				probe_socket.bind(local_endpoint);
+			}
+			catch (const boost::system::system_error& ex)
+			{
+				m_logger(log_level::warning) << "Unable to open the path MTU probe socket (" << ex.what() << "). Path MTU discovery is disabled.";
+
+				boost::system::error_code close_ec;
+				probe_socket.close(close_ec);
+
+				dont_fragment = false;
+			}
+		}
+#endif
+
+		for (auto&& listener : m_listeners)
+		{
+			async_receive_from(listener);
+		}
+
+		if (m_probe_listener->socket.is_open())
 		{
-			// We accept both IPv4 and IPv6 addresses
-			m_socket.set_option(boost::asio::ip::v6_only(false));
+			// Until it gets connected, the probe socket receives its share of the incoming flows: those are handled like on any listen socket.
+			async_receive_from(m_probe_listener);
 		}
 
-		m_socket.bind(listen_endpoint);
+		// The sessions that survived a previous close() still have their keep-alives scheduled.
+		m_session_strand.post(boost::bind(&server::arm_keep_alive_timer, this));
 
-		async_receive_from();
+		// The key pairs of the first sessions are generated while the hosts are being contacted.
+		m_ecdhe_key_pool.fill(m_elliptic_curves);
 
-		m_keep_alive_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
+		if (dont_fragment)
+		{
+			m_path_mtu_timer.expires_from_now(PATH_MTU_PROBE_PERIOD);
+			m_path_mtu_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_path_mtu, this, boost::asio::placeholders::error)));
+		}
 	}
 
 	void server::close()
@@ -292,8 +520,18 @@ namespace fscp
 		cancel_all_greetings();
 
 		m_keep_alive_timer.cancel();
+		m_path_mtu_timer.cancel();
+
+		for (auto&& listener : m_listeners)
+		{
+			// The multishot receive request keeps the port bound until its ring is closed: this must happen before the socket is closed.
+			listener->uring.reset();
+			listener->receive_retry_timer.cancel();
+			listener->socket.close();
+		}
 
-		m_socket.close();
+		m_probe_listener->receive_retry_timer.cancel();
+		m_probe_listener->socket.close();
 	}
 
 	void server::async_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
@@ -486,6 +724,19 @@ namespace fscp
 		return promise.get_future().get();
 	}
 
+	server::statistics_type server::sync_get_statistics()
+	{
+		typedef statistics_type result_type;
+		typedef boost::promise<result_type> promise_type;
+		promise_type promise;
+
+		void (promise_type::*setter)(const result_type&) = &promise_type::set_value;
+
+		async_get_statistics(boost::bind(setter, &promise, _1));
+
+		return promise.get_future().get();
+	}
+
 	boost::system::error_code server::sync_request_session(const ep_type& target)
 	{
 		typedef boost::promise<boost::system::error_code> promise_type;
@@ -598,6 +849,16 @@ namespace fscp
 		return promise.get_future().wait();
 	}
 
+	void server::sync_set_path_mtu_changed_callback(path_mtu_changed_handler_type callback)
+	{
+		typedef boost::promise<void> promise_type;
+		promise_type promise;
+
+		async_set_path_mtu_changed_callback(callback, boost::bind(&promise_type::set_value, &promise));
+
+		return promise.get_future().wait();
+	}
+
 	void server::async_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
 	{
 		m_session_strand.post(boost::bind(&server::do_send_data, this, normalize(target), channel_number, data, handler));
@@ -798,6 +1059,13 @@ namespace fscp
 		// do_set_identity() is executed within the socket strand so this is safe.
 		set_identity(identity);
 
+		for (auto&& listener : m_listeners)
+		{
+			listener->strand.post(boost::bind(&server::do_set_listener_identity, this, listener, identity));
+		}
+
+		m_probe_listener->strand.post(boost::bind(&server::do_set_listener_identity, this, m_probe_listener, identity));
+
 		async_reintroduce_to_all(&null_multiple_endpoints_handler);
 
 		if (handler)
@@ -806,155 +1074,65 @@ namespace fscp
 		}
 	}
 
-	void server::do_async_receive_from()
+	void server::do_set_listener_identity(listener_ptr_type listener, const identity_store& identity)
 	{
-		// do_async_receive_from() is executed within the socket strand so this is safe.
-		boost::shared_ptr<ep_type> sender = boost::make_shared<ep_type>();
+		// do_set_listener_identity() is executed within the listener strand so this is safe.
+		listener->identity = identity;
+	}
 
-		// Get either a new buffer or an old, recycled one if possible.
-		const SharedBuffer receive_buffer = m_socket_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_socket_buffers.front();
-			m_socket_buffers.pop_front();
+	void server::do_async_receive_from(listener_ptr_type listener)
+	{
+		// do_async_receive_from() is executed within the listener strand so this is safe.
+		if (listener->uring)
+		{
+			do_async_receive_uring(listener);
 
-			return result;
-		}();
+			return;
+		}
+
+		// The probe listener has no batch buffers: it does not receive enough to need them.
+		if (is_io_batching_enabled() && !listener->batch_buffers.empty())
+		{
+			do_async_receive_batch(listener);
+
+			return;
+		}
+
+		boost::shared_ptr<ep_type> sender = boost::make_shared<ep_type>();
+
+		// The buffer comes from the pool and goes back to it once the last handler that references it is done.
+		const SharedBuffer receive_buffer(65536);
 
-		m_socket.async_receive_from(
+		listener->socket.async_receive_from(
 			buffer(receive_buffer),
 			*sender,
 			boost::bind(
 				&server::handle_receive_from,
 				this,
-				get_identity(),
+				listener,
+				listener->identity,
 				sender,
-				SharedBuffer(receive_buffer, [this](const SharedBuffer& buffer) {
-					m_socket_strand.post([this, buffer]() {
-						m_socket_buffers.push_back(buffer);
-					});
-				}),
+				receive_buffer,
 				boost::asio::placeholders::error,
 				boost::asio::placeholders::bytes_transferred
 			)
 		);
 	}
 
-	void server::handle_receive_from(const identity_store& identity, boost::shared_ptr<ep_type> sender, SharedBuffer data, const boost::system::error_code& ec, size_t bytes_received)
+	void server::handle_receive_from(listener_ptr_type listener, const identity_store& identity, boost::shared_ptr<ep_type> sender, SharedBuffer data, const boost::system::error_code& ec, size_t bytes_received)
 	{
 		assert(sender);
 
 		if (ec != boost::asio::error::operation_aborted)
 		{
 			// Let's read again !
-			async_receive_from();
+			async_receive_from(listener);
 
 			*sender = normalize(*sender);
 
 			if (!ec)
 			{
-				try
-				{
-					message message(buffer_cast<const uint8_t*>(data), bytes_received);
-
-					switch (message.type())
-					{
-						case MESSAGE_TYPE_DATA_0:
-						case MESSAGE_TYPE_DATA_1:
-						case MESSAGE_TYPE_DATA_2:
-						case MESSAGE_TYPE_DATA_3:
-						case MESSAGE_TYPE_DATA_4:
-						case MESSAGE_TYPE_DATA_5:
-						case MESSAGE_TYPE_DATA_6:
-						case MESSAGE_TYPE_DATA_7:
-						case MESSAGE_TYPE_DATA_8:
-						case MESSAGE_TYPE_DATA_9:
-						case MESSAGE_TYPE_DATA_10:
-						case MESSAGE_TYPE_DATA_11:
-						case MESSAGE_TYPE_DATA_12:
-						case MESSAGE_TYPE_DATA_13:
-						case MESSAGE_TYPE_DATA_14:
-						case MESSAGE_TYPE_DATA_15:
-						case MESSAGE_TYPE_CONTACT_REQUEST:
-						case MESSAGE_TYPE_CONTACT:
-						case MESSAGE_TYPE_KEEP_ALIVE:
-						{
-							data_message data_message(message);
-
-							m_session_strand.post(
-								make_shared_buffer_handler(
-									data,
-									boost::bind(
-										&server::do_handle_data,
-										this,
-										identity,
-										*sender,
-										data_message
-									)
-								)
-							);
-
-							break;
-						}
-						case MESSAGE_TYPE_HELLO_REQUEST:
-						case MESSAGE_TYPE_HELLO_RESPONSE:
-						{
-							hello_message hello_message(message);
-
-							handle_hello_message_from(hello_message, *sender);
-
-							break;
-						}
-						case MESSAGE_TYPE_PRESENTATION:
-						{
-							presentation_message presentation_message(message);
-
-							handle_presentation_message_from(identity, presentation_message, *sender);
-
-							break;
-						}
-						case MESSAGE_TYPE_SESSION_REQUEST:
-						{
-							session_request_message session_request_message(message);
-
-							m_presentation_strand.post(
-								boost::bind(
-									&server::do_handle_session_request,
-									this,
-									data,
-									identity,
-									*sender,
-									session_request_message
-								)
-							);
-
-							break;
-						}
-						case MESSAGE_TYPE_SESSION:
-						{
-							session_message session_message(message);
-
-							m_presentation_strand.post(
-								boost::bind(
-									&server::do_handle_session,
-									this,
-									data,
-									identity,
-									*sender,
-									session_message
-								)
-							);
-
-							break;
-						}
-						default:
-						{
-							break;
-						}
-					}
-				}
-				catch (std::runtime_error&)
-				{
-					// These errors can happen in normal situations (for instance when a crypto operation fails due to invalid input).
-				}
+				handle_message_from(identity, *sender, data, bytes_received, nullptr);
 			}
 			else if (ec == boost::asio::error::connection_refused)
 			{
@@ -964,605 +1142,1036 @@ namespace fscp
 		}
 	}
 
-	void server::push_write(void_handler_type handler)
+	void server::handle_message_from(const identity_store& identity, const ep_type& sender, SharedBuffer data, size_t bytes_received, std::vector<void_handler_type>* data_batch)
 	{
-		// All push_write() calls are done in the same strand so the following is thread-safe.
-		if (m_write_queue.empty())
+		try
 		{
-			// Nothing is being written, lets start the write immediately.
-			m_socket_strand.post(make_causal_handler(handler, m_write_queue_strand.wrap(boost::bind(&server::pop_write, this))));
-		}
+			message message(buffer_cast<const uint8_t*>(data), bytes_received);
 
-		m_write_queue.push(handler);
-	}
+			switch (message.type())
+			{
+				case MESSAGE_TYPE_DATA_0:
+				case MESSAGE_TYPE_DATA_1:
+				case MESSAGE_TYPE_DATA_2:
+				case MESSAGE_TYPE_DATA_3:
+				case MESSAGE_TYPE_DATA_4:
+				case MESSAGE_TYPE_DATA_5:
+				case MESSAGE_TYPE_DATA_6:
+				case MESSAGE_TYPE_DATA_7:
+				case MESSAGE_TYPE_DATA_8:
+				case MESSAGE_TYPE_DATA_9:
+				case MESSAGE_TYPE_DATA_10:
+				case MESSAGE_TYPE_DATA_11:
+				case MESSAGE_TYPE_DATA_12:
+				case MESSAGE_TYPE_DATA_13:
+				case MESSAGE_TYPE_DATA_14:
+				case MESSAGE_TYPE_DATA_15:
+				case MESSAGE_TYPE_PATH_MTU:
+				case MESSAGE_TYPE_CONTACT_REQUEST:
+				case MESSAGE_TYPE_CONTACT:
+				case MESSAGE_TYPE_KEEP_ALIVE:
+				{
+					data_message data_message(message);
 
-	void server::pop_write()
-	{
-		// All pop_write() calls are done in the same strand so the following is thread-safe.
-		m_write_queue.pop();
+					if (!m_cipher_strands.empty())
+					{
+						// The message is handled within the cipher strand of its sender, without going through the session strand.
+						m_cipher_strands[get_cipher_strand_index(sender)]->post(boost::bind(&server::do_handle_host_data, this, data, identity, sender, data_message));
 
-		if (!m_write_queue.empty())
-		{
-			m_socket_strand.post(make_causal_handler(m_write_queue.front(), m_write_queue_strand.wrap(boost::bind(&server::pop_write, this))));
-		}
-	}
+						break;
+					}
 
-	server::ep_type server::to_socket_format(const server::ep_type& ep)
-	{
-#ifdef WINDOWS
-		if (m_socket.local_endpoint().address().is_v6() && ep.address().is_v4())
-		{
-			return server::ep_type(boost::asio::ip::address_v6::v4_mapped(ep.address().to_v4()), ep.port());
-		}
-		else
-		{
-			return ep;
-		}
-#else
-		static_cast<void>(ep);
+					const void_handler_type handler = boost::bind(
+						&server::do_handle_data,
+						this,
+						data,
+						identity,
+						sender,
+						data_message
+					);
 
-		return ep;
-#endif
-	}
+					if (data_batch)
+					{
+						// The whole batch will be posted at once into the session strand.
+						data_batch->push_back(handler);
+					}
+					else
+					{
+						m_session_strand.post(handler);
+					}
 
-	uint32_t server::ep_hello_context_type::generate_unique_number()
-	{
-		// The first call to this function is *NOT* thread-safe in C++03 !
-		static boost::mt19937 rng(static_cast<uint32_t>(time(0)));
+					break;
+				}
+				case MESSAGE_TYPE_HELLO_REQUEST:
+				case MESSAGE_TYPE_HELLO_RESPONSE:
+				{
+					hello_message hello_message(message);
 
-		return rng();
-	}
+					handle_hello_message_from(hello_message, sender);
 
-	server::ep_hello_context_type::ep_hello_context_type() :
-		m_current_hello_unique_number(generate_unique_number())
-	{
-	}
+					break;
+				}
+				case MESSAGE_TYPE_PRESENTATION:
+				{
+					presentation_message presentation_message(message);
 
-	uint32_t server::ep_hello_context_type::next_hello_unique_number()
-	{
-		return m_current_hello_unique_number++;
-	}
+					handle_presentation_message_from(identity, presentation_message, sender);
 
-	template <typename WaitHandler>
-	void server::ep_hello_context_type::async_wait_reply(boost::asio::io_service& io_service, uint32_t hello_unique_number, const boost::posix_time::time_duration& timeout, WaitHandler handler)
-	{
-		const boost::shared_ptr<boost::asio::deadline_timer> timer = boost::make_shared<boost::asio::deadline_timer>(boost::ref(io_service), timeout);
+					break;
+				}
+				case MESSAGE_TYPE_SESSION_REQUEST:
+				{
+					session_request_message session_request_message(message);
+
+					m_presentation_strand.post(
+						boost::bind(
+							&server::do_handle_session_request,
+							this,
+							data,
+							identity,
+							sender,
+							session_request_message
+						)
+					);
 
-		m_pending_requests[hello_unique_number] = pending_request_status(timer);
+					break;
+				}
+				case MESSAGE_TYPE_SESSION:
+				{
+					session_message session_message(message);
+
+					m_presentation_strand.post(
+						boost::bind(
+							&server::do_handle_session,
+							this,
+							data,
+							identity,
+							sender,
+							session_message
+						)
+					);
 
-		timer->async_wait(handler);
+					break;
+				}
+				default:
+				{
+					break;
+				}
+			}
+		}
+		catch (std::runtime_error&)
+		{
+			// These errors can happen in normal situations (for instance when a crypto operation fails due to invalid input).
+		}
 	}
 
-	bool server::ep_hello_context_type::cancel_reply_wait(uint32_t hello_unique_number, bool success)
+	void server::async_send_to(const SharedBuffer& data, const size_t size, const ep_type& target, simple_handler_type handler)
 	{
-		pending_requests_map::iterator request = m_pending_requests.find(hello_unique_number);
+		const listener_ptr_type listener = m_listeners[hash_endpoint(target) % m_listeners.size()];
 
-		if (request != m_pending_requests.end())
+		if (is_io_batching_enabled())
 		{
-			if (request->second.timer->cancel() > 0)
-			{
-				// At least one handler was cancelled which means we can set the success flag.
-				request->second.success = success;
+			listener->write_queue_strand.post(boost::bind(&server::push_write_batch, this, listener, pending_write_type(data, size, target, handler)));
 
-				return true;
-			}
+			return;
 		}
 
-		return false;
+		const void_handler_type write_handler = [listener, data, size, target, handler] () {
+			listener->socket.async_send_to(buffer(data, size), target, 0, [data, handler] (const boost::system::error_code& ec, size_t) {
+				handler(ec);
+			});
+		};
+
+		listener->write_queue_strand.post(boost::bind(&server::push_write, this, listener, write_handler));
 	}
 
-	void server::ep_hello_context_type::cancel_all_reply_wait()
+	void server::push_write(listener_ptr_type listener, void_handler_type handler)
 	{
-		for (pending_requests_map::iterator request = m_pending_requests.begin(); request != m_pending_requests.end(); ++request)
+		// All push_write() calls are done in the write queue strand of the listener so the following is thread-safe.
+		if (listener->write_queue.empty())
 		{
-			if (request->second.timer->cancel() > 0)
-			{
-				// At least one handler was cancelled which means we can set the success flag.
-				request->second.success = false;
-			}
+			// Nothing is being written, lets start the write immediately.
+			listener->strand.post(make_causal_handler(handler, listener->write_queue_strand.wrap(boost::bind(&server::pop_write, this, listener))));
 		}
+
+		listener->write_queue.push(handler);
 	}
 
-	bool server::ep_hello_context_type::remove_reply_wait(uint32_t hello_unique_number, boost::posix_time::time_duration& duration)
+	void server::pop_write(listener_ptr_type listener)
 	{
-		pending_requests_map::iterator request = m_pending_requests.find(hello_unique_number);
-
-		assert(request != m_pending_requests.end());
+		// All pop_write() calls are done in the write queue strand of the listener so the following is thread-safe.
+		listener->write_queue.pop();
 
-		const bool result = request->second.success;
-
-		duration = boost::posix_time::microsec_clock::universal_time() - request->second.start_date;
-
-		m_pending_requests.erase(request);
+		if (!listener->write_queue.empty())
+		{
+			listener->strand.post(make_causal_handler(listener->write_queue.front(), listener->write_queue_strand.wrap(boost::bind(&server::pop_write, this, listener))));
+		}
+	}
 
-		return result;
+	void server::do_async_receive_batch(listener_ptr_type listener)
+	{
+		// do_async_receive_batch() is executed within the listener strand so this is safe.
+		listener->socket.async_receive(
+			boost::asio::null_buffers(),
+			listener->strand.wrap(
+				boost::bind(
+					&server::handle_receive_batch,
+					this,
+					listener,
+					listener->identity,
+					boost::asio::placeholders::error
+				)
+			)
+		);
 	}
 
-	void server::do_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
+	void server::handle_receive_batch(listener_ptr_type listener, const identity_store& identity, const boost::system::error_code& ec)
 	{
-		if (!m_socket.is_open())
+		// handle_receive_batch() is executed within the listener strand so this is safe.
+		if (ec == boost::asio::error::operation_aborted)
 		{
-			handler(server_error::server_offline, boost::posix_time::time_duration());
-
 			return;
 		}
 
-		// All do_greet() calls are done in the same strand so the following is thread-safe.
-		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
+#ifdef LINUX
+		if (!ec)
+		{
+			std::vector<SharedBuffer>& batch_buffers = listener->batch_buffers;
+			const size_t batch_size = batch_buffers.size();
 
-		const uint32_t hello_unique_number = ep_hello_context.next_hello_unique_number();
-		const auto send_buffer = SharedBuffer(16);
-		const size_t size = hello_message::write_request(buffer_cast<uint8_t*>(send_buffer), buffer_size(send_buffer), hello_unique_number);
+			ep_type senders[MAX_IO_BATCH_SIZE];
+			::iovec iovecs[MAX_IO_BATCH_SIZE];
+			::mmsghdr headers[MAX_IO_BATCH_SIZE] = {};
 
-		async_send_to(
-			send_buffer,
-			size,
-			target,
-			m_greet_strand.wrap([this, target, hello_unique_number, handler, timeout](const boost::system::error_code& ec) {
-				do_greet_handler(target, hello_unique_number, handler, timeout, ec);
-			})
-		);
-	}
+			for (size_t i = 0; i < batch_size; ++i)
+			{
+				iovecs[i].iov_base = buffer_cast<uint8_t*>(batch_buffers[i]);
+				iovecs[i].iov_len = buffer_size(batch_buffers[i]);
+				headers[i].msg_hdr.msg_name = senders[i].data();
+				headers[i].msg_hdr.msg_namelen = static_cast<socklen_t>(senders[i].capacity());
+				headers[i].msg_hdr.msg_iov = &iovecs[i];
+				headers[i].msg_hdr.msg_iovlen = 1;
+			}
 
-	void server::do_greet_handler(const ep_type& target, uint32_t hello_unique_number, duration_handler_type handler, const boost::posix_time::time_duration& timeout, const boost::system::error_code& ec)
-	{
-		if (ec)
-		{
-			handler(ec, boost::posix_time::time_duration());
+			const int count = ::recvmmsg(listener->socket.native_handle(), headers, static_cast<unsigned int>(batch_size), MSG_DONTWAIT, NULL);
 
-			return;
-		}
+			if (count > 0)
+			{
+				listener->receive_error = boost::system::error_code();
 
-		// All do_greet() calls are done in the same strand so the following is thread-safe.
-		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
+				const boost::shared_ptr<std::vector<void_handler_type> > data_batch = boost::make_shared<std::vector<void_handler_type> >();
+				data_batch->reserve(count);
 
-		ep_hello_context.async_wait_reply(get_io_service(), hello_unique_number, timeout, m_greet_strand.wrap(boost::bind(&server::do_greet_timeout, this, target, hello_unique_number, handler, _1)));
-	}
+				for (size_t i = 0; i < static_cast<size_t>(count); ++i)
+				{
+					senders[i].resize(headers[i].msg_hdr.msg_namelen);
 
-	void server::do_greet_timeout(const ep_type& target, uint32_t hello_unique_number, duration_handler_type handler, const boost::system::error_code& ec)
-	{
-		// All do_greet_timeout() calls are done in the same strand so the following is thread-safe.
-		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
+					const SharedBuffer data = batch_buffers[i];
 
-		boost::posix_time::time_duration duration;
+					// The buffer was handed over: we replace it with another one from the pool.
+					batch_buffers[i] = SharedBuffer(65536);
 
-		const bool success = ep_hello_context.remove_reply_wait(hello_unique_number, duration);
+					handle_message_from(identity, normalize(senders[i]), data, headers[i].msg_len, data_batch.get());
+				}
 
-		if (ec == boost::asio::error::operation_aborted)
-		{
-			// The timer was aborted, which means we received a reply or the server was shut down.
-			if (success)
+				if (!data_batch->empty())
+				{
+					m_session_strand.post(boost::bind(&server::do_handle_data_batch, this, data_batch));
+				}
+			}
+			else if ((count < 0) && (errno == ECONNREFUSED))
+			{
+				// A host refused one of our datagrams. Linux does not report which one, so there is no session to close: the unbatched receives do not get a sender for this error either.
+			}
+			else if ((count < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
 			{
-				// The success flag is set: the timer was cancelled due to a reply.
-				handler(server_error::success, duration);
+				const boost::system::error_code receive_ec(errno, boost::system::system_category());
+
+				if (receive_ec != listener->receive_error)
+				{
+					m_logger(log_level::warning) << "Batched receive failed: " << receive_ec.message();
+
+					listener->receive_error = receive_ec;
+				}
+
+				// The error is likely to persist: we give it some time instead of spinning.
+				listener->receive_retry_timer.expires_from_now(RECEIVE_ERROR_RETRY_DELAY);
+				listener->receive_retry_timer.async_wait(listener->strand.wrap(boost::bind(&server::handle_receive_retry_timer, this, listener, boost::asio::placeholders::error)));
 
 				return;
 			}
 		}
-		else if (!ec)
-		{
-			// The timer timed out: replacing the error code.
-			handler(server_error::hello_request_timed_out, duration);
-
-			return;
-		}
+#else
+		static_cast<void>(identity);
+#endif
 
-		handler(ec, duration);
+		// Let's read again !
+		do_async_receive_batch(listener);
 	}
 
-	void server::do_cancel_all_greetings()
+	void server::handle_receive_retry_timer(listener_ptr_type listener, const boost::system::error_code& ec)
 	{
-		// All do_cancel_all_greetings() calls are done in the same strand so the following is thread-safe.
-		for (ep_hello_context_map::iterator hello_context = m_ep_hello_contexts.begin(); hello_context != m_ep_hello_contexts.end(); ++hello_context)
+		// handle_receive_retry_timer() is executed within the listener strand so this is safe.
+		if ((ec != boost::asio::error::operation_aborted) && listener->socket.is_open())
 		{
-			hello_context->second.cancel_all_reply_wait();
+			do_async_receive_from(listener);
 		}
 	}
 
-	void server::handle_hello_message_from(const hello_message& _hello_message, const ep_type& sender)
+	void server::do_async_receive_uring(listener_ptr_type listener)
 	{
-		switch (_hello_message.type())
+#ifdef LINUX
+		// do_async_receive_uring() is executed within the listener strand so this is safe.
+		listener->uring->async_wait(
+			listener->strand.wrap(
+				boost::bind(
+					&server::handle_receive_uring,
+					this,
+					listener,
+					listener->identity,
+					boost::asio::placeholders::error
+				)
+			)
+		);
+#else
+		static_cast<void>(listener);
+#endif
+	}
+
+	void server::handle_receive_uring(listener_ptr_type listener, const identity_store& identity, const boost::system::error_code& ec)
+	{
+		// handle_receive_uring() is executed within the listener strand so this is safe.
+		if ((ec == boost::asio::error::operation_aborted) || !listener->uring)
 		{
-			case MESSAGE_TYPE_HELLO_REQUEST:
+			return;
+		}
+
+		if (ec)
+		{
+			if (ec != listener->receive_error)
 			{
-				// We need to handle the response in the proper strand to avoid race conditions.
-				m_greet_strand.post(boost::bind(&server::do_handle_hello_request, this, sender, _hello_message.unique_number()));
+				m_logger(log_level::warning) << "io_uring wait failed: " << ec.message();
 
-				break;
+				listener->receive_error = ec;
 			}
-			case MESSAGE_TYPE_HELLO_RESPONSE:
-			{
-				// We need to handle the response in the proper strand to avoid race conditions.
-				m_greet_strand.post(boost::bind(&server::do_handle_hello_response, this, sender, _hello_message.unique_number()));
 
-				break;
+			// The error is likely to persist: we give it some time instead of spinning.
+			listener->receive_retry_timer.expires_from_now(RECEIVE_ERROR_RETRY_DELAY);
+			listener->receive_retry_timer.async_wait(listener->strand.wrap(boost::bind(&server::handle_receive_retry_timer, this, listener, boost::asio::placeholders::error)));
+
+			return;
+		}
+
+		listener->receive_error = boost::system::error_code();
+
+#ifdef LINUX
+		{
+			const boost::shared_ptr<std::vector<void_handler_type> > data_batch = boost::make_shared<std::vector<void_handler_type> >();
+
+			try
+			{
+				listener->uring->process(boost::bind(&server::handle_uring_datagram, this, boost::cref(identity), data_batch.get(), _1, _2, _3));
 			}
-			default:
+			catch (const boost::system::system_error& ex)
 			{
-				// This should never happen.
-				assert(false);
+				m_logger(log_level::warning) << "io_uring receive failed (" << ex.what() << "). Falling back to regular receives.";
 
-				break;
+				listener->uring.reset();
+			}
+
+			if (!data_batch->empty())
+			{
+				m_session_strand.post(boost::bind(&server::do_handle_data_batch, this, data_batch));
 			}
 		}
+#else
+		static_cast<void>(identity);
+#endif
+
+		// Let's read again !
+		do_async_receive_from(listener);
 	}
 
-	void server::do_handle_hello_request(const ep_type& sender, uint32_t hello_unique_number)
+	void server::handle_uring_datagram(const identity_store& identity, std::vector<void_handler_type>* data_batch, const ep_type& sender, SharedBuffer data, size_t bytes_received)
 	{
-		// All do_handle_hello_request() calls are done in the same strand so the following is thread-safe.
-		bool can_reply = m_accept_hello_messages_default;
+		handle_message_from(identity, normalize(sender), data, bytes_received, data_batch);
+	}
 
-		if (m_hello_message_received_handler)
-		{
-			can_reply = m_hello_message_received_handler(sender, can_reply);
-		}
+	void server::push_write_batch(listener_ptr_type listener, const pending_write_type& pending_write)
+	{
+		// All push_write_batch() calls are done in the write queue strand of the listener so the following is thread-safe.
+		listener->pending_writes.push_back(pending_write);
 
-		if (can_reply)
+		if (!listener->write_batch_in_progress)
 		{
-			const auto send_buffer = SharedBuffer(16);
-			const size_t size = hello_message::write_response(buffer_cast<uint8_t*>(send_buffer), buffer_size(send_buffer), hello_unique_number);
+			listener->write_batch_in_progress = true;
 
-			async_send_to(
-				send_buffer,
-				size,
-				sender,
-				[](const boost::system::error_code&) {}
-			);
+			// Flushing is deferred so that the writes already queued in the strand end up in the same batch.
+			listener->write_queue_strand.post(boost::bind(&server::flush_write_batch, this, listener));
 		}
 	}
 
-	void server::do_handle_hello_response(const ep_type& sender, uint32_t hello_unique_number)
+	void server::flush_write_batch(listener_ptr_type listener)
 	{
-		// All do_handle_hello_response() calls are done in the same strand so the following is thread-safe.
-		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[sender];
+		// All flush_write_batch() calls are done in the write queue strand of the listener so the following is thread-safe.
+		const boost::shared_ptr<write_batch_type> batch = boost::make_shared<write_batch_type>();
+		batch->swap(listener->pending_writes);
 
-		ep_hello_context.cancel_reply_wait(hello_unique_number, true);
+		listener->strand.post(boost::bind(&server::do_send_batch, this, listener, batch, 0));
 	}
 
-	void server::do_set_accept_hello_messages_default(bool value, void_handler_type handler)
+	void server::pop_write_batch(listener_ptr_type listener)
 	{
-		// All do_set_accept_hello_messages_default() calls are done in the same strand so the following is thread-safe.
-		set_accept_hello_messages_default(value);
-
-		if (handler)
+		// All pop_write_batch() calls are done in the write queue strand of the listener so the following is thread-safe.
+		if (listener->pending_writes.empty())
 		{
-			handler();
+			listener->write_batch_in_progress = false;
+		}
+		else
+		{
+			flush_write_batch(listener);
 		}
 	}
 
-	void server::do_set_hello_message_received_callback(hello_message_received_handler_type callback, void_handler_type handler)
+	void server::do_send_batch(listener_ptr_type listener, boost::shared_ptr<write_batch_type> batch, size_t offset)
 	{
-		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_hello_message_received_callback(callback);
-
-		if (handler)
+		// do_send_batch() is executed within the listener strand so this is safe.
+#ifdef LINUX
+		while (offset < batch->size())
 		{
-			handler();
+			const size_t batch_size = std::min(batch->size() - offset, m_io_batch_size);
+
+			::iovec iovecs[MAX_IO_BATCH_SIZE];
+			::mmsghdr headers[MAX_IO_BATCH_SIZE] = {};
+
+			for (size_t i = 0; i < batch_size; ++i)
+			{
+				const pending_write_type& pending_write = (*batch)[offset + i];
+
+				iovecs[i].iov_base = buffer_cast<uint8_t*>(pending_write.data);
+				iovecs[i].iov_len = pending_write.size;
+				headers[i].msg_hdr.msg_name = const_cast<ep_type::data_type*>(pending_write.target.data());
+				headers[i].msg_hdr.msg_namelen = static_cast<socklen_t>(pending_write.target.size());
+				headers[i].msg_hdr.msg_iov = &iovecs[i];
+				headers[i].msg_hdr.msg_iovlen = 1;
+			}
+
+			const int count = ::sendmmsg(listener->socket.native_handle(), headers, static_cast<unsigned int>(batch_size), MSG_DONTWAIT);
+
+			if (count < 0)
+			{
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				{
+					// The socket buffer is full: we wait until it is writable again.
+					listener->socket.async_send(
+						boost::asio::null_buffers(),
+						listener->strand.wrap(
+							boost::bind(
+								&server::handle_send_batch_ready,
+								this,
+								listener,
+								batch,
+								offset,
+								boost::asio::placeholders::error
+							)
+						)
+					);
+
+					return;
+				}
+
+				// The first datagram could not be sent: we report the error and go on with the next ones.
+				(*batch)[offset].handler(boost::system::error_code(errno, boost::system::system_category()));
+				++offset;
+			}
+			else
+			{
+				for (size_t i = 0; i < static_cast<size_t>(count); ++i)
+				{
+					(*batch)[offset + i].handler(boost::system::error_code());
+				}
+
+				offset += count;
+			}
 		}
+#else
+		static_cast<void>(offset);
+#endif
+
+		// The batch is complete: its buffers are released at once.
+		batch.reset();
+
+		listener->write_queue_strand.post(boost::bind(&server::pop_write_batch, this, listener));
 	}
 
-	bool server::has_presentation_store_for(const ep_type& ep) const
+	void server::handle_send_batch_ready(listener_ptr_type listener, boost::shared_ptr<write_batch_type> batch, size_t offset, const boost::system::error_code& ec)
 	{
-		// This method should only be called from within the presentation strand.
-		presentation_store_map::const_iterator presentation_store = m_presentation_store_map.find(ep);
-
-		if (presentation_store != m_presentation_store_map.end())
+		// handle_send_batch_ready() is executed within the listener strand so this is safe.
+		if (ec)
 		{
-			return !(presentation_store->second.empty());
+			for (size_t i = offset; i < batch->size(); ++i)
+			{
+				(*batch)[i].handler(ec);
+			}
+
+			listener->write_queue_strand.post(boost::bind(&server::pop_write_batch, this, listener));
+
+			return;
 		}
 
-		return false;
+		do_send_batch(listener, batch, offset);
 	}
 
-	void server::do_introduce_to(const ep_type& target, simple_handler_type handler)
+	void server::do_send_path_mtu_probe(const SharedBuffer& data, size_t size, const ep_type& target, simple_handler_type handler)
 	{
-		// All do_introduce_to() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		// do_send_path_mtu_probe() is executed within the probe listener strand so this is safe.
+		socket_type& probe_socket = m_probe_listener->socket;
+
+		if (!probe_socket.is_open())
 		{
 			handler(server_error::server_offline);
 
 			return;
 		}
 
-		const identity_store& identity = get_identity();
-		const auto send_buffer = SharedBuffer(4096);
+		boost::system::error_code ec;
 
-		try
+		// A connected socket no longer gets a share of the incoming flows: it only receives the datagrams of its host, which its receive loop handles.
+		if (target != m_probe_target)
 		{
-			const size_t size = presentation_message::write(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				identity.signature_certificate()
-			);
+			probe_socket.connect(target, ec);
 
-			async_send_to(
-				send_buffer,
-				size,
-				target,
-				handler
-			);
+			if (!ec)
+			{
+				m_probe_target = target;
+			}
 		}
-		catch (const boost::system::system_error& ex)
+
+		if (!ec)
 		{
-			handler(ex.code());
+			probe_socket.send(buffer(data, size), 0, ec);
 		}
+
+		handler(ec);
 	}
 
-	void server::do_reintroduce_to_all(multiple_endpoints_handler_type handler)
+	server::ep_type server::to_socket_format(const server::ep_type& ep)
 	{
-		// All do_reintroduce_to_all() calls are done in the same strand so the following is thread-safe.
-		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
-
-		results_gatherer_type::set_type targets;
-
-		for (presentation_store_map::const_iterator presentation_store = m_presentation_store_map.begin(); presentation_store != m_presentation_store_map.end(); ++presentation_store)
+#ifdef WINDOWS
+		if (m_socket.local_endpoint().address().is_v6() && ep.address().is_v4())
 		{
-			targets.insert(presentation_store->first);
+			return server::ep_type(boost::asio::ip::address_v6::v4_mapped(ep.address().to_v4()), ep.port());
 		}
-
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
-
-		for (presentation_store_map::const_iterator presentation_store = m_presentation_store_map.begin(); presentation_store != m_presentation_store_map.end(); ++presentation_store)
+		else
 		{
-			async_introduce_to(presentation_store->first, boost::bind(&results_gatherer_type::gather, rg, presentation_store->first, _1));
+			return ep;
 		}
-	}
+#else
+		static_cast<void>(ep);
 
-	void server::do_get_presentation(const ep_type& target, optional_presentation_store_handler_type handler)
-	{
-		// All do_get_presentation() calls are done in the same strand so the following is thread-safe.
-		handler(get_presentation(target));
+		return ep;
+#endif
 	}
 
-	void server::do_set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key, void_handler_type handler)
+	uint32_t server::ep_hello_context_type::generate_unique_number()
 	{
-		// All do_set_presentation() calls are done in the same strand so the following is thread-safe.
-		set_presentation(target, signature_certificate, pre_shared_key);
+		// The first call to this function is *NOT* thread-safe in C++03 !
+		static boost::mt19937 rng(static_cast<uint32_t>(time(0)));
 
-		if (handler)
-		{
-			handler();
-		}
+		return rng();
 	}
 
-	void server::do_clear_presentation(const ep_type& target, void_handler_type handler)
+	server::ep_hello_context_type::ep_hello_context_type() :
+		m_current_hello_unique_number(generate_unique_number())
 	{
-		// All do_set_presentation() calls are done in the same strand so the following is thread-safe.
-		clear_presentation(target);
+	}
 
-		if (handler)
-		{
-			handler();
-		}
+	uint32_t server::ep_hello_context_type::next_hello_unique_number()
+	{
+		return m_current_hello_unique_number++;
 	}
 
-	void server::handle_presentation_message_from(const identity_store& identity, const presentation_message& _presentation_message, const ep_type& sender)
+	timing_wheel_handle& server::ep_hello_context_type::add_reply_wait(uint32_t hello_unique_number, duration_handler_type handler)
 	{
-		const auto signature_certificate = _presentation_message.signature_certificate();
+		pending_request_status& request = m_pending_requests[hello_unique_number];
+		request = pending_request_status(handler);
 
-		async_has_session_with_endpoint(sender, [this, identity, sender, signature_certificate](bool has_session) {
-			m_presentation_strand.post(
-				boost::bind(
-					&server::do_handle_presentation,
-					this,
-					identity,
-					sender,
-					has_session,
-					signature_certificate
-				)
-			);
-		});
+		return request.timeout;
 	}
 
-	void server::do_handle_presentation(const identity_store& identity, const ep_type& sender, bool has_session, cert_type signature_certificate)
+	bool server::ep_hello_context_type::remove_reply_wait(uint32_t hello_unique_number, boost::posix_time::time_duration& duration, duration_handler_type& handler, timing_wheel_handle& timeout)
 	{
-		// All do_handle_presentation() calls are done in the same strand so the following is thread-safe.
-		presentation_status_type presentation_status = PS_FIRST;
-
-		const presentation_store_map::iterator entry = m_presentation_store_map.find(sender);
+		pending_requests_map::iterator request = m_pending_requests.find(hello_unique_number);
 
-		if (entry != m_presentation_store_map.end())
+		if (request == m_pending_requests.end())
 		{
-			if (compare_certificates(entry->second.signature_certificate(), signature_certificate))
-			{
-				presentation_status = PS_SAME;
-			}
-			else
-			{
-				presentation_status = PS_NEW;
-			}
+			return false;
 		}
 
-		if (m_presentation_message_received_handler)
-		{
-			if (!m_presentation_message_received_handler(sender, signature_certificate, presentation_status, has_session))
-			{
-				return;
-			}
-		}
+		duration = boost::posix_time::microsec_clock::universal_time() - request->second.start_date;
+		handler = request->second.handler;
+		timeout = request->second.timeout;
 
-		m_presentation_store_map[sender] = presentation_store(signature_certificate, identity.pre_shared_key());
+		m_pending_requests.erase(request);
+
+		return true;
 	}
 
-	void server::do_set_presentation_message_received_callback(presentation_message_received_handler_type callback, void_handler_type handler)
+	std::vector<uint32_t> server::ep_hello_context_type::pending_reply_waits() const
 	{
-		// All do_set_presentation_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_presentation_message_received_callback(callback);
+		std::vector<uint32_t> result;
+		result.reserve(m_pending_requests.size());
 
-		if (handler)
+		for (pending_requests_map::const_iterator request = m_pending_requests.begin(); request != m_pending_requests.end(); ++request)
 		{
-			handler();
+			result.push_back(request->first);
 		}
+
+		return result;
 	}
 
-	cipher_suite_type server::get_first_common_supported_cipher_suite(const cipher_suite_list_type& reference, const cipher_suite_list_type& capabilities, cipher_suite_type default_value = cipher_suite_type::unsupported)
+	void server::do_greet(const ep_type& target, duration_handler_type handler, const boost::posix_time::time_duration& timeout)
 	{
-		for (auto&& cs : reference)
+		if (!m_socket.is_open())
 		{
-			if (std::find(capabilities.begin(), capabilities.end(), cs) != capabilities.end())
-			{
-				return cs;
-			}
+			handler(server_error::server_offline, boost::posix_time::time_duration());
+
+			return;
 		}
 
-		return default_value;
-	}
+		// All do_greet() calls are done in the same strand so the following is thread-safe.
+		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
 
-	elliptic_curve_type server::get_first_common_supported_elliptic_curve(const elliptic_curve_list_type& reference, const elliptic_curve_list_type& capabilities, elliptic_curve_type default_value = elliptic_curve_type::unsupported)
+		const uint32_t hello_unique_number = ep_hello_context.next_hello_unique_number();
+		const auto send_buffer = SharedBuffer(16);
+		const size_t size = hello_message::write_request(buffer_cast<uint8_t*>(send_buffer), buffer_size(send_buffer), hello_unique_number);
+
+		async_send_to(
+			send_buffer,
+			size,
+			target,
+			m_greet_strand.wrap([this, target, hello_unique_number, handler, timeout](const boost::system::error_code& ec) {
+				do_greet_handler(target, hello_unique_number, handler, timeout, ec);
+			})
+		);
+	}
 
+	void server::do_greet_handler(const ep_type& target, uint32_t hello_unique_number, duration_handler_type handler, const boost::posix_time::time_duration& timeout, const boost::system::error_code& ec)
 	{
-		for (auto&& cs : reference)
+		if (ec)
 		{
-			if (std::find(capabilities.begin(), capabilities.end(), cs) != capabilities.end())
-			{
-				return cs;
-			}
+			handler(ec, boost::posix_time::time_duration());
+
+			return;
 		}
 
-		return default_value;
+		// All do_greet() calls are done in the same strand so the following is thread-safe.
+		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[target];
+
+		m_hello_wheel.schedule(ep_hello_context.add_reply_wait(hello_unique_number, handler), hello_request_type(target, hello_unique_number), boost::posix_time::microsec_clock::universal_time() + timeout);
+		arm_hello_timer();
 	}
 
-	void server::do_request_session(const identity_store& identity, const ep_type& target, simple_handler_type handler)
+	void server::do_complete_greeting(const hello_request_type& request, const boost::system::error_code& ec)
 	{
-		// All do_request_session() calls are done in the session strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		// All do_complete_greeting() calls are done in the same strand so the following is thread-safe.
+		ep_hello_context_type& ep_hello_context = m_ep_hello_contexts[request.first];
+
+		boost::posix_time::time_duration duration;
+		duration_handler_type handler;
+		timing_wheel_handle timeout;
+
+		if (ep_hello_context.remove_reply_wait(request.second, duration, handler, timeout))
 		{
-			handler(server_error::server_offline);
+			// The timeout is no longer pending if it is the reason of the completion.
+			m_hello_wheel.cancel(timeout);
 
-			return;
+			handler(ec, duration);
 		}
+	}
 
-		peer_session& p_session = m_peer_sessions[target];
+	void server::do_cancel_all_greetings()
+	{
+		// All do_cancel_all_greetings() calls are done in the same strand so the following is thread-safe.
+		std::vector<hello_request_type> requests;
 
-		if (p_session.has_current_session())
+		for (ep_hello_context_map::iterator hello_context = m_ep_hello_contexts.begin(); hello_context != m_ep_hello_contexts.end(); ++hello_context)
 		{
-			handler(server_error::session_already_exist);
+			const std::vector<uint32_t> hello_unique_numbers = hello_context->second.pending_reply_waits();
 
-			return;
+			for (std::vector<uint32_t>::const_iterator hello_unique_number = hello_unique_numbers.begin(); hello_unique_number != hello_unique_numbers.end(); ++hello_unique_number)
+			{
+				requests.push_back(hello_request_type(hello_context->first, *hello_unique_number));
+			}
 		}
 
-		const SharedBuffer send_buffer = m_session_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_session_buffers.front();
-			m_session_buffers.pop_front();
+		// The handlers are called once all the requests were gathered, as they may start new ones.
+		for (std::vector<hello_request_type>::const_iterator request = requests.begin(); request != requests.end(); ++request)
+		{
+			do_complete_greeting(*request, boost::asio::error::operation_aborted);
+		}
 
-			return result;
-		}();
+		if (m_hello_wheel.empty())
+		{
+			m_hello_timer.cancel();
+		}
+	}
 
-		try
+	void server::arm_hello_timer()
+	{
+		// All arm_hello_timer() calls are done in the greet strand so the following is thread-safe.
+		if (!m_hello_timer_armed && !m_hello_wheel.empty())
+		{
+			m_hello_timer_armed = true;
+			m_hello_timer.expires_from_now(m_hello_wheel.tick_duration());
+			m_hello_timer.async_wait(m_greet_strand.wrap(boost::bind(&server::do_check_hello_timeouts, this, boost::asio::placeholders::error)));
+		}
+	}
+
+	void server::do_check_hello_timeouts(const boost::system::error_code& ec)
+	{
+		// All do_check_hello_timeouts() calls are done in the same strand so the following is thread-safe.
+		m_hello_timer_armed = false;
+
+		if (ec != boost::asio::error::operation_aborted)
 		{
-			const auto next_session_number = p_session.next_session_number();
-			const auto local_host_identifier = p_session.local_host_identifier();
+			m_hello_wheel.advance(boost::posix_time::microsec_clock::universal_time(), [this](const hello_request_type& request) {
+				do_complete_greeting(request, server_error::hello_request_timed_out);
+			});
+		}
 
-			m_logger(log_level::trace) << "Sending session request message to " << target << " (next_session_number: " << next_session_number << ", local_host_identifier: " << local_host_identifier << ")";
-			size_t size = 0;
+		// Requests may have been started after a cancellation.
+		arm_hello_timer();
+	}
 
-			if (!!identity.signature_key())
+	void server::handle_hello_message_from(const hello_message& _hello_message, const ep_type& sender)
+	{
+		switch (_hello_message.type())
+		{
+			case MESSAGE_TYPE_HELLO_REQUEST:
 			{
-				size = session_request_message::write(
-					buffer_cast<uint8_t*>(send_buffer),
-					buffer_size(send_buffer),
-					next_session_number,
-					local_host_identifier,
-					m_cipher_suites,
-					m_elliptic_curves,
-					identity.signature_key()
-				);
+				// We need to handle the response in the proper strand to avoid race conditions.
+				m_greet_strand.post(boost::bind(&server::do_handle_hello_request, this, sender, _hello_message.unique_number()));
+
+				break;
 			}
-			else
+			case MESSAGE_TYPE_HELLO_RESPONSE:
 			{
-				size = session_request_message::write(
-					buffer_cast<uint8_t*>(send_buffer),
-					buffer_size(send_buffer),
-					next_session_number,
-					local_host_identifier,
-					m_cipher_suites,
-					m_elliptic_curves,
-					buffer_cast<const uint8_t*>(identity.pre_shared_key()),
-					buffer_size(identity.pre_shared_key())
-					);
+				// We need to handle the response in the proper strand to avoid race conditions.
+				m_greet_strand.post(boost::bind(&server::do_handle_hello_response, this, sender, _hello_message.unique_number()));
+
+				break;
 			}
+			default:
+			{
+				// This should never happen.
+				assert(false);
 
-			async_send_to(
-				SharedBuffer(send_buffer, [this](const SharedBuffer& buffer) {
-					m_session_strand.post([this, buffer]() {
-						m_session_buffers.push_back(buffer);
-					});
-				}),
-				size,
-				target,
-				handler
-			);
-		}
-		catch (const boost::system::system_error& ex)
-		{
-			handler(ex.code());
+				break;
+			}
 		}
 	}
 
-	void server::do_close_session(const ep_type& target, simple_handler_type handler)
+	void server::do_handle_hello_request(const ep_type& sender, uint32_t hello_unique_number)
 	{
-		// All do_close_session() calls are done in the same strand so the following is thread-safe.
+		// All do_handle_hello_request() calls are done in the same strand so the following is thread-safe.
+		bool can_reply = m_accept_hello_messages_default;
 
-		if (m_peer_sessions[target].clear())
+		if (m_hello_message_received_handler)
 		{
-			handler(server_error::success);
-
-			if (m_session_lost_handler)
-			{
-				m_session_lost_handler(target, session_loss_reason::manual_termination);
-			}
+			can_reply = m_hello_message_received_handler(sender, can_reply);
 		}
-		else
+
+		if (can_reply)
 		{
-			handler(server_error::no_session_for_host);
+			const auto send_buffer = SharedBuffer(16);
+			const size_t size = hello_message::write_response(buffer_cast<uint8_t*>(send_buffer), buffer_size(send_buffer), hello_unique_number);
+
+			async_send_to(
+				send_buffer,
+				size,
+				sender,
+				[](const boost::system::error_code&) {}
+			);
 		}
 	}
 
-	void server::do_handle_session_request(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message)
+	void server::do_handle_hello_response(const ep_type& sender, uint32_t hello_unique_number)
 	{
-		// All do_handle_session_request() calls are done in the presentation strand so the following is thread-safe.
-		if (!has_presentation_store_for(sender))
-		{
-			// No presentation_store for the given host.
-			// We do nothing.
-			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but no presentation is available. Ignoring.";
+		// All do_handle_hello_response() calls are done in the same strand so the following is thread-safe.
+		do_complete_greeting(hello_request_type(sender, hello_unique_number), server_error::success);
+	}
 
-			return;
+	void server::do_set_accept_hello_messages_default(bool value, void_handler_type handler)
+	{
+		// All do_set_accept_hello_messages_default() calls are done in the same strand so the following is thread-safe.
+		set_accept_hello_messages_default(value);
+
+		if (handler)
+		{
+			handler();
 		}
+	}
 
-		// We make sure the signatures matches.
-		bool check_ok = false;
+	void server::do_set_hello_message_received_callback(hello_message_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_hello_message_received_callback(callback);
 
-		if (!!m_presentation_store_map[sender].signature_certificate())
+		if (handler)
 		{
-			check_ok = _session_request_message.check_signature(m_presentation_store_map[sender].signature_certificate().public_key());
+			handler();
 		}
-		else
+	}
+
+	bool server::has_presentation_store_for(const ep_type& ep) const
+	{
+		// This method should only be called from within the presentation strand.
+		presentation_store_map::const_iterator presentation_store = m_presentation_store_map.find(ep);
+
+		if (presentation_store != m_presentation_store_map.end())
 		{
-			const auto psk = m_presentation_store_map[sender].pre_shared_key();
-			check_ok = _session_request_message.check_signature(buffer_cast<const uint8_t*>(psk), buffer_size(psk));
+			return !(presentation_store->second.empty());
 		}
 
-		if (!check_ok)
+		return false;
+	}
+
+	void server::do_introduce_to(const ep_type& target, simple_handler_type handler)
+	{
+		// All do_introduce_to() calls are done in the same strand so the following is thread-safe.
+		if (!m_socket.is_open())
 		{
-			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with an invalid signature. Ignoring.";
+			handler(server_error::server_offline);
 
 			return;
 		}
 
-		// The make_shared_buffer_handler() call below is necessary so that the reference to session_request_message remains valid.
-		m_session_strand.post(
-			make_shared_buffer_handler(
-				data,
+		const identity_store& identity = get_identity();
+		const auto send_buffer = SharedBuffer(4096);
+
+		try
+		{
+			const size_t size = presentation_message::write(
+				buffer_cast<uint8_t*>(send_buffer),
+				buffer_size(send_buffer),
+				identity.signature_certificate()
+			);
+
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler
+			);
+		}
+		catch (const boost::system::system_error& ex)
+		{
+			handler(ex.code());
+		}
+	}
+
+	void server::do_reintroduce_to_all(multiple_endpoints_handler_type handler)
+	{
+		// All do_reintroduce_to_all() calls are done in the same strand so the following is thread-safe.
+		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+
+		results_gatherer_type::set_type targets;
+
+		for (presentation_store_map::const_iterator presentation_store = m_presentation_store_map.begin(); presentation_store != m_presentation_store_map.end(); ++presentation_store)
+		{
+			targets.insert(presentation_store->first);
+		}
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+
+		for (presentation_store_map::const_iterator presentation_store = m_presentation_store_map.begin(); presentation_store != m_presentation_store_map.end(); ++presentation_store)
+		{
+			async_introduce_to(presentation_store->first, boost::bind(&results_gatherer_type::gather, rg, presentation_store->first, _1));
+		}
+	}
+
+	void server::do_get_presentation(const ep_type& target, optional_presentation_store_handler_type handler)
+	{
+		// All do_get_presentation() calls are done in the same strand so the following is thread-safe.
+		handler(get_presentation(target));
+	}
+
+	void server::do_set_presentation(const ep_type& target, cert_type signature_certificate, const cryptoplus::buffer& pre_shared_key, void_handler_type handler)
+	{
+		// All do_set_presentation() calls are done in the same strand so the following is thread-safe.
+		set_presentation(target, signature_certificate, pre_shared_key);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_clear_presentation(const ep_type& target, void_handler_type handler)
+	{
+		// All do_set_presentation() calls are done in the same strand so the following is thread-safe.
+		clear_presentation(target);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::handle_presentation_message_from(const identity_store& identity, const presentation_message& _presentation_message, const ep_type& sender)
+	{
+		const auto signature_certificate = _presentation_message.signature_certificate();
+
+		async_has_session_with_endpoint(sender, [this, identity, sender, signature_certificate](bool has_session) {
+			m_presentation_strand.post(
 				boost::bind(
-					&server::do_handle_verified_session_request,
+					&server::do_handle_presentation,
 					this,
 					identity,
 					sender,
-					_session_request_message
+					has_session,
+					signature_certificate
 				)
-			)
-		);
+			);
+		});
+	}
+
+	void server::do_handle_presentation(const identity_store& identity, const ep_type& sender, bool has_session, cert_type signature_certificate)
+	{
+		// All do_handle_presentation() calls are done in the same strand so the following is thread-safe.
+		presentation_status_type presentation_status = PS_FIRST;
+
+		const presentation_store_map::iterator entry = m_presentation_store_map.find(sender);
+
+		if (entry != m_presentation_store_map.end())
+		{
+			if (compare_certificates(entry->second.signature_certificate(), signature_certificate))
+			{
+				presentation_status = PS_SAME;
+			}
+			else
+			{
+				presentation_status = PS_NEW;
+			}
+		}
+
+		if (m_presentation_message_received_handler)
+		{
+			if (!m_presentation_message_received_handler(sender, signature_certificate, presentation_status, has_session))
+			{
+				return;
+			}
+		}
+
+		m_presentation_store_map[sender] = presentation_store(signature_certificate, identity.pre_shared_key());
+	}
+
+	void server::do_set_presentation_message_received_callback(presentation_message_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_presentation_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_presentation_message_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	cipher_suite_type server::get_first_common_supported_cipher_suite(const cipher_suite_list_type& reference, const cipher_suite_list_type& capabilities, cipher_suite_type default_value = cipher_suite_type::unsupported)
+	{
+		for (auto&& cs : reference)
+		{
+			if (std::find(capabilities.begin(), capabilities.end(), cs) != capabilities.end())
+			{
+				return cs;
+			}
+		}
+
+		return default_value;
+	}
+
+	elliptic_curve_type server::get_first_common_supported_elliptic_curve(const elliptic_curve_list_type& reference, const elliptic_curve_list_type& capabilities, elliptic_curve_type default_value = elliptic_curve_type::unsupported)
+
+	{
+		for (auto&& cs : reference)
+		{
+			if (std::find(capabilities.begin(), capabilities.end(), cs) != capabilities.end())
+			{
+				return cs;
+			}
+		}
+
+		return default_value;
+	}
+
+	void server::do_request_session(const identity_store& identity, const ep_type& target, simple_handler_type handler)
+	{
+		// All do_request_session() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		peer_session& p_session = m_peer_sessions[target];
+
+		if (p_session.has_current_session())
+		{
+			handler(server_error::session_already_exist);
+
+			return;
+		}
+
+		if (!async_handshake_crypto(boost::bind(&server::do_write_session_request, this, identity, target, p_session.next_session_number(), p_session.local_host_identifier(), m_cipher_suites, m_elliptic_curves, handler)))
+		{
+			m_logger(log_level::warning) << "Not sending session request message to " << target << ": too many handshakes are pending.";
+
+			handler(server_error::handshake_queue_full);
+		}
+	}
+
+	void server::do_close_session(const ep_type& target, simple_handler_type handler)
+	{
+		// All do_close_session() calls are done in the same strand so the following is thread-safe.
+
+		const bool cleared = m_peer_sessions[target].clear();
+
+		index_session(target, boost::shared_ptr<peer_session::current_session_type>());
+
+		if (cleared)
+		{
+			handler(server_error::success);
+
+			if (m_session_lost_handler)
+			{
+				m_session_lost_handler(target, session_loss_reason::manual_termination);
+			}
+		}
+		else
+		{
+			handler(server_error::no_session_for_host);
+		}
+	}
+
+	void server::do_handle_session_request(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message)
+	{
+		// All do_handle_session_request() calls are done in the presentation strand so the following is thread-safe.
+		if (!has_presentation_store_for(sender))
+		{
+			// No presentation_store for the given host.
+			// We do nothing.
+			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but no presentation is available. Ignoring.";
+
+			return;
+		}
+
+		// The presentation store is copied as the signature check may happen outside of the presentation strand.
+		if (!async_handshake_crypto(boost::bind(&server::do_verify_session_request, this, data, identity, sender, _session_request_message, m_presentation_store_map[sender])))
+		{
+			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " but too many handshakes are pending. Ignoring.";
+		}
 	}
 
 	void server::do_handle_verified_session_request(const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message)
@@ -1610,7 +2219,7 @@ namespace fscp
 			{
 				m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with session number " << _session_request_message.session_number() << " and cipher suite " << calg << "_" << ec << ". No current session exist: preparing one and sending it.";
 
-				p_session.prepare_session(_session_request_message.session_number(), calg, ec);
+				p_session.prepare_session(_session_request_message.session_number(), calg, ec, m_ecdhe_key_pool);
 				do_send_session(identity, sender, p_session.next_session_parameters());
 			}
 			else
@@ -1622,7 +2231,7 @@ namespace fscp
 					m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with session number " << _session_request_message.session_number() << " and cipher suite " << calg << "_" << ec << ". A current session exists but has the number " << p_session.current_session().parameters.session_number << ": preparing a new session and sending it.";
 
 					// A new session is requested. Sending a new message.
-					p_session.prepare_session(_session_request_message.session_number(), calg, ec);
+					p_session.prepare_session(_session_request_message.session_number(), calg, ec, m_ecdhe_key_pool);
 					do_send_session(identity, sender, p_session.next_session_parameters());
 				}
 				else
@@ -1677,6 +2286,38 @@ namespace fscp
 		handler(has_session_with_endpoint(host));
 	}
 
+	void server::do_get_statistics(const boost::posix_time::ptime& request_time, statistics_handler_type handler)
+	{
+		// All do_get_statistics() calls are done in the same strand so the following is thread-safe.
+		statistics_type result;
+
+		result.session_strand_latency = boost::posix_time::microsec_clock::universal_time() - request_time;
+		m_session_strand_latencies.observe(static_cast<uint64_t>(std::max<int64_t>(result.session_strand_latency.total_microseconds(), 0)));
+		result.session_strand_latencies = m_session_strand_latencies.snapshot();
+		result.handshake_latencies = m_handshake_latencies.snapshot();
+		result.handshake_queue_depth = m_handshake_workers ? m_handshake_workers->pending() : 0;
+		result.handshake_rejections = m_handshake_workers ? m_handshake_workers->rejected() : 0;
+		result.ecdhe_key_pool_hits = m_ecdhe_key_pool.hits();
+		result.ecdhe_key_pool_misses = m_ecdhe_key_pool.misses();
+
+		for (auto&& p_session: m_peer_sessions)
+		{
+			const peer_session::counters_type& counters = p_session.second.counters();
+			peer_statistics_type& peer_statistics = result.peers[p_session.first];
+
+			peer_statistics.has_session = p_session.second.has_current_session();
+			peer_statistics.bytes_received = counters.get(peer_session::counter::bytes_received);
+			peer_statistics.messages_received = counters.get(peer_session::counter::messages_received);
+			peer_statistics.bytes_sent = counters.get(peer_session::counter::bytes_sent);
+			peer_statistics.messages_sent = counters.get(peer_session::counter::messages_sent);
+			peer_statistics.decipher_failures = counters.get(peer_session::counter::decipher_failures);
+			peer_statistics.replays = counters.get(peer_session::counter::replays);
+			peer_statistics.drops = counters.get(peer_session::counter::drops);
+		}
+
+		handler(result);
+	}
+
 	void server::do_set_accept_session_request_messages_default(bool value, void_handler_type handler)
 	{
 		// All do_set_hello_message_received_callback() calls are done in the same strand so the following is thread-safe.
@@ -1726,326 +2367,1035 @@ namespace fscp
 		// All do_send_session() calls are done in the session strand so the following is thread-safe.
 		m_logger(log_level::trace) << "Sending session message to " << target << " (session number: " << parameters.session_number << ", cipher suite: " << parameters.cipher_suite << ", elliptic curve: " << parameters.elliptic_curve << ").";
 
-		peer_session& p_session = m_peer_sessions[target];
-		const SharedBuffer send_buffer = m_session_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_session_buffers.front();
-			m_session_buffers.pop_front();
+		const peer_session& p_session = m_peer_sessions[target];
 
-			return result;
-		}();
+		if (!async_handshake_crypto(boost::bind(&server::do_write_session, this, identity, target, p_session.local_host_identifier(), parameters)))
+		{
+			m_logger(log_level::warning) << "Not sending session message to " << target << ": too many handshakes are pending.";
+		}
+	}
 
+	void server::do_handle_session(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_message& _session_message)
+	{
+		// All do_handle_session() calls are done in the same strand so the following is thread-safe.
 
-		try
+		if (!has_presentation_store_for(sender))
 		{
-			size_t size = 0;
+			// No presentation_store for the given host.
+			// We do nothing.
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but no presentation is available. Ignoring.";
 
-			if (!!identity.signature_key())
-			{
-				size = session_message::write(
-					buffer_cast<uint8_t*>(send_buffer),
-					buffer_size(send_buffer),
-					parameters.session_number,
-					p_session.local_host_identifier(),
-					parameters.cipher_suite,
-					parameters.elliptic_curve,
-					buffer_cast<const void*>(parameters.public_key),
-					buffer_size(parameters.public_key),
-					identity.signature_key()
-				);
-			}
-			else
+			return;
+		}
+
+		// The presentation store is copied as the signature check may happen outside of the presentation strand.
+		if (!async_handshake_crypto(boost::bind(&server::do_verify_session, this, data, identity, sender, _session_message, m_presentation_store_map[sender])))
+		{
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but too many handshakes are pending. Ignoring.";
+		}
+	}
+
+	void server::do_handle_verified_session(const identity_store& identity, const ep_type& sender, const session_message& _session_message)
+	{
+		// All do_handle_verified_session() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[sender];
+
+		if (!p_session.set_first_remote_host_identifier(_session_message.host_identifier()))
+		{
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but the host identifier does not match (Received: " << _session_message.host_identifier() << ". Expected: " << *p_session.remote_host_identifier() << "). Ignoring.";
+
+			// The host identifier does not match.
+			return;
+		}
+
+		const bool session_is_new = !p_session.has_current_session();
+
+		if (!session_is_new)
+		{
+			if (_session_message.session_number() == p_session.current_session().parameters.session_number)
 			{
-				size = session_message::write(
+				// The session number matches the current session.
+				if (p_session.current_session().parameters.cipher_suite != _session_message.cipher_suite())
+				{
+					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has the same number but its cipher suite does not match (" << p_session.current_session().parameters.cipher_suite << "): requesting a new session.";
+
+					// The parameters don't match the current session. Requesting a new one.
+					do_request_session(identity, sender, &null_simple_handler);
+				}
+				else
+				{
+					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has the same number and cipher suite. Ignoring.";
+				}
+
+				return;
+			}
+			else if (_session_message.session_number() < p_session.current_session().parameters.session_number)
+			{
+				m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has a higher number (" << p_session.current_session().parameters.session_number << "). Ignoring.";
+
+				// This is an old session message. Ignore it.
+				return;
+			}
+		}
+
+		if (_session_message.cipher_suite() == cipher_suite_type::unsupported)
+		{
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " but an unsupported cipher suite. Failing session handshake.";
+
+			if (m_session_failed_handler)
+			{
+				m_session_failed_handler(sender, session_is_new);
+			}
+
+			return;
+		}
+
+		bool can_accept = m_accept_session_messages_default;
+
+		if (m_session_message_received_handler)
+		{
+			can_accept = m_session_message_received_handler(sender, _session_message.cipher_suite(), _session_message.elliptic_curve(), can_accept);
+		}
+
+		if (!can_accept)
+		{
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but not allowed to accept (`m_accept_session_messages_default` is " << m_accept_session_messages_default << ").";
+		}
+		else
+		{
+			try
+			{
+				if (!p_session.get_next_session())
+				{
+					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " but no session was prepared yet. Preparing a new one.";
+
+					// We received a session message but no session was prepared yet: we issue one.
+					p_session.prepare_session(_session_message.session_number(), _session_message.cipher_suite(), _session_message.elliptic_curve(), m_ecdhe_key_pool);
+				}
+			}
+			catch (const std::exception& ex)
+			{
+				m_logger(log_level::error) << "Exception while computing the session keys with " << sender << ": " << ex.what() << ".";
+
+				if (m_session_error_handler)
+				{
+					m_session_error_handler(sender, session_is_new, ex);
+				}
+
+				return;
+			}
+
+			const cryptoplus::buffer remote_public_key(_session_message.public_key(), _session_message.public_key_size());
+
+			if (!async_handshake_crypto(boost::bind(&server::do_derive_session, this, identity, sender, session_is_new, p_session.get_next_session(), p_session.local_host_identifier(), *p_session.remote_host_identifier(), remote_public_key)))
+			{
+				m_logger(log_level::trace) << "Received a SESSION from " << sender << " but too many handshakes are pending. Ignoring.";
+			}
+		}
+	}
+
+	void server::do_set_accept_session_messages_default(bool value, void_handler_type handler)
+	{
+		// All do_set_accept_session_messages_default() calls are done in the same strand so the following is thread-safe.
+		set_accept_session_messages_default(value);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_message_received_callback(session_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_message_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_message_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_failed_callback(session_failed_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_failed_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_failed_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_error_callback(session_error_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_error_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_error_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_established_callback(session_established_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_established_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_established_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_session_lost_callback(session_lost_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_session_lost_callback() calls are done in the same strand so the following is thread-safe.
+		set_session_lost_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
+	{
+		// All do_send_data() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[target];
+
+		do_send_data_to_session(p_session, target, channel_number, data, handler);
+	}
+
+	void server::do_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_data_to_list() calls are done in the session strand so the following is thread-safe.
+		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+
+		for (auto&& target: targets)
+		{
+			const peer_session_map_type::iterator p_session = m_peer_sessions.find(target);
+
+			if (p_session != m_peer_sessions.end())
+			{
+				do_send_data_to_session(p_session->second, target, channel_number, data, boost::bind(&results_gatherer_type::gather, rg, target, _1));
+			}
+			else
+			{
+				rg->gather(target, server_error::no_session_for_host);
+			}
+		}
+	}
+
+	void server::do_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_data_to_all() calls are done in the session strand so the following is thread-safe.
+		do_send_data_to_list(get_session_endpoints(), channel_number, data, handler);
+	}
+
+	void server::do_send_data_to_session(peer_session& p_session, const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
+	{
+		// All do_send_data_to_session() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+		const SharedBuffer send_buffer(data_message::get_write_buffer_size(buffer_size(data)));
+
+		// The sequence number is allocated here so that it matches the order of the calls, even if the cipherment is deferred.
+		const sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		p_session.mark_data_sent();
+		const boost::shared_ptr<peer_session::current_session_type> session = p_session.get_current_session();
+
+		async_cipher(target, [this, send_buffer, target, channel_number, data, sequence_number, session, handler] () {
+			try
+			{
+				const size_t size = data_message::write(
 					buffer_cast<uint8_t*>(send_buffer),
 					buffer_size(send_buffer),
-					parameters.session_number,
-					p_session.local_host_identifier(),
-					parameters.cipher_suite,
-					parameters.elliptic_curve,
-					buffer_cast<const void*>(parameters.public_key),
-					buffer_size(parameters.public_key),
-					buffer_cast<const uint8_t*>(identity.pre_shared_key()),
-					buffer_size(identity.pre_shared_key())
+					channel_number,
+					sequence_number,
+					session->local_cipher_context,
+					buffer_cast<const uint8_t*>(data),
+					buffer_size(data),
+					buffer_cast<const uint8_t*>(session->local_nonce_prefix),
+					buffer_size(session->local_nonce_prefix)
+				);
+
+				session->counters->increment(peer_session::counter::messages_sent);
+				session->counters->increment(peer_session::counter::bytes_sent, buffer_size(data));
+
+				async_send_to(
+					send_buffer,
+					size,
+					target,
+					handler
 				);
 			}
+			catch (const boost::system::system_error& ex)
+			{
+				handler(ex.code());
+			}
+		});
+	}
 
-			async_send_to(
-				SharedBuffer(send_buffer, [this](const SharedBuffer& buffer) {
-					m_session_strand.post([this, buffer]() {
-						m_session_buffers.push_back(buffer);
-					});
-				}),
-				size,
-				target,
-				[] (const boost::system::error_code&) {}
+	void server::do_send_contact_request(const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
+	{
+		// All do_send_contact_request() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[target];
+
+		do_send_contact_request_to_session(p_session, target, hash_list, handler);
+	}
+
+	void server::do_send_contact_request_to_list(const std::set<ep_type>& targets, const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_contact_request_to_list() calls are done in the same strand so the following is thread-safe.
+		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+
+		for (auto&& target: targets)
+		{
+			const peer_session_map_type::iterator p_session = m_peer_sessions.find(target);
+
+			if (p_session != m_peer_sessions.end())
+			{
+				do_send_contact_request_to_session(p_session->second, target, hash_list, boost::bind(&results_gatherer_type::gather, rg, target, _1));
+			}
+			else
+			{
+				rg->gather(target, server_error::no_session_for_host);
+			}
+		}
+	}
+
+	void server::do_send_contact_request_to_all(const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_contact_request_to_all() calls are done in the same strand so the following is thread-safe.
+		do_send_contact_request_to_list(get_session_endpoints(), hash_list, handler);
+	}
+
+	void server::do_send_contact_request_to_session(peer_session& p_session, const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
+	{
+		// All do_send_contact_request_to_session() calls are done in the same strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+		const sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		const boost::shared_ptr<peer_session::current_session_type> session = p_session.get_current_session();
+
+		async_cipher(target, [this, target, hash_list, sequence_number, session, handler] () {
+			const auto send_buffer = SharedBuffer(65536);
+
+			try
+			{
+				const size_t size = data_message::write_contact_request(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					sequence_number,
+					session->local_cipher_context,
+					hash_list,
+					buffer_cast<const uint8_t*>(session->local_nonce_prefix),
+					buffer_size(session->local_nonce_prefix)
+				);
+
+				async_send_to(
+					send_buffer,
+					size,
+					target,
+					handler
+				);
+			}
+			catch (const boost::system::system_error& ex)
+			{
+				handler(ex.code());
+			}
+		});
+	}
+
+	void server::do_send_contact(const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
+	{
+		// All do_send_contact() calls are done in the same strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[target];
+
+		do_send_contact_to_session(p_session, target, contact_map, handler);
+	}
+
+	void server::do_send_contact_to_list(const std::set<ep_type>& targets, const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_contact_to_list() calls are done in the same strand so the following is thread-safe.
+		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+
+		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+
+		for (auto&& target: targets)
+		{
+			const peer_session_map_type::iterator p_session = m_peer_sessions.find(target);
+
+			if (p_session != m_peer_sessions.end())
+			{
+				do_send_contact_to_session(p_session->second, target, contact_map, boost::bind(&results_gatherer_type::gather, rg, target, _1));
+			}
+			else
+			{
+				rg->gather(target, server_error::no_session_for_host);
+			}
+		}
+	}
+
+	void server::do_send_contact_to_all(const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
+	{
+		// All do_send_contact_to_all() calls are done in the same strand so the following is thread-safe.
+		do_send_contact_to_list(get_session_endpoints(), contact_map, handler);
+	}
+
+	void server::do_send_contact_to_session(peer_session& p_session, const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
+	{
+		// All do_send_contact_to_session() calls are done in the same strand so the following is thread-safe.
+		if (!m_socket.is_open())
+		{
+			handler(server_error::server_offline);
+
+			return;
+		}
+
+		if (!p_session.has_current_session())
+		{
+			handler(server_error::no_session_for_host);
+
+			return;
+		}
+
+		const sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		const boost::shared_ptr<peer_session::current_session_type> session = p_session.get_current_session();
+
+		async_cipher(target, [this, target, contact_map, sequence_number, session, handler] () {
+			const auto send_buffer = SharedBuffer(65536);
+
+			try
+			{
+				const size_t size = data_message::write_contact(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					sequence_number,
+					session->local_cipher_context,
+					contact_map,
+					buffer_cast<const uint8_t*>(session->local_nonce_prefix),
+					buffer_size(session->local_nonce_prefix)
+				);
+
+				async_send_to(
+					send_buffer,
+					size,
+					target,
+					handler
+				);
+			}
+			catch (const boost::system::system_error& ex)
+			{
+				handler(ex.code());
+			}
+		});
+	}
+
+	void server::do_handle_data(SharedBuffer data, const identity_store& identity, const ep_type& sender, const data_message& _data_message)
+	{
+		// All do_handle_data() calls are done in the same strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[sender];
+
+		if (!p_session.has_current_session())
+		{
+			m_logger(log_level::trace) << "Received a data message from " << sender << " but no session exists. Ignoring.";
+			p_session.counters().increment(peer_session::counter::drops);
+
+			return;
+		}
+
+		switch (p_session.check_remote_sequence_number(_data_message.sequence_number()))
+		{
+			case peer_session::sequence_number_status::in_order:
+			case peer_session::sequence_number_status::out_of_order:
+				break;
+			case peer_session::sequence_number_status::duplicate:
+			{
+				// The message is a replay: we ignore it.
+				m_logger(log_level::trace) << "Received a data message from " << sender << " but its sequence number was already received (received: " << _data_message.sequence_number() << ", greatest: " << p_session.current_session().remote_sequence_number << "). Ignoring.";
+				p_session.counters().increment(peer_session::counter::replays);
+
+				return;
+			}
+			case peer_session::sequence_number_status::too_old:
+			{
+				// The message is outdated: we ignore it.
+				m_logger(log_level::trace) << "Received a data message from " << sender << " but its sequence number is outside of the replay window (received: " << _data_message.sequence_number() << ", greatest: " << p_session.current_session().remote_sequence_number << "). Ignoring.";
+				p_session.counters().increment(peer_session::counter::replays);
+
+				return;
+			}
+		}
+
+		// With GCM, the cleartext is never bigger than the ciphertext.
+		const SharedBuffer cleartext_buffer(_data_message.ciphertext_size() + EVP_MAX_BLOCK_LENGTH);
+
+		const boost::shared_ptr<peer_session::current_session_type> session = p_session.get_current_session();
+
+		async_cipher(
+			sender,
+			make_shared_buffer_handler(
+				data,
+				boost::bind(
+					&server::do_decipher_data,
+					this,
+					identity,
+					sender,
+					session,
+					_data_message,
+					cleartext_buffer
+				)
+			)
+		);
+	}
+
+	void server::do_handle_data_batch(boost::shared_ptr<std::vector<void_handler_type> > data_batch)
+	{
+		// All do_handle_data_batch() calls are done in the session strand so the following is thread-safe.
+		for (auto&& handler : *data_batch)
+		{
+			handler();
+		}
+	}
+
+	void server::do_decipher_data(const identity_store& identity, const ep_type& sender, boost::shared_ptr<peer_session::current_session_type> session, const data_message& _data_message, SharedBuffer cleartext_buffer)
+	{
+		// do_decipher_data() is called either from the session strand or from the cipher strand of sender: it must only access the specified session.
+
+		try
+		{
+			const size_t cleartext_len = _data_message.get_cleartext(
+				buffer_cast<uint8_t*>(cleartext_buffer),
+				buffer_size(cleartext_buffer),
+				session->remote_cipher_context,
+				buffer_cast<const uint8_t*>(session->remote_nonce_prefix),
+				buffer_size(session->remote_nonce_prefix)
 			);
+
+			if (m_cipher_strands.empty())
+			{
+				do_handle_deciphered_data(identity, sender, session, _data_message.sequence_number(), _data_message.type(), cleartext_buffer, cleartext_len);
+			}
+			else
+			{
+				do_handle_host_deciphered_data(identity, sender, session, _data_message.sequence_number(), _data_message.type(), cleartext_buffer, cleartext_len);
+			}
 		}
 		catch (const boost::system::system_error& ex)
 		{
-			m_logger(log_level::error) << "Error sending session to " << target << ": " << ex.what() << ".";
+			// This can happen if a message is decoded after a session rekeying.
+			m_logger(log_level::error) << "Error deciphering data message from " << sender << ": " << ex.what();
+			session->counters->increment(peer_session::counter::decipher_failures);
 		}
 	}
 
-	void server::do_handle_session(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_message& _session_message)
+	void server::do_handle_deciphered_data(const identity_store& identity, const ep_type& sender, boost::shared_ptr<peer_session::current_session_type> session, sequence_number_type sequence_number, message_type type, SharedBuffer cleartext_buffer, size_t cleartext_len)
 	{
-		// All do_handle_session() calls are done in the same strand so the following is thread-safe.
+		// All do_handle_deciphered_data() calls are done in the session strand so the following is thread-safe.
+		peer_session& p_session = m_peer_sessions[sender];
 
-		if (!has_presentation_store_for(sender))
+		if (p_session.get_current_session() != session)
 		{
-			// No presentation_store for the given host.
-			// We do nothing.
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but no presentation is available. Ignoring.";
+			// The session was renewed or cleared while the message was being deciphered.
+			m_logger(log_level::trace) << "Received a data message from " << sender << " for a session that is no longer current. Ignoring.";
+			p_session.counters().increment(peer_session::counter::drops);
 
 			return;
 		}
 
-		// We make sure the signatures matches.
-		bool check_ok = false;
-
-		if (!!m_presentation_store_map[sender].signature_certificate())
+		switch (p_session.set_remote_sequence_number(sequence_number))
 		{
-			check_ok = _session_message.check_signature(m_presentation_store_map[sender].signature_certificate().public_key());
+			case peer_session::sequence_number_status::in_order:
+			case peer_session::sequence_number_status::out_of_order:
+				break;
+			case peer_session::sequence_number_status::duplicate:
+			case peer_session::sequence_number_status::too_old:
+			{
+				// Another message with the same sequence number was deciphered in the meantime or the window moved past it.
+				m_logger(log_level::trace) << "Received a data message from " << sender << " but its sequence number is no longer acceptable (received: " << sequence_number << ", greatest: " << p_session.current_session().remote_sequence_number << "). Ignoring.";
+				p_session.counters().increment(peer_session::counter::replays);
+
+				return;
+			}
 		}
-		else
+
+		p_session.keep_alive();
+
+		if (p_session.current_session().is_old())
 		{
-			const auto psk = m_presentation_store_map[sender].pre_shared_key();
-			check_ok = _session_message.check_signature(buffer_cast<const uint8_t*>(psk), buffer_size(psk));
+			// do_send_clear_session() and do_handle_deciphered_data() are to be invoked through the same strand, so this is fine.
+			p_session.prepare_session(p_session.next_session_number(), p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve, m_ecdhe_key_pool);
+			do_send_session(identity, sender, p_session.next_session_parameters());
 		}
 
-		if (!check_ok)
+		if ((type == MESSAGE_TYPE_KEEP_ALIVE) || (type == MESSAGE_TYPE_PATH_MTU))
 		{
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " with an invalid signature. Ignoring.";
+			do_handle_control_data(sender, p_session, type, cleartext_buffer, cleartext_len);
 
 			return;
 		}
 
-		m_session_strand.post(
-			make_shared_buffer_handler(
-				data,
-				boost::bind(
-					&server::do_handle_verified_session,
-					this,
-					identity,
-					sender,
-					_session_message
-				)
-			)
+		if (is_data_message_type(type))
+		{
+			p_session.counters().increment(peer_session::counter::messages_received);
+			p_session.counters().increment(peer_session::counter::bytes_received, cleartext_len);
+		}
+
+		// This call is fast so we hold on to the cleartext buffer a bit longer.
+		do_handle_data_message(
+			sender,
+			type,
+			cleartext_buffer,
+			buffer(cleartext_buffer, cleartext_len)
 		);
 	}
 
-	void server::do_handle_verified_session(const identity_store& identity, const ep_type& sender, const session_message& _session_message)
+	void server::do_handle_host_data(SharedBuffer data, const identity_store& identity, const ep_type& sender, const data_message& _data_message)
 	{
-		// All do_handle_verified_session() calls are done in the session strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[sender];
+		// All do_handle_host_data() calls for a given sender are done in its cipher strand: only the current session of sender is accessed.
+		const boost::shared_ptr<peer_session::current_session_type> session = find_indexed_session(sender);
 
-		if (!p_session.set_first_remote_host_identifier(_session_message.host_identifier()))
+		if (!session)
 		{
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but the host identifier does not match (Received: " << _session_message.host_identifier() << ". Expected: " << *p_session.remote_host_identifier() << "). Ignoring.";
+			// The peer sessions, and their counters, are owned by the session strand.
+			m_session_strand.post(boost::bind(&server::do_drop_data, this, sender));
 
-			// The host identifier does not match.
 			return;
 		}
 
-		const bool session_is_new = !p_session.has_current_session();
-
-		if (!session_is_new)
+		switch (session->check_remote_sequence_number(_data_message.sequence_number()))
 		{
-			if (_session_message.session_number() == p_session.current_session().parameters.session_number)
+			case peer_session::sequence_number_status::in_order:
+			case peer_session::sequence_number_status::out_of_order:
+				break;
+			case peer_session::sequence_number_status::duplicate:
+			case peer_session::sequence_number_status::too_old:
 			{
-				// The session number matches the current session.
-				if (p_session.current_session().parameters.cipher_suite != _session_message.cipher_suite())
-				{
-					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has the same number but its cipher suite does not match (" << p_session.current_session().parameters.cipher_suite << "): requesting a new session.";
-
-					// The parameters don't match the current session. Requesting a new one.
-					do_request_session(identity, sender, &null_simple_handler);
-				}
-				else
-				{
-					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has the same number and cipher suite. Ignoring.";
-				}
+				m_logger(log_level::trace) << "Received a data message from " << sender << " but its sequence number is not acceptable (received: " << _data_message.sequence_number() << ", greatest: " << session->remote_sequence_number << "). Ignoring.";
+				session->counters->increment(peer_session::counter::replays);
 
 				return;
 			}
-			else if (_session_message.session_number() < p_session.current_session().parameters.session_number)
+		}
+
+		// With GCM, the cleartext is never bigger than the ciphertext.
+		const SharedBuffer cleartext_buffer(_data_message.ciphertext_size() + EVP_MAX_BLOCK_LENGTH);
+
+		// data holds the ciphertext until the call returns.
+		static_cast<void>(data);
+
+		do_decipher_data(identity, sender, session, _data_message, cleartext_buffer);
+	}
+
+	void server::do_handle_host_deciphered_data(const identity_store& identity, const ep_type& sender, boost::shared_ptr<peer_session::current_session_type> session, sequence_number_type sequence_number, message_type type, SharedBuffer cleartext_buffer, size_t cleartext_len)
+	{
+		// All do_handle_host_deciphered_data() calls for a given sender are done in its cipher strand: only the current session of sender is accessed.
+		switch (session->set_remote_sequence_number(sequence_number))
+		{
+			case peer_session::sequence_number_status::in_order:
+			case peer_session::sequence_number_status::out_of_order:
+				break;
+			case peer_session::sequence_number_status::duplicate:
+			case peer_session::sequence_number_status::too_old:
 			{
-				m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " and cipher suite " << _session_message.cipher_suite() << ". A session currently exists and has a higher number (" << p_session.current_session().parameters.session_number << "). Ignoring.";
+				m_logger(log_level::trace) << "Received a data message from " << sender << " but its sequence number is no longer acceptable (received: " << sequence_number << ", greatest: " << session->remote_sequence_number << "). Ignoring.";
+				session->counters->increment(peer_session::counter::replays);
 
-				// This is an old session message. Ignore it.
 				return;
 			}
 		}
 
-		if (_session_message.cipher_suite() == cipher_suite_type::unsupported)
+		// The session strand keeps the session alive the next time it checks it.
+		session->mark_remote_activity();
+
+		if (session->is_remote_old())
 		{
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " but an unsupported cipher suite. Failing session handshake.";
+			// The local sequence numbers are checked by the host, when it receives our messages.
+			m_session_strand.post(boost::bind(&server::do_renew_session, this, identity, sender, session));
+		}
 
-			if (m_session_failed_handler)
+		if (type == MESSAGE_TYPE_KEEP_ALIVE)
+		{
+			if (cleartext_len > SESSION_KEEP_ALIVE_DATA_SIZE)
 			{
-				m_session_failed_handler(sender, session_is_new);
+				m_session_strand.post(boost::bind(&server::do_handle_host_control_data, this, sender, session, type, cleartext_buffer, cleartext_len));
 			}
 
 			return;
 		}
 
-		bool can_accept = m_accept_session_messages_default;
-
-		if (m_session_message_received_handler)
+		if (type == MESSAGE_TYPE_PATH_MTU)
 		{
-			can_accept = m_session_message_received_handler(sender, _session_message.cipher_suite(), _session_message.elliptic_curve(), can_accept);
+			m_session_strand.post(boost::bind(&server::do_handle_host_control_data, this, sender, session, type, cleartext_buffer, cleartext_len));
+
+			return;
 		}
 
-		if (!can_accept)
+		if (is_data_message_type(type))
 		{
-			m_logger(log_level::trace) << "Received a SESSION from " << sender << " but not allowed to accept (`m_accept_session_messages_default` is " << m_accept_session_messages_default << ").";
+			session->counters->increment(peer_session::counter::messages_received);
+			session->counters->increment(peer_session::counter::bytes_received, cleartext_len);
 		}
-		else
+
+		do_handle_data_message(
+			sender,
+			type,
+			cleartext_buffer,
+			buffer(cleartext_buffer, cleartext_len)
+		);
+	}
+
+	void server::do_handle_host_control_data(const ep_type& sender, boost::shared_ptr<peer_session::current_session_type> session, message_type type, SharedBuffer cleartext_buffer, size_t cleartext_len)
+	{
+		// All do_handle_host_control_data() calls are done in the session strand so the following is thread-safe.
+		const peer_session_map_type::iterator p_session = m_peer_sessions.find(sender);
+
+		if ((p_session == m_peer_sessions.end()) || (p_session->second.get_current_session() != session))
 		{
-			bool session_completed = true;
+			// The session was renewed or cleared while the message was being handled.
+			return;
+		}
 
+		do_handle_control_data(sender, p_session->second, type, cleartext_buffer, cleartext_len);
+	}
+
+	void server::do_handle_control_data(const ep_type& sender, peer_session& p_session, message_type type, SharedBuffer cleartext_buffer, size_t cleartext_len)
+	{
+		// All do_handle_control_data() calls are done in the session strand so the following is thread-safe.
+		if (type == MESSAGE_TYPE_KEEP_ALIVE)
+		{
+			if (cleartext_len > SESSION_KEEP_ALIVE_DATA_SIZE)
+			{
+				// This is a path MTU probe: we tell the host that its size gets through.
+				do_send_path_mtu(sender, p_session, data_message::get_message_size(cleartext_len));
+			}
+		}
+		else if (type == MESSAGE_TYPE_PATH_MTU)
+		{
 			try
 			{
-				if (!p_session.complete_session(_session_message.public_key(), _session_message.public_key_size()))
-				{
-					m_logger(log_level::trace) << "Received a SESSION from " << sender << " with session number " << _session_message.session_number() << " but no session was prepared yet. Preparing a new one.";
+				do_handle_path_mtu(sender, p_session, data_message::parse_path_mtu(buffer_cast<const uint8_t*>(cleartext_buffer), cleartext_len));
+			}
+			catch (const std::runtime_error&)
+			{
+				m_logger(log_level::trace) << "Received an invalid path MTU message from " << sender << ". Ignoring.";
+			}
+		}
+	}
 
-					// We received a session message but no session was prepared yet: we issue one and retry.
-					p_session.prepare_session(_session_message.session_number(), _session_message.cipher_suite(), _session_message.elliptic_curve());
+	void server::do_drop_data(const ep_type& sender)
+	{
+		// All do_drop_data() calls are done in the session strand so the following is thread-safe.
+		m_logger(log_level::trace) << "Received a data message from " << sender << " but no session exists. Ignoring.";
+		m_peer_sessions[sender].counters().increment(peer_session::counter::drops);
+	}
 
-					if (!p_session.complete_session(_session_message.public_key(), _session_message.public_key_size()))
-					{
-						// Unable to complete the session.
-						m_logger(log_level::warning) << "Unable to compute the session keys with " << sender << ".";
+	void server::do_renew_session(const identity_store& identity, const ep_type& sender, boost::shared_ptr<peer_session::current_session_type> session)
+	{
+		// All do_renew_session() calls are done in the session strand so the following is thread-safe.
+		const peer_session_map_type::iterator p_session = m_peer_sessions.find(sender);
 
-						return;
-					}
-				}
+		if ((p_session == m_peer_sessions.end()) || (p_session->second.get_current_session() != session))
+		{
+			// The session was already renewed or cleared.
+			return;
+		}
+
+		p_session->second.prepare_session(p_session->second.next_session_number(), session->parameters.cipher_suite, session->parameters.elliptic_curve, m_ecdhe_key_pool);
+		do_send_session(identity, sender, p_session->second.next_session_parameters());
+	}
+
+	void server::do_handle_data_message(const ep_type& sender, message_type type, SharedBuffer buffer, boost::asio::const_buffer data)
+	{
+		// All do_handle_data_message() calls are done in the same strand as do_handle_data() so the following is thread-safe.
+		// This call should remain *FAST*. That ims, it should only discard the message or trigger some deferred handling by another task.
+
+		if (is_data_message_type(type))
+		{
+			// This is safe only because type is a DATA message type.
+			const channel_number_type channel_number = to_channel_number(type);
+
+			if (m_data_received_handler)
+			{
+				m_data_received_handler(sender, channel_number, buffer, data);
 			}
-			catch (const std::exception& ex)
+		}
+		else if (type == MESSAGE_TYPE_CONTACT_REQUEST)
+		{
+			const hash_list_type hash_list = data_message::parse_hash_list(buffer_cast<const uint8_t*>(data), buffer_size(data));
+
+			m_presentation_strand.post(
+				boost::bind(
+					&server::do_handle_contact_request,
+					this,
+					sender,
+					hash_list
+				)
+			);
+		}
+		else if (type == MESSAGE_TYPE_CONTACT)
+		{
+			const contact_map_type contact_map = data_message::parse_contact_map(buffer_cast<const uint8_t*>(data), buffer_size(data));
+
+			m_contact_strand.post(
+				boost::bind(
+					&server::do_handle_contact,
+					this,
+					sender,
+					contact_map
+				)
+			);
+		}
+	}
+
+	void server::do_handle_contact_request(const ep_type& sender, const std::set<hash_type>& hash_list)
+	{
+		// All do_handle_contact_request() calls are done in the same strand so the following is thread-safe.
+		contact_map_type contact_map;
+
+		for (std::set<hash_type>::iterator hash_it = hash_list.begin(); hash_it != hash_list.end(); ++hash_it)
+		{
+			for (presentation_store_map::const_iterator it = m_presentation_store_map.begin(); it != m_presentation_store_map.end(); ++it)
 			{
-				session_completed = false;
+				// Contact requests do not work for PSK authenticated hosts.
+				if (!it->second.signature_certificate())
+				{
+					continue;
+				}
 
-				m_logger(log_level::error) << "Exception while computing the session keys with " << sender << ": " << ex.what() << ".";
+				const boost::optional<hash_type> hash = it->second.signature_certificate_hash();
 
-				if (m_session_error_handler)
+				if (hash && (*hash == *hash_it))
 				{
-					m_session_error_handler(sender, session_is_new, ex);
+					if (!m_contact_request_message_received_handler || m_contact_request_message_received_handler(sender, it->second.signature_certificate(), *hash, it->first))
+					{
+						contact_map[*hash_it] = it->first;
+					}
 				}
 			}
+		}
 
-			if (session_completed)
-			{
-				m_logger(log_level::trace) << "Session established with " << sender << ". Sending acknowledgement session message back.";
+		// Our contact map contains some answers: we send those.
+		if (!contact_map.empty())
+		{
+			async_send_contact(sender, contact_map, &null_simple_handler);
+		}
+	}
 
-				do_send_session(identity, sender, p_session.current_session_parameters());
+	void server::do_handle_contact(const ep_type& sender, const contact_map_type& contact_map)
+	{
+		// All do_handle_contact() calls are done in the same strand so the following is thread-safe.
 
-				if (m_session_established_handler)
-				{
-					m_session_established_handler(sender, session_is_new, p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
-				}
+		if (m_contact_message_received_handler)
+		{
+			for (contact_map_type::const_iterator contact_it = contact_map.begin(); contact_it != contact_map.end(); ++contact_it)
+			{
+				m_contact_message_received_handler(sender, contact_it->first, contact_it->second);
 			}
 		}
 	}
 
-	void server::do_set_accept_session_messages_default(bool value, void_handler_type handler)
+	void server::do_set_data_received_callback(data_received_handler_type callback, void_handler_type handler)
 	{
-		// All do_set_accept_session_messages_default() calls are done in the same strand so the following is thread-safe.
-		set_accept_session_messages_default(value);
+		// All do_set_data_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_data_received_callback(callback);
 
 		if (handler)
 		{
-			handler();
+			handler();
+		}
+	}
+
+	void server::do_set_contact_request_received_callback(contact_request_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_contact_request_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_contact_request_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::do_set_contact_received_callback(contact_received_handler_type callback, void_handler_type handler)
+	{
+		// All do_set_contact_received_callback() calls are done in the same strand so the following is thread-safe.
+		set_contact_received_callback(callback);
+
+		if (handler)
+		{
+			handler();
+		}
+	}
+
+	void server::async_cipher(const ep_type& host, void_handler_type handler)
+	{
+		// All async_cipher() calls are done in the session strand so that the order of the cipherment operations for a given host matches the order of their sequence numbers.
+		if (m_cipher_strands.empty())
+		{
+			handler();
+		}
+		else
+		{
+			m_cipher_strands[get_cipher_strand_index(host)]->post(handler);
 		}
 	}
 
-	void server::do_set_session_message_received_callback(session_received_handler_type callback, void_handler_type handler)
+	size_t server::get_cipher_strand_index(const ep_type& host) const
 	{
-		// All do_set_session_message_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_message_received_callback(callback);
+		return hash_endpoint(host) % m_cipher_strands.size();
+	}
 
-		if (handler)
+	void server::index_session(const ep_type& host, boost::shared_ptr<peer_session::current_session_type> session)
+	{
+		// All index_session() calls are done in the session strand: the shard lock only guards against the lookups of the cipher strand.
+		if (m_session_index.empty())
 		{
-			handler();
+			return;
 		}
-	}
 
-	void server::do_set_session_failed_callback(session_failed_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_session_failed_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_failed_callback(callback);
+		session_index_shard& shard = *m_session_index[get_cipher_strand_index(host)];
 
-		if (handler)
+		boost::mutex::scoped_lock lock(shard.mutex);
+
+		if (session)
 		{
-			handler();
+			shard.sessions[host] = session;
+		}
+		else
+		{
+			shard.sessions.erase(host);
 		}
 	}
 
-	void server::do_set_session_error_callback(session_error_handler_type callback, void_handler_type handler)
+	boost::shared_ptr<peer_session::current_session_type> server::find_indexed_session(const ep_type& host)
 	{
-		// All do_set_session_error_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_error_callback(callback);
+		session_index_shard& shard = *m_session_index[get_cipher_strand_index(host)];
 
-		if (handler)
-		{
-			handler();
-		}
+		boost::mutex::scoped_lock lock(shard.mutex);
+
+		const auto session = shard.sessions.find(host);
+
+		return (session != shard.sessions.end()) ? session->second : boost::shared_ptr<peer_session::current_session_type>();
 	}
 
-	void server::do_set_session_established_callback(session_established_handler_type callback, void_handler_type handler)
+	void server::schedule_keep_alive(const ep_type& host, peer_session& p_session, const boost::posix_time::time_duration& delay)
 	{
-		// All do_set_session_established_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_established_callback(callback);
+		m_keep_alive_wheel.schedule(p_session.keep_alive_handle(), host, boost::posix_time::microsec_clock::universal_time() + delay);
 
-		if (handler)
+		arm_keep_alive_timer();
+	}
+
+	void server::arm_keep_alive_timer()
+	{
+		// All arm_keep_alive_timer() calls are done in the session strand so the following is thread-safe.
+		if (!m_keep_alive_timer_armed && !m_keep_alive_wheel.empty())
 		{
-			handler();
+			m_keep_alive_timer_armed = true;
+			m_keep_alive_timer.expires_from_now(m_keep_alive_wheel.tick_duration());
+			m_keep_alive_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
 		}
 	}
 
-	void server::do_set_session_lost_callback(session_lost_handler_type callback, void_handler_type handler)
+	void server::do_check_keep_alive(const boost::system::error_code& ec)
 	{
-		// All do_set_session_lost_callback() calls are done in the same strand so the following is thread-safe.
-		set_session_lost_callback(callback);
+		// All do_check_keep_alive() calls are done in the same strand so the following is thread-safe.
+		m_keep_alive_timer_armed = false;
 
-		if (handler)
+		if ((ec == boost::asio::error::operation_aborted) && !m_socket.is_open())
 		{
-			handler();
+			// The server was closed.
+			return;
 		}
-	}
 
-	void server::do_send_data(const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
-	{
-		// All do_send_data() calls are done in the session strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[target];
+		const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
 
-		do_send_data_to_session(p_session, target, channel_number, data, handler);
+		if (!ec)
+		{
+			// The time since the timer expired is mostly spent waiting for the session strand.
+			m_session_strand_latencies.observe(static_cast<uint64_t>(std::max<int64_t>((now - m_keep_alive_timer.expires_at()).total_microseconds(), 0)));
+		}
+
+		m_keep_alive_wheel.advance(now, boost::bind(&server::do_keep_alive, this, _1));
+
+		arm_keep_alive_timer();
 	}
 
-	void server::do_send_data_to_list(const std::set<ep_type>& targets, channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
+	void server::do_keep_alive(const ep_type& host)
 	{
-		// All do_send_data_to_list() calls are done in the session strand so the following is thread-safe.
-		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+		// All do_keep_alive() calls are done in the session strand so the following is thread-safe.
+		const peer_session_map_type::iterator p_session = m_peer_sessions.find(host);
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+		if ((p_session == m_peer_sessions.end()) || !p_session->second.has_current_session())
+		{
+			// The host is scheduled again once a new session gets established.
+			return;
+		}
+
+		// The DATA messages handled by the cipher strands only flag the session as active.
+		if (p_session->second.get_current_session()->reset_remote_activity())
+		{
+			p_session->second.keep_alive();
+		}
 
-		for (auto&& item: m_peer_sessions)
+		if (p_session->second.has_timed_out(SESSION_TIMEOUT))
 		{
-			if (targets.count(item.first) > 0)
+			index_session(host, boost::shared_ptr<peer_session::current_session_type>());
+
+			if (p_session->second.clear())
 			{
-				do_send_data_to_session(item.second, item.first, channel_number, data, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
+				if (m_session_lost_handler)
+				{
+					m_session_lost_handler(host, session_loss_reason::timeout);
+				}
 			}
+
+			return;
 		}
-	}
 
-	void server::do_send_data_to_all(channel_number_type channel_number, boost::asio::const_buffer data, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_data_to_all() calls are done in the session strand so the following is thread-safe.
-		do_send_data_to_list(get_session_endpoints(), channel_number, data, handler);
+		// The data sent during the last period already kept the session alive on the host side.
+		if (!p_session->second.reset_data_sent())
+		{
+			do_send_keep_alive(host, SESSION_KEEP_ALIVE_DATA_SIZE, false, &null_simple_handler);
+		}
+
+		schedule_keep_alive(host, p_session->second, SESSION_KEEP_ALIVE_PERIOD);
 	}
 
-	void server::do_send_data_to_session(peer_session& p_session, const ep_type& target, channel_number_type channel_number, boost::asio::const_buffer data, simple_handler_type handler)
+	void server::do_send_keep_alive(const ep_type& target, size_t random_len, bool dont_fragment, simple_handler_type handler)
 	{
-		// All do_send_data_to_session() calls are done in the session strand so the following is thread-safe.
+		// All do_send_keep_alive() calls are done in the same strand so the following is thread-safe.
 		if (!m_socket.is_open())
 		{
 			handler(server_error::server_offline);
@@ -2053,6 +3403,8 @@ namespace fscp
 			return;
 		}
 
+		peer_session& p_session = m_peer_sessions[target];
+
 		if (!p_session.has_current_session())
 		{
 			handler(server_error::no_session_for_host);
@@ -2060,472 +3412,488 @@ namespace fscp
 			return;
 		}
 
-		// Get either a new buffer or an old, recycled one if possible.
-		const SharedBuffer send_buffer = m_session_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_session_buffers.front();
-			m_session_buffers.pop_front();
+		const sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		const boost::shared_ptr<peer_session::current_session_type> session = p_session.get_current_session();
 
-			return result;
-		}();
+		async_cipher(target, [this, target, sequence_number, session, random_len, dont_fragment, handler] () {
+			const auto send_buffer = SharedBuffer(data_message::get_write_buffer_size(random_len));
 
-		try
-		{
-			const size_t size = data_message::write(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				channel_number,
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				buffer_cast<const uint8_t*>(data),
-				buffer_size(data),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			try
+			{
+				const size_t size = data_message::write_keep_alive(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					sequence_number,
+					session->local_cipher_context,
+					random_len, // This is the count of random data to send.
+					buffer_cast<const uint8_t*>(session->local_nonce_prefix),
+					buffer_size(session->local_nonce_prefix)
+				);
 
-			async_send_to(
-				SharedBuffer(send_buffer, [this](const SharedBuffer& buffer) {
-					m_session_strand.post([this, buffer]() {
-						m_session_buffers.push_back(buffer);
-					});
-				}),
-				size,
-				target,
-				handler
-			);
-		}
-		catch (const boost::system::system_error& ex)
-		{
-			handler(ex.code());
-		}
+				if (dont_fragment)
+				{
+					m_probe_listener->strand.post(boost::bind(&server::do_send_path_mtu_probe, this, send_buffer, size, target, handler));
+				}
+				else
+				{
+					async_send_to(
+						send_buffer,
+						size,
+						target,
+						handler
+					);
+				}
+			}
+			catch (const boost::system::system_error& ex)
+			{
+				handler(ex.code());
+			}
+		});
 	}
 
-	void server::do_send_contact_request(const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
+	void server::do_check_path_mtu(const boost::system::error_code& ec)
 	{
-		// All do_send_contact_request() calls are done in the session strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[target];
+		// All do_check_path_mtu() calls are done in the session strand so the following is thread-safe.
+		if (ec != boost::asio::error::operation_aborted)
+		{
+			const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
 
-		do_send_contact_request_to_session(p_session, target, hash_list, handler);
+			for (auto&& p_session: m_peer_sessions)
+			{
+				if (p_session.second.has_current_session())
+				{
+					do_probe_path_mtu(p_session.first, p_session.second, now);
+				}
+			}
+
+			m_path_mtu_timer.expires_from_now(PATH_MTU_PROBE_PERIOD);
+			m_path_mtu_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_path_mtu, this, boost::asio::placeholders::error)));
+		}
 	}
 
-	void server::do_send_contact_request_to_list(const std::set<ep_type>& targets, const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
+	void server::do_probe_path_mtu(const ep_type& target, peer_session& p_session, const boost::posix_time::ptime& now)
 	{
-		// All do_send_contact_request_to_list() calls are done in the same strand so the following is thread-safe.
-		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+		// All do_probe_path_mtu() calls are done in the session strand so the following is thread-safe.
+		path_mtu_discovery& discovery = p_session.path_mtu_discovery();
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+		const path_mtu_discovery::state_type state = discovery.state();
+		const size_t path_mtu = discovery.path_mtu();
+		const size_t probe_size = discovery.get_probe_size(now);
 
-		for (auto&& item: m_peer_sessions)
+		if (discovery.path_mtu() != path_mtu)
 		{
-			if (targets.count(item.first) > 0)
+			if (m_path_mtu_changed_handler)
 			{
-				do_send_contact_request_to_session(item.second, item.first, hash_list, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
+				m_path_mtu_changed_handler(target, discovery.path_mtu());
 			}
 		}
-	}
 
-	void server::do_send_contact_request_to_all(const hash_list_type& hash_list, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_contact_request_to_all() calls are done in the same strand so the following is thread-safe.
-		do_send_contact_request_to_list(get_session_endpoints(), hash_list, handler);
+		if (discovery.state() != state)
+		{
+			if (discovery.state() == path_mtu_discovery::state_type::complete)
+			{
+				m_logger(log_level::information) << "The path MTU to " << target << " is " << discovery.path_mtu() << " byte(s).";
+			}
+			else if (discovery.state() == path_mtu_discovery::state_type::disabled)
+			{
+				m_logger(log_level::debug) << target << " does not acknowledge path MTU probes.";
+			}
+		}
+
+		if (probe_size > 0)
+		{
+			// The probe is a keep-alive message, padded to the probe size.
+			do_send_keep_alive(target, probe_size - data_message::get_message_size(0), true, m_session_strand.wrap(boost::bind(&server::handle_send_path_mtu_probe, this, target, probe_size, boost::asio::placeholders::error)));
+		}
 	}
 
-	void server::do_send_contact_request_to_session(peer_session& p_session, const ep_type& target, const hash_list_type& hash_list, simple_handler_type handler)
+	void server::handle_send_path_mtu_probe(const ep_type& target, size_t probe_size, const boost::system::error_code& ec)
 	{
-		// All do_send_contact_request_to_session() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
+		// All handle_send_path_mtu_probe() calls are done in the session strand so the following is thread-safe.
+		if (ec == boost::asio::error::message_size)
 		{
-			handler(server_error::server_offline);
+			// The probe does not even fit the local link: there is no need to wait for it.
+			const peer_session_map_type::iterator p_session = m_peer_sessions.find(target);
 
-			return;
+			if ((p_session != m_peer_sessions.end()) && p_session->second.has_current_session())
+			{
+				const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+				if (p_session->second.path_mtu_discovery().reject_probe(probe_size, now))
+				{
+					do_probe_path_mtu(target, p_session->second, now);
+				}
+			}
 		}
+	}
 
-		if (!p_session.has_current_session())
+	void server::do_send_path_mtu(const ep_type& target, peer_session& p_session, size_t path_mtu)
+	{
+		// All do_send_path_mtu() calls are done in the session strand so the following is thread-safe.
+		if (!m_socket.is_open())
 		{
-			handler(server_error::no_session_for_host);
-
 			return;
 		}
 
-		const auto send_buffer = SharedBuffer(65536);
-
-		try
-		{
-			const size_t size = data_message::write_contact_request(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				hash_list,
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+		const sequence_number_type sequence_number = p_session.increment_local_sequence_number();
+		const boost::shared_ptr<peer_session::current_session_type> session = p_session.get_current_session();
 
-			async_send_to(
-				send_buffer,
-				size,
-				target,
-				handler
-			);
-		}
-		catch (const boost::system::system_error& ex)
-		{
-			handler(ex.code());
-		}
-	}
+		async_cipher(target, [this, target, sequence_number, session, path_mtu] () {
+			const auto send_buffer = SharedBuffer(data_message::get_write_buffer_size(sizeof(uint16_t)));
 
-	void server::do_send_contact(const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
-	{
-		// All do_send_contact() calls are done in the same strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[target];
+			try
+			{
+				const size_t size = data_message::write_path_mtu(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					sequence_number,
+					session->local_cipher_context,
+					path_mtu,
+					buffer_cast<const uint8_t*>(session->local_nonce_prefix),
+					buffer_size(session->local_nonce_prefix)
+				);
 
-		do_send_contact_to_session(p_session, target, contact_map, handler);
+				async_send_to(
+					send_buffer,
+					size,
+					target,
+					&null_simple_handler
+				);
+			}
+			catch (const boost::system::system_error& ex)
+			{
+				m_logger(log_level::warning) << "Unable to acknowledge a path MTU probe from " << target << ": " << ex.what();
+			}
+		});
 	}
 
-	void server::do_send_contact_to_list(const std::set<ep_type>& targets, const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
+	void server::do_handle_path_mtu(const ep_type& sender, peer_session& p_session, size_t path_mtu)
 	{
-		// All do_send_contact_to_list() calls are done in the same strand so the following is thread-safe.
-		typedef results_gatherer<ep_type, boost::system::error_code, multiple_endpoints_handler_type> results_gatherer_type;
+		// All do_handle_path_mtu() calls are done in the session strand so the following is thread-safe.
+		path_mtu_discovery& discovery = p_session.path_mtu_discovery();
 
-		boost::shared_ptr<results_gatherer_type> rg = boost::make_shared<results_gatherer_type>(handler, targets);
+		const size_t previous_path_mtu = discovery.path_mtu();
+		const bool acknowledged = discovery.acknowledge_probe(path_mtu);
 
-		for (auto&& item: m_peer_sessions)
+		if (discovery.path_mtu() != previous_path_mtu)
 		{
-			if (targets.count(item.first) > 0)
+			if (m_path_mtu_changed_handler)
 			{
-				do_send_contact_to_session(item.second, item.first, contact_map, boost::bind(&results_gatherer_type::gather, rg, item.first, _1));
+				m_path_mtu_changed_handler(sender, discovery.path_mtu());
 			}
 		}
-	}
 
-	void server::do_send_contact_to_all(const contact_map_type& contact_map, multiple_endpoints_handler_type handler)
-	{
-		// All do_send_contact_to_all() calls are done in the same strand so the following is thread-safe.
-		do_send_contact_to_list(get_session_endpoints(), contact_map, handler);
+		if (acknowledged)
+		{
+			// The search goes on at the pace of the acknowledgments.
+			do_probe_path_mtu(sender, p_session, boost::posix_time::microsec_clock::universal_time());
+		}
 	}
 
-	void server::do_send_contact_to_session(peer_session& p_session, const ep_type& target, const contact_map_type& contact_map, simple_handler_type handler)
+	void server::do_set_path_mtu_changed_callback(path_mtu_changed_handler_type callback, void_handler_type handler)
 	{
-		// All do_send_contact_to_session() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
-		{
-			handler(server_error::server_offline);
+		// All do_set_path_mtu_changed_callback() calls are done in the same strand so the following is thread-safe.
+		set_path_mtu_changed_callback(callback);
 
-			return;
+		if (handler)
+		{
+			handler();
 		}
+	}
 
-		if (!p_session.has_current_session())
-		{
-			handler(server_error::no_session_for_host);
+	bool server::async_handshake_crypto(void_handler_type job)
+	{
+		const boost::posix_time::ptime queued_at = boost::posix_time::microsec_clock::universal_time();
 
-			return;
-		}
+		const void_handler_type timed_job = [this, job, queued_at] () {
+			job();
 
-		const auto send_buffer = SharedBuffer(65536);
+			m_handshake_latencies.observe(static_cast<uint64_t>(std::max<int64_t>((boost::posix_time::microsec_clock::universal_time() - queued_at).total_microseconds(), 0)));
+		};
 
-		try
+		if (!m_handshake_workers)
 		{
-			const size_t size = data_message::write_contact(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				contact_map,
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+			timed_job();
 
-			async_send_to(
-				send_buffer,
-				size,
-				target,
-				handler
-			);
+			return true;
 		}
-		catch (const boost::system::system_error& ex)
+
+		return m_handshake_workers->post(timed_job);
+	}
+
+	bool server::async_generate_keys(void_handler_type job)
+	{
+		if (m_handshake_workers)
 		{
-			handler(ex.code());
+			return m_handshake_workers->post(job);
 		}
+
+		get_io_service().post(job);
+
+		return true;
 	}
 
-	void server::do_handle_data(const identity_store& identity, const ep_type& sender, const data_message& _data_message)
+	void server::do_verify_session_request(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_request_message& _session_request_message, const presentation_store& presentation)
 	{
-		// All do_handle_data() calls are done in the same strand so the following is thread-safe.
-		peer_session& p_session = m_peer_sessions[sender];
+		// This may run on a handshake thread: only the arguments can be accessed.
 
-		if (!p_session.has_current_session())
+		// We make sure the signatures matches.
+		bool check_ok = false;
+
+		try
 		{
-			m_logger(log_level::trace) << "Received a data message from " << sender << " but no session exists. Ignoring.";
+			if (!!presentation.signature_certificate())
+			{
+				check_ok = _session_request_message.check_signature(presentation.signature_certificate().public_key());
+			}
+			else
+			{
+				const auto psk = presentation.pre_shared_key();
+				check_ok = _session_request_message.check_signature(buffer_cast<const uint8_t*>(psk), buffer_size(psk));
+			}
+		}
+		catch (const std::exception& ex)
+		{
+			m_logger(log_level::trace) << "Unable to check the signature of a SESSION_REQUEST from " << sender << ": " << ex.what() << ". Ignoring.";
 
 			return;
 		}
 
-		if (_data_message.sequence_number() <= p_session.current_session().remote_sequence_number)
+		if (!check_ok)
 		{
-			// The message is outdated: we ignore it.
-			m_logger(log_level::trace) << "Received a data message from " << sender << " but its sequence number is outdated (received: " << _data_message.sequence_number() << ", expecting: " << p_session.current_session().remote_sequence_number << "). Ignoring.";
+			m_logger(log_level::trace) << "Received a SESSION_REQUEST from " << sender << " with an invalid signature. Ignoring.";
 
 			return;
 		}
 
-		// Get either a new buffer or an old, recycled one if possible.
-		const SharedBuffer cleartext_buffer = m_session_buffers.empty() ? SharedBuffer(65536) : [this]() {
-			const auto result = m_session_buffers.front();
-			m_session_buffers.pop_front();
+		// The make_shared_buffer_handler() call below is necessary so that the reference to session_request_message remains valid.
+		m_session_strand.post(
+			make_shared_buffer_handler(
+				data,
+				boost::bind(
+					&server::do_handle_verified_session_request,
+					this,
+					identity,
+					sender,
+					_session_request_message
+				)
+			)
+		);
+	}
+
+	void server::do_verify_session(SharedBuffer data, const identity_store& identity, const ep_type& sender, const session_message& _session_message, const presentation_store& presentation)
+	{
+		// This may run on a handshake thread: only the arguments can be accessed.
 
-			return result;
-		}();
+		// We make sure the signatures matches.
+		bool check_ok = false;
 
 		try
 		{
-			const size_t cleartext_len = _data_message.get_cleartext(
-				buffer_cast<uint8_t*>(cleartext_buffer),
-				buffer_size(cleartext_buffer),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				buffer_cast<const uint8_t*>(p_session.current_session().remote_session_key),
-				buffer_size(p_session.current_session().remote_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().remote_nonce_prefix),
-				buffer_size(p_session.current_session().remote_nonce_prefix)
-			);
-
-			p_session.set_remote_sequence_number(_data_message.sequence_number());
-			p_session.keep_alive();
-
-			if (p_session.current_session().is_old())
+			if (!!presentation.signature_certificate())
 			{
-				// do_send_clear_session() and do_handle_data() are to be invoked through the same strand, so this is fine.
-				p_session.prepare_session(p_session.next_session_number(), p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
-				do_send_session(identity, sender, p_session.next_session_parameters());
+				check_ok = _session_message.check_signature(presentation.signature_certificate().public_key());
 			}
-
-			const message_type type = _data_message.type();
-
-			if (type == MESSAGE_TYPE_KEEP_ALIVE)
+			else
 			{
-				// If the message is a keep alive then nothing is to be done and we avoid posting an empty call into the data strand.
-				return;
+				const auto psk = presentation.pre_shared_key();
+				check_ok = _session_message.check_signature(buffer_cast<const uint8_t*>(psk), buffer_size(psk));
 			}
-
-			// This call is fast so we hold on to the data_message a bit longer.
-			do_handle_data_message(
-				sender,
-				type,
-				SharedBuffer(cleartext_buffer, [this] (const SharedBuffer& buffer) {
-					m_session_strand.post([this, buffer] () {
-						m_session_buffers.push_back(buffer);
-					});
-				}),
-				buffer(cleartext_buffer, cleartext_len)
-			);
-		}
-		catch (const boost::system::system_error& ex)
-		{
-			// This can happen if a message is decoded after a session rekeying.
-			m_logger(log_level::error) << "Error deciphering data message from " << sender << ": " << ex.what();
 		}
-	}
-
-	void server::do_handle_data_message(const ep_type& sender, message_type type, SharedBuffer buffer, boost::asio::const_buffer data)
-	{
-		// All do_handle_data_message() calls are done in the same strand as do_handle_data() so the following is thread-safe.
-		// This call should remain *FAST*. That ims, it should only discard the message or trigger some deferred handling by another task.
-
-		if (is_data_message_type(type))
+		catch (const std::exception& ex)
 		{
-			// This is safe only because type is a DATA message type.
-			const channel_number_type channel_number = to_channel_number(type);
+			m_logger(log_level::trace) << "Unable to check the signature of a SESSION from " << sender << ": " << ex.what() << ". Ignoring.";
 
-			if (m_data_received_handler)
-			{
-				m_data_received_handler(sender, channel_number, buffer, data);
-			}
+			return;
 		}
-		else if (type == MESSAGE_TYPE_CONTACT_REQUEST)
+
+		if (!check_ok)
 		{
-			const hash_list_type hash_list = data_message::parse_hash_list(buffer_cast<const uint8_t*>(data), buffer_size(data));
+			m_logger(log_level::trace) << "Received a SESSION from " << sender << " with an invalid signature. Ignoring.";
 
-			m_presentation_strand.post(
-				boost::bind(
-					&server::do_handle_contact_request,
-					this,
-					sender,
-					hash_list
-				)
-			);
+			return;
 		}
-		else if (type == MESSAGE_TYPE_CONTACT)
-		{
-			const contact_map_type contact_map = data_message::parse_contact_map(buffer_cast<const uint8_t*>(data), buffer_size(data));
 
-			m_contact_strand.post(
+		m_session_strand.post(
+			make_shared_buffer_handler(
+				data,
 				boost::bind(
-					&server::do_handle_contact,
+					&server::do_handle_verified_session,
 					this,
+					identity,
 					sender,
-					contact_map
+					_session_message
 				)
-			);
-		}
+			)
+		);
 	}
 
-	void server::do_handle_contact_request(const ep_type& sender, const std::set<hash_type>& hash_list)
+	void server::do_write_session_request(const identity_store& identity, const ep_type& target, session_number_type session_number, const host_identifier_type& local_host_identifier, const cipher_suite_list_type& cipher_suites, const elliptic_curve_list_type& elliptic_curves, simple_handler_type handler)
 	{
-		// All do_handle_contact_request() calls are done in the same strand so the following is thread-safe.
-		contact_map_type contact_map;
+		// This may run on a handshake thread: only the arguments can be accessed.
+		const SharedBuffer send_buffer(65536);
 
-		for (std::set<hash_type>::iterator hash_it = hash_list.begin(); hash_it != hash_list.end(); ++hash_it)
+		try
 		{
-			for (presentation_store_map::const_iterator it = m_presentation_store_map.begin(); it != m_presentation_store_map.end(); ++it)
-			{
-				// Contact requests do not work for PSK authenticated hosts.
-				if (!it->second.signature_certificate())
-				{
-					continue;
-				}
-
-				const boost::optional<hash_type> hash = it->second.signature_certificate_hash();
+			m_logger(log_level::trace) << "Sending session request message to " << target << " (next_session_number: " << session_number << ", local_host_identifier: " << local_host_identifier << ")";
+			size_t size = 0;
 
-				if (hash && (*hash == *hash_it))
-				{
-					if (!m_contact_request_message_received_handler || m_contact_request_message_received_handler(sender, it->second.signature_certificate(), *hash, it->first))
-					{
-						contact_map[*hash_it] = it->first;
-					}
-				}
+			if (!!identity.signature_key())
+			{
+				size = session_request_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					session_number,
+					local_host_identifier,
+					cipher_suites,
+					elliptic_curves,
+					identity.signature_key()
+				);
+			}
+			else
+			{
+				size = session_request_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					session_number,
+					local_host_identifier,
+					cipher_suites,
+					elliptic_curves,
+					buffer_cast<const uint8_t*>(identity.pre_shared_key()),
+					buffer_size(identity.pre_shared_key())
+					);
 			}
-		}
 
-		// Our contact map contains some answers: we send those.
-		if (!contact_map.empty())
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				handler
+			);
+		}
+		catch (const boost::system::system_error& ex)
 		{
-			async_send_contact(sender, contact_map, &null_simple_handler);
+			handler(ex.code());
 		}
 	}
 
-	void server::do_handle_contact(const ep_type& sender, const contact_map_type& contact_map)
+	void server::do_write_session(const identity_store& identity, const ep_type& target, const host_identifier_type& local_host_identifier, const peer_session::session_parameters& parameters)
 	{
-		// All do_handle_contact() calls are done in the same strand so the following is thread-safe.
+		// This may run on a handshake thread: only the arguments can be accessed.
+		const SharedBuffer send_buffer(65536);
 
-		if (m_contact_message_received_handler)
+		try
 		{
-			for (contact_map_type::const_iterator contact_it = contact_map.begin(); contact_it != contact_map.end(); ++contact_it)
+			size_t size = 0;
+
+			if (!!identity.signature_key())
 			{
-				m_contact_message_received_handler(sender, contact_it->first, contact_it->second);
+				size = session_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					parameters.session_number,
+					local_host_identifier,
+					parameters.cipher_suite,
+					parameters.elliptic_curve,
+					buffer_cast<const void*>(parameters.public_key),
+					buffer_size(parameters.public_key),
+					identity.signature_key()
+				);
+			}
+			else
+			{
+				size = session_message::write(
+					buffer_cast<uint8_t*>(send_buffer),
+					buffer_size(send_buffer),
+					parameters.session_number,
+					local_host_identifier,
+					parameters.cipher_suite,
+					parameters.elliptic_curve,
+					buffer_cast<const void*>(parameters.public_key),
+					buffer_size(parameters.public_key),
+					buffer_cast<const uint8_t*>(identity.pre_shared_key()),
+					buffer_size(identity.pre_shared_key())
+				);
 			}
-		}
-	}
-
-	void server::do_set_data_received_callback(data_received_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_data_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_data_received_callback(callback);
 
-		if (handler)
+			async_send_to(
+				send_buffer,
+				size,
+				target,
+				[] (const boost::system::error_code&) {}
+			);
+		}
+		catch (const boost::system::system_error& ex)
 		{
-			handler();
+			m_logger(log_level::error) << "Error sending session to " << target << ": " << ex.what() << ".";
 		}
 	}
 
-	void server::do_set_contact_request_received_callback(contact_request_received_handler_type callback, void_handler_type handler)
+	void server::do_derive_session(const identity_store& identity, const ep_type& sender, bool session_is_new, boost::shared_ptr<peer_session::next_session_type> next_session, const host_identifier_type& local_host_identifier, const host_identifier_type& remote_host_identifier, const cryptoplus::buffer& remote_public_key)
 	{
-		// All do_set_contact_request_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_contact_request_received_callback(callback);
+		// This may run on a handshake thread: only the arguments can be accessed.
+		boost::shared_ptr<peer_session::current_session_type> session;
+		std::exception_ptr error;
 
-		if (handler)
+		try
 		{
-			handler();
+			session = peer_session::derive_session(*next_session, local_host_identifier, remote_host_identifier, buffer_cast<const void*>(remote_public_key), buffer_size(remote_public_key));
 		}
-	}
-
-	void server::do_set_contact_received_callback(contact_received_handler_type callback, void_handler_type handler)
-	{
-		// All do_set_contact_received_callback() calls are done in the same strand so the following is thread-safe.
-		set_contact_received_callback(callback);
-
-		if (handler)
+		catch (const std::exception&)
 		{
-			handler();
+			error = std::current_exception();
 		}
+
+		// When there are no handshake threads, we are already in the session strand: the session is completed right away.
+		m_session_strand.dispatch(boost::bind(&server::do_complete_session, this, identity, sender, session_is_new, next_session, session, error));
 	}
 
-	void server::do_check_keep_alive(const boost::system::error_code& ec)
+	void server::do_complete_session(const identity_store& identity, const ep_type& sender, bool session_is_new, boost::shared_ptr<peer_session::next_session_type> next_session, boost::shared_ptr<peer_session::current_session_type> session, std::exception_ptr error)
 	{
-		// All do_check_keep_alive() calls are done in the same strand so the following is thread-safe.
-		if (ec != boost::asio::error::operation_aborted)
+		// All do_complete_session() calls are done in the session strand so the following is thread-safe.
+		if (error)
 		{
-			for (auto&& p_session: m_peer_sessions)
+			try
 			{
-				if (p_session.second.has_timed_out(SESSION_TIMEOUT))
-				{
-					if (p_session.second.clear())
-					{
-						if (m_session_lost_handler)
-						{
-							m_session_lost_handler(p_session.first, session_loss_reason::timeout);
-						}
-					}
-				}
-				else
+				std::rethrow_exception(error);
+			}
+			catch (const std::exception& ex)
+			{
+				m_logger(log_level::error) << "Exception while computing the session keys with " << sender << ": " << ex.what() << ".";
+
+				if (m_session_error_handler)
 				{
-					do_send_keep_alive(p_session.first, &null_simple_handler);
+					m_session_error_handler(sender, session_is_new, ex);
 				}
 			}
 
-			m_keep_alive_timer.expires_from_now(SESSION_KEEP_ALIVE_PERIOD);
-			m_keep_alive_timer.async_wait(m_session_strand.wrap(boost::bind(&server::do_check_keep_alive, this, boost::asio::placeholders::error)));
-		}
-	}
-
-	void server::do_send_keep_alive(const ep_type& target, simple_handler_type handler)
-	{
-		// All do_send_keep_alive() calls are done in the same strand so the following is thread-safe.
-		if (!m_socket.is_open())
-		{
-			handler(server_error::server_offline);
-
 			return;
 		}
 
-		peer_session& p_session = m_peer_sessions[target];
+		peer_session& p_session = m_peer_sessions[sender];
 
-		if (!p_session.has_current_session())
+		if (!p_session.install_session(next_session, session))
 		{
-			handler(server_error::no_session_for_host);
+			m_logger(log_level::trace) << "Computed the session keys with " << sender << " but the session in preparation changed in the meantime. Ignoring.";
 
 			return;
 		}
 
-		const auto send_buffer = SharedBuffer(1024);
+		index_session(sender, p_session.get_current_session());
 
-		try
-		{
-			const size_t size = data_message::write_keep_alive(
-				buffer_cast<uint8_t*>(send_buffer),
-				buffer_size(send_buffer),
-				p_session.increment_local_sequence_number(),
-				p_session.current_session().parameters.cipher_suite.to_cipher_algorithm(),
-				SESSION_KEEP_ALIVE_DATA_SIZE, // This is the count of random data to send.
-				buffer_cast<const uint8_t*>(p_session.current_session().local_session_key),
-				buffer_size(p_session.current_session().local_session_key),
-				buffer_cast<const uint8_t*>(p_session.current_session().local_nonce_prefix),
-				buffer_size(p_session.current_session().local_nonce_prefix)
-			);
+		m_logger(log_level::trace) << "Session established with " << sender << ". Sending acknowledgement session message back.";
 
-			async_send_to(
-				send_buffer,
-				size,
-				target,
-				handler
-			);
+		if (!m_keep_alive_wheel.is_scheduled(p_session.keep_alive_handle()))
+		{
+			// The first keep-alive of a host is delayed by an offset that depends on its endpoint, which spreads the keep-alives of all the hosts over the period.
+			schedule_keep_alive(sender, p_session, boost::posix_time::milliseconds(static_cast<int64_t>(hash_endpoint(sender) % static_cast<size_t>(SESSION_KEEP_ALIVE_PERIOD.total_milliseconds()))));
 		}
-		catch (const boost::system::system_error& ex)
+
+		do_send_session(identity, sender, p_session.current_session_parameters());
+
+		if (m_session_established_handler)
 		{
-			handler(ex.code());
+			m_session_established_handler(sender, session_is_new, p_session.current_session().parameters.cipher_suite, p_session.current_session().parameters.elliptic_curve);
 		}
 	}
 
@@ -86,6 +86,10 @@ namespace fscp
 			{
 				return "No session is available for the specified host";
 			}
+			case server_error::handshake_queue_full:
+			{
+				return "Too many handshakes are pending";
+			}
 			default:
 			{
 				return "Unknown FSCP error";
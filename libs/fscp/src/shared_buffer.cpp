@@ -44,6 +44,230 @@
 
 #include "shared_buffer.hpp"
 
+#include <boost/lockfree/stack.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <cassert>
+#include <new>
+
 namespace fscp
 {
+	namespace
+	{
+		// Keep-alive and control messages, MTU-sized frames and full-sized datagrams (or tap adapter GSO frames, with their headers).
+		const size_t BLOCK_SIZES[buffer_pool::SIZE_CLASSES_COUNT] = { 256, 2048, 65536 + 1024 };
+
+		// The maximum number of free blocks retained globally, per size class.
+		const size_t GLOBAL_FREE_LIST_CAPACITY = 1024;
+
+		// The maximum number of free blocks retained by each thread, per size class.
+		const size_t THREAD_CACHE_CAPACITY = 64;
+
+		struct size_class_type
+		{
+			size_class_type() :
+				free_list(),
+				blocks(0),
+				blocks_in_use(0),
+				cache_hits(0),
+				global_hits(0),
+				misses(0)
+			{}
+
+			boost::lockfree::stack<buffer_block*, boost::lockfree::capacity<GLOBAL_FREE_LIST_CAPACITY> > free_list;
+			std::atomic<uint64_t> blocks;
+			std::atomic<uint64_t> blocks_in_use;
+			std::atomic<uint64_t> cache_hits;
+			std::atomic<uint64_t> global_hits;
+			std::atomic<uint64_t> misses;
+		};
+
+		buffer_block* create_block(size_t size_class, size_t capacity)
+		{
+			void* const memory = ::operator new(sizeof(buffer_block) + capacity);
+
+			return new (memory) buffer_block(size_class, capacity);
+		}
+
+		void destroy_block(buffer_block* block)
+		{
+			block->~buffer_block();
+			::operator delete(block);
+		}
+
+		size_class_type* get_size_classes()
+		{
+			// The size classes are never destroyed, so that buffers released during the static destruction remain valid.
+			static size_class_type* const size_classes = new size_class_type[buffer_pool::SIZE_CLASSES_COUNT];
+
+			return size_classes;
+		}
+
+		class thread_cache
+		{
+			public:
+
+				~thread_cache()
+				{
+					size_class_type* const size_classes = get_size_classes();
+
+					for (size_t size_class = 0; size_class < buffer_pool::SIZE_CLASSES_COUNT; ++size_class)
+					{
+						for (auto&& block : m_blocks[size_class])
+						{
+							if (!size_classes[size_class].free_list.bounded_push(block))
+							{
+								size_classes[size_class].blocks.fetch_sub(1, std::memory_order_relaxed);
+								destroy_block(block);
+							}
+						}
+					}
+				}
+
+				buffer_block* pop(size_t size_class)
+				{
+					std::vector<buffer_block*>& blocks = m_blocks[size_class];
+
+					if (blocks.empty())
+					{
+						return nullptr;
+					}
+
+					buffer_block* const block = blocks.back();
+					blocks.pop_back();
+
+					return block;
+				}
+
+				bool push(size_t size_class, buffer_block* block)
+				{
+					std::vector<buffer_block*>& blocks = m_blocks[size_class];
+
+					if (blocks.size() >= THREAD_CACHE_CAPACITY)
+					{
+						return false;
+					}
+
+					if (blocks.capacity() == 0)
+					{
+						blocks.reserve(THREAD_CACHE_CAPACITY);
+					}
+
+					blocks.push_back(block);
+
+					return true;
+				}
+
+			private:
+
+				std::vector<buffer_block*> m_blocks[buffer_pool::SIZE_CLASSES_COUNT];
+		};
+
+		thread_cache& get_thread_cache()
+		{
+			static boost::thread_specific_ptr<thread_cache>* const cache = new boost::thread_specific_ptr<thread_cache>();
+
+			if (!cache->get())
+			{
+				cache->reset(new thread_cache());
+			}
+
+			return *cache->get();
+		}
+	}
+
+	size_t buffer_pool::get_block_size(size_t size_class)
+	{
+		assert(size_class < SIZE_CLASSES_COUNT);
+
+		return BLOCK_SIZES[size_class];
+	}
+
+	buffer_block* buffer_pool::allocate(size_t size)
+	{
+		size_t size_class = 0;
+
+		while ((size_class < SIZE_CLASSES_COUNT) && (size > BLOCK_SIZES[size_class]))
+		{
+			++size_class;
+		}
+
+		if (size_class == SIZE_CLASSES_COUNT)
+		{
+			return create_block(UNPOOLED_SIZE_CLASS, size);
+		}
+
+		size_class_type& sc = get_size_classes()[size_class];
+		sc.blocks_in_use.fetch_add(1, std::memory_order_relaxed);
+
+		buffer_block* block = get_thread_cache().pop(size_class);
+
+		if (block)
+		{
+			sc.cache_hits.fetch_add(1, std::memory_order_relaxed);
+		}
+		else if (sc.free_list.pop(block))
+		{
+			sc.global_hits.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			sc.misses.fetch_add(1, std::memory_order_relaxed);
+			sc.blocks.fetch_add(1, std::memory_order_relaxed);
+
+			return create_block(size_class, BLOCK_SIZES[size_class]);
+		}
+
+		block->references.store(1, std::memory_order_relaxed);
+
+		return block;
+	}
+
+	void buffer_pool::release(buffer_block* block)
+	{
+		assert(block);
+
+		const size_t size_class = block->size_class;
+
+		if (size_class == UNPOOLED_SIZE_CLASS)
+		{
+			destroy_block(block);
+
+			return;
+		}
+
+		size_class_type& sc = get_size_classes()[size_class];
+		sc.blocks_in_use.fetch_sub(1, std::memory_order_relaxed);
+
+		if (!get_thread_cache().push(size_class, block) && !sc.free_list.bounded_push(block))
+		{
+			sc.blocks.fetch_sub(1, std::memory_order_relaxed);
+			destroy_block(block);
+		}
+	}
+
+	std::vector<buffer_pool::statistics_type> buffer_pool::get_statistics()
+	{
+		std::vector<statistics_type> result;
+		result.reserve(SIZE_CLASSES_COUNT);
+
+		const size_class_type* const size_classes = get_size_classes();
+
+		for (size_t size_class = 0; size_class < SIZE_CLASSES_COUNT; ++size_class)
+		{
+			const size_class_type& sc = size_classes[size_class];
+
+			statistics_type statistics;
+			statistics.block_size = BLOCK_SIZES[size_class];
+			statistics.blocks = sc.blocks.load(std::memory_order_relaxed);
+			statistics.blocks_in_use = sc.blocks_in_use.load(std::memory_order_relaxed);
+			statistics.cache_hits = sc.cache_hits.load(std::memory_order_relaxed);
+			statistics.global_hits = sc.global_hits.load(std::memory_order_relaxed);
+			statistics.misses = sc.misses.load(std::memory_order_relaxed);
+
+			result.push_back(statistics);
+		}
+
+		return result;
+	}
 }
@@ -0,0 +1,401 @@
+/*
+ * libfscp - C++ portable OpenSSL cryptographic wrapper library.
+ * Copyright (C) 2010-2011 Julien Kauffmann <julien.kauffmann@freelan.org>
+ *
+ * This file is part of libfscp.
+ *
+ * libfscp is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libfscp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ *
+ * If you intend to use libfscp in a commercial software, please
+ * contact me : we may arrange this for a small fee or no fee at all,
+ * depending on the nature of your project.
+ */
+
+/**
+ * \file uring_receiver.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief An io_uring based datagram receiver.
+ */
+
+#include "uring_receiver.hpp"
+
+#ifdef LINUX
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace fscp
+{
+	namespace
+	{
+		const uint16_t BUFFER_GROUP_ID = 0;
+		const unsigned SUBMISSION_QUEUE_ENTRIES = 4;
+		const size_t MAX_BUFFERS_COUNT = 32768;
+
+		void throw_system_error(int error)
+		{
+			throw boost::system::system_error(error, boost::system::system_category());
+		}
+
+		int io_uring_setup(unsigned entries, ::io_uring_params* params)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+		}
+
+		int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0));
+		}
+
+		int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+		}
+
+		template <typename Type>
+		Type* ring_pointer(void* base, uint32_t offset)
+		{
+			return reinterpret_cast<Type*>(static_cast<uint8_t*>(base) + offset);
+		}
+
+		size_t round_up_to_power_of_two(size_t value)
+		{
+			size_t result = 1;
+
+			while (result < value)
+			{
+				result <<= 1;
+			}
+
+			return result;
+		}
+	}
+
+	uring_receiver::uring_receiver(boost::asio::io_service& io_service, int socket, size_t buffers_count, size_t buffer_size) :
+		m_event_descriptor(io_service),
+		m_socket(socket),
+		m_ring_fd(-1),
+		m_buffer_size(buffer_size),
+		m_rings(MAP_FAILED),
+		m_rings_size(0),
+		m_sqes(static_cast<::io_uring_sqe*>(MAP_FAILED)),
+		m_sqes_size(0),
+		m_sq_tail(NULL),
+		m_sq_mask(0),
+		m_sq_array(NULL),
+		m_cq_head(NULL),
+		m_cq_tail(NULL),
+		m_cq_mask(0),
+		m_cqes(NULL),
+		m_buffer_ring(static_cast<::io_uring_buf*>(MAP_FAILED)),
+		m_buffer_ring_size(0),
+		m_buffer_ring_tail(0),
+		m_buffers(),
+		m_msghdr(),
+		m_armed(false)
+	{
+		buffers_count = round_up_to_power_of_two(std::min(std::max(buffers_count, static_cast<size_t>(1)), MAX_BUFFERS_COUNT));
+
+		try
+		{
+			// Every buffer may complete before we get a chance to reap it: the completion ring must be able to hold all of them.
+			::io_uring_params params = {};
+			params.flags = IORING_SETUP_CQSIZE;
+			params.cq_entries = static_cast<uint32_t>(buffers_count * 2);
+
+			m_ring_fd = io_uring_setup(SUBMISSION_QUEUE_ENTRIES, &params);
+
+			if (m_ring_fd < 0)
+			{
+				throw_system_error(errno);
+			}
+
+			if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+			{
+				throw_system_error(EOPNOTSUPP);
+			}
+
+			m_rings_size = std::max(
+				params.sq_off.array + params.sq_entries * sizeof(unsigned),
+				params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe)
+			);
+
+			m_rings = ::mmap(NULL, m_rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+
+			if (m_rings == MAP_FAILED)
+			{
+				throw_system_error(errno);
+			}
+
+			m_sqes_size = params.sq_entries * sizeof(::io_uring_sqe);
+			m_sqes = static_cast<::io_uring_sqe*>(::mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES));
+
+			if (m_sqes == MAP_FAILED)
+			{
+				throw_system_error(errno);
+			}
+
+			m_sq_tail = ring_pointer<unsigned>(m_rings, params.sq_off.tail);
+			m_sq_mask = *ring_pointer<unsigned>(m_rings, params.sq_off.ring_mask);
+			m_sq_array = ring_pointer<unsigned>(m_rings, params.sq_off.array);
+			m_cq_head = ring_pointer<unsigned>(m_rings, params.cq_off.head);
+			m_cq_tail = ring_pointer<unsigned>(m_rings, params.cq_off.tail);
+			m_cq_mask = *ring_pointer<unsigned>(m_rings, params.cq_off.ring_mask);
+			m_cqes = ring_pointer<::io_uring_cqe>(m_rings, params.cq_off.cqes);
+
+			// The provided buffer ring must be page-aligned: an anonymous mapping is. Its tail overlaps the reserved field of the first entry.
+			m_buffer_ring_size = buffers_count * sizeof(::io_uring_buf);
+			m_buffer_ring = static_cast<::io_uring_buf*>(::mmap(NULL, m_buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+			if (m_buffer_ring == MAP_FAILED)
+			{
+				throw_system_error(errno);
+			}
+
+			::io_uring_buf_reg buffer_registration = {};
+			buffer_registration.ring_addr = reinterpret_cast<uint64_t>(m_buffer_ring);
+			buffer_registration.ring_entries = static_cast<uint32_t>(buffers_count);
+			buffer_registration.bgid = BUFFER_GROUP_ID;
+
+			if (io_uring_register(m_ring_fd, IORING_REGISTER_PBUF_RING, &buffer_registration, 1) != 0)
+			{
+				throw_system_error(errno);
+			}
+
+			m_buffers.reserve(buffers_count);
+
+			for (size_t i = 0; i < buffers_count; ++i)
+			{
+				m_buffers.push_back(SharedBuffer(m_buffer_size));
+				add_buffer(static_cast<uint16_t>(i));
+			}
+
+			const int event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+			if (event_fd < 0)
+			{
+				throw_system_error(errno);
+			}
+
+			// The descriptor takes ownership of event_fd.
+			m_event_descriptor.assign(event_fd);
+
+			if (io_uring_register(m_ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) != 0)
+			{
+				throw_system_error(errno);
+			}
+
+			// The kernel only needs to know how much room to reserve in front of the payload.
+			m_msghdr.msg_namelen = sizeof(::sockaddr_in6);
+
+			submit_receive();
+		}
+		catch (...)
+		{
+			release();
+
+			throw;
+		}
+	}
+
+	uring_receiver::~uring_receiver()
+	{
+		release();
+	}
+
+	size_t uring_receiver::process(const datagram_handler_type& handler)
+	{
+		// Reset the eventfd counter before reaping so that any later completion signals it again.
+		uint64_t events = 0;
+
+		if (::read(m_event_descriptor.native_handle(), &events, sizeof(events)) < 0)
+		{
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+			{
+				throw_system_error(errno);
+			}
+		}
+
+		size_t count = 0;
+		int error = 0;
+		unsigned head = *m_cq_head;
+		const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+		for (; head != tail; ++head)
+		{
+			const ::io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+
+			if (!(cqe.flags & IORING_CQE_F_MORE))
+			{
+				m_armed = false;
+			}
+
+			if (!(cqe.flags & IORING_CQE_F_BUFFER))
+			{
+				// ENOBUFS means we did not give buffers back fast enough: the request must simply be posted again.
+				if ((cqe.res < 0) && (cqe.res != -ENOBUFS) && (error == 0))
+				{
+					error = -cqe.res;
+				}
+
+				continue;
+			}
+
+			const uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			const SharedBuffer data = m_buffers[bid];
+
+			// The buffer was handed over: we replace it with another one from the pool.
+			m_buffers[bid] = SharedBuffer(m_buffer_size);
+			add_buffer(bid);
+
+			if (cqe.res < 0)
+			{
+				continue;
+			}
+
+			uint8_t* const base = buffer_cast<uint8_t*>(data);
+			const ::io_uring_recvmsg_out* const out = reinterpret_cast<const ::io_uring_recvmsg_out*>(base);
+			const size_t payload_offset = sizeof(::io_uring_recvmsg_out) + m_msghdr.msg_namelen + m_msghdr.msg_controllen;
+
+			if ((out->flags & MSG_TRUNC) || (payload_offset + out->payloadlen > static_cast<size_t>(cqe.res)))
+			{
+				continue;
+			}
+
+			ep_type sender;
+			const size_t sender_size = std::min(static_cast<size_t>(out->namelen), static_cast<size_t>(m_msghdr.msg_namelen));
+			std::memcpy(sender.data(), base + sizeof(::io_uring_recvmsg_out), sender_size);
+			sender.resize(sender_size);
+
+			// Messages are parsed from the start of their buffer.
+			std::memmove(base, base + payload_offset, out->payloadlen);
+
+			handler(sender, data, out->payloadlen);
+			++count;
+		}
+
+		__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+		// Make the replenished buffers visible to the kernel at once.
+		__atomic_store_n(&m_buffer_ring->resv, m_buffer_ring_tail, __ATOMIC_RELEASE);
+
+		if (error != 0)
+		{
+			throw_system_error(error);
+		}
+
+		if (!m_armed)
+		{
+			submit_receive();
+		}
+
+		return count;
+	}
+
+	void uring_receiver::cancel()
+	{
+		m_event_descriptor.cancel();
+	}
+
+	void uring_receiver::release()
+	{
+		// Closing the ring cancels the receive request: the kernel stops writing into our buffers.
+		if (m_ring_fd >= 0)
+		{
+			::close(m_ring_fd);
+			m_ring_fd = -1;
+		}
+
+		if (m_buffer_ring != MAP_FAILED)
+		{
+			::munmap(m_buffer_ring, m_buffer_ring_size);
+			m_buffer_ring = static_cast<::io_uring_buf*>(MAP_FAILED);
+		}
+
+		if (m_sqes != MAP_FAILED)
+		{
+			::munmap(m_sqes, m_sqes_size);
+			m_sqes = static_cast<::io_uring_sqe*>(MAP_FAILED);
+		}
+
+		if (m_rings != MAP_FAILED)
+		{
+			::munmap(m_rings, m_rings_size);
+			m_rings = MAP_FAILED;
+		}
+	}
+
+
+	void uring_receiver::add_buffer(uint16_t bid)
+	{
+		const unsigned mask = static_cast<unsigned>(m_buffer_ring_size / sizeof(::io_uring_buf) - 1);
+		::io_uring_buf& entry = m_buffer_ring[m_buffer_ring_tail & mask];
+
+		entry.addr = reinterpret_cast<uint64_t>(buffer_cast<uint8_t*>(m_buffers[bid]));
+		entry.len = static_cast<uint32_t>(m_buffer_size);
+		entry.bid = bid;
+
+		++m_buffer_ring_tail;
+	}
+
+	void uring_receiver::submit_receive()
+	{
+		// Buffers added by the constructor are published here as well.
+		__atomic_store_n(&m_buffer_ring->resv, m_buffer_ring_tail, __ATOMIC_RELEASE);
+
+		const unsigned tail = *m_sq_tail;
+		const unsigned index = tail & m_sq_mask;
+		::io_uring_sqe& sqe = m_sqes[index];
+
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_RECVMSG;
+		sqe.fd = m_socket;
+		sqe.addr = reinterpret_cast<uint64_t>(&m_msghdr);
+		sqe.len = 1;
+		sqe.flags = IOSQE_BUFFER_SELECT;
+		sqe.buf_group = BUFFER_GROUP_ID;
+		sqe.ioprio = IORING_RECV_MULTISHOT;
+
+		m_sq_array[index] = index;
+		__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+		if (io_uring_enter(m_ring_fd, 1, 0, 0) < 0)
+		{
+			throw_system_error(errno);
+		}
+
+		m_armed = true;
+	}
+}
+
+#endif
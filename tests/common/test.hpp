@@ -0,0 +1,98 @@
+/**
+ * \file test.hpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief The helpers shared by the tests.
+ */
+
+#ifndef TEST_HPP
+#define TEST_HPP
+
+#include <boost/thread/thread.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+namespace test
+{
+	/**
+	 * \brief Gathers the results of the checks of a test.
+	 */
+	class checker
+	{
+		public:
+
+			/**
+			 * \brief Create a checker for which no check failed.
+			 */
+			checker() :
+				m_success(true)
+			{}
+
+			/**
+			 * \brief Check a condition.
+			 * \param condition The condition.
+			 * \param message The message to report on the error output if condition is false.
+			 * \return condition.
+			 */
+			bool operator()(bool condition, const char* message)
+			{
+				if (!condition)
+				{
+					std::cerr << "Failure: " << message << std::endl;
+
+					m_success = false;
+				}
+
+				return condition;
+			}
+
+			/**
+			 * \brief Check if all the checks succeeded so far.
+			 * \return true if no check failed.
+			 */
+			bool success() const
+			{
+				return m_success;
+			}
+
+			/**
+			 * \brief Get the exit code of the test.
+			 * \return EXIT_SUCCESS if no check failed, EXIT_FAILURE otherwise.
+			 */
+			int result() const
+			{
+				return m_success ? EXIT_SUCCESS : EXIT_FAILURE;
+			}
+
+		private:
+
+			bool m_success;
+	};
+
+	/**
+	 * \brief Wait for a predicate to become true.
+	 * \param predicate The predicate, polled every 10 milliseconds.
+	 * \param timeout The maximum time to wait.
+	 * \return true if predicate became true before timeout.
+	 */
+	template <typename Predicate>
+	bool wait_for(Predicate predicate, std::chrono::steady_clock::duration timeout)
+	{
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+
+		while (!predicate())
+		{
+			if (std::chrono::steady_clock::now() > deadline)
+			{
+				return false;
+			}
+
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+		}
+
+		return true;
+	}
+}
+
+#endif /* TEST_HPP */
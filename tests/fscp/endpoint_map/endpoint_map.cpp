@@ -0,0 +1,62 @@
+/**
+ * \file endpoint_map.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Checks that the endpoint map tells apart the same endpoints as std::map.
+ */
+
+#include <fscp/endpoint_map.hpp>
+
+#include <boost/asio.hpp>
+
+#include "test.hpp"
+
+namespace
+{
+	typedef boost::asio::ip::udp::endpoint ep_type;
+
+	ep_type make_link_local_endpoint(unsigned long scope_id)
+	{
+		boost::asio::ip::address_v6 address = boost::asio::ip::address_v6::from_string("fe80::1");
+		address.scope_id(scope_id);
+
+		return ep_type(address, 12000);
+	}
+}
+
+int main()
+{
+	test::checker check;
+
+	{
+		// The same link-local address on two interfaces designates two different hosts.
+		const ep_type first = make_link_local_endpoint(1);
+		const ep_type second = make_link_local_endpoint(2);
+
+		fscp::endpoint_map<int> map;
+		map[first] = 1;
+		map[second] = 2;
+
+		check(map.size() == 2, "link-local endpoints that only differ by scope share an entry");
+		check((map.find(first) != map.end()) && (map.find(first)->second == 1), "the first link-local endpoint was not found");
+		check((map.find(second) != map.end()) && (map.find(second)->second == 2), "the second link-local endpoint was not found");
+		check(map.find(make_link_local_endpoint(3)) == map.end(), "a link-local endpoint with another scope was found");
+
+		map.erase(first);
+
+		check((map.find(first) == map.end()) && (map.count(second) == 1), "erasing a link-local endpoint erased the wrong entry");
+	}
+
+	{
+		// An IPv4 endpoint and its IPv4-mapped IPv6 form are different keys, as with std::map.
+		const ep_type v4(boost::asio::ip::address_v4::from_string("192.168.0.1"), 12000);
+		const ep_type v4_mapped(boost::asio::ip::address_v6::v4_mapped(v4.address().to_v4()), 12000);
+
+		fscp::endpoint_map<int> map;
+		map[v4] = 1;
+		map[v4_mapped] = 2;
+
+		check(map.size() == 2, "an IPv4 endpoint and its IPv4-mapped form share an entry");
+	}
+
+	return check.result();
+}
@@ -0,0 +1,130 @@
+/**
+ * \file path_mtu.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Checks that path MTU discovery does not prevent the delivery of greater datagrams.
+ *
+ * Two servers are connected over the loopback interface with path MTU discovery enabled. Once a path MTU was discovered, a data message greater than any discoverable path MTU must still be delivered, and the socket must not be left in a mode that forbids fragmentation.
+ */
+
+#include <fscp/fscp.hpp>
+#include <fscp/server.hpp>
+#include <fscp/shared_buffer.hpp>
+
+#include <cryptoplus/cryptoplus.hpp>
+#include <cryptoplus/random/random.hpp>
+#include <cryptoplus/error/error_strings.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#ifdef LINUX
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "test.hpp"
+
+namespace
+{
+	const size_t DATA_SIZE = 2 * fscp::PATH_MTU_MAX_SIZE;
+}
+
+int main()
+{
+	cryptoplus::crypto_initializer crypto_initializer;
+	cryptoplus::algorithms_initializer algorithms_initializer;
+	cryptoplus::error::error_strings_initializer error_strings_initializer;
+
+	try
+	{
+		boost::asio::io_service io_service;
+		boost::asio::io_service::work work(io_service);
+		fscp::logger logger;
+
+		const cryptoplus::buffer pre_shared_key = cryptoplus::random::get_random_bytes(32);
+		const fscp::identity_store identity(fscp::identity_store::cert_type(), fscp::identity_store::key_type(), pre_shared_key);
+
+		fscp::server alice(io_service, logger, identity);
+		fscp::server bob(io_service, logger, identity);
+
+		std::atomic<bool> established(false);
+		std::atomic<size_t> path_mtu(0);
+		std::atomic<size_t> received_size(0);
+
+		alice.set_path_mtu_discovery_enabled(true);
+		alice.set_session_established_callback([&established] (const fscp::server::ep_type&, bool, const fscp::cipher_suite_type&, const fscp::elliptic_curve_type&) { established = true; });
+		alice.set_path_mtu_changed_callback([&path_mtu] (const fscp::server::ep_type&, size_t _path_mtu) { path_mtu = _path_mtu; });
+		bob.set_data_received_callback([&received_size] (const fscp::server::ep_type&, fscp::channel_number_type, fscp::SharedBuffer, boost::asio::const_buffer data) {
+			received_size = boost::asio::buffer_size(data);
+		});
+
+		alice.open(fscp::server::ep_type(boost::asio::ip::address_v4::loopback(), 0));
+		bob.open(fscp::server::ep_type(boost::asio::ip::address_v4::loopback(), 0));
+
+		const fscp::server::ep_type alice_endpoint = alice.get_socket().local_endpoint();
+		const fscp::server::ep_type bob_endpoint = bob.get_socket().local_endpoint();
+
+		boost::thread_group threads;
+
+		for (unsigned int i = 0; i < 2; ++i)
+		{
+			threads.create_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+		}
+
+		alice.sync_set_presentation(bob_endpoint, fscp::server::cert_type(), pre_shared_key);
+		bob.sync_set_presentation(alice_endpoint, fscp::server::cert_type(), pre_shared_key);
+		alice.async_request_session(bob_endpoint, [] (const boost::system::error_code&) {});
+
+		test::checker check;
+
+		check(test::wait_for([&] () { return established.load(); }, std::chrono::seconds(10)), "the session was not established");
+
+#ifdef LINUX
+		// Path MTU discovery is only supported on Linux.
+		if (check.success())
+		{
+			check(test::wait_for([&] () { return (path_mtu > 0); }, std::chrono::seconds(10)), "no path MTU was discovered");
+		}
+
+		if (check.success())
+		{
+			int mode = 0;
+			socklen_t mode_len = sizeof(mode);
+
+			if (check(::getsockopt(alice.get_socket().native_handle(), IPPROTO_IP, IP_MTU_DISCOVER, &mode, &mode_len) == 0, "the path MTU discovery mode could not be read"))
+			{
+				check((mode != IP_PMTUDISC_PROBE) && (mode != IP_PMTUDISC_DO), "the socket forbids the fragmentation of all the datagrams");
+			}
+		}
+#endif
+
+		// The data must remain valid until the servers are closed.
+		const std::vector<uint8_t> data(DATA_SIZE, 0x42);
+
+		if (check.success())
+		{
+			alice.async_send_data(bob_endpoint, fscp::CHANNEL_NUMBER_0, boost::asio::buffer(data), [] (const boost::system::error_code&) {});
+
+			check(test::wait_for([&] () { return (received_size == DATA_SIZE); }, std::chrono::seconds(10)), "a data message greater than the path MTU was not delivered");
+		}
+
+		alice.close();
+		bob.close();
+		io_service.stop();
+		threads.join_all();
+
+		return check.result();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "Error: " << ex.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,100 @@
+/**
+ * \file timing_wheel.cpp
+ * \author Julien Kauffmann <julien.kauffmann@freelan.org>
+ * \brief Checks that the timing wheel expires, cancels and reuses the expirations through their handles.
+ */
+
+#include <fscp/timing_wheel.hpp>
+
+#include <vector>
+
+#include "test.hpp"
+
+namespace
+{
+	typedef fscp::timing_wheel<int> wheel_type;
+}
+
+int main()
+{
+	test::checker check;
+
+	const boost::posix_time::ptime origin(boost::gregorian::date(2020, 1, 1));
+	const boost::posix_time::time_duration tick = boost::posix_time::milliseconds(10);
+
+	{
+		// Expirations are due at their tick, including the ones far enough to start in an upper level.
+		wheel_type wheel(tick, origin);
+		std::vector<wheel_type::handle_type> handles(3);
+
+		wheel.schedule(handles[0], 0, origin + boost::posix_time::milliseconds(50));
+		wheel.schedule(handles[1], 1, origin + boost::posix_time::seconds(5));
+		wheel.schedule(handles[2], 2, origin + boost::posix_time::seconds(600));
+
+		std::vector<int> expired;
+		const auto handler = [&expired] (int key) { expired.push_back(key); };
+
+		wheel.advance(origin + boost::posix_time::milliseconds(40), handler);
+		check(expired.empty(), "an expiration was due too early");
+
+		wheel.advance(origin + boost::posix_time::milliseconds(50), handler);
+		check((expired.size() == 1) && (expired[0] == 0), "the first expiration was not due at its tick");
+		check(!wheel.is_scheduled(handles[0]), "a due expiration is still scheduled");
+
+		wheel.advance(origin + boost::posix_time::seconds(5), handler);
+		check((expired.size() == 2) && (expired[1] == 1), "the second expiration was not due at its tick");
+
+		wheel.advance(origin + boost::posix_time::seconds(600), handler);
+		check((expired.size() == 3) && (expired[2] == 2), "the third expiration was not due at its tick");
+		check(wheel.empty(), "the wheel is not empty");
+	}
+
+	{
+		// A stale handle must not cancel the expiration that reuses its node.
+		wheel_type wheel(tick, origin);
+		wheel_type::handle_type first;
+		wheel_type::handle_type second;
+
+		wheel.schedule(first, 1, origin + boost::posix_time::milliseconds(100));
+		wheel_type::handle_type stale = first;
+
+		check(wheel.cancel(first), "a pending expiration could not be cancelled");
+		check(!wheel.is_scheduled(first), "a cancelled handle still designates an expiration");
+
+		wheel.schedule(second, 2, origin + boost::posix_time::milliseconds(100));
+
+		check(!wheel.cancel(stale), "a stale handle cancelled another expiration");
+		check(wheel.is_scheduled(second) && (wheel.size() == 1), "the expiration of a reused node was lost");
+	}
+
+	{
+		// Rescheduling a handle replaces its expiration and the pool does not grow in steady state.
+		wheel_type wheel(tick, origin);
+		std::vector<wheel_type::handle_type> handles(100);
+
+		for (size_t i = 0; i < handles.size(); ++i)
+		{
+			wheel.schedule(handles[i], static_cast<int>(i), origin + boost::posix_time::milliseconds(10 * (i + 1)));
+		}
+
+		for (size_t i = 0; i < handles.size(); ++i)
+		{
+			wheel.schedule(handles[i], static_cast<int>(i), origin + boost::posix_time::seconds(1));
+		}
+
+		check(wheel.size() == handles.size(), "rescheduling a handle did not replace its expiration");
+
+		size_t expired = 0;
+
+		wheel.advance(origin + boost::posix_time::milliseconds(990), [&expired] (int) { ++expired; });
+		check(expired == 0, "a replaced expiration was due");
+
+		wheel.advance(origin + boost::posix_time::seconds(1), [&expired] (int) { ++expired; });
+		check(expired == handles.size(), "the rescheduled expirations were not due");
+
+		wheel.clear();
+		check(wheel.empty(), "clearing the wheel left expirations");
+	}
+
+	return check.result();
+}